@@ -11,6 +11,7 @@ StructuredBuffer<SceneLight> lights : register(t4);
 
 RWTexture2D<float3> outputTexture : register(u0);
 
+// only hit/no hit matters, rays end at the first accepted hit and hit stays true unless the miss shader runs
 struct RayPayload {
 	bool hit;
 };
@@ -33,8 +34,8 @@ void rayGen() {
 			rayDesc.Direction = light.direction;
 			rayDesc.TMin = 0.001;
 			rayDesc.TMax = 500;
-			RayPayload payload = { false };
-			TraceRay(sceneBVH, RAY_FLAG_NONE, 0xff, 0, 0, 0, rayDesc, payload);
+			RayPayload payload = { true };
+			TraceRay(sceneBVH, RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, 0xff, 0, 0, 0, rayDesc, payload);
 			if (!payload.hit) {
 				outputColor += light.color * dot(normal, rayDesc.Direction);
 			}
@@ -45,8 +46,8 @@ void rayGen() {
 			rayDesc.Direction = normalize(light.position - position);
 			rayDesc.TMin = 0.001;
 			rayDesc.TMax = 500;
-			RayPayload payload = { false };
-			TraceRay(sceneBVH, RAY_FLAG_NONE, 0xff, 0, 0, 0, rayDesc, payload);
+			RayPayload payload = { true };
+			TraceRay(sceneBVH, RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH | RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, 0xff, 0, 0, 0, rayDesc, payload);
 			if (!payload.hit) {
 				outputColor += light.color * dot(normal, rayDesc.Direction);
 			}
@@ -66,4 +67,5 @@ void anyHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes t
 
 [shader("miss")]
 void miss(inout RayPayload payload) {
+	payload.hit = false;
 }
\ No newline at end of file
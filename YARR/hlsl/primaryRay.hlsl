@@ -11,11 +11,31 @@ RWTexture2D<float3> emissiveTexture : register(u3);
 RaytracingAccelerationStructure sceneBVH : register(t0);
 StructuredBuffer<InstanceInfo> instanceInfos : register(t1);
 StructuredBuffer<GeometryInfo> geometryInfos : register(t2);
-StructuredBuffer<TriangleInfo> triangleInfos : register(t3);
-StructuredBuffer<MaterialInfo> materialInfos : register(t4);
-Texture2D textures[] : register(t5);
+StructuredBuffer<TriangleIndices> triangleIndices : register(t3);
+StructuredBuffer<SceneVertexInfo> vertexInfos : register(t4);
+StructuredBuffer<MaterialInfo> materialInfos : register(t5);
+Texture2D textures[] : register(t6);
 sampler sampler0 : register(s0);
 
+VertexInfo decodeVertexInfo(VertexInfo vertexInfo) {
+	return vertexInfo;
+}
+
+VertexInfo decodeVertexInfo(CompactVertexInfo compactVertexInfo) {
+	VertexInfo vertexInfo;
+	vertexInfo.normal = octDecode(compactVertexInfo.normal);
+	vertexInfo.texCoord = halfDecode2(compactVertexInfo.texCoord);
+	vertexInfo.tangent = octDecode(compactVertexInfo.tangent);
+	return vertexInfo;
+}
+
+void getTriangleVertices(GeometryInfo geometryInfo, uint primitiveIndex, out VertexInfo vertices[3]) {
+	uint3 indices = triangleIndices[geometryInfo.triangleOffset + primitiveIndex].indices + geometryInfo.vertexOffset;
+	vertices[0] = decodeVertexInfo(vertexInfos[indices.x]);
+	vertices[1] = decodeVertexInfo(vertexInfos[indices.y]);
+	vertices[2] = decodeVertexInfo(vertexInfos[indices.z]);
+}
+
 void getEyeRay(uint2 dimensions, uint2 pixelIndex, inout float3 origin, inout float3 direction) {
 	float2 xy = pixelIndex + float2(0.5, 0.5);
 	float2 screenPos = (xy / dimensions) * 2.0 - 1.0;
@@ -28,6 +48,15 @@ void getEyeRay(uint2 dimensions, uint2 pixelIndex, inout float3 origin, inout fl
 	direction = normalize(world.xyz - origin);
 }
 
+// ray cone mip level (Akenine-Moller et al., Ray Tracing Gems chapter 20): the cone's object space width at the hit,
+// widened by the angle to the surface and scaled to texels by the geometry's texel density
+float textureLOD(Texture2D texture, float texCoordAreaRatio, float coneWidth, float3 direction, float3 normal) {
+	uint width, height;
+	texture.GetDimensions(width, height);
+	float texelWidth = coneWidth * sqrt(texCoordAreaRatio * width * height) / max(abs(dot(direction, normal)), 1e-4);
+	return max(log2(texelWidth), 0);
+}
+
 struct RayPayload {
 	float3 position;
 	float3 normal;
@@ -63,24 +92,40 @@ void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 	InstanceInfo instanceInfo = instanceInfos[InstanceIndex()];
 	GeometryInfo geometryInfo = geometryInfos[instanceInfo.geometryOffset + GeometryIndex()];
 	MaterialInfo materialInfo = materialInfos[geometryInfo.materialIndex];
-	TriangleInfo triangleInfo = triangleInfos[geometryInfo.triangleOffset + PrimitiveIndex()];
+	VertexInfo vertices[3];
+	getTriangleVertices(geometryInfo, PrimitiveIndex(), vertices);
+	float3 normals[3] = { vertices[0].normal, vertices[1].normal, vertices[2].normal };
+	float2 texCoords[3] = { vertices[0].texCoord, vertices[1].texCoord, vertices[2].texCoord };
 	float3 position = WorldRayOrigin() + WorldRayDirection() * RayTCurrent();
-	float3 normal = barycentricsInterpolate(triangleAttribs.barycentrics, triangleInfo.normals);
+	float3 normal = barycentricsInterpolate(triangleAttribs.barycentrics, normals);
 	float3 color = materialInfo.baseColorFactor.rgb;
-	float2 texCoord = barycentricsInterpolate(triangleAttribs.barycentrics, triangleInfo.texCoords);
+	float2 texCoord = barycentricsInterpolate(triangleAttribs.barycentrics, texCoords);
+	float3x3 transformMat = (float3x3)instanceInfo.transformMat;
+	float3 worldNormal = normalize(mul(transformMat, normal));
+	// texCoordAreaRatio is per object space area, so the cone is scaled by the instance's average scale
+	float coneWidth = constants.pixelSpreadAngle * RayTCurrent() / pow(abs(determinant(transformMat)), 1.0 / 3.0);
 	if (materialInfo.baseColorTextureIndex >= 0) {
 		Texture2D baseColorTexture = textures[materialInfo.baseColorTextureIndex];
-		color *= baseColorTexture.SampleLevel(sampler0, texCoord, 0).rgb;
+		float lod = textureLOD(baseColorTexture, geometryInfo.texCoordAreaRatio, coneWidth, WorldRayDirection(), worldNormal);
+		color *= baseColorTexture.SampleLevel(sampler0, texCoord, lod).rgb;
 	}
 	if (materialInfo.normalTextureIndex >= 0) {
-		float3 tangent = barycentricsInterpolate(triangleAttribs.barycentrics, triangleInfo.tangents);
+		float3 tangents[3] = { vertices[0].tangent, vertices[1].tangent, vertices[2].tangent };
+		float3 tangent = barycentricsInterpolate(triangleAttribs.barycentrics, tangents);
 		float3 bitangent = cross(normal, tangent);
 		float3x3 tbn = transpose(float3x3(tangent, bitangent, normal));
 		Texture2D normalTexture = textures[materialInfo.normalTextureIndex];
-		float3 n = normalTexture.SampleLevel(sampler0, texCoord, 0).xyz;
+		float lod = textureLOD(normalTexture, geometryInfo.texCoordAreaRatio, coneWidth, WorldRayDirection(), worldNormal);
+		float3 n = normalTexture.SampleLevel(sampler0, texCoord, lod).xyz;
+		if (materialInfo.normalTextureTwoChannel) {
+			// BC5 has no sRGB format, so x and y come back as stored: z is rebuilt from them in the stored encoding,
+			// then all three are decoded like the R8G8B8A8_UNORM_SRGB texture of an uncompressed normal image would be
+			float2 xy = n.xy * 2.0 - 1.0;
+			n = srgbToLinear(float3(n.xy, sqrt(saturate(1.0 - dot(xy, xy))) * 0.5 + 0.5));
+		}
 		normal = mul(tbn, n);
 	}
-	normal = normalize(mul((float3x3)instanceInfo.transformMat, normal));
+	normal = normalize(mul(transformMat, normal));
 	payload.position = position;
 	payload.normal = normal;
 	payload.color = color;
@@ -92,10 +137,13 @@ void anyHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes t
 	InstanceInfo instanceInfo = instanceInfos[InstanceIndex()];
 	GeometryInfo geometryInfo = geometryInfos[instanceInfo.geometryOffset + GeometryIndex()];
 	MaterialInfo materialInfo = materialInfos[geometryInfo.materialIndex];
-	if (materialInfo.baseColorTextureIndex > 0) {
-		TriangleInfo triangleInfo = triangleInfos[geometryInfo.triangleOffset + PrimitiveIndex()];
-		float2 texCoord = barycentricsInterpolate(triangleAttribs.barycentrics, triangleInfo.texCoords);
+	if (materialInfo.baseColorTextureIndex >= 0) {
+		VertexInfo vertices[3];
+		getTriangleVertices(geometryInfo, PrimitiveIndex(), vertices);
+		float2 texCoords[3] = { vertices[0].texCoord, vertices[1].texCoord, vertices[2].texCoord };
+		float2 texCoord = barycentricsInterpolate(triangleAttribs.barycentrics, texCoords);
 		Texture2D baseColorTexture = textures[materialInfo.baseColorTextureIndex];
+		// alpha tests stay at mip 0: box filtered alpha erodes cutouts with distance, and CPURenderer's AlphaMask is mip 0
 		float4 color = baseColorTexture.SampleLevel(sampler0, texCoord, 0);
 		if (color.w < materialInfo.alphaCutoff) {
 			IgnoreHit();
@@ -7,6 +7,8 @@ struct SceneConstants {
 	int sampleCount;
 	int frameCount;
 	int lightCount;
+	// angle between the eye rays of two neighbouring pixels, see Camera::pixelSpreadAngle
+	float pixelSpreadAngle;
 #endif
 };
 
@@ -20,31 +22,72 @@ struct InstanceInfo {
 #endif
 };
 
+// texCoordAreaRatio is the uv area over the object space area of the geometry's triangles, the texel density of the ray
+// cone texture LOD in primaryRay.hlsl
 struct GeometryInfo {
 #ifdef __cplusplus
 	int triangleOffset;
+	int vertexOffset;
 	int materialIndex;
+	float texCoordAreaRatio;
 #else
 	int triangleOffset;
+	int vertexOffset;
 	int materialIndex;
+	float texCoordAreaRatio;
 #endif
 };
 
-struct TriangleInfo {
+struct VertexInfo {
 #ifdef __cplusplus
-	float normals[3][3];
-	float uvs[3][2];
-	float tangents[3][3];
+	float normal[3];
+	float uv[2];
+	float tangent[3];
 #else
-	float3 normals[3];
-	float2 texCoords[3];
-	float3 tangents[3];
+	float3 normal;
+	float2 texCoord;
+	float3 tangent;
+#endif
+};
+
+// 12 byte encoding of VertexInfo: normal and tangent as 16 bit per component octahedral coordinates, uv as half floats
+struct CompactVertexInfo {
+#ifdef __cplusplus
+	uint32 normal;
+	uint32 tangent;
+	uint32 uv;
+#else
+	uint normal;
+	uint tangent;
+	uint texCoord;
+#endif
+};
+
+// the vertex attribute stream the ray tracing shaders read holds CompactVertexInfos when this is 1, VertexInfos when 0.
+// Both scene.h and the shaders get SceneVertexInfo from here, so it has to be defined for the C++ and the HLSL compile alike
+#ifndef COMPACT_VERTEX_INFOS
+#define COMPACT_VERTEX_INFOS 0
+#endif
+
+#if COMPACT_VERTEX_INFOS
+typedef CompactVertexInfo SceneVertexInfo;
+#else
+typedef VertexInfo SceneVertexInfo;
+#endif
+
+struct TriangleIndices {
+#ifdef __cplusplus
+	uint32 indices[3];
+#else
+	uint3 indices;
 #endif
 };
 
 struct MaterialInfo {
 #ifdef __cplusplus
 	ModelMaterial material;
+	// the normal texture is BC5, x and y only, see primaryRay.hlsl
+	int normalTextureTwoChannel;
 #else
 	float4 baseColorFactor;
 	int baseColorTextureIndex;
@@ -55,6 +98,7 @@ struct MaterialInfo {
 	int emissiveTextureIndex;
 	int emissiveTectureSamplerIndex;
 	float alphaCutoff;
+	int normalTextureTwoChannel;
 #endif
 };
 
@@ -5,6 +5,10 @@ float3 linearToSRGB(float3 rgb) {
 	return max(1.055 * pow(rgb, 0.416666667) - 0.055, 0);
 }
 
+float3 srgbToLinear(float3 srgb) {
+	return select(srgb <= 0.04045, srgb / 12.92, pow((srgb + 0.055) / 1.055, 2.4));
+}
+
 float2 barycentricsInterpolate(float2 barycentrics, float2 vertexAttrib[3]) {
 	return vertexAttrib[0] + barycentrics.x * (vertexAttrib[1] - vertexAttrib[0]) + barycentrics.y * (vertexAttrib[2] - vertexAttrib[0]);
 }
@@ -17,6 +21,19 @@ float4 barycentricsInterpolate(float2 barycentrics, float4 vertexAttrib[3]) {
 	return vertexAttrib[0] + barycentrics.x * (vertexAttrib[1] - vertexAttrib[0]) + barycentrics.y * (vertexAttrib[2] - vertexAttrib[0]);
 }
 
+// inverse of octEncode of scene.h, x in the low and y in the high 16 bits as snorm
+float3 octDecode(uint e) {
+	float2 f = max(float2(int2(e << 16, e) >> 16) / 32767.0, -1.0);
+	float3 n = float3(f.x, f.y, 1.0 - abs(f.x) - abs(f.y));
+	float t = saturate(-n.z);
+	n.xy += select(n.xy >= 0.0, -t, t);
+	return normalize(n);
+}
+
+float2 halfDecode2(uint e) {
+	return f16tof32(uint2(e, e >> 16));
+}
+
 uint wangHash(inout uint seed) {
 	seed = (seed ^ 61) ^ (seed >> 16);
 	seed *= 9;
@@ -0,0 +1,355 @@
+/************************************************************************************************/
+/*			Copyright (C) 2020 By Yang Chen (yngccc@gmail.com). All Rights Reserved.			*/
+/************************************************************************************************/
+
+#pragma once
+
+#include "scene.h"
+
+#include <chrono>
+#include <random>
+
+// object space triangles of every mesh in the scene, or a 2048 x 1024 segment sphere (4M triangles) without a scene
+std::vector<BVHTriangle> benchmarkTriangles(const Scene* scene) {
+	std::vector<BVHTriangle> triangles;
+	if (scene) {
+		for (auto& [modelName, model] : scene->models) {
+			for (auto& mesh : model.meshes) {
+				for (auto& primitive : mesh.primitives) {
+					for (uint64 index = 0; index < primitive.indexCount(); index += 3) {
+						BVHTriangle triangle;
+						arrayCopy(triangle.v0, primitive.vertices[primitive.getIndex(index)].position);
+						arrayCopy(triangle.v1, primitive.vertices[primitive.getIndex(index + 1)].position);
+						arrayCopy(triangle.v2, primitive.vertices[primitive.getIndex(index + 2)].position);
+						triangles.push_back(triangle);
+					}
+				}
+			}
+		}
+	}
+	else {
+		const uint segmentCountX = 2048;
+		const uint segmentCountY = 1024;
+		auto spherePoint = [](uint x, uint y, float* point) {
+			float theta = static_cast<float>(M_PI) * 2.0f * x / segmentCountX;
+			float phi = static_cast<float>(M_PI) * y / segmentCountY;
+			point[0] = sinf(phi) * cosf(theta);
+			point[1] = cosf(phi);
+			point[2] = sinf(phi) * sinf(theta);
+		};
+		triangles.reserve(segmentCountX * segmentCountY * 2);
+		for (uint y = 0; y < segmentCountY; y += 1) {
+			for (uint x = 0; x < segmentCountX; x += 1) {
+				BVHTriangle triangle0;
+				BVHTriangle triangle1;
+				spherePoint(x, y, triangle0.v0);
+				spherePoint(x + 1, y, triangle0.v1);
+				spherePoint(x + 1, y + 1, triangle0.v2);
+				spherePoint(x, y, triangle1.v0);
+				spherePoint(x + 1, y + 1, triangle1.v1);
+				spherePoint(x, y + 1, triangle1.v2);
+				triangles.push_back(triangle0);
+				triangles.push_back(triangle1);
+			}
+		}
+	}
+	return triangles;
+}
+
+// rays with random origins inside the bounds and uniformly distributed directions, the incoherent case of secondary rays
+std::vector<Ray> benchmarkIncoherentRays(const AABB& bounds, uint64 rayCount) {
+	std::vector<Ray> rays(rayCount);
+	std::mt19937 random(0);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	for (auto& ray : rays) {
+		for (int i = 0; i < 3; i += 1) {
+			ray.origin[i] = bounds.min[i] + (bounds.max[i] - bounds.min[i]) * uniform(random);
+		}
+		float z = uniform(random) * 2.0f - 1.0f;
+		float phi = uniform(random) * 2.0f * static_cast<float>(M_PI);
+		float r = sqrtf(std::max(1.0f - z * z, 0.0f));
+		ray.direction[0] = r * cosf(phi);
+		ray.direction[1] = r * sinf(phi);
+		ray.direction[2] = z;
+	}
+	return rays;
+}
+
+// pinhole camera rays of a width x height image looking at the bounds from outside, the coherent case of primary rays.
+// Rays are stored 8 x 8 block by block so every 64 consecutive rays form one packet.
+std::vector<Ray> benchmarkPrimaryRays(const AABB& bounds, uint width, uint height) {
+	float center[3];
+	bounds.centroid(center);
+	float extent[3] = { bounds.max[0] - center[0], bounds.max[1] - center[1], bounds.max[2] - center[2] };
+	float radius = vec3Len(extent);
+	float origin[3] = { center[0] + radius * 0.5f, center[1] + radius * 0.5f, center[2] - radius * 2.0f };
+	float forward[3] = { center[0] - origin[0], center[1] - origin[1], center[2] - origin[2] };
+	vec3Normalize(forward, forward);
+	float up[3] = { 0, 1, 0 };
+	float right[3];
+	crossProduct(up, forward, right);
+	vec3Normalize(right, right);
+	crossProduct(forward, right, up);
+	float tanHalfFov = tanf(static_cast<float>(M_PI) / 6.0f);
+	float aspect = static_cast<float>(width) / height;
+	std::vector<Ray> rays;
+	rays.reserve(static_cast<uint64>(width) * height);
+	for (uint blockY = 0; blockY < height; blockY += 8) {
+		for (uint blockX = 0; blockX < width; blockX += 8) {
+			for (uint y = blockY; y < std::min(blockY + 8, height); y += 1) {
+				for (uint x = blockX; x < std::min(blockX + 8, width); x += 1) {
+					float screenX = ((x + 0.5f) / width * 2.0f - 1.0f) * tanHalfFov * aspect;
+					float screenY = (1.0f - (y + 0.5f) / height * 2.0f) * tanHalfFov;
+					float direction[3];
+					for (int i = 0; i < 3; i += 1) {
+						direction[i] = forward[i] + right[i] * screenX + up[i] * screenY;
+					}
+					Ray ray;
+					arrayCopy(ray.origin, origin);
+					vec3Normalize(direction, ray.direction);
+					rays.push_back(ray);
+				}
+			}
+		}
+	}
+	return rays;
+}
+
+// traces the rays on every thread of the pool, returns the best Mrays/s of 3 runs
+template <typename Trace>
+double benchmarkTrace(const std::vector<Ray>& rays, Trace&& trace) {
+	const uint64 batchSize = 4096;
+	double bestTime = DBL_MAX;
+	for (int run = 0; run < 3; run += 1) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		threadPool.parallelFor((rays.size() + batchSize - 1) / batchSize, [&](uint64 batch) {
+			uint64 end = std::min((batch + 1) * batchSize, static_cast<uint64>(rays.size()));
+			for (uint64 i = batch * batchSize; i < end; i += 1) {
+				RayHit hit;
+				trace(rays[i], hit);
+			}
+		});
+		bestTime = std::min(bestTime, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+	}
+	return rays.size() / bestTime / 1000000;
+}
+
+// benchmarkTrace with the rays traced as packets of up to 64 consecutive rays
+template <typename TracePacket>
+double benchmarkTracePackets(const std::vector<Ray>& rays, TracePacket&& tracePacket) {
+	const uint64 batchSize = 4096;
+	double bestTime = DBL_MAX;
+	for (int run = 0; run < 3; run += 1) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		threadPool.parallelFor((rays.size() + batchSize - 1) / batchSize, [&](uint64 batch) {
+			uint64 end = std::min((batch + 1) * batchSize, static_cast<uint64>(rays.size()));
+			for (uint64 i = batch * batchSize; i < end; i += RayPacket::maxRayCount) {
+				RayPacket packet;
+				for (uint64 j = i; j < std::min(i + RayPacket::maxRayCount, end); j += 1) {
+					packet.addRay(rays[j]);
+				}
+				RayHit hits[RayPacket::maxRayCount];
+				tracePacket(packet, hits);
+			}
+		});
+		bestTime = std::min(bestTime, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+	}
+	return rays.size() / bestTime / 1000000;
+}
+
+void benchmarkBVHTrace(const std::vector<BVHTriangle>& triangles, const std::vector<AABB>& triangleBounds, const BVHBuildSettings& settings) {
+	BVH bvh = buildBVH(triangleBounds, settings);
+	BVH8 bvh8 = buildBVH8(bvh);
+	std::vector<Ray> rays = benchmarkIncoherentRays(bvh.nodes[0].bounds, 1 << 22);
+	double bvhMRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit& hit) { traceBVH(bvh, triangles.data(), ray, hit); });
+	double bvh8MRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit& hit) { traceBVH8(bvh8, triangles.data(), ray, hit); });
+	char str[256];
+	snprintf(str, sizeof(str), "BVH trace benchmark: %llu incoherent rays, %u threads\n", static_cast<unsigned long long>(rays.size()), threadPool.threadCount() + 1);
+	OutputDebugStringA(str);
+	snprintf(str, sizeof(str), "  BVH2 scalar: %8.2f Mrays/s, %llu nodes\n", bvhMRays, static_cast<unsigned long long>(bvh.nodes.size()));
+	OutputDebugStringA(str);
+	snprintf(str, sizeof(str), "  BVH8 %s: %8.2f Mrays/s, %llu nodes, %.2fx\n", cpuSupportsAVX2 ? "AVX2" : "SSE4", bvh8MRays, static_cast<unsigned long long>(bvh8.nodes.size()), bvh8MRays / bvhMRays);
+	OutputDebugStringA(str);
+	double occludedMRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit&) { occludedBVH8(bvh8, triangles.data(), ray); });
+	snprintf(str, sizeof(str), "  BVH8 occluded: %8.2f Mrays/s, %.2fx of closest hit\n", occludedMRays, occludedMRays / bvh8MRays);
+	OutputDebugStringA(str);
+	// the block kernel tests a whole leaf at once, so it's also measured on a tree built for leaves of up to 8
+	BVHBuildSettings wideLeafSettings = settings;
+	wideLeafSettings.maxLeafSize = 8;
+	wideLeafSettings.intersectionCost = settings.intersectionCost / 4;
+	BVH8 wideLeafBVH8 = buildBVH8(buildBVH(triangleBounds, wideLeafSettings));
+	for (const BVH8* blocksBVH8 : { &bvh8, &wideLeafBVH8 }) {
+		BVH8TriangleBlocks triangleBlocks = buildBVH8TriangleBlocks(*blocksBVH8, triangles.data());
+		double blocksMRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit& hit) { traceBVH8(*blocksBVH8, triangleBlocks, ray, hit); });
+		double blocksOccludedMRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit&) { occludedBVH8(*blocksBVH8, triangleBlocks, ray); });
+		snprintf(str, sizeof(str), "  BVH8 triangle blocks%s: %8.2f Mrays/s, %.2fx, occluded %8.2f Mrays/s, %.2fx, %llu blocks\n", blocksBVH8 == &bvh8 ? "" : " (max leaf size 8)", blocksMRays, blocksMRays / bvh8MRays, blocksOccludedMRays, blocksOccludedMRays / occludedMRays, static_cast<unsigned long long>(triangleBlocks.blocks.size()));
+		OutputDebugStringA(str);
+	}
+	// same tree with 8 bit child bounds, half the node memory against the extra nodes its looser bounds let through
+	BVH8Quantized quantizedBVH8 = buildBVH8Quantized(bvh8);
+	double quantizedMRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit& hit) { traceBVH8(quantizedBVH8, triangles.data(), ray, hit); });
+	double quantizedOccludedMRays = benchmarkTrace(rays, [&](const Ray& ray, RayHit&) { occludedBVH8(quantizedBVH8, triangles.data(), ray); });
+	snprintf(str, sizeof(str), "  BVH8 quantized nodes: %8.2f Mrays/s, %.2fx, occluded %8.2f Mrays/s, %.2fx, nodes %.2f MB instead of %.2f MB\n", quantizedMRays, quantizedMRays / bvh8MRays, quantizedOccludedMRays, quantizedOccludedMRays / occludedMRays, quantizedBVH8.nodes.size() * sizeof(BVH8QuantizedNode) / 1e6, bvh8.nodes.size() * sizeof(BVH8Node) / 1e6);
+	OutputDebugStringA(str);
+	// the same rays in rayStreamOrder, Mrays/s with the time of the sort added, single rays and packets of 64
+	// consecutive rays, which are close to incoherent as given
+	std::vector<uint32> order;
+	double orderTime = DBL_MAX;
+	for (int run = 0; run < 3; run += 1) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		rayStreamOrder(rays.data(), static_cast<uint32>(rays.size()), order, &threadPool);
+		orderTime = std::min(orderTime, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+	}
+	std::vector<Ray> orderedRays(rays.size());
+	for (uint64 i = 0; i < rays.size(); i += 1) {
+		orderedRays[i] = rays[order[i]];
+	}
+	auto withOrderTime = [&](double mrays) { return rays.size() / (orderTime + rays.size() / (mrays * 1000000)) / 1000000; };
+	double incoherentPacketMRays = benchmarkTracePackets(rays, [&](RayPacket& packet, RayHit* hits) { traceBVH8Packet(bvh8, triangles.data(), packet, hits); });
+	double orderedMRays = withOrderTime(benchmarkTrace(orderedRays, [&](const Ray& ray, RayHit& hit) { traceBVH8(bvh8, triangles.data(), ray, hit); }));
+	double orderedPacketMRays = withOrderTime(benchmarkTracePackets(orderedRays, [&](RayPacket& packet, RayHit* hits) { traceBVH8Packet(bvh8, triangles.data(), packet, hits); }));
+	snprintf(str, sizeof(str), "  BVH8 ray stream order (%.2f ms): single ray %8.2f Mrays/s, %.2fx, 8x8 packet %8.2f Mrays/s, %.2fx of unordered packets\n", orderTime * 1000, orderedMRays, orderedMRays / bvh8MRays, orderedPacketMRays, orderedPacketMRays / incoherentPacketMRays);
+	OutputDebugStringA(str);
+	std::vector<Ray> primaryRays = benchmarkPrimaryRays(bvh.nodes[0].bounds, 2048, 2048);
+	double singleMRays = benchmarkTrace(primaryRays, [&](const Ray& ray, RayHit& hit) { traceBVH8(bvh8, triangles.data(), ray, hit); });
+	double packetMRays = benchmarkTracePackets(primaryRays, [&](RayPacket& packet, RayHit* hits) { traceBVH8Packet(bvh8, triangles.data(), packet, hits); });
+	snprintf(str, sizeof(str), "BVH trace benchmark: %llu primary rays, %u threads\n", static_cast<unsigned long long>(primaryRays.size()), threadPool.threadCount() + 1);
+	OutputDebugStringA(str);
+	snprintf(str, sizeof(str), "  BVH8 single ray: %8.2f Mrays/s\n", singleMRays);
+	OutputDebugStringA(str);
+	snprintf(str, sizeof(str), "  BVH8 8x8 packet: %8.2f Mrays/s, %.2fx\n", packetMRays, packetMRays / singleMRays);
+	OutputDebugStringA(str);
+	double occludedPacketMRays = benchmarkTracePackets(primaryRays, [&](RayPacket& packet, RayHit*) { occludedBVH8Packet(bvh8, triangles.data(), packet); });
+	snprintf(str, sizeof(str), "  BVH8 8x8 packet occluded: %8.2f Mrays/s, %.2fx of closest hit\n", occludedPacketMRays, occludedPacketMRays / packetMRays);
+	OutputDebugStringA(str);
+	double quantizedSingleMRays = benchmarkTrace(primaryRays, [&](const Ray& ray, RayHit& hit) { traceBVH8(quantizedBVH8, triangles.data(), ray, hit); });
+	double quantizedPacketMRays = benchmarkTracePackets(primaryRays, [&](RayPacket& packet, RayHit* hits) { traceBVH8Packet(quantizedBVH8, triangles.data(), packet, hits); });
+	snprintf(str, sizeof(str), "  BVH8 quantized nodes: single ray %8.2f Mrays/s, %.2fx, 8x8 packet %8.2f Mrays/s, %.2fx\n", quantizedSingleMRays, quantizedSingleMRays / singleMRays, quantizedPacketMRays, quantizedPacketMRays / packetMRays);
+	OutputDebugStringA(str);
+}
+
+// build time of the best of 3 runs for 1, 2, 4 ... hardware_concurrency threads, 1 thread is the single threaded builder
+void benchmarkBVHBuild(const std::vector<AABB>& triangleBounds, const BVHBuildSettings& settings) {
+	char str[256];
+	if (settings.builder == BVHBuildSettings::LBVH) {
+		snprintf(str, sizeof(str), "BVH build benchmark: LBVH, %llu triangles, %u bit Morton codes, max leaf size %u%s\n", static_cast<unsigned long long>(triangleBounds.size()), settings.mortonCodeBits, settings.maxLeafSize, settings.treeletOptimization ? ", treelet optimization" : "");
+	}
+	else {
+		snprintf(str, sizeof(str), "BVH build benchmark: binned SAH, %llu triangles, %u bins, max leaf size %u%s\n", static_cast<unsigned long long>(triangleBounds.size()), settings.binCount, settings.maxLeafSize, settings.treeletOptimization ? ", treelet optimization" : "");
+	}
+	OutputDebugStringA(str);
+	uint maxThreadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<uint> threadCounts;
+	for (uint threadCount = 1; threadCount < maxThreadCount; threadCount *= 2) {
+		threadCounts.push_back(threadCount);
+	}
+	threadCounts.push_back(maxThreadCount);
+	double singleThreadTime = 0;
+	for (uint threadCount : threadCounts) {
+		ThreadPool pool(threadCount - 1);
+		double bestTime = DBL_MAX;
+		float sahCost = 0;
+		for (int run = 0; run < 3; run += 1) {
+			auto startTime = std::chrono::high_resolution_clock::now();
+			BVH bvh = buildBVH(triangleBounds, settings, threadCount > 1 ? &pool : nullptr);
+			bestTime = std::min(bestTime, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+			sahCost = bvhSAHCost(bvh, settings);
+		}
+		if (threadCount == 1) {
+			singleThreadTime = bestTime;
+		}
+		snprintf(str, sizeof(str), "  %3u threads: %9.2f ms, %8.2f Mtris/s, %6.2fx, SAH cost %.2f\n", threadCount, bestTime * 1000, triangleBounds.size() / bestTime / 1000000, singleThreadTime / bestTime, sahCost);
+		OutputDebugStringA(str);
+	}
+}
+
+// setNodeTransforms + SceneBVH::refit against a full SceneBVH::build for one model of instanceCount quads under a
+// single root node, moving 1 node, 1000 nodes and the root (every instance)
+void benchmarkInstanceUpdate(uint32 instanceCount) {
+	Model model;
+	ModelPrimitive quad;
+	for (int corner = 0; corner < 4; corner += 1) {
+		float x = static_cast<float>(corner == 1 || corner == 2);
+		float y = static_cast<float>(corner >= 2);
+		quad.vertices.push_back(ModelVertex{ { x, y, 0 }, { 0, 0, 1 }, { x, y }, { 1, 0, 0 } });
+	}
+	uint16 quadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+	quad.indices.assign(reinterpret_cast<uint8*>(quadIndices), reinterpret_cast<uint8*>(quadIndices) + sizeof(quadIndices));
+	model.meshes.emplace_back();
+	model.meshes[0].primitives.push_back(quad);
+	model.nodes.push_back(ModelNode{ -1, DirectX::XMMatrixIdentity() });
+	std::mt19937 random(0);
+	std::uniform_real_distribution<float> uniform(-100.0f, 100.0f);
+	for (uint32 i = 0; i < instanceCount; i += 1) {
+		model.nodes[0].children.push_back(static_cast<int>(model.nodes.size()));
+		model.nodes.push_back(ModelNode{ 0, DirectX::XMMatrixTranslation(uniform(random), uniform(random), uniform(random)), {}, 0 });
+	}
+	model.rootNodes = { 0 };
+	Scene scene("benchmark");
+	scene.models.insert({ "instances", std::move(model) });
+	scene.rebuildInstances();
+	scene.buildModelMeshBVHs({});
+	SceneBVH sceneBVH;
+	double buildTime = DBL_MAX;
+	for (int run = 0; run < 3; run += 1) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		sceneBVH = SceneBVH();
+		sceneBVH.build(scene.instances);
+		buildTime = std::min(buildTime, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+	}
+	char str[256];
+	snprintf(str, sizeof(str), "Instance update benchmark: %u instances, SceneBVH build %.2f ms\n", instanceCount, buildTime * 1000);
+	OutputDebugStringA(str);
+	for (uint32 nodeCount : { 1u, 1000u, 0u }) {
+		std::vector<SceneNodeTransform> nodeTransforms;
+		if (nodeCount == 0) {
+			nodeTransforms.push_back({ "instances", 0, DirectX::XMMatrixTranslation(1, 0, 0) });
+		}
+		for (uint32 i = 0; i < nodeCount; i += 1) {
+			int nodeIndex = 1 + static_cast<int>(static_cast<uint64>(i) * instanceCount / nodeCount);
+			nodeTransforms.push_back({ "instances", nodeIndex, DirectX::XMMatrixTranslation(uniform(random), uniform(random), uniform(random)) });
+		}
+		double updateTime = DBL_MAX;
+		uint64 changedCount = 0;
+		for (int run = 0; run < 3; run += 1) {
+			auto startTime = std::chrono::high_resolution_clock::now();
+			std::vector<uint32> changedInstances = scene.setNodeTransforms(nodeTransforms);
+			sceneBVH.refit(scene.instances, changedInstances);
+			updateTime = std::min(updateTime, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+			changedCount = changedInstances.size();
+		}
+		snprintf(str, sizeof(str), "  %10s: %6llu changed instances, %9.3f ms, %8.2fx faster than build\n", nodeCount == 0 ? "root node" : nodeCount == 1 ? "1 node" : "1000 nodes", static_cast<unsigned long long>(changedCount), updateTime * 1000, buildTime / updateTime);
+		OutputDebugStringA(str);
+	}
+}
+
+// YARR.exe -benchmark [scene file]
+void runBenchmarks(const std::filesystem::path& sceneFilePath) {
+	std::vector<BVHTriangle> triangles;
+	if (sceneFilePath.empty()) {
+		triangles = benchmarkTriangles(nullptr);
+	}
+	else {
+		Scene scene("benchmark", sceneFilePath, nullptr);
+		triangles = benchmarkTriangles(&scene);
+	}
+	if (triangles.empty()) {
+		return;
+	}
+	std::vector<AABB> triangleBounds(triangles.size());
+	for (uint64 i = 0; i < triangles.size(); i += 1) {
+		triangleBounds[i] = triangles[i].bounds();
+	}
+	benchmarkBVHBuild(triangleBounds, BVHBuildSettings{});
+	BVHBuildSettings lbvhSettings;
+	lbvhSettings.builder = BVHBuildSettings::LBVH;
+	for (uint32 mortonCodeBits : { 30u, 63u }) {
+		lbvhSettings.mortonCodeBits = mortonCodeBits;
+		benchmarkBVHBuild(triangleBounds, lbvhSettings);
+	}
+	lbvhSettings.mortonCodeBits = 30;
+	lbvhSettings.treeletOptimization = true;
+	benchmarkBVHBuild(triangleBounds, lbvhSettings);
+	benchmarkBVHTrace(triangles, triangleBounds, BVHBuildSettings{});
+	benchmarkInstanceUpdate(100000);
+}
@@ -0,0 +1,2508 @@
+/************************************************************************************************/
+/*			Copyright (C) 2020 By Yang Chen (yngccc@gmail.com). All Rights Reserved.			*/
+/************************************************************************************************/
+
+#pragma once
+
+#include "miscs.h"
+
+#include <cfloat>
+#include <queue>
+#include <immintrin.h>
+
+struct AABB {
+	float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	void extend(const float* point) {
+		for (int i = 0; i < 3; i += 1) {
+			min[i] = std::min(min[i], point[i]);
+			max[i] = std::max(max[i], point[i]);
+		}
+	}
+	void extend(const AABB& aabb) {
+		for (int i = 0; i < 3; i += 1) {
+			min[i] = std::min(min[i], aabb.min[i]);
+			max[i] = std::max(max[i], aabb.max[i]);
+		}
+	}
+	void intersect(const AABB& aabb) {
+		for (int i = 0; i < 3; i += 1) {
+			min[i] = std::max(min[i], aabb.min[i]);
+			max[i] = std::min(max[i], aabb.max[i]);
+		}
+	}
+	bool empty() const {
+		return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+	}
+	float surfaceArea() const {
+		if (empty()) {
+			return 0;
+		}
+		float x = max[0] - min[0];
+		float y = max[1] - min[1];
+		float z = max[2] - min[2];
+		return 2 * (x * y + y * z + z * x);
+	}
+	void centroid(float* c) const {
+		c[0] = (min[0] + max[0]) * 0.5f;
+		c[1] = (min[1] + max[1]) * 0.5f;
+		c[2] = (min[2] + max[2]) * 0.5f;
+	}
+};
+
+struct BVHNode {
+	AABB bounds;
+	// interior node: children are allocated in pairs, at childIndex and childIndex + 1
+	// leaf node: primCount > 0, primOffset indexes into BVH::primIndices
+	union {
+		uint32 childIndex;
+		uint32 primOffset;
+	};
+	uint32 primCount;
+
+	bool isLeaf() const {
+		return primCount > 0;
+	}
+};
+static_assert(sizeof(BVHNode) == 32);
+
+struct BVH {
+	std::vector<BVHNode> nodes;
+	std::vector<uint32> primIndices;
+};
+
+struct BVHTriangle {
+	float v0[3];
+	float v1[3];
+	float v2[3];
+
+	AABB bounds() const {
+		AABB aabb;
+		aabb.extend(v0);
+		aabb.extend(v1);
+		aabb.extend(v2);
+		return aabb;
+	}
+};
+
+struct Ray {
+	float origin[3];
+	float direction[3];
+	float tMin = 0;
+	float tMax = FLT_MAX;
+};
+
+struct RayHit {
+	float t = FLT_MAX;
+	float barycentrics[2] = {};
+	uint32 primIndex = UINT32_MAX;
+};
+
+struct BVHBuildSettings {
+	static constexpr uint32 maxBinCount = 256;
+
+	enum Builder {
+		BinnedSAH,
+		LBVH,
+		// needs the triangles, see buildTriangleBVH
+		SBVH,
+	};
+
+	Builder builder = BinnedSAH;
+	uint32 binCount = 16;
+	uint32 maxLeafSize = 4;
+	float traversalCost = 1.0f;
+	float intersectionCost = 1.0f;
+	// LBVH only, 30 or 63
+	uint32 mortonCodeBits = 30;
+	// SBVH only: spatial splits are tried where the object split children overlap by more than spatialSplitAlpha of the
+	// root area, and stop once duplicated references exceed spatialSplitBudget of the prim count
+	float spatialSplitAlpha = 1e-5f;
+	float spatialSplitBudget = 0.3f;
+	// restructures treelets of the finished tree to lower its SAH cost, meant to recover LBVH quality
+	bool treeletOptimization = false;
+	// ModelMeshBVH only: BVH8 nodes in the BVH8QuantizedNode format, half the memory for slightly looser child bounds
+	bool quantizedNodes = false;
+};
+
+struct BVHBin {
+	AABB bounds;
+	uint32 count = 0;
+};
+
+struct BVHSplit {
+	int axis = -1;
+	uint32 bin = 0;
+	float cost = FLT_MAX;
+};
+
+// sweeps the bins from both ends, split cost is relative to the parent: Ct + Ci * (A(L) * N(L) + A(R) * N(R)) / A(parent)
+BVHSplit bvhFindSplit(const BVHBin* bins, const AABB& bounds, const AABB& centroidBounds, const BVHBuildSettings& settings) {
+	BVHSplit split;
+	float invArea = 1.0f / std::max(bounds.surfaceArea(), FLT_MIN);
+	float rightCosts[BVHBuildSettings::maxBinCount];
+	for (int axis = 0; axis < 3; axis += 1) {
+		if (centroidBounds.max[axis] - centroidBounds.min[axis] <= 0) {
+			continue;
+		}
+		const BVHBin* axisBins = &bins[axis * settings.binCount];
+		AABB rightBounds;
+		uint32 rightCount = 0;
+		for (uint32 i = settings.binCount - 1; i > 0; i -= 1) {
+			rightBounds.extend(axisBins[i].bounds);
+			rightCount += axisBins[i].count;
+			rightCosts[i] = rightBounds.surfaceArea() * rightCount;
+		}
+		AABB leftBounds;
+		uint32 leftCount = 0;
+		for (uint32 i = 0; i < settings.binCount - 1; i += 1) {
+			leftBounds.extend(axisBins[i].bounds);
+			leftCount += axisBins[i].count;
+			if (leftCount == 0) {
+				continue;
+			}
+			float cost = settings.traversalCost + settings.intersectionCost * (leftBounds.surfaceArea() * leftCount + rightCosts[i + 1]) * invArea;
+			if (cost < split.cost) {
+				split.axis = axis;
+				split.bin = i;
+				split.cost = cost;
+			}
+		}
+	}
+	return split;
+}
+
+// Binned SAH builder. Nodes above parallelThreshold prims compute bounds, bins and partitions with parallelFor over
+// chunks of prims, and every node above subtreeTaskThreshold hands one child to the thread pool as a new task.
+// Smaller subtrees are built single threaded from an explicit stack.
+struct BVHBuilder {
+	static constexpr uint32 parallelThreshold = 1 << 16;
+	static constexpr uint32 parallelChunkSize = 1 << 14;
+	static constexpr uint32 subtreeTaskThreshold = 1 << 12;
+
+	const std::vector<AABB>& primBounds;
+	const BVHBuildSettings& settings;
+	ThreadPool* pool;
+	BVH& bvh;
+	std::vector<float> centroids;
+	std::vector<uint32> scratchPrimIndices;
+	std::atomic<uint32> nodeCount = 0;
+
+	BVHBuilder(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings, ThreadPool* pool, BVH& bvh) : primBounds(primBounds), settings(settings), pool(pool), bvh(bvh) {}
+
+	uint32 allocateNodePair() {
+		uint32 nodeIndex = nodeCount.fetch_add(2);
+		assert(nodeIndex + 2 <= bvh.nodes.size());
+		return nodeIndex;
+	}
+	uint32 primBin(uint32 primIndex, int axis, const AABB& centroidBounds, float scale) const {
+		return std::min(static_cast<uint32>((centroids[primIndex * 3 + axis] - centroidBounds.min[axis]) * scale), settings.binCount - 1);
+	}
+	void computeBounds(uint32 begin, uint32 end, AABB& bounds, AABB& centroidBounds) const {
+		for (uint32 i = begin; i < end; i += 1) {
+			bounds.extend(primBounds[bvh.primIndices[i]]);
+			centroidBounds.extend(&centroids[bvh.primIndices[i] * 3]);
+		}
+	}
+	void binPrims(uint32 begin, uint32 end, const AABB& centroidBounds, BVHBin* bins) const {
+		for (int axis = 0; axis < 3; axis += 1) {
+			float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+			if (extent <= 0) {
+				continue;
+			}
+			float scale = settings.binCount / extent;
+			BVHBin* axisBins = &bins[axis * settings.binCount];
+			for (uint32 i = begin; i < end; i += 1) {
+				uint32 primIndex = bvh.primIndices[i];
+				BVHBin& bin = axisBins[primBin(primIndex, axis, centroidBounds, scale)];
+				bin.bounds.extend(primBounds[primIndex]);
+				bin.count += 1;
+			}
+		}
+	}
+	// partitions [begin, end) so prims in bins <= split.bin come first, returns the first prim of the right side
+	uint32 partition(uint32 begin, uint32 end, const AABB& centroidBounds, const BVHSplit& split) {
+		float scale = settings.binCount / (centroidBounds.max[split.axis] - centroidBounds.min[split.axis]);
+		auto isLeft = [&](uint32 primIndex) {
+			return primBin(primIndex, split.axis, centroidBounds, scale) <= split.bin;
+		};
+		if (!pool || end - begin < parallelThreshold) {
+			uint32* primIndices = bvh.primIndices.data();
+			return static_cast<uint32>(std::partition(primIndices + begin, primIndices + end, isLeft) - primIndices);
+		}
+		// count per chunk, scatter into scratchPrimIndices at prefix summed offsets, copy back
+		uint32 chunkCount = (end - begin + parallelChunkSize - 1) / parallelChunkSize;
+		std::vector<uint32> leftCounts(chunkCount);
+		pool->parallelFor(chunkCount, [&](uint64 chunk) {
+			uint32 chunkBegin = begin + static_cast<uint32>(chunk) * parallelChunkSize;
+			uint32 chunkEnd = std::min(chunkBegin + parallelChunkSize, end);
+			leftCounts[chunk] = static_cast<uint32>(std::count_if(bvh.primIndices.data() + chunkBegin, bvh.primIndices.data() + chunkEnd, isLeft));
+		});
+		std::vector<uint32> leftOffsets(chunkCount);
+		uint32 leftCount = 0;
+		for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+			leftOffsets[chunk] = leftCount;
+			leftCount += leftCounts[chunk];
+		}
+		pool->parallelFor(chunkCount, [&](uint64 chunk) {
+			uint32 chunkBegin = begin + static_cast<uint32>(chunk) * parallelChunkSize;
+			uint32 chunkEnd = std::min(chunkBegin + parallelChunkSize, end);
+			uint32 left = begin + leftOffsets[chunk];
+			uint32 right = begin + leftCount + (chunkBegin - begin - leftOffsets[chunk]);
+			for (uint32 i = chunkBegin; i < chunkEnd; i += 1) {
+				uint32 primIndex = bvh.primIndices[i];
+				if (isLeft(primIndex)) {
+					scratchPrimIndices[left++] = primIndex;
+				}
+				else {
+					scratchPrimIndices[right++] = primIndex;
+				}
+			}
+		});
+		pool->parallelFor(chunkCount, [&](uint64 chunk) {
+			uint32 chunkBegin = begin + static_cast<uint32>(chunk) * parallelChunkSize;
+			uint32 chunkEnd = std::min(chunkBegin + parallelChunkSize, end);
+			std::copy(scratchPrimIndices.data() + chunkBegin, scratchPrimIndices.data() + chunkEnd, bvh.primIndices.data() + chunkBegin);
+		});
+		return begin + leftCount;
+	}
+	// fills in the node, returns the first prim of the right child or 0 if the node stays a leaf
+	uint32 splitNode(uint32 nodeIndex, uint32 begin, uint32 end, const AABB& bounds, const AABB& centroidBounds, const BVHBin* bins) {
+		BVHNode& node = bvh.nodes[nodeIndex];
+		node.bounds = bounds;
+		node.primOffset = begin;
+		node.primCount = end - begin;
+		if (node.primCount == 1) {
+			return 0;
+		}
+		BVHSplit split = bvhFindSplit(bins, bounds, centroidBounds, settings);
+		float leafCost = settings.intersectionCost * node.primCount;
+		if (node.primCount <= settings.maxLeafSize && leafCost <= split.cost) {
+			return 0;
+		}
+		uint32 mid = 0;
+		if (split.axis >= 0) {
+			mid = partition(begin, end, centroidBounds, split);
+		}
+		else {
+			// every centroid is at the same point, no bin can separate them
+			mid = begin + node.primCount / 2;
+		}
+		node.childIndex = allocateNodePair();
+		node.primCount = 0;
+		return mid;
+	}
+	void buildSubtree(uint32 rootNodeIndex, uint32 rootBegin, uint32 rootEnd) {
+		struct BuildTask {
+			uint32 nodeIndex;
+			uint32 begin;
+			uint32 end;
+		};
+		std::stack<BuildTask> tasks;
+		std::vector<BVHBin> bins(settings.binCount * 3);
+		tasks.push(BuildTask{ rootNodeIndex, rootBegin, rootEnd });
+		while (!tasks.empty()) {
+			BuildTask task = tasks.top();
+			tasks.pop();
+			AABB bounds;
+			AABB centroidBounds;
+			computeBounds(task.begin, task.end, bounds, centroidBounds);
+			std::fill(bins.begin(), bins.end(), BVHBin{});
+			if (task.end - task.begin > 1) {
+				binPrims(task.begin, task.end, centroidBounds, bins.data());
+			}
+			uint32 mid = splitNode(task.nodeIndex, task.begin, task.end, bounds, centroidBounds, bins.data());
+			if (mid > 0) {
+				uint32 childIndex = bvh.nodes[task.nodeIndex].childIndex;
+				tasks.push(BuildTask{ childIndex + 1, mid, task.end });
+				tasks.push(BuildTask{ childIndex, task.begin, mid });
+			}
+		}
+	}
+	void buildNode(uint32 nodeIndex, uint32 begin, uint32 end) {
+		if (!pool || end - begin <= subtreeTaskThreshold) {
+			buildSubtree(nodeIndex, begin, end);
+			return;
+		}
+		AABB bounds;
+		AABB centroidBounds;
+		std::vector<BVHBin> bins(settings.binCount * 3);
+		if (end - begin < parallelThreshold) {
+			computeBounds(begin, end, bounds, centroidBounds);
+			binPrims(begin, end, centroidBounds, bins.data());
+		}
+		else {
+			uint32 chunkCount = (end - begin + parallelChunkSize - 1) / parallelChunkSize;
+			std::vector<AABB> chunkBounds(chunkCount * 2);
+			pool->parallelFor(chunkCount, [&](uint64 chunk) {
+				uint32 chunkBegin = begin + static_cast<uint32>(chunk) * parallelChunkSize;
+				computeBounds(chunkBegin, std::min(chunkBegin + parallelChunkSize, end), chunkBounds[chunk * 2], chunkBounds[chunk * 2 + 1]);
+			});
+			for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+				bounds.extend(chunkBounds[chunk * 2]);
+				centroidBounds.extend(chunkBounds[chunk * 2 + 1]);
+			}
+			std::vector<BVHBin> chunkBins(chunkCount * bins.size());
+			pool->parallelFor(chunkCount, [&](uint64 chunk) {
+				uint32 chunkBegin = begin + static_cast<uint32>(chunk) * parallelChunkSize;
+				binPrims(chunkBegin, std::min(chunkBegin + parallelChunkSize, end), centroidBounds, &chunkBins[chunk * bins.size()]);
+			});
+			for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+				for (uint32 i = 0; i < bins.size(); i += 1) {
+					bins[i].bounds.extend(chunkBins[chunk * bins.size() + i].bounds);
+					bins[i].count += chunkBins[chunk * bins.size() + i].count;
+				}
+			}
+		}
+		uint32 mid = splitNode(nodeIndex, begin, end, bounds, centroidBounds, bins.data());
+		if (mid > 0) {
+			uint32 childIndex = bvh.nodes[nodeIndex].childIndex;
+			ThreadPoolTaskGroup taskGroup(*pool);
+			taskGroup.run([this, childIndex, begin, mid] { buildNode(childIndex, begin, mid); });
+			buildNode(childIndex + 1, mid, end);
+			taskGroup.wait();
+		}
+	}
+	void build() {
+		uint32 primCount = static_cast<uint32>(primBounds.size());
+		centroids.resize(primBounds.size() * 3);
+		bvh.primIndices.resize(primBounds.size());
+		bvh.nodes.resize(primBounds.size() * 2);
+		auto initPrims = [&](uint64 chunk) {
+			uint32 chunkBegin = static_cast<uint32>(chunk) * parallelChunkSize;
+			uint32 chunkEnd = std::min(chunkBegin + parallelChunkSize, primCount);
+			for (uint32 i = chunkBegin; i < chunkEnd; i += 1) {
+				primBounds[i].centroid(&centroids[i * 3]);
+				bvh.primIndices[i] = i;
+			}
+		};
+		uint32 chunkCount = (primCount + parallelChunkSize - 1) / parallelChunkSize;
+		if (pool) {
+			scratchPrimIndices.resize(primBounds.size());
+			pool->parallelFor(chunkCount, initPrims);
+		}
+		else {
+			for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+				initPrims(chunk);
+			}
+		}
+		nodeCount = 1;
+		buildNode(0, 0, primCount);
+		bvh.nodes.resize(nodeCount);
+	}
+};
+
+// LSD radix sort of keys and their values by the low keyBits bits of the keys, 8 bits per pass. Every chunk builds its
+// own digit histogram and the offsets are summed digit major, chunk minor, so chunks scatter into disjoint ranges
+// and the sort stays stable.
+void radixSortPairs(std::vector<uint64>& keys, std::vector<uint32>& values, uint32 keyBits, ThreadPool* pool) {
+	static constexpr uint32 chunkSize = 1 << 14;
+	assert(keys.size() == values.size() && keys.size() < UINT32_MAX);
+	uint32 count = static_cast<uint32>(keys.size());
+	uint32 chunkCount = (count + chunkSize - 1) / chunkSize;
+	auto forEachChunk = [&](auto&& func) {
+		if (pool) {
+			pool->parallelFor(chunkCount, func);
+		}
+		else {
+			for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+				func(chunk);
+			}
+		}
+	};
+	std::vector<uint64> scratchKeys(count);
+	std::vector<uint32> scratchValues(count);
+	std::vector<uint32> offsets(chunkCount * 256);
+	for (uint32 shift = 0; shift < keyBits; shift += 8) {
+		forEachChunk([&](uint64 chunk) {
+			uint32* histogram = &offsets[chunk * 256];
+			std::fill(histogram, histogram + 256, 0);
+			uint32 chunkBegin = static_cast<uint32>(chunk) * chunkSize;
+			uint32 chunkEnd = std::min(chunkBegin + chunkSize, count);
+			for (uint32 i = chunkBegin; i < chunkEnd; i += 1) {
+				histogram[(keys[i] >> shift) & 255] += 1;
+			}
+		});
+		uint32 offset = 0;
+		for (uint32 digit = 0; digit < 256; digit += 1) {
+			for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+				uint32 digitCount = offsets[chunk * 256 + digit];
+				offsets[chunk * 256 + digit] = offset;
+				offset += digitCount;
+			}
+		}
+		forEachChunk([&](uint64 chunk) {
+			uint32* chunkOffsets = &offsets[chunk * 256];
+			uint32 chunkBegin = static_cast<uint32>(chunk) * chunkSize;
+			uint32 chunkEnd = std::min(chunkBegin + chunkSize, count);
+			for (uint32 i = chunkBegin; i < chunkEnd; i += 1) {
+				uint32 dst = chunkOffsets[(keys[i] >> shift) & 255]++;
+				scratchKeys[dst] = keys[i];
+				scratchValues[dst] = values[i];
+			}
+		});
+		keys.swap(scratchKeys);
+		values.swap(scratchValues);
+	}
+}
+
+// spreads the low 21 bits of x so bit i lands on bit 3 * i
+uint64 mortonExpandBits(uint64 x) {
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffff;
+	x = (x | x << 16) & 0x1f0000ff0000ff;
+	x = (x | x << 8) & 0x100f00f00f00f00f;
+	x = (x | x << 4) & 0x10c30c30c30c30c3;
+	x = (x | x << 2) & 0x1249249249249249;
+	return x;
+}
+
+// Linear BVH for fast rebuilds of dynamic geometry. Prim centroids are quantized to 30 bit (10 bits per axis) or
+// 63 bit (21 bits per axis) Morton codes and radix sorted, after which every node just splits its range of sorted codes
+// at their highest differing bit. Nodes are emitted top down in one pass and bounds are merged on the way back up,
+// subtrees above subtreeTaskThreshold prims hand their left child to the thread pool.
+struct LBVHBuilder {
+	static constexpr uint32 parallelChunkSize = 1 << 14;
+	static constexpr uint32 subtreeTaskThreshold = 1 << 12;
+
+	const std::vector<AABB>& primBounds;
+	const BVHBuildSettings& settings;
+	ThreadPool* pool;
+	BVH& bvh;
+	std::vector<uint64> mortonCodes;
+	std::atomic<uint32> nodeCount = 0;
+
+	LBVHBuilder(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings, ThreadPool* pool, BVH& bvh) : primBounds(primBounds), settings(settings), pool(pool), bvh(bvh) {}
+
+	uint32 allocateNodePair() {
+		uint32 nodeIndex = nodeCount.fetch_add(2);
+		assert(nodeIndex + 2 <= bvh.nodes.size());
+		return nodeIndex;
+	}
+	template <typename F>
+	void forEachChunk(uint32 count, F&& func) {
+		uint32 chunkCount = (count + parallelChunkSize - 1) / parallelChunkSize;
+		auto chunkFunc = [&](uint64 chunk) {
+			uint32 chunkBegin = static_cast<uint32>(chunk) * parallelChunkSize;
+			func(static_cast<uint32>(chunk), chunkBegin, std::min(chunkBegin + parallelChunkSize, count));
+		};
+		if (pool) {
+			pool->parallelFor(chunkCount, chunkFunc);
+		}
+		else {
+			for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+				chunkFunc(chunk);
+			}
+		}
+	}
+	// first prim of the right child, codes below it have the highest differing bit of the range cleared
+	uint32 findSplit(uint32 begin, uint32 end) const {
+		uint64 first = mortonCodes[begin];
+		uint64 last = mortonCodes[end - 1];
+		if (first == last) {
+			return begin + (end - begin) / 2;
+		}
+		uint32 splitBit = 63 - countLeadingZeros(first ^ last);
+		uint64 rightFirst = (last >> splitBit) << splitBit;
+		return static_cast<uint32>(std::lower_bound(mortonCodes.begin() + begin, mortonCodes.begin() + end, rightFirst) - mortonCodes.begin());
+	}
+	AABB emitNode(uint32 nodeIndex, uint32 begin, uint32 end) {
+		BVHNode& node = bvh.nodes[nodeIndex];
+		if (end - begin <= settings.maxLeafSize) {
+			node.bounds = AABB{};
+			for (uint32 i = begin; i < end; i += 1) {
+				node.bounds.extend(primBounds[bvh.primIndices[i]]);
+			}
+			node.primOffset = begin;
+			node.primCount = end - begin;
+			return node.bounds;
+		}
+		uint32 mid = findSplit(begin, end);
+		uint32 childIndex = allocateNodePair();
+		AABB leftBounds;
+		AABB rightBounds;
+		if (pool && end - begin > subtreeTaskThreshold) {
+			ThreadPoolTaskGroup taskGroup(*pool);
+			taskGroup.run([this, &leftBounds, childIndex, begin, mid] { leftBounds = emitNode(childIndex, begin, mid); });
+			rightBounds = emitNode(childIndex + 1, mid, end);
+			taskGroup.wait();
+		}
+		else {
+			leftBounds = emitNode(childIndex, begin, mid);
+			rightBounds = emitNode(childIndex + 1, mid, end);
+		}
+		node.bounds = leftBounds;
+		node.bounds.extend(rightBounds);
+		node.childIndex = childIndex;
+		node.primCount = 0;
+		return node.bounds;
+	}
+	void build() {
+		uint32 primCount = static_cast<uint32>(primBounds.size());
+		mortonCodes.resize(primCount);
+		bvh.primIndices.resize(primCount);
+		bvh.nodes.resize(primCount * 2);
+		uint32 chunkCount = (primCount + parallelChunkSize - 1) / parallelChunkSize;
+		std::vector<AABB> chunkCentroidBounds(chunkCount);
+		forEachChunk(primCount, [&](uint32 chunk, uint32 chunkBegin, uint32 chunkEnd) {
+			for (uint32 i = chunkBegin; i < chunkEnd; i += 1) {
+				float centroid[3];
+				primBounds[i].centroid(centroid);
+				chunkCentroidBounds[chunk].extend(centroid);
+			}
+		});
+		AABB centroidBounds;
+		for (auto& bounds : chunkCentroidBounds) {
+			centroidBounds.extend(bounds);
+		}
+		uint32 bitsPerAxis = settings.mortonCodeBits / 3;
+		float maxCoord = static_cast<float>((1u << bitsPerAxis) - 1);
+		float scales[3];
+		for (int axis = 0; axis < 3; axis += 1) {
+			float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+			scales[axis] = extent > 0 ? maxCoord / extent : 0;
+		}
+		forEachChunk(primCount, [&](uint32 chunk, uint32 chunkBegin, uint32 chunkEnd) {
+			for (uint32 i = chunkBegin; i < chunkEnd; i += 1) {
+				float centroid[3];
+				primBounds[i].centroid(centroid);
+				uint64 code = 0;
+				for (int axis = 0; axis < 3; axis += 1) {
+					float coord = std::min((centroid[axis] - centroidBounds.min[axis]) * scales[axis], maxCoord);
+					code |= mortonExpandBits(static_cast<uint64>(coord)) << (2 - axis);
+				}
+				mortonCodes[i] = code;
+				bvh.primIndices[i] = i;
+			}
+		});
+		radixSortPairs(mortonCodes, bvh.primIndices, bitsPerAxis * 3, pool);
+		nodeCount = 1;
+		emitNode(0, 0, primCount);
+		bvh.nodes.resize(nodeCount);
+	}
+};
+
+// Treelet restructuring after Karras and Aila, "Fast Parallel Construction of High-Quality Bounding Volume Hierarchies".
+// Nodes are visited children first. Each one grows a treelet of up to treeletSize subtrees by repeatedly opening the
+// one with the largest area, finds the topology over those subtrees with the lowest SAH cost by dynamic programming over
+// all their subsets and rewrites the treelet's interior nodes into the same node pairs. Subtrees move as whole nodes,
+// so nothing below the treelet changes.
+struct BVHTreeletOptimizer {
+	static constexpr uint32 treeletSize = 7;
+	static constexpr uint32 subsetCount = 1 << treeletSize;
+	static constexpr uint32 taskDepth = 6;
+
+	struct Treelet {
+		BVHNode leaves[treeletSize];
+		float leafCosts[treeletSize];
+		uint32 leafCount;
+		uint32 nodePairs[treeletSize - 1];
+		uint32 nodePairCount;
+		float costs[subsetCount];
+		uint8 splits[subsetCount];
+	};
+
+	const BVHBuildSettings& settings;
+	ThreadPool* pool;
+	BVH& bvh;
+	// unnormalized SAH cost of the subtree below every node
+	std::vector<float> costs;
+
+	BVHTreeletOptimizer(const BVHBuildSettings& settings, ThreadPool* pool, BVH& bvh) : settings(settings), pool(pool), bvh(bvh) {}
+
+	AABB subsetBounds(const Treelet& treelet, uint32 subset) const {
+		AABB bounds;
+		for (uint32 i = 0; i < treelet.leafCount; i += 1) {
+			if (subset & (1 << i)) {
+				bounds.extend(treelet.leaves[i].bounds);
+			}
+		}
+		return bounds;
+	}
+	void writeTreelet(Treelet& treelet, uint32 subset, uint32 nodeIndex) {
+		if (popCount(subset) == 1) {
+			uint32 leaf = countTrailingZeros(subset);
+			bvh.nodes[nodeIndex] = treelet.leaves[leaf];
+			costs[nodeIndex] = treelet.leafCosts[leaf];
+			return;
+		}
+		uint32 childIndex = treelet.nodePairs[--treelet.nodePairCount];
+		BVHNode& node = bvh.nodes[nodeIndex];
+		node.bounds = subsetBounds(treelet, subset);
+		node.childIndex = childIndex;
+		node.primCount = 0;
+		costs[nodeIndex] = treelet.costs[subset];
+		uint32 leftSubset = treelet.splits[subset];
+		writeTreelet(treelet, leftSubset, childIndex);
+		writeTreelet(treelet, subset ^ leftSubset, childIndex + 1);
+	}
+	void optimizeNode(uint32 nodeIndex) {
+		Treelet treelet;
+		uint32 leafIndices[treeletSize] = { bvh.nodes[nodeIndex].childIndex, bvh.nodes[nodeIndex].childIndex + 1 };
+		treelet.leafCount = 2;
+		treelet.nodePairs[0] = bvh.nodes[nodeIndex].childIndex;
+		treelet.nodePairCount = 1;
+		while (treelet.leafCount < treeletSize) {
+			int largestLeaf = -1;
+			float largestArea = -1;
+			for (uint32 i = 0; i < treelet.leafCount; i += 1) {
+				const BVHNode& leaf = bvh.nodes[leafIndices[i]];
+				float area = leaf.bounds.surfaceArea();
+				if (!leaf.isLeaf() && area > largestArea) {
+					largestLeaf = i;
+					largestArea = area;
+				}
+			}
+			if (largestLeaf < 0) {
+				break;
+			}
+			uint32 childIndex = bvh.nodes[leafIndices[largestLeaf]].childIndex;
+			treelet.nodePairs[treelet.nodePairCount++] = childIndex;
+			leafIndices[largestLeaf] = childIndex;
+			leafIndices[treelet.leafCount++] = childIndex + 1;
+		}
+		for (uint32 i = 0; i < treelet.leafCount; i += 1) {
+			treelet.leaves[i] = bvh.nodes[leafIndices[i]];
+			treelet.leafCosts[i] = costs[leafIndices[i]];
+		}
+		// every proper subset of a subset is numerically smaller, so ascending order solves the parts first,
+		// left parts always hold the lowest leaf of the subset to skip mirrored splits
+		uint32 fullSubset = (1 << treelet.leafCount) - 1;
+		for (uint32 subset = 1; subset <= fullSubset; subset += 1) {
+			if (popCount(subset) == 1) {
+				treelet.costs[subset] = treelet.leafCosts[countTrailingZeros(subset)];
+				continue;
+			}
+			uint32 lowestLeaf = subset & (~subset + 1);
+			float bestCost = FLT_MAX;
+			uint32 bestSplit = 0;
+			for (uint32 left = (subset - 1) & subset; left > 0; left = (left - 1) & subset) {
+				if (!(left & lowestLeaf)) {
+					continue;
+				}
+				float cost = treelet.costs[left] + treelet.costs[subset ^ left];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestSplit = left;
+				}
+			}
+			treelet.costs[subset] = settings.traversalCost * subsetBounds(treelet, subset).surfaceArea() + bestCost;
+			treelet.splits[subset] = static_cast<uint8>(bestSplit);
+		}
+		writeTreelet(treelet, fullSubset, nodeIndex);
+		assert(treelet.nodePairCount == 0);
+	}
+	void optimizeSubtree(uint32 nodeIndex, uint32 depth) {
+		const BVHNode& node = bvh.nodes[nodeIndex];
+		if (node.isLeaf()) {
+			costs[nodeIndex] = settings.intersectionCost * node.primCount * node.bounds.surfaceArea();
+			return;
+		}
+		uint32 childIndex = node.childIndex;
+		if (pool && depth < taskDepth) {
+			ThreadPoolTaskGroup taskGroup(*pool);
+			taskGroup.run([this, childIndex, depth] { optimizeSubtree(childIndex, depth + 1); });
+			optimizeSubtree(childIndex + 1, depth + 1);
+			taskGroup.wait();
+		}
+		else {
+			optimizeSubtree(childIndex, depth + 1);
+			optimizeSubtree(childIndex + 1, depth + 1);
+		}
+		optimizeNode(nodeIndex);
+	}
+	void optimize() {
+		costs.resize(bvh.nodes.size());
+		optimizeSubtree(0, 0);
+	}
+};
+
+// bounds of the part of triangle between planeMin and planeMax on axis: the vertices inside the slab plus the points
+// where the edges cross either plane
+AABB clipTriangleBounds(const BVHTriangle& triangle, int axis, float planeMin, float planeMax) {
+	AABB bounds;
+	const float* vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+	for (int i = 0; i < 3; i += 1) {
+		const float* v0 = vertices[i];
+		const float* v1 = vertices[(i + 1) % 3];
+		if (v0[axis] >= planeMin && v0[axis] <= planeMax) {
+			bounds.extend(v0);
+		}
+		for (float plane : { planeMin, planeMax }) {
+			if ((v0[axis] < plane && v1[axis] > plane) || (v0[axis] > plane && v1[axis] < plane)) {
+				float t = (plane - v0[axis]) / (v1[axis] - v0[axis]);
+				float point[3];
+				for (int j = 0; j < 3; j += 1) {
+					point[j] = v0[j] + (v1[j] - v0[j]) * t;
+				}
+				point[axis] = plane;
+				bounds.extend(point);
+			}
+		}
+	}
+	return bounds;
+}
+
+// Spatial split BVH after Stich et al., "Spatial Splits in Bounding Volume Hierarchies". Every node evaluates the binned
+// object split and, when its children overlap by more than spatialSplitAlpha of the root area, also a spatial split that
+// bins references by their extent and clips the triangles at the bin planes. References straddling a spatial split are
+// split in two unless keeping them whole on one side is cheaper, and splits stop once the duplicated references would
+// exceed spatialSplitBudget. Children above subtreeTaskThreshold references are built as thread pool tasks.
+struct SBVHBuilder {
+	static constexpr uint32 subtreeTaskThreshold = 1 << 12;
+	static constexpr uint32 maxSpatialSplitDepth = 64;
+
+	struct Reference {
+		AABB bounds;
+		uint32 primIndex;
+	};
+	struct SpatialBin {
+		AABB bounds;
+		uint32 entryCount = 0;
+		uint32 exitCount = 0;
+	};
+
+	const std::vector<BVHTriangle>& triangles;
+	const std::vector<AABB>& triangleBounds;
+	const BVHBuildSettings& settings;
+	ThreadPool* pool;
+	BVH& bvh;
+	float minSpatialSplitOverlap = 0;
+	uint32 maxReferenceCount = 0;
+	std::atomic<uint32> referenceCount = 0;
+	std::atomic<uint32> primIndexCount = 0;
+	std::atomic<uint32> nodeCount = 0;
+
+	SBVHBuilder(const std::vector<BVHTriangle>& triangles, const std::vector<AABB>& triangleBounds, const BVHBuildSettings& settings, ThreadPool* pool, BVH& bvh) : triangles(triangles), triangleBounds(triangleBounds), settings(settings), pool(pool), bvh(bvh) {}
+
+	uint32 allocateNodePair() {
+		uint32 nodeIndex = nodeCount.fetch_add(2);
+		assert(nodeIndex + 2 <= bvh.nodes.size());
+		return nodeIndex;
+	}
+	uint32 objectBin(const Reference& reference, int axis, const AABB& centroidBounds, float scale) const {
+		float centroid = (reference.bounds.min[axis] + reference.bounds.max[axis]) * 0.5f;
+		return std::min(static_cast<uint32>((centroid - centroidBounds.min[axis]) * scale), settings.binCount - 1);
+	}
+	uint32 spatialBin(float position, int axis, const AABB& bounds, float scale) const {
+		return std::min(static_cast<uint32>(std::max(position - bounds.min[axis], 0.0f) * scale), settings.binCount - 1);
+	}
+	BVHSplit findSpatialSplit(const std::vector<Reference>& references, const AABB& bounds) const {
+		BVHSplit split;
+		float invArea = 1.0f / std::max(bounds.surfaceArea(), FLT_MIN);
+		float rightCosts[BVHBuildSettings::maxBinCount];
+		std::vector<SpatialBin> bins(settings.binCount);
+		for (int axis = 0; axis < 3; axis += 1) {
+			float extent = bounds.max[axis] - bounds.min[axis];
+			if (extent <= 0) {
+				continue;
+			}
+			float scale = settings.binCount / extent;
+			float binWidth = extent / settings.binCount;
+			std::fill(bins.begin(), bins.end(), SpatialBin{});
+			for (auto& reference : references) {
+				uint32 firstBin = spatialBin(reference.bounds.min[axis], axis, bounds, scale);
+				uint32 lastBin = spatialBin(reference.bounds.max[axis], axis, bounds, scale);
+				bins[firstBin].entryCount += 1;
+				bins[lastBin].exitCount += 1;
+				if (firstBin == lastBin) {
+					bins[firstBin].bounds.extend(reference.bounds);
+					continue;
+				}
+				for (uint32 bin = firstBin; bin <= lastBin; bin += 1) {
+					float planeMin = bin == firstBin ? -FLT_MAX : bounds.min[axis] + bin * binWidth;
+					float planeMax = bin == lastBin ? FLT_MAX : bounds.min[axis] + (bin + 1) * binWidth;
+					AABB clippedBounds = clipTriangleBounds(triangles[reference.primIndex], axis, planeMin, planeMax);
+					clippedBounds.intersect(reference.bounds);
+					bins[bin].bounds.extend(clippedBounds);
+				}
+			}
+			AABB rightBounds;
+			uint32 rightCount = 0;
+			for (uint32 i = settings.binCount - 1; i > 0; i -= 1) {
+				rightBounds.extend(bins[i].bounds);
+				rightCount += bins[i].exitCount;
+				rightCosts[i] = rightBounds.surfaceArea() * rightCount;
+			}
+			AABB leftBounds;
+			uint32 leftCount = 0;
+			for (uint32 i = 0; i < settings.binCount - 1; i += 1) {
+				leftBounds.extend(bins[i].bounds);
+				leftCount += bins[i].entryCount;
+				if (leftCount == 0 || leftCount == references.size()) {
+					continue;
+				}
+				float cost = settings.traversalCost + settings.intersectionCost * (leftBounds.surfaceArea() * leftCount + rightCosts[i + 1]) * invArea;
+				if (cost < split.cost) {
+					split.axis = axis;
+					split.bin = i;
+					split.cost = cost;
+				}
+			}
+		}
+		return split;
+	}
+	// returns false without touching left/right if the split would exceed the reference budget or leave a side empty
+	bool spatialPartition(const std::vector<Reference>& references, const AABB& bounds, const BVHSplit& split, std::vector<Reference>& left, std::vector<Reference>& right) {
+		int axis = split.axis;
+		float plane = bounds.min[axis] + (split.bin + 1) * ((bounds.max[axis] - bounds.min[axis]) / settings.binCount);
+		struct StraddlingReference {
+			Reference left;
+			Reference right;
+		};
+		std::vector<Reference> leftReferences;
+		std::vector<Reference> rightReferences;
+		std::vector<StraddlingReference> straddlingReferences;
+		AABB leftBounds;
+		AABB rightBounds;
+		for (auto& reference : references) {
+			if (reference.bounds.max[axis] <= plane) {
+				leftReferences.push_back(reference);
+				leftBounds.extend(reference.bounds);
+			}
+			else if (reference.bounds.min[axis] >= plane) {
+				rightReferences.push_back(reference);
+				rightBounds.extend(reference.bounds);
+			}
+			else {
+				const BVHTriangle& triangle = triangles[reference.primIndex];
+				StraddlingReference straddling = { { clipTriangleBounds(triangle, axis, -FLT_MAX, plane), reference.primIndex }, { clipTriangleBounds(triangle, axis, plane, FLT_MAX), reference.primIndex } };
+				straddling.left.bounds.intersect(reference.bounds);
+				straddling.right.bounds.intersect(reference.bounds);
+				if (straddling.left.bounds.empty()) {
+					rightReferences.push_back(reference);
+					rightBounds.extend(reference.bounds);
+				}
+				else if (straddling.right.bounds.empty()) {
+					leftReferences.push_back(reference);
+					leftBounds.extend(reference.bounds);
+				}
+				else {
+					straddlingReferences.push_back(straddling);
+					leftBounds.extend(straddling.left.bounds);
+					rightBounds.extend(straddling.right.bounds);
+				}
+			}
+		}
+		uint32 duplicateCount = static_cast<uint32>(straddlingReferences.size());
+		if (referenceCount.fetch_add(duplicateCount) + duplicateCount > maxReferenceCount) {
+			referenceCount -= duplicateCount;
+			return false;
+		}
+		// reference unsplitting: keep a straddling reference whole on one side when that costs less than duplicating it
+		float leftCount = static_cast<float>(leftReferences.size() + straddlingReferences.size());
+		float rightCount = static_cast<float>(rightReferences.size() + straddlingReferences.size());
+		for (auto& straddling : straddlingReferences) {
+			AABB reference = straddling.left.bounds;
+			reference.extend(straddling.right.bounds);
+			AABB leftUnsplitBounds = leftBounds;
+			leftUnsplitBounds.extend(reference);
+			AABB rightUnsplitBounds = rightBounds;
+			rightUnsplitBounds.extend(reference);
+			float splitCost = leftBounds.surfaceArea() * leftCount + rightBounds.surfaceArea() * rightCount;
+			float leftUnsplitCost = leftUnsplitBounds.surfaceArea() * leftCount + rightBounds.surfaceArea() * (rightCount - 1);
+			float rightUnsplitCost = leftBounds.surfaceArea() * (leftCount - 1) + rightUnsplitBounds.surfaceArea() * rightCount;
+			if (leftUnsplitCost < splitCost && leftUnsplitCost <= rightUnsplitCost) {
+				leftReferences.push_back(Reference{ reference, straddling.left.primIndex });
+				leftBounds = leftUnsplitBounds;
+				rightCount -= 1;
+				referenceCount -= 1;
+			}
+			else if (rightUnsplitCost < splitCost) {
+				rightReferences.push_back(Reference{ reference, straddling.right.primIndex });
+				rightBounds = rightUnsplitBounds;
+				leftCount -= 1;
+				referenceCount -= 1;
+			}
+			else {
+				leftReferences.push_back(straddling.left);
+				rightReferences.push_back(straddling.right);
+			}
+		}
+		if (leftReferences.empty() || rightReferences.empty()) {
+			referenceCount -= static_cast<uint32>(leftReferences.size() + rightReferences.size() - references.size());
+			return false;
+		}
+		left = std::move(leftReferences);
+		right = std::move(rightReferences);
+		return true;
+	}
+	void buildNode(uint32 nodeIndex, std::vector<Reference> references, uint32 depth) {
+		AABB bounds;
+		AABB centroidBounds;
+		for (auto& reference : references) {
+			float centroid[3];
+			reference.bounds.centroid(centroid);
+			bounds.extend(reference.bounds);
+			centroidBounds.extend(centroid);
+		}
+		uint32 count = static_cast<uint32>(references.size());
+		BVHNode& node = bvh.nodes[nodeIndex];
+		node.bounds = bounds;
+		BVHSplit objectSplit;
+		BVHSplit spatialSplit;
+		std::vector<BVHBin> bins(settings.binCount * 3);
+		if (count > 1) {
+			for (int axis = 0; axis < 3; axis += 1) {
+				float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				if (extent <= 0) {
+					continue;
+				}
+				float scale = settings.binCount / extent;
+				for (auto& reference : references) {
+					BVHBin& bin = bins[axis * settings.binCount + objectBin(reference, axis, centroidBounds, scale)];
+					bin.bounds.extend(reference.bounds);
+					bin.count += 1;
+				}
+			}
+			objectSplit = bvhFindSplit(bins.data(), bounds, centroidBounds, settings);
+			if (depth < maxSpatialSplitDepth && referenceCount < maxReferenceCount) {
+				AABB overlap = bounds;
+				if (objectSplit.axis >= 0) {
+					AABB leftBounds;
+					AABB rightBounds;
+					for (uint32 i = 0; i < settings.binCount; i += 1) {
+						(i <= objectSplit.bin ? leftBounds : rightBounds).extend(bins[objectSplit.axis * settings.binCount + i].bounds);
+					}
+					overlap = leftBounds;
+					overlap.intersect(rightBounds);
+				}
+				if (overlap.surfaceArea() > minSpatialSplitOverlap) {
+					spatialSplit = findSpatialSplit(references, bounds);
+				}
+			}
+		}
+		float leafCost = settings.intersectionCost * count;
+		if (count == 1 || (count <= settings.maxLeafSize && leafCost <= std::min(objectSplit.cost, spatialSplit.cost))) {
+			node.primOffset = primIndexCount.fetch_add(count);
+			node.primCount = count;
+			for (uint32 i = 0; i < count; i += 1) {
+				bvh.primIndices[node.primOffset + i] = references[i].primIndex;
+			}
+			return;
+		}
+		std::vector<Reference> left;
+		std::vector<Reference> right;
+		if (!(spatialSplit.cost < objectSplit.cost && spatialPartition(references, bounds, spatialSplit, left, right))) {
+			if (objectSplit.axis >= 0) {
+				float scale = settings.binCount / (centroidBounds.max[objectSplit.axis] - centroidBounds.min[objectSplit.axis]);
+				for (auto& reference : references) {
+					(objectBin(reference, objectSplit.axis, centroidBounds, scale) <= objectSplit.bin ? left : right).push_back(reference);
+				}
+			}
+			else {
+				// every centroid is at the same point, no bin can separate them
+				left.assign(references.begin(), references.begin() + count / 2);
+				right.assign(references.begin() + count / 2, references.end());
+			}
+		}
+		references = std::vector<Reference>();
+		uint32 childIndex = allocateNodePair();
+		node.childIndex = childIndex;
+		node.primCount = 0;
+		if (pool && left.size() + right.size() > subtreeTaskThreshold) {
+			ThreadPoolTaskGroup taskGroup(*pool);
+			taskGroup.run([this, childIndex, depth, left = std::move(left)]() mutable { buildNode(childIndex, std::move(left), depth + 1); });
+			buildNode(childIndex + 1, std::move(right), depth + 1);
+			taskGroup.wait();
+		}
+		else {
+			buildNode(childIndex, std::move(left), depth + 1);
+			buildNode(childIndex + 1, std::move(right), depth + 1);
+		}
+	}
+	void build() {
+		uint32 primCount = static_cast<uint32>(triangles.size());
+		maxReferenceCount = primCount + static_cast<uint32>(primCount * std::max(settings.spatialSplitBudget, 0.0f));
+		referenceCount = primCount;
+		bvh.nodes.resize(maxReferenceCount * 2);
+		bvh.primIndices.resize(maxReferenceCount);
+		std::vector<Reference> references(primCount);
+		AABB bounds;
+		for (uint32 i = 0; i < primCount; i += 1) {
+			references[i] = Reference{ triangleBounds[i], i };
+			bounds.extend(triangleBounds[i]);
+		}
+		minSpatialSplitOverlap = settings.spatialSplitAlpha * bounds.surfaceArea();
+		nodeCount = 1;
+		buildNode(0, std::move(references), 0);
+		bvh.nodes.resize(nodeCount);
+		bvh.primIndices.resize(primIndexCount);
+	}
+};
+
+// pool can be nullptr for a single threaded build, SBVH settings build a binned SAH BVH here (see buildTriangleBVH)
+BVH buildBVH(const std::vector<AABB>& primBounds, const BVHBuildSettings& settings = {}, ThreadPool* pool = &threadPool) {
+	assert(settings.binCount >= 2 && settings.binCount <= BVHBuildSettings::maxBinCount && settings.maxLeafSize >= 1);
+	assert(settings.mortonCodeBits == 30 || settings.mortonCodeBits == 63);
+	assert(primBounds.size() < UINT32_MAX / 2);
+	BVH bvh;
+	if (primBounds.empty()) {
+		return bvh;
+	}
+	if (settings.builder == BVHBuildSettings::LBVH) {
+		LBVHBuilder builder(primBounds, settings, pool, bvh);
+		builder.build();
+	}
+	else {
+		BVHBuilder builder(primBounds, settings, pool, bvh);
+		builder.build();
+	}
+	if (settings.treeletOptimization) {
+		BVHTreeletOptimizer optimizer(settings, pool, bvh);
+		optimizer.optimize();
+	}
+	return bvh;
+}
+
+// SBVH builds need the triangles to clip references against split planes, other builders only use triangleBounds.
+// An SBVH can reference a triangle from several leaves, so bvh8ParentIndices and refitBVH8 don't apply to it.
+BVH buildTriangleBVH(const std::vector<BVHTriangle>& triangles, const std::vector<AABB>& triangleBounds, const BVHBuildSettings& settings = {}, ThreadPool* pool = &threadPool) {
+	if (settings.builder != BVHBuildSettings::SBVH) {
+		return buildBVH(triangleBounds, settings, pool);
+	}
+	assert(settings.binCount >= 2 && settings.binCount <= BVHBuildSettings::maxBinCount && settings.maxLeafSize >= 1);
+	assert(triangles.size() == triangleBounds.size());
+	assert(triangles.size() * (1 + std::max(settings.spatialSplitBudget, 0.0f)) < UINT32_MAX / 2);
+	BVH bvh;
+	if (triangles.empty()) {
+		return bvh;
+	}
+	SBVHBuilder builder(triangles, triangleBounds, settings, pool, bvh);
+	builder.build();
+	if (settings.treeletOptimization) {
+		BVHTreeletOptimizer optimizer(settings, pool, bvh);
+		optimizer.optimize();
+	}
+	return bvh;
+}
+
+// expected cost of a random ray that hits the root: sum over nodes of A(node) / A(root) * (Ct for interior nodes, Ci * N for leaves)
+float bvhSAHCost(const BVH& bvh, const BVHBuildSettings& settings = {}) {
+	if (bvh.nodes.empty()) {
+		return 0;
+	}
+	float invRootArea = 1.0f / std::max(bvh.nodes[0].bounds.surfaceArea(), FLT_MIN);
+	double cost = 0;
+	for (auto& node : bvh.nodes) {
+		float nodeCost = node.isLeaf() ? settings.intersectionCost * node.primCount : settings.traversalCost;
+		cost += node.bounds.surfaceArea() * invRootArea * nodeCost;
+	}
+	return static_cast<float>(cost);
+}
+
+bool rayIntersectAABB(const AABB& aabb, const float* origin, const float* invDirection, float tMin, float tMax) {
+	for (int i = 0; i < 3; i += 1) {
+		float t0 = (aabb.min[i] - origin[i]) * invDirection[i];
+		float t1 = (aabb.max[i] - origin[i]) * invDirection[i];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		tMin = std::max(tMin, t0);
+		tMax = std::min(tMax, t1);
+	}
+	return tMin <= tMax;
+}
+
+// Per ray constants of the watertight ray/triangle test (Woop, Benthin, Wald 2013). The axes are permuted so kz is
+// the largest direction component and the vertices are sheared so the ray becomes the +z axis from the origin,
+// the hit test is then the signs of three 2D edge functions, which are exact for edges shared by two triangles as
+// long as the compiler doesn't contract them into FMAs (/fp:precise without /arch:AVX2 can't).
+struct WatertightRay {
+	float origin[3];
+	float shear[3];
+	int kx, ky, kz;
+
+	WatertightRay(const Ray& ray) {
+		kz = fabsf(ray.direction[0]) > fabsf(ray.direction[1]) ? 0 : 1;
+		kz = fabsf(ray.direction[2]) > fabsf(ray.direction[kz]) ? 2 : kz;
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (ray.direction[kz] < 0) {
+			std::swap(kx, ky);
+		}
+		shear[0] = ray.direction[kx] / ray.direction[kz];
+		shear[1] = ray.direction[ky] / ray.direction[kz];
+		shear[2] = 1.0f / ray.direction[kz];
+		arrayCopy(origin, ray.origin);
+	}
+	// vertex relative to the origin in the sheared space, z is scaled so the hit t is the interpolated z
+	void transformVertex(const float* vertex, float* result) const {
+		float p[3] = { vertex[0] - origin[0], vertex[1] - origin[1], vertex[2] - origin[2] };
+		result[0] = p[kx] - shear[0] * p[kz];
+		result[1] = p[ky] - shear[1] * p[kz];
+		result[2] = shear[2] * p[kz];
+	}
+};
+
+// edge functions in double precision, used when one of the float ones is exactly 0 and its sign is unreliable
+void watertightEdgeFunctionsDouble(const float* a, const float* b, const float* c, float* edges) {
+	edges[0] = static_cast<float>(static_cast<double>(c[0]) * b[1] - static_cast<double>(c[1]) * b[0]);
+	edges[1] = static_cast<float>(static_cast<double>(a[0]) * c[1] - static_cast<double>(a[1]) * c[0]);
+	edges[2] = static_cast<float>(static_cast<double>(b[0]) * a[1] - static_cast<double>(b[1]) * a[0]);
+}
+
+// watertight ray/triangle test, barycentrics follow the DXR convention (weights of v1 and v2) so they feed
+// barycentricsInterpolate of utils.hlsli as is. Both faces are hit, like DXR without cull flags.
+bool rayIntersectTriangle(const BVHTriangle& triangle, const WatertightRay& ray, float tMin, float tMax, float& t, float& u, float& v) {
+	float a[3], b[3], c[3];
+	ray.transformVertex(triangle.v0, a);
+	ray.transformVertex(triangle.v1, b);
+	ray.transformVertex(triangle.v2, c);
+	float edges[3] = { c[0] * b[1] - c[1] * b[0], a[0] * c[1] - a[1] * c[0], b[0] * a[1] - b[1] * a[0] };
+	if (edges[0] == 0 || edges[1] == 0 || edges[2] == 0) {
+		watertightEdgeFunctionsDouble(a, b, c, edges);
+	}
+	if ((edges[0] < 0 || edges[1] < 0 || edges[2] < 0) && (edges[0] > 0 || edges[1] > 0 || edges[2] > 0)) {
+		return false;
+	}
+	float det = edges[0] + edges[1] + edges[2];
+	if (det == 0) {
+		return false;
+	}
+	float invDet = 1.0f / det;
+	t = (edges[0] * a[2] + edges[1] * b[2] + edges[2] * c[2]) * invDet;
+	u = edges[1] * invDet;
+	v = edges[2] * invDet;
+	return t >= tMin && t <= tMax;
+}
+
+bool rayIntersectTriangle(const BVHTriangle& triangle, const Ray& ray, float& t, float& u, float& v) {
+	return rayIntersectTriangle(triangle, WatertightRay(ray), ray.tMin, ray.tMax, t, u, v);
+}
+
+// closest hit traversal, anyHit(primIndex, u, v) returning false rejects a candidate hit like IgnoreHit()
+template <typename AnyHit>
+bool traceBVH(const BVH& bvh, const BVHTriangle* triangles, Ray ray, RayHit& hit, AnyHit&& anyHit) {
+	if (bvh.nodes.empty()) {
+		return false;
+	}
+	float invDirection[3] = { 1.0f / ray.direction[0], 1.0f / ray.direction[1], 1.0f / ray.direction[2] };
+	uint32 stack[64];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	bool found = false;
+	while (stackSize > 0) {
+		const BVHNode& node = bvh.nodes[stack[--stackSize]];
+		if (!rayIntersectAABB(node.bounds, ray.origin, invDirection, ray.tMin, ray.tMax)) {
+			continue;
+		}
+		if (node.isLeaf()) {
+			for (uint32 i = 0; i < node.primCount; i += 1) {
+				uint32 primIndex = bvh.primIndices[node.primOffset + i];
+				float t, u, v;
+				if (rayIntersectTriangle(triangles[primIndex], ray, t, u, v) && anyHit(primIndex, u, v)) {
+					ray.tMax = t;
+					hit.t = t;
+					hit.barycentrics[0] = u;
+					hit.barycentrics[1] = v;
+					hit.primIndex = primIndex;
+					found = true;
+				}
+			}
+		}
+		else {
+			assert(stackSize + 2 <= countof(stack));
+			stack[stackSize++] = node.childIndex + 1;
+			stack[stackSize++] = node.childIndex;
+		}
+	}
+	return found;
+}
+
+bool traceBVH(const BVH& bvh, const BVHTriangle* triangles, const Ray& ray, RayHit& hit) {
+	return traceBVH(bvh, triangles, ray, hit, [](uint32, float, float) { return true; });
+}
+
+// 8 wide BVH collapsed from the binary BVH, child bounds are SoA so one node visit is a single 8 lane slab test
+struct alignas(32) BVH8Node {
+	// minX, minY, minZ, maxX, maxY, maxZ, empty slots have min = FLT_MAX and max = -FLT_MAX so they never hit
+	float bounds[6][8];
+	// interior child: index into BVH8::nodes, leaf child: offset into BVH8::primIndices, UINT32_MAX for empty slots
+	uint32 childIndices[8];
+	// 0 for interior children and empty slots
+	uint32 primCounts[8];
+};
+static_assert(sizeof(BVH8Node) == 256);
+
+struct BVH8 {
+	std::vector<BVH8Node> nodes;
+	std::vector<uint32> primIndices;
+};
+
+// what traversal reads, a BVH8 or the same arrays in memory owned elsewhere (see ModelMeshBVH)
+struct BVH8View {
+	ArrayView<BVH8Node> nodes;
+	ArrayView<uint32> primIndices;
+
+	BVH8View() = default;
+	BVH8View(const BVH8& bvh) : nodes(bvh.nodes), primIndices(bvh.primIndices) {}
+};
+
+// every BVH8 node takes the children of a binary node and keeps opening its largest interior child until it has 8
+BVH8 buildBVH8(const BVH& bvh) {
+	BVH8 bvh8;
+	if (bvh.nodes.empty()) {
+		return bvh8;
+	}
+	bvh8.primIndices = bvh.primIndices;
+	bvh8.nodes.reserve(bvh.nodes.size() / 4 + 1);
+	auto newNode = [&bvh8] {
+		BVH8Node node;
+		for (int slot = 0; slot < 8; slot += 1) {
+			for (int axis = 0; axis < 3; axis += 1) {
+				node.bounds[axis][slot] = FLT_MAX;
+				node.bounds[axis + 3][slot] = -FLT_MAX;
+			}
+			node.childIndices[slot] = UINT32_MAX;
+			node.primCounts[slot] = 0;
+		}
+		bvh8.nodes.push_back(node);
+		return static_cast<uint32>(bvh8.nodes.size() - 1);
+	};
+	std::stack<std::pair<uint32, uint32>> tasks;
+	tasks.push(std::make_pair(newNode(), 0u));
+	while (!tasks.empty()) {
+		auto [nodeIndex, binaryNodeIndex] = tasks.top();
+		tasks.pop();
+		uint32 children[8] = { binaryNodeIndex };
+		uint32 childCount = 1;
+		if (!bvh.nodes[binaryNodeIndex].isLeaf()) {
+			children[0] = bvh.nodes[binaryNodeIndex].childIndex;
+			children[1] = bvh.nodes[binaryNodeIndex].childIndex + 1;
+			childCount = 2;
+		}
+		while (childCount < 8) {
+			int largestChild = -1;
+			float largestArea = -1;
+			for (uint32 i = 0; i < childCount; i += 1) {
+				const BVHNode& child = bvh.nodes[children[i]];
+				if (!child.isLeaf() && child.bounds.surfaceArea() > largestArea) {
+					largestChild = i;
+					largestArea = child.bounds.surfaceArea();
+				}
+			}
+			if (largestChild < 0) {
+				break;
+			}
+			uint32 childIndex = bvh.nodes[children[largestChild]].childIndex;
+			children[largestChild] = childIndex;
+			children[childCount] = childIndex + 1;
+			childCount += 1;
+		}
+		for (uint32 slot = 0; slot < childCount; slot += 1) {
+			const BVHNode& child = bvh.nodes[children[slot]];
+			for (int axis = 0; axis < 3; axis += 1) {
+				bvh8.nodes[nodeIndex].bounds[axis][slot] = child.bounds.min[axis];
+				bvh8.nodes[nodeIndex].bounds[axis + 3][slot] = child.bounds.max[axis];
+			}
+			if (child.isLeaf()) {
+				bvh8.nodes[nodeIndex].childIndices[slot] = child.primOffset;
+				bvh8.nodes[nodeIndex].primCounts[slot] = child.primCount;
+			}
+			else {
+				uint32 childNodeIndex = newNode();
+				bvh8.nodes[nodeIndex].childIndices[slot] = childNodeIndex;
+				tasks.push(std::make_pair(childNodeIndex, children[slot]));
+			}
+		}
+	}
+	return bvh8;
+}
+
+// BVH8Node with the child bounds stored as 8 bit offsets in a frame fitted to the node, child bound q of an axis is
+// origin + q * 2^(scaleExponents - 127). The bounds are rounded outwards, so they always contain the float ones and
+// traversal finds the same hits, only visiting a few more nodes. Everything the slab test reads is in the first
+// 64 bytes, and the node is 128 bytes instead of 256.
+struct alignas(64) BVH8QuantizedNode {
+	float origin[3];
+	// biased like float exponents, the scale of an axis is the float with these exponent bits
+	uint8 scaleExponents[3];
+	// bit per slot with a child, empty slots can't be made to miss with quantized bounds alone
+	uint8 childMask;
+	// minX, minY, minZ, maxX, maxY, maxZ
+	uint8 bounds[6][8];
+	// same as BVH8Node
+	uint32 childIndices[8];
+	uint32 primCounts[8];
+};
+static_assert(sizeof(BVH8QuantizedNode) == 128);
+
+struct BVH8Quantized {
+	std::vector<BVH8QuantizedNode> nodes;
+	std::vector<uint32> primIndices;
+};
+
+struct BVH8QuantizedView {
+	ArrayView<BVH8QuantizedNode> nodes;
+	ArrayView<uint32> primIndices;
+
+	BVH8QuantizedView() = default;
+	BVH8QuantizedView(const BVH8Quantized& bvh) : nodes(bvh.nodes), primIndices(bvh.primIndices) {}
+};
+
+float bvh8QuantizedScale(uint8 scaleExponent) {
+	uint32 bits = static_cast<uint32>(scaleExponent) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return scale;
+}
+
+// same topology, node indices and primIndices as bvh, so everything indexed by them (triangle blocks) is shared
+BVH8Quantized buildBVH8Quantized(const BVH8& bvh) {
+	BVH8Quantized quantized;
+	quantized.nodes.resize(bvh.nodes.size());
+	quantized.primIndices = bvh.primIndices;
+	for (uint64 nodeIndex = 0; nodeIndex < bvh.nodes.size(); nodeIndex += 1) {
+		const BVH8Node& node = bvh.nodes[nodeIndex];
+		BVH8QuantizedNode& quantizedNode = quantized.nodes[nodeIndex];
+		quantizedNode = {};
+		for (int slot = 0; slot < 8; slot += 1) {
+			quantizedNode.childIndices[slot] = node.childIndices[slot];
+			quantizedNode.primCounts[slot] = node.primCounts[slot];
+			if (node.childIndices[slot] != UINT32_MAX) {
+				quantizedNode.childMask |= 1 << slot;
+			}
+		}
+		for (int axis = 0; axis < 3; axis += 1) {
+			float boundMin = FLT_MAX;
+			float boundMax = -FLT_MAX;
+			for (int slot = 0; slot < 8; slot += 1) {
+				if (quantizedNode.childMask & (1 << slot)) {
+					boundMin = std::min(boundMin, node.bounds[axis][slot]);
+					boundMax = std::max(boundMax, node.bounds[axis + 3][slot]);
+				}
+			}
+			if (boundMin > boundMax) {
+				boundMin = boundMax = 0;
+			}
+			// smallest power of two scale that covers the node in 255 steps, frexpf gives a starting point
+			int exponent;
+			frexpf((boundMax - boundMin) / 255.0f, &exponent);
+			int scaleExponent = std::min(std::max(exponent + 126, 1), 254);
+			while (scaleExponent < 254 && boundMin + 255.0f * bvh8QuantizedScale(static_cast<uint8>(scaleExponent)) < boundMax) {
+				scaleExponent += 1;
+			}
+			float scale = bvh8QuantizedScale(static_cast<uint8>(scaleExponent));
+			quantizedNode.origin[axis] = boundMin;
+			quantizedNode.scaleExponents[axis] = static_cast<uint8>(scaleExponent);
+			for (int slot = 0; slot < 8; slot += 1) {
+				if (!(quantizedNode.childMask & (1 << slot))) {
+					continue;
+				}
+				// the loops fix up the rounding of the divisions
+				int qMin = std::min(std::max(static_cast<int>(floorf((node.bounds[axis][slot] - boundMin) / scale)), 0), 255);
+				while (qMin > 0 && boundMin + qMin * scale > node.bounds[axis][slot]) {
+					qMin -= 1;
+				}
+				int qMax = std::min(std::max(static_cast<int>(ceilf((node.bounds[axis + 3][slot] - boundMin) / scale)), 0), 255);
+				while (qMax < 255 && boundMin + qMax * scale < node.bounds[axis + 3][slot]) {
+					qMax += 1;
+				}
+				quantizedNode.bounds[axis][slot] = static_cast<uint8>(qMin);
+				quantizedNode.bounds[axis + 3][slot] = static_cast<uint8>(qMax);
+			}
+		}
+	}
+	return quantized;
+}
+
+// (minX, minY, minZ, maxX, maxY, maxZ) of a slot, for code that works on both node formats
+void bvh8ChildBounds(const BVH8Node& node, uint32 slot, float* bounds) {
+	for (int i = 0; i < 6; i += 1) {
+		bounds[i] = node.bounds[i][slot];
+	}
+}
+
+void bvh8ChildBounds(const BVH8QuantizedNode& node, uint32 slot, float* bounds) {
+	for (int i = 0; i < 6; i += 1) {
+		bounds[i] = node.origin[i % 3] + node.bounds[i][slot] * bvh8QuantizedScale(node.scaleExponents[i % 3]);
+	}
+}
+
+template <typename BVH8Type>
+AABB bvh8Bounds(const BVH8Type& bvh) {
+	AABB bounds;
+	if (!bvh.nodes.empty()) {
+		for (uint32 slot = 0; slot < 8; slot += 1) {
+			if (bvh.nodes[0].childIndices[slot] == UINT32_MAX) {
+				continue;
+			}
+			float childBounds[6];
+			bvh8ChildBounds(bvh.nodes[0], slot, childBounds);
+			for (int axis = 0; axis < 3; axis += 1) {
+				bounds.min[axis] = std::min(bounds.min[axis], childBounds[axis]);
+				bounds.max[axis] = std::max(bounds.max[axis], childBounds[axis + 3]);
+			}
+		}
+	}
+	return bounds;
+}
+
+// shape of a BVH8 for diagnosing slow traces, bvh8Stats fills everything but primCount and sahCost,
+// which come from the build (see ModelMeshBVH::stats)
+struct BVH8Stats {
+	uint64 primCount = 0;
+	uint64 interiorNodeCount = 0;
+	uint64 leafCount = 0;
+	// more than primCount when SBVH spatial splits referenced a prim from several leaves
+	uint64 leafPrimCount = 0;
+	// leafDepthHistogram[depth] is the number of leaves at depth, the root's leaf children are at depth 1
+	std::vector<uint64> leafDepthHistogram;
+	// bvhSAHCost of the binary BVH the BVH8 was collapsed from, prim count weighted average after add
+	float sahCost = 0;
+
+	float averageLeafSize() const {
+		return leafCount > 0 ? static_cast<float>(leafPrimCount) / leafCount : 0;
+	}
+	uint32 maxDepth() const {
+		return static_cast<uint32>(leafDepthHistogram.size()) - (leafDepthHistogram.empty() ? 0 : 1);
+	}
+	void add(const BVH8Stats& stats) {
+		if (primCount + stats.primCount > 0) {
+			sahCost = (sahCost * primCount + stats.sahCost * stats.primCount) / (primCount + stats.primCount);
+		}
+		primCount += stats.primCount;
+		interiorNodeCount += stats.interiorNodeCount;
+		leafCount += stats.leafCount;
+		leafPrimCount += stats.leafPrimCount;
+		leafDepthHistogram.resize(std::max(leafDepthHistogram.size(), stats.leafDepthHistogram.size()), 0);
+		for (uint64 depth = 0; depth < stats.leafDepthHistogram.size(); depth += 1) {
+			leafDepthHistogram[depth] += stats.leafDepthHistogram[depth];
+		}
+	}
+};
+
+template <typename BVH8Type>
+BVH8Stats bvh8Stats(const BVH8Type& bvh) {
+	BVH8Stats stats;
+	if (bvh.nodes.empty()) {
+		return stats;
+	}
+	std::stack<std::pair<uint32, uint32>> nodes;
+	nodes.push(std::make_pair(0u, 0u));
+	while (!nodes.empty()) {
+		auto [nodeIndex, depth] = nodes.top();
+		nodes.pop();
+		stats.interiorNodeCount += 1;
+		const auto& node = bvh.nodes[nodeIndex];
+		for (int slot = 0; slot < 8; slot += 1) {
+			if (node.primCounts[slot] > 0) {
+				stats.leafCount += 1;
+				stats.leafPrimCount += node.primCounts[slot];
+				stats.leafDepthHistogram.resize(std::max<uint64>(stats.leafDepthHistogram.size(), depth + 2), 0);
+				stats.leafDepthHistogram[depth + 1] += 1;
+			}
+			else if (node.childIndices[slot] != UINT32_MAX) {
+				nodes.push(std::make_pair(node.childIndices[slot], depth + 1));
+			}
+		}
+	}
+	return stats;
+}
+
+// Work counters of the BVH8 traversal functions, which add to the BVHTraversalStats bvhTraversalStats points to on
+// their thread, if any. Off it costs a predictable branch per node. Packet traversal counts a node once per packet and
+// a prim once per ray tested against it
+struct BVHTraversalStats {
+	uint64 nodesVisited = 0;
+	uint64 primsTested = 0;
+
+	void add(const BVHTraversalStats& stats) {
+		nodesVisited += stats.nodesVisited;
+		primsTested += stats.primsTested;
+	}
+};
+
+static thread_local BVHTraversalStats* bvhTraversalStats = nullptr;
+
+// parentIndices[node] is the node holding it in a slot (UINT32_MAX for the root),
+// primNodeIndices[primIndex] is the node holding the leaf slot of primIndex
+void bvh8ParentIndices(const BVH8& bvh, std::vector<uint32>& parentIndices, std::vector<uint32>& primNodeIndices) {
+	parentIndices.assign(bvh.nodes.size(), UINT32_MAX);
+	primNodeIndices.assign(bvh.primIndices.size(), UINT32_MAX);
+	for (uint32 nodeIndex = 0; nodeIndex < bvh.nodes.size(); nodeIndex += 1) {
+		const BVH8Node& node = bvh.nodes[nodeIndex];
+		for (int slot = 0; slot < 8; slot += 1) {
+			if (node.primCounts[slot] > 0) {
+				for (uint32 i = 0; i < node.primCounts[slot]; i += 1) {
+					primNodeIndices[bvh.primIndices[node.childIndices[slot] + i]] = nodeIndex;
+				}
+			}
+			else if (node.childIndices[slot] != UINT32_MAX) {
+				parentIndices[node.childIndices[slot]] = nodeIndex;
+			}
+		}
+	}
+}
+
+// Recomputes the bounds of the nodes above changedPrims from primBounds without touching the rest of the tree.
+// Children always have larger indices than their parent (buildBVH8 allocates them while visiting the parent),
+// so visiting dirty nodes in descending index order refits every child before its parent.
+void refitBVH8(BVH8& bvh, const std::vector<uint32>& parentIndices, const std::vector<uint32>& primNodeIndices, const std::vector<AABB>& primBounds, const std::vector<uint32>& changedPrims) {
+	std::priority_queue<uint32> dirtyNodes;
+	for (uint32 primIndex : changedPrims) {
+		dirtyNodes.push(primNodeIndices[primIndex]);
+	}
+	uint32 lastNodeIndex = UINT32_MAX;
+	while (!dirtyNodes.empty()) {
+		uint32 nodeIndex = dirtyNodes.top();
+		dirtyNodes.pop();
+		if (nodeIndex == lastNodeIndex) {
+			continue;
+		}
+		lastNodeIndex = nodeIndex;
+		BVH8Node& node = bvh.nodes[nodeIndex];
+		for (int slot = 0; slot < 8; slot += 1) {
+			AABB slotBounds;
+			if (node.primCounts[slot] > 0) {
+				for (uint32 i = 0; i < node.primCounts[slot]; i += 1) {
+					slotBounds.extend(primBounds[bvh.primIndices[node.childIndices[slot] + i]]);
+				}
+			}
+			else if (node.childIndices[slot] != UINT32_MAX) {
+				const BVH8Node& child = bvh.nodes[node.childIndices[slot]];
+				for (int childSlot = 0; childSlot < 8; childSlot += 1) {
+					for (int axis = 0; axis < 3; axis += 1) {
+						slotBounds.min[axis] = std::min(slotBounds.min[axis], child.bounds[axis][childSlot]);
+						slotBounds.max[axis] = std::max(slotBounds.max[axis], child.bounds[axis + 3][childSlot]);
+					}
+				}
+			}
+			else {
+				continue;
+			}
+			for (int axis = 0; axis < 3; axis += 1) {
+				node.bounds[axis][slot] = slotBounds.min[axis];
+				node.bounds[axis + 3][slot] = slotBounds.max[axis];
+			}
+		}
+		if (parentIndices[nodeIndex] != UINT32_MAX) {
+			dirtyNodes.push(parentIndices[nodeIndex]);
+		}
+	}
+}
+
+// Leaf triangles of a BVH8 preprocessed for the 8 wide watertight kernel: every leaf of n prims owns (n + 7) / 8
+// consecutive blocks starting at leafBlockOffsets[leaf primOffset], unused lanes of the last block are degenerate.
+// Built from the triangles once, it has to be rebuilt if they move (refitBVH8 only updates node bounds).
+struct alignas(32) BVH8TriangleBlock {
+	// [vertex][axis][lane]
+	float vertices[3][3][8];
+	uint32 primIndices[8];
+};
+static_assert(sizeof(BVH8TriangleBlock) == 320);
+
+struct BVH8TriangleBlocks {
+	std::vector<BVH8TriangleBlock> blocks;
+	std::vector<uint32> leafBlockOffsets;
+};
+
+struct BVH8TriangleBlocksView {
+	ArrayView<BVH8TriangleBlock> blocks;
+	ArrayView<uint32> leafBlockOffsets;
+
+	BVH8TriangleBlocksView() = default;
+	BVH8TriangleBlocksView(const BVH8TriangleBlocks& triangleBlocks) : blocks(triangleBlocks.blocks), leafBlockOffsets(triangleBlocks.leafBlockOffsets) {}
+};
+
+BVH8TriangleBlocks buildBVH8TriangleBlocks(const BVH8& bvh, const BVHTriangle* triangles) {
+	BVH8TriangleBlocks triangleBlocks;
+	triangleBlocks.leafBlockOffsets.assign(bvh.primIndices.size(), UINT32_MAX);
+	for (auto& node : bvh.nodes) {
+		for (int slot = 0; slot < 8; slot += 1) {
+			uint32 primOffset = node.childIndices[slot];
+			uint32 primCount = node.primCounts[slot];
+			if (primCount == 0 || triangleBlocks.leafBlockOffsets[primOffset] != UINT32_MAX) {
+				continue;
+			}
+			triangleBlocks.leafBlockOffsets[primOffset] = static_cast<uint32>(triangleBlocks.blocks.size());
+			for (uint32 blockFirstPrim = 0; blockFirstPrim < primCount; blockFirstPrim += 8) {
+				BVH8TriangleBlock block = {};
+				for (uint32 lane = 0; lane < 8 && blockFirstPrim + lane < primCount; lane += 1) {
+					uint32 primIndex = bvh.primIndices[primOffset + blockFirstPrim + lane];
+					const float* vertices[3] = { triangles[primIndex].v0, triangles[primIndex].v1, triangles[primIndex].v2 };
+					for (int vertex = 0; vertex < 3; vertex += 1) {
+						for (int axis = 0; axis < 3; axis += 1) {
+							block.vertices[vertex][axis][lane] = vertices[vertex][axis];
+						}
+					}
+					block.primIndices[lane] = primIndex;
+				}
+				triangleBlocks.blocks.push_back(block);
+			}
+		}
+	}
+	return triangleBlocks;
+}
+
+// every slab test scales its far distances by this before comparing, so a ray through an edge or corner shared by a box
+// and a triangle isn't culled by rounding at the box while the watertight triangle test would hit (robust BVH
+// traversal, Ize 2013). A t computed as (bound - origin) * invDirection is off by at most gamma(3) relatively, near and
+// far in opposite directions, so the padding is 1 + 2 * gamma(3). tNear is left as is, the padding only keeps more
+// children
+static const float slabFarPadding = 1.0f + 3.0f * FLT_EPSILON;
+
+// per ray constants of the slab test, nearBounds[axis] picks min or max bounds by the sign of the direction
+struct BVH8Ray {
+	float origin[3];
+	float invDirection[3];
+	int nearBounds[3];
+	int farBounds[3];
+
+	BVH8Ray(const Ray& ray) {
+		for (int axis = 0; axis < 3; axis += 1) {
+			origin[axis] = ray.origin[axis];
+			invDirection[axis] = 1.0f / ray.direction[axis];
+			nearBounds[axis] = invDirection[axis] >= 0 ? axis : axis + 3;
+			farBounds[axis] = invDirection[axis] >= 0 ? axis + 3 : axis;
+		}
+	}
+};
+
+// returns the bit mask of children whose bounds overlap [tMin, tMax] and writes their entry distances to tNears,
+// tMin/tMax are the second operand of every max/min so NaNs from 0 * inf pick the ray interval instead.
+// The AVX2 and SSE4 versions round the same subtract then multiply, so a child grazed by a ray is culled or kept the
+// same way whichever instruction set runs. Subtracting first keeps the error relative to t, which slabFarPadding needs
+uint32 bvh8IntersectChildrenAVX2(const BVH8Node& node, const BVH8Ray& ray, float tMin, float tMax, float* tNears) {
+	__m256 tNear = _mm256_set1_ps(tMin);
+	__m256 tFar = _mm256_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis += 1) {
+		__m256 origin = _mm256_set1_ps(ray.origin[axis]);
+		__m256 invDirection = _mm256_set1_ps(ray.invDirection[axis]);
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearBounds[axis]]), origin), invDirection);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.farBounds[axis]]), origin), invDirection);
+		tNear = _mm256_max_ps(t0, tNear);
+		tFar = _mm256_min_ps(_mm256_mul_ps(t1, _mm256_set1_ps(slabFarPadding)), tFar);
+	}
+	_mm256_storeu_ps(tNears, tNear);
+	return static_cast<uint32>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+}
+
+uint32 bvh8IntersectChildrenSSE4(const BVH8Node& node, const BVH8Ray& ray, float tMin, float tMax, float* tNears) {
+	uint32 mask = 0;
+	for (int half = 0; half < 8; half += 4) {
+		__m128 tNear = _mm_set1_ps(tMin);
+		__m128 tFar = _mm_set1_ps(tMax);
+		for (int axis = 0; axis < 3; axis += 1) {
+			__m128 origin = _mm_set1_ps(ray.origin[axis]);
+			__m128 invDirection = _mm_set1_ps(ray.invDirection[axis]);
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[ray.nearBounds[axis]][half]), origin), invDirection);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&node.bounds[ray.farBounds[axis]][half]), origin), invDirection);
+			tNear = _mm_max_ps(t0, tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(slabFarPadding)), tFar);
+		}
+		_mm_storeu_ps(tNears + half, tNear);
+		mask |= static_cast<uint32>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << half;
+	}
+	return mask;
+}
+
+// bvh8IntersectChildren for quantized nodes, t of a bound q is (origin - rayOrigin) / direction + q * (scale / direction)
+// so decoding folds into the slab test's multiply add, unfused like bvh8IntersectChildrenAVX2. With origin - rayOrigin
+// subtracted first an axis parallel ray still culls, its t are infinite instead of inf - inf
+uint32 bvh8IntersectQuantizedChildrenAVX2(const BVH8QuantizedNode& node, const BVH8Ray& ray, float tMin, float tMax, float* tNears) {
+	__m256 tNear = _mm256_set1_ps(tMin);
+	__m256 tFar = _mm256_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis += 1) {
+		__m256 scaleInvDirection = _mm256_set1_ps(bvh8QuantizedScale(node.scaleExponents[axis]) * ray.invDirection[axis]);
+		__m256 originT = _mm256_set1_ps((node.origin[axis] - ray.origin[axis]) * ray.invDirection[axis]);
+		__m256 nearBounds = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.bounds[ray.nearBounds[axis]]))));
+		__m256 farBounds = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(node.bounds[ray.farBounds[axis]]))));
+		__m256 t0 = _mm256_add_ps(_mm256_mul_ps(nearBounds, scaleInvDirection), originT);
+		__m256 t1 = _mm256_add_ps(_mm256_mul_ps(farBounds, scaleInvDirection), originT);
+		tNear = _mm256_max_ps(t0, tNear);
+		tFar = _mm256_min_ps(_mm256_mul_ps(t1, _mm256_set1_ps(slabFarPadding)), tFar);
+	}
+	_mm256_storeu_ps(tNears, tNear);
+	return static_cast<uint32>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ))) & node.childMask;
+}
+
+uint32 bvh8IntersectQuantizedChildrenSSE4(const BVH8QuantizedNode& node, const BVH8Ray& ray, float tMin, float tMax, float* tNears) {
+	auto loadBounds = [](const uint8* bounds) {
+		int32 bits;
+		memcpy(&bits, bounds, sizeof(bits));
+		return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bits)));
+	};
+	uint32 mask = 0;
+	for (int half = 0; half < 8; half += 4) {
+		__m128 tNear = _mm_set1_ps(tMin);
+		__m128 tFar = _mm_set1_ps(tMax);
+		for (int axis = 0; axis < 3; axis += 1) {
+			__m128 scaleInvDirection = _mm_set1_ps(bvh8QuantizedScale(node.scaleExponents[axis]) * ray.invDirection[axis]);
+			__m128 originT = _mm_set1_ps((node.origin[axis] - ray.origin[axis]) * ray.invDirection[axis]);
+			__m128 t0 = _mm_add_ps(_mm_mul_ps(loadBounds(&node.bounds[ray.nearBounds[axis]][half]), scaleInvDirection), originT);
+			__m128 t1 = _mm_add_ps(_mm_mul_ps(loadBounds(&node.bounds[ray.farBounds[axis]][half]), scaleInvDirection), originT);
+			tNear = _mm_max_ps(t0, tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(slabFarPadding)), tFar);
+		}
+		_mm_storeu_ps(tNears + half, tNear);
+		mask |= static_cast<uint32>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << half;
+	}
+	return mask & node.childMask;
+}
+
+// node format and instruction set dispatch for the traversal functions
+uint32 bvh8IntersectChildren(const BVH8Node& node, const BVH8Ray& ray, float tMin, float tMax, float* tNears) {
+	return cpuSupportsAVX2 ? bvh8IntersectChildrenAVX2(node, ray, tMin, tMax, tNears) : bvh8IntersectChildrenSSE4(node, ray, tMin, tMax, tNears);
+}
+
+uint32 bvh8IntersectChildren(const BVH8QuantizedNode& node, const BVH8Ray& ray, float tMin, float tMax, float* tNears) {
+	return cpuSupportsAVX2 ? bvh8IntersectQuantizedChildrenAVX2(node, ray, tMin, tMax, tNears) : bvh8IntersectQuantizedChildrenSSE4(node, ray, tMin, tMax, tNears);
+}
+
+// Watertight test of the lanes in laneMask of a triangle block, lane by lane the same operations as
+// rayIntersectTriangle. Returns the mask of lanes hit within [tMin, tMax] and writes their t and barycentrics.
+uint32 rayIntersectTriangleBlockAVX2(const BVH8TriangleBlock& block, const WatertightRay& ray, uint32 laneMask, float tMin, float tMax, float* ts, float* us, float* vs) {
+	__m256 shear[3] = { _mm256_set1_ps(ray.shear[0]), _mm256_set1_ps(ray.shear[1]), _mm256_set1_ps(ray.shear[2]) };
+	// [vertex][sheared x, y, z]
+	__m256 vertices[3][3];
+	for (int vertex = 0; vertex < 3; vertex += 1) {
+		__m256 px = _mm256_sub_ps(_mm256_load_ps(block.vertices[vertex][ray.kx]), _mm256_set1_ps(ray.origin[ray.kx]));
+		__m256 py = _mm256_sub_ps(_mm256_load_ps(block.vertices[vertex][ray.ky]), _mm256_set1_ps(ray.origin[ray.ky]));
+		__m256 pz = _mm256_sub_ps(_mm256_load_ps(block.vertices[vertex][ray.kz]), _mm256_set1_ps(ray.origin[ray.kz]));
+		vertices[vertex][0] = _mm256_sub_ps(px, _mm256_mul_ps(shear[0], pz));
+		vertices[vertex][1] = _mm256_sub_ps(py, _mm256_mul_ps(shear[1], pz));
+		vertices[vertex][2] = _mm256_mul_ps(shear[2], pz);
+	}
+	const __m256* a = vertices[0];
+	const __m256* b = vertices[1];
+	const __m256* c = vertices[2];
+	__m256 edges[3] = {
+		_mm256_sub_ps(_mm256_mul_ps(c[0], b[1]), _mm256_mul_ps(c[1], b[0])),
+		_mm256_sub_ps(_mm256_mul_ps(a[0], c[1]), _mm256_mul_ps(a[1], c[0])),
+		_mm256_sub_ps(_mm256_mul_ps(b[0], a[1]), _mm256_mul_ps(b[1], a[0])),
+	};
+	__m256 zero = _mm256_setzero_ps();
+	__m256 edgeIsZero = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(edges[0], zero, _CMP_EQ_OQ), _mm256_cmp_ps(edges[1], zero, _CMP_EQ_OQ)), _mm256_cmp_ps(edges[2], zero, _CMP_EQ_OQ));
+	uint32 zeroEdgeMask = static_cast<uint32>(_mm256_movemask_ps(edgeIsZero)) & laneMask;
+	if (zeroEdgeMask) {
+		alignas(32) float vertexLanes[3][2][8];
+		alignas(32) float edgeLanes[3][8];
+		for (int i = 0; i < 3; i += 1) {
+			_mm256_store_ps(vertexLanes[i][0], vertices[i][0]);
+			_mm256_store_ps(vertexLanes[i][1], vertices[i][1]);
+			_mm256_store_ps(edgeLanes[i], edges[i]);
+		}
+		while (zeroEdgeMask) {
+			uint32 lane = countTrailingZeros(zeroEdgeMask);
+			zeroEdgeMask &= zeroEdgeMask - 1;
+			float laneVertices[3][2];
+			for (int i = 0; i < 3; i += 1) {
+				laneVertices[i][0] = vertexLanes[i][0][lane];
+				laneVertices[i][1] = vertexLanes[i][1][lane];
+			}
+			float laneEdges[3];
+			watertightEdgeFunctionsDouble(laneVertices[0], laneVertices[1], laneVertices[2], laneEdges);
+			for (int i = 0; i < 3; i += 1) {
+				edgeLanes[i][lane] = laneEdges[i];
+			}
+		}
+		for (int i = 0; i < 3; i += 1) {
+			edges[i] = _mm256_load_ps(edgeLanes[i]);
+		}
+	}
+	__m256 anyNegative = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(edges[0], zero, _CMP_LT_OQ), _mm256_cmp_ps(edges[1], zero, _CMP_LT_OQ)), _mm256_cmp_ps(edges[2], zero, _CMP_LT_OQ));
+	__m256 anyPositive = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(edges[0], zero, _CMP_GT_OQ), _mm256_cmp_ps(edges[1], zero, _CMP_GT_OQ)), _mm256_cmp_ps(edges[2], zero, _CMP_GT_OQ));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(edges[0], edges[1]), edges[2]);
+	__m256 invDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+	__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(edges[0], a[2]), _mm256_mul_ps(edges[1], b[2])), _mm256_mul_ps(edges[2], c[2])), invDet);
+	__m256 hit = _mm256_andnot_ps(_mm256_and_ps(anyNegative, anyPositive), _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+	hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(tMin), _CMP_GE_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LE_OQ)));
+	_mm256_storeu_ps(ts, t);
+	_mm256_storeu_ps(us, _mm256_mul_ps(edges[1], invDet));
+	_mm256_storeu_ps(vs, _mm256_mul_ps(edges[2], invDet));
+	return static_cast<uint32>(_mm256_movemask_ps(hit)) & laneMask;
+}
+
+uint32 rayIntersectTriangleBlockSSE4(const BVH8TriangleBlock& block, const WatertightRay& ray, uint32 laneMask, float tMin, float tMax, float* ts, float* us, float* vs) {
+	uint32 hitMask = 0;
+	__m128 shear[3] = { _mm_set1_ps(ray.shear[0]), _mm_set1_ps(ray.shear[1]), _mm_set1_ps(ray.shear[2]) };
+	for (int half = 0; half < 8; half += 4) {
+		if (((laneMask >> half) & 0xf) == 0) {
+			continue;
+		}
+		__m128 vertices[3][3];
+		for (int vertex = 0; vertex < 3; vertex += 1) {
+			__m128 px = _mm_sub_ps(_mm_load_ps(&block.vertices[vertex][ray.kx][half]), _mm_set1_ps(ray.origin[ray.kx]));
+			__m128 py = _mm_sub_ps(_mm_load_ps(&block.vertices[vertex][ray.ky][half]), _mm_set1_ps(ray.origin[ray.ky]));
+			__m128 pz = _mm_sub_ps(_mm_load_ps(&block.vertices[vertex][ray.kz][half]), _mm_set1_ps(ray.origin[ray.kz]));
+			vertices[vertex][0] = _mm_sub_ps(px, _mm_mul_ps(shear[0], pz));
+			vertices[vertex][1] = _mm_sub_ps(py, _mm_mul_ps(shear[1], pz));
+			vertices[vertex][2] = _mm_mul_ps(shear[2], pz);
+		}
+		const __m128* a = vertices[0];
+		const __m128* b = vertices[1];
+		const __m128* c = vertices[2];
+		__m128 edges[3] = {
+			_mm_sub_ps(_mm_mul_ps(c[0], b[1]), _mm_mul_ps(c[1], b[0])),
+			_mm_sub_ps(_mm_mul_ps(a[0], c[1]), _mm_mul_ps(a[1], c[0])),
+			_mm_sub_ps(_mm_mul_ps(b[0], a[1]), _mm_mul_ps(b[1], a[0])),
+		};
+		__m128 zero = _mm_setzero_ps();
+		__m128 edgeIsZero = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(edges[0], zero), _mm_cmpeq_ps(edges[1], zero)), _mm_cmpeq_ps(edges[2], zero));
+		uint32 zeroEdgeMask = static_cast<uint32>(_mm_movemask_ps(edgeIsZero)) & (laneMask >> half);
+		if (zeroEdgeMask) {
+			alignas(16) float vertexLanes[3][2][4];
+			alignas(16) float edgeLanes[3][4];
+			for (int i = 0; i < 3; i += 1) {
+				_mm_store_ps(vertexLanes[i][0], vertices[i][0]);
+				_mm_store_ps(vertexLanes[i][1], vertices[i][1]);
+				_mm_store_ps(edgeLanes[i], edges[i]);
+			}
+			while (zeroEdgeMask) {
+				uint32 lane = countTrailingZeros(zeroEdgeMask);
+				zeroEdgeMask &= zeroEdgeMask - 1;
+				float laneVertices[3][2];
+				for (int i = 0; i < 3; i += 1) {
+					laneVertices[i][0] = vertexLanes[i][0][lane];
+					laneVertices[i][1] = vertexLanes[i][1][lane];
+				}
+				float laneEdges[3];
+				watertightEdgeFunctionsDouble(laneVertices[0], laneVertices[1], laneVertices[2], laneEdges);
+				for (int i = 0; i < 3; i += 1) {
+					edgeLanes[i][lane] = laneEdges[i];
+				}
+			}
+			for (int i = 0; i < 3; i += 1) {
+				edges[i] = _mm_load_ps(edgeLanes[i]);
+			}
+		}
+		__m128 anyNegative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(edges[0], zero), _mm_cmplt_ps(edges[1], zero)), _mm_cmplt_ps(edges[2], zero));
+		__m128 anyPositive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(edges[0], zero), _mm_cmpgt_ps(edges[1], zero)), _mm_cmpgt_ps(edges[2], zero));
+		__m128 det = _mm_add_ps(_mm_add_ps(edges[0], edges[1]), edges[2]);
+		__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+		__m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(edges[0], a[2]), _mm_mul_ps(edges[1], b[2])), _mm_mul_ps(edges[2], c[2])), invDet);
+		__m128 hit = _mm_andnot_ps(_mm_and_ps(anyNegative, anyPositive), _mm_cmpneq_ps(det, zero));
+		hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(tMin)), _mm_cmple_ps(t, _mm_set1_ps(tMax))));
+		_mm_storeu_ps(ts + half, t);
+		_mm_storeu_ps(us + half, _mm_mul_ps(edges[1], invDet));
+		_mm_storeu_ps(vs + half, _mm_mul_ps(edges[2], invDet));
+		hitMask |= static_cast<uint32>(_mm_movemask_ps(hit)) << half;
+	}
+	return hitMask & laneMask;
+}
+
+// hit children (leaves included) are pushed far to near so leaves are visited front to back and any entry farther
+// than ray.tMax is skipped when popped. intersectLeaf(primOffset, primCount, ray) tests the prims of a leaf and lowers
+// ray.tMax when it accepts a closer hit. rootIndex starts the traversal at an interior node other than the root.
+// bvh is a BVH8, BVH8Quantized or a view of either, here and in the functions built on it
+template <typename BVH8Type, typename IntersectLeaf>
+void traverseBVH8Leaves(const BVH8Type& bvh, Ray& ray, IntersectLeaf&& intersectLeaf, uint32 rootIndex = 0) {
+	if (bvh.nodes.empty()) {
+		return;
+	}
+	BVH8Ray bvh8Ray(ray);
+	BVHTraversalStats* stats = bvhTraversalStats;
+	struct StackEntry {
+		uint32 childIndex;
+		uint32 primCount;
+		float tNear;
+	};
+	StackEntry stack[512];
+	uint32 stackSize = 0;
+	stack[stackSize++] = StackEntry{ rootIndex, 0, ray.tMin };
+	while (stackSize > 0) {
+		StackEntry entry = stack[--stackSize];
+		if (entry.tNear > ray.tMax) {
+			continue;
+		}
+		if (entry.primCount > 0) {
+			if (stats) {
+				stats->primsTested += entry.primCount;
+			}
+			intersectLeaf(entry.childIndex, entry.primCount, ray);
+			continue;
+		}
+		const auto& node = bvh.nodes[entry.childIndex];
+		if (stats) {
+			stats->nodesVisited += 1;
+		}
+		float tNears[8];
+		uint32 mask = bvh8IntersectChildren(node, bvh8Ray, ray.tMin, ray.tMax, tNears);
+		uint32 childCount = 0;
+		assert(stackSize + 8 <= countof(stack));
+		StackEntry* children = &stack[stackSize];
+		while (mask) {
+			uint32 slot = countTrailingZeros(mask);
+			mask &= mask - 1;
+			// insertion sort by descending tNear
+			uint32 i = childCount;
+			while (i > 0 && children[i - 1].tNear < tNears[slot]) {
+				children[i] = children[i - 1];
+				i -= 1;
+			}
+			children[i] = StackEntry{ node.childIndices[slot], node.primCounts[slot], tNears[slot] };
+			childCount += 1;
+		}
+		stackSize += childCount;
+	}
+}
+
+// traverseBVH8Leaves calling intersectPrim(primIndex, ray) for every prim of a leaf
+template <typename BVH8Type, typename IntersectPrim>
+void traverseBVH8(const BVH8Type& bvh, Ray& ray, IntersectPrim&& intersectPrim, uint32 rootIndex = 0) {
+	traverseBVH8Leaves(bvh, ray, [&](uint32 primOffset, uint32 primCount, Ray& leafRay) {
+		for (uint32 i = 0; i < primCount; i += 1) {
+			intersectPrim(bvh.primIndices[primOffset + i], leafRay);
+		}
+	}, rootIndex);
+}
+
+// same contract as traceBVH
+template <typename BVH8Type, typename AnyHit>
+bool traceBVH8(const BVH8Type& bvh, const BVHTriangle* triangles, Ray ray, RayHit& hit, AnyHit&& anyHit) {
+	bool found = false;
+	traverseBVH8(bvh, ray, [&](uint32 primIndex, Ray& traversalRay) {
+		float t, u, v;
+		if (rayIntersectTriangle(triangles[primIndex], traversalRay, t, u, v) && anyHit(primIndex, u, v)) {
+			traversalRay.tMax = t;
+			hit.t = t;
+			hit.barycentrics[0] = u;
+			hit.barycentrics[1] = v;
+			hit.primIndex = primIndex;
+			found = true;
+		}
+	});
+	return found;
+}
+
+template <typename BVH8Type>
+bool traceBVH8(const BVH8Type& bvh, const BVHTriangle* triangles, const Ray& ray, RayHit& hit) {
+	return traceBVH8(bvh, triangles, ray, hit, [](uint32, float, float) { return true; });
+}
+
+// traceBVH8 with leaves intersected 8 (AVX2) or 4 (SSE4) triangles at a time from buildBVH8TriangleBlocks,
+// candidates of a block are passed to anyHit in leaf order like the per triangle version
+template <typename BVH8Type, typename AnyHit>
+bool traceBVH8(const BVH8Type& bvh, const BVH8TriangleBlocksView& triangleBlocks, Ray ray, RayHit& hit, AnyHit&& anyHit) {
+	WatertightRay watertightRay(ray);
+	auto intersectBlock = cpuSupportsAVX2 ? rayIntersectTriangleBlockAVX2 : rayIntersectTriangleBlockSSE4;
+	bool found = false;
+	traverseBVH8Leaves(bvh, ray, [&](uint32 primOffset, uint32 primCount, Ray& leafRay) {
+		const BVH8TriangleBlock* block = &triangleBlocks.blocks[triangleBlocks.leafBlockOffsets[primOffset]];
+		for (uint32 blockFirstPrim = 0; blockFirstPrim < primCount; blockFirstPrim += 8, block += 1) {
+			uint32 laneMask = primCount - blockFirstPrim >= 8 ? 0xff : (1u << (primCount - blockFirstPrim)) - 1;
+			float ts[8], us[8], vs[8];
+			uint32 hitMask = intersectBlock(*block, watertightRay, laneMask, leafRay.tMin, leafRay.tMax, ts, us, vs);
+			while (hitMask) {
+				uint32 lane = countTrailingZeros(hitMask);
+				hitMask &= hitMask - 1;
+				if (ts[lane] <= leafRay.tMax && anyHit(block->primIndices[lane], us[lane], vs[lane])) {
+					leafRay.tMax = ts[lane];
+					hit.t = ts[lane];
+					hit.barycentrics[0] = us[lane];
+					hit.barycentrics[1] = vs[lane];
+					hit.primIndex = block->primIndices[lane];
+					found = true;
+				}
+			}
+		}
+	});
+	return found;
+}
+
+template <typename BVH8Type>
+bool traceBVH8(const BVH8Type& bvh, const BVH8TriangleBlocksView& triangleBlocks, const Ray& ray, RayHit& hit) {
+	return traceBVH8(bvh, triangleBlocks, ray, hit, [](uint32, float, float) { return true; });
+}
+
+// Any hit traversal for occlusion queries, returns true as soon as intersectLeaf(primOffset, primCount, ray) accepts
+// a prim of a leaf. Hit order doesn't matter here, so leaf children are intersected right when their node is visited
+// instead of going through the stack, and only interior children are sorted, nearest on top, to reach occluders near
+// the origin first.
+template <typename BVH8Type, typename IntersectLeaf>
+bool occludedTraverseBVH8Leaves(const BVH8Type& bvh, const Ray& ray, IntersectLeaf&& intersectLeaf, uint32 rootIndex = 0) {
+	if (bvh.nodes.empty()) {
+		return false;
+	}
+	BVH8Ray bvh8Ray(ray);
+	BVHTraversalStats* stats = bvhTraversalStats;
+	struct StackEntry {
+		uint32 nodeIndex;
+		float tNear;
+	};
+	StackEntry stack[512];
+	uint32 stackSize = 0;
+	stack[stackSize++] = StackEntry{ rootIndex, ray.tMin };
+	while (stackSize > 0) {
+		const auto& node = bvh.nodes[stack[--stackSize].nodeIndex];
+		if (stats) {
+			stats->nodesVisited += 1;
+		}
+		float tNears[8];
+		uint32 mask = bvh8IntersectChildren(node, bvh8Ray, ray.tMin, ray.tMax, tNears);
+		uint32 childCount = 0;
+		assert(stackSize + 8 <= countof(stack));
+		StackEntry* children = &stack[stackSize];
+		while (mask) {
+			uint32 slot = countTrailingZeros(mask);
+			mask &= mask - 1;
+			if (node.primCounts[slot] > 0) {
+				if (stats) {
+					stats->primsTested += node.primCounts[slot];
+				}
+				if (intersectLeaf(node.childIndices[slot], node.primCounts[slot], ray)) {
+					return true;
+				}
+				continue;
+			}
+			// insertion sort by descending tNear
+			uint32 i = childCount;
+			while (i > 0 && children[i - 1].tNear < tNears[slot]) {
+				children[i] = children[i - 1];
+				i -= 1;
+			}
+			children[i] = StackEntry{ node.childIndices[slot], tNears[slot] };
+			childCount += 1;
+		}
+		stackSize += childCount;
+	}
+	return false;
+}
+
+// occludedTraverseBVH8Leaves with intersectPrim(primIndex, ray) called for every prim of a leaf until one accepts
+template <typename BVH8Type, typename IntersectPrim>
+bool occludedTraverseBVH8(const BVH8Type& bvh, const Ray& ray, IntersectPrim&& intersectPrim, uint32 rootIndex = 0) {
+	return occludedTraverseBVH8Leaves(bvh, ray, [&](uint32 primOffset, uint32 primCount, const Ray& leafRay) {
+		for (uint32 i = 0; i < primCount; i += 1) {
+			if (intersectPrim(bvh.primIndices[primOffset + i], leafRay)) {
+				return true;
+			}
+		}
+		return false;
+	}, rootIndex);
+}
+
+// true if any triangle accepted by anyHit(primIndex, u, v) intersects the ray within [tMin, tMax]
+template <typename BVH8Type, typename AnyHit>
+bool occludedBVH8(const BVH8Type& bvh, const BVHTriangle* triangles, const Ray& ray, AnyHit&& anyHit) {
+	return occludedTraverseBVH8(bvh, ray, [&](uint32 primIndex, const Ray& traversalRay) {
+		float t, u, v;
+		return rayIntersectTriangle(triangles[primIndex], traversalRay, t, u, v) && anyHit(primIndex, u, v);
+	});
+}
+
+template <typename BVH8Type>
+bool occludedBVH8(const BVH8Type& bvh, const BVHTriangle* triangles, const Ray& ray) {
+	return occludedBVH8(bvh, triangles, ray, [](uint32, float, float) { return true; });
+}
+
+// occludedBVH8 with leaves intersected a triangle block at a time, see traceBVH8
+template <typename BVH8Type, typename AnyHit>
+bool occludedBVH8(const BVH8Type& bvh, const BVH8TriangleBlocksView& triangleBlocks, const Ray& ray, AnyHit&& anyHit) {
+	WatertightRay watertightRay(ray);
+	auto intersectBlock = cpuSupportsAVX2 ? rayIntersectTriangleBlockAVX2 : rayIntersectTriangleBlockSSE4;
+	return occludedTraverseBVH8Leaves(bvh, ray, [&](uint32 primOffset, uint32 primCount, const Ray& leafRay) {
+		const BVH8TriangleBlock* block = &triangleBlocks.blocks[triangleBlocks.leafBlockOffsets[primOffset]];
+		for (uint32 blockFirstPrim = 0; blockFirstPrim < primCount; blockFirstPrim += 8, block += 1) {
+			uint32 laneMask = primCount - blockFirstPrim >= 8 ? 0xff : (1u << (primCount - blockFirstPrim)) - 1;
+			float ts[8], us[8], vs[8];
+			uint32 hitMask = intersectBlock(*block, watertightRay, laneMask, leafRay.tMin, leafRay.tMax, ts, us, vs);
+			while (hitMask) {
+				uint32 lane = countTrailingZeros(hitMask);
+				hitMask &= hitMask - 1;
+				if (anyHit(block->primIndices[lane], us[lane], vs[lane])) {
+					return true;
+				}
+			}
+		}
+		return false;
+	});
+}
+
+template <typename BVH8Type>
+bool occludedBVH8(const BVH8Type& bvh, const BVH8TriangleBlocksView& triangleBlocks, const Ray& ray) {
+	return occludedBVH8(bvh, triangleBlocks, ray, [](uint32, float, float) { return true; });
+}
+
+// up to 8x8 coherent rays in SoA layout for packet traversal, lane i of every array belongs to ray i
+struct alignas(32) RayPacket {
+	static constexpr uint32 maxRayCount = 64;
+
+	float origins[3][maxRayCount];
+	float directions[3][maxRayCount];
+	float invDirections[3][maxRayCount];
+	float tMins[maxRayCount];
+	float tMaxs[maxRayCount];
+	uint32 rayCount = 0;
+
+	void addRay(const Ray& ray) {
+		assert(rayCount < maxRayCount);
+		for (int axis = 0; axis < 3; axis += 1) {
+			origins[axis][rayCount] = ray.origin[axis];
+			directions[axis][rayCount] = ray.direction[axis];
+			invDirections[axis][rayCount] = 1.0f / ray.direction[axis];
+		}
+		tMins[rayCount] = ray.tMin;
+		tMaxs[rayCount] = ray.tMax;
+		rayCount += 1;
+	}
+	Ray ray(uint32 i) const {
+		Ray ray;
+		for (int axis = 0; axis < 3; axis += 1) {
+			ray.origin[axis] = origins[axis][i];
+			ray.direction[axis] = directions[axis][i];
+		}
+		ray.tMin = tMins[i];
+		ray.tMax = tMaxs[i];
+		return ray;
+	}
+	// fills the lanes up to the next multiple of 8 with rays that can't hit anything, so SIMD loops run whole groups
+	void padRays() {
+		for (uint32 i = rayCount; i < (rayCount + 7) / 8 * 8; i += 1) {
+			for (int axis = 0; axis < 3; axis += 1) {
+				origins[axis][i] = origins[axis][0];
+				directions[axis][i] = directions[axis][0];
+				invDirections[axis][i] = invDirections[axis][0];
+			}
+			tMins[i] = 1;
+			tMaxs[i] = 0;
+		}
+	}
+	float maxTMax() const {
+		float tMax = -FLT_MAX;
+		for (uint32 i = 0; i < rayCount; i += 1) {
+			tMax = std::max(tMax, tMaxs[i]);
+		}
+		return tMax;
+	}
+};
+
+// Interval arithmetic bounds of a whole packet for the node test, a conservative frustum around every ray of the packet.
+// The near plane t of a child is smallest for the origin farthest along the direction, nearOrigins/farOrigins pick the
+// extreme origins per axis and the inverse direction ranges cover the rest. Only valid when each axis has a single
+// direction sign over the packet, coherent is false otherwise and the packet is traced one ray at a time.
+struct BVH8PacketFrustum {
+	float invDirectionMins[3];
+	float invDirectionMaxs[3];
+	float nearOrigins[3];
+	float farOrigins[3];
+	int nearBounds[3];
+	int farBounds[3];
+	float tMin = FLT_MAX;
+	bool coherent = true;
+
+	BVH8PacketFrustum(const RayPacket& packet) {
+		for (int axis = 0; axis < 3; axis += 1) {
+			float originMin = FLT_MAX;
+			float originMax = -FLT_MAX;
+			invDirectionMins[axis] = FLT_MAX;
+			invDirectionMaxs[axis] = -FLT_MAX;
+			for (uint32 i = 0; i < packet.rayCount; i += 1) {
+				originMin = std::min(originMin, packet.origins[axis][i]);
+				originMax = std::max(originMax, packet.origins[axis][i]);
+				invDirectionMins[axis] = std::min(invDirectionMins[axis], packet.invDirections[axis][i]);
+				invDirectionMaxs[axis] = std::max(invDirectionMaxs[axis], packet.invDirections[axis][i]);
+			}
+			bool positive = invDirectionMins[axis] > 0;
+			bool negative = invDirectionMaxs[axis] < 0;
+			if (!(positive || negative) || !std::isfinite(invDirectionMins[axis]) || !std::isfinite(invDirectionMaxs[axis])) {
+				coherent = false;
+			}
+			nearOrigins[axis] = positive ? originMax : originMin;
+			farOrigins[axis] = positive ? originMin : originMax;
+			nearBounds[axis] = positive ? axis : axis + 3;
+			farBounds[axis] = positive ? axis + 3 : axis;
+		}
+		for (uint32 i = 0; i < packet.rayCount; i += 1) {
+			tMin = std::min(tMin, packet.tMins[i]);
+		}
+	}
+};
+
+// bvh8IntersectChildren for a packet frustum, the mask keeps every child that at least one ray of the packet might hit
+uint32 bvh8IntersectChildrenPacketAVX2(const BVH8Node& node, const BVH8PacketFrustum& frustum, float tMax, float* tNears) {
+	__m256 tNear = _mm256_set1_ps(frustum.tMin);
+	__m256 tFar = _mm256_set1_ps(tMax);
+	for (int axis = 0; axis < 3; axis += 1) {
+		__m256 invDirectionMin = _mm256_set1_ps(frustum.invDirectionMins[axis]);
+		__m256 invDirectionMax = _mm256_set1_ps(frustum.invDirectionMaxs[axis]);
+		__m256 nearDistance = _mm256_sub_ps(_mm256_load_ps(node.bounds[frustum.nearBounds[axis]]), _mm256_set1_ps(frustum.nearOrigins[axis]));
+		__m256 farDistance = _mm256_sub_ps(_mm256_load_ps(node.bounds[frustum.farBounds[axis]]), _mm256_set1_ps(frustum.farOrigins[axis]));
+		__m256 t0 = _mm256_min_ps(_mm256_mul_ps(nearDistance, invDirectionMin), _mm256_mul_ps(nearDistance, invDirectionMax));
+		__m256 t1 = _mm256_max_ps(_mm256_mul_ps(farDistance, invDirectionMin), _mm256_mul_ps(farDistance, invDirectionMax));
+		tNear = _mm256_max_ps(t0, tNear);
+		tFar = _mm256_min_ps(_mm256_mul_ps(t1, _mm256_set1_ps(slabFarPadding)), tFar);
+	}
+	_mm256_storeu_ps(tNears, tNear);
+	return static_cast<uint32>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+}
+
+uint32 bvh8IntersectChildrenPacketSSE4(const BVH8Node& node, const BVH8PacketFrustum& frustum, float tMax, float* tNears) {
+	uint32 mask = 0;
+	for (int half = 0; half < 8; half += 4) {
+		__m128 tNear = _mm_set1_ps(frustum.tMin);
+		__m128 tFar = _mm_set1_ps(tMax);
+		for (int axis = 0; axis < 3; axis += 1) {
+			__m128 invDirectionMin = _mm_set1_ps(frustum.invDirectionMins[axis]);
+			__m128 invDirectionMax = _mm_set1_ps(frustum.invDirectionMaxs[axis]);
+			__m128 nearDistance = _mm_sub_ps(_mm_load_ps(&node.bounds[frustum.nearBounds[axis]][half]), _mm_set1_ps(frustum.nearOrigins[axis]));
+			__m128 farDistance = _mm_sub_ps(_mm_load_ps(&node.bounds[frustum.farBounds[axis]][half]), _mm_set1_ps(frustum.farOrigins[axis]));
+			__m128 t0 = _mm_min_ps(_mm_mul_ps(nearDistance, invDirectionMin), _mm_mul_ps(nearDistance, invDirectionMax));
+			__m128 t1 = _mm_max_ps(_mm_mul_ps(farDistance, invDirectionMin), _mm_mul_ps(farDistance, invDirectionMax));
+			tNear = _mm_max_ps(t0, tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(t1, _mm_set1_ps(slabFarPadding)), tFar);
+		}
+		_mm_storeu_ps(tNears + half, tNear);
+		mask |= static_cast<uint32>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << half;
+	}
+	return mask;
+}
+
+uint32 bvh8IntersectChildrenPacket(const BVH8Node& node, const BVH8PacketFrustum& frustum, float tMax, float* tNears) {
+	return cpuSupportsAVX2 ? bvh8IntersectChildrenPacketAVX2(node, frustum, tMax, tNears) : bvh8IntersectChildrenPacketSSE4(node, frustum, tMax, tNears);
+}
+
+// decoded to float bounds once per node, which the whole packet then shares
+uint32 bvh8IntersectChildrenPacket(const BVH8QuantizedNode& node, const BVH8PacketFrustum& frustum, float tMax, float* tNears) {
+	BVH8Node decodedNode;
+	for (uint32 slot = 0; slot < 8; slot += 1) {
+		float bounds[6] = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		if (node.childMask & (1 << slot)) {
+			bvh8ChildBounds(node, slot, bounds);
+		}
+		for (int i = 0; i < 6; i += 1) {
+			decodedNode.bounds[i][slot] = bounds[i];
+		}
+	}
+	return bvh8IntersectChildrenPacket(decodedNode, frustum, tMax, tNears);
+}
+
+// slab test of rays [firstRay, firstRay + 8) against bounds (minX, minY, minZ, maxX, maxY, maxZ), returns the hit mask
+uint32 rayPacketIntersectAABBAVX2(const RayPacket& packet, uint32 firstRay, const float* bounds) {
+	__m256 tNear = _mm256_load_ps(&packet.tMins[firstRay]);
+	__m256 tFar = _mm256_load_ps(&packet.tMaxs[firstRay]);
+	for (int axis = 0; axis < 3; axis += 1) {
+		__m256 origin = _mm256_load_ps(&packet.origins[axis][firstRay]);
+		__m256 invDirection = _mm256_load_ps(&packet.invDirections[axis][firstRay]);
+		__m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds[axis]), origin), invDirection);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(bounds[axis + 3]), origin), invDirection);
+		tNear = _mm256_max_ps(_mm256_min_ps(t0, t1), tNear);
+		tFar = _mm256_min_ps(_mm256_mul_ps(_mm256_max_ps(t0, t1), _mm256_set1_ps(slabFarPadding)), tFar);
+	}
+	return static_cast<uint32>(_mm256_movemask_ps(_mm256_cmp_ps(tNear, tFar, _CMP_LE_OQ)));
+}
+
+uint32 rayPacketIntersectAABBSSE4(const RayPacket& packet, uint32 firstRay, const float* bounds) {
+	uint32 mask = 0;
+	for (uint32 half = 0; half < 8; half += 4) {
+		__m128 tNear = _mm_load_ps(&packet.tMins[firstRay + half]);
+		__m128 tFar = _mm_load_ps(&packet.tMaxs[firstRay + half]);
+		for (int axis = 0; axis < 3; axis += 1) {
+			__m128 origin = _mm_load_ps(&packet.origins[axis][firstRay + half]);
+			__m128 invDirection = _mm_load_ps(&packet.invDirections[axis][firstRay + half]);
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds[axis]), origin), invDirection);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bounds[axis + 3]), origin), invDirection);
+			tNear = _mm_max_ps(_mm_min_ps(t0, t1), tNear);
+			tFar = _mm_min_ps(_mm_mul_ps(_mm_max_ps(t0, t1), _mm_set1_ps(slabFarPadding)), tFar);
+		}
+		mask |= static_cast<uint32>(_mm_movemask_ps(_mm_cmple_ps(tNear, tFar))) << half;
+	}
+	return mask;
+}
+
+// Packet version of traverseBVH8. Interior nodes are culled once per packet against its frustum, and every visited node
+// slab tests the rays still active in its parent 8 at a time, so each stack entry carries the mask of rays that reach
+// it. Once no more than singleRayThreshold rays are left the rays diverge enough that each one traverses the rest of
+// the subtree on its own with traverseBVH8. intersectPrim(primIndex, rayMask) tests the prim against the rays in rayMask
+// and lowers their packet.tMaxs when it accepts closer hits. Packets without a single direction sign per axis are
+// traced one ray at a time from the root.
+static constexpr uint32 singleRayThreshold = 16;
+
+template <typename BVH8Type, typename IntersectPrim>
+void traverseBVH8Packet(const BVH8Type& bvh, RayPacket& packet, IntersectPrim&& intersectPrim) {
+	if (bvh.nodes.empty() || packet.rayCount == 0) {
+		return;
+	}
+	auto traverseSingleRay = [&](uint32 rayIndex, uint32 rootIndex) {
+		Ray ray = packet.ray(rayIndex);
+		traverseBVH8(bvh, ray, [&](uint32 primIndex, Ray& traversalRay) {
+			intersectPrim(primIndex, 1ull << rayIndex);
+			traversalRay.tMax = packet.tMaxs[rayIndex];
+		}, rootIndex);
+	};
+	BVH8PacketFrustum frustum(packet);
+	if (!frustum.coherent) {
+		for (uint32 rayIndex = 0; rayIndex < packet.rayCount; rayIndex += 1) {
+			traverseSingleRay(rayIndex, 0);
+		}
+		return;
+	}
+	packet.padRays();
+	auto intersectRays = cpuSupportsAVX2 ? rayPacketIntersectAABBAVX2 : rayPacketIntersectAABBSSE4;
+	BVHTraversalStats* stats = bvhTraversalStats;
+	float tMax = packet.maxTMax();
+	struct StackEntry {
+		uint32 childIndex;
+		uint32 primCount;
+		float tNear;
+		// the node's bounds are in its parent's slot
+		uint32 parentIndex;
+		uint32 slot;
+		uint64 rayMask;
+	};
+	StackEntry stack[512];
+	uint32 stackSize = 0;
+	uint64 allRays = packet.rayCount == 64 ? UINT64_MAX : (1ull << packet.rayCount) - 1;
+	stack[stackSize++] = StackEntry{ 0, 0, frustum.tMin, UINT32_MAX, 0, allRays };
+	while (stackSize > 0) {
+		StackEntry entry = stack[--stackSize];
+		if (entry.tNear > tMax) {
+			continue;
+		}
+		uint64 rayMask = entry.rayMask;
+		if (entry.parentIndex != UINT32_MAX) {
+			float bounds[6];
+			bvh8ChildBounds(bvh.nodes[entry.parentIndex], entry.slot, bounds);
+			rayMask = 0;
+			for (uint32 firstRay = 0; firstRay < packet.rayCount; firstRay += 8) {
+				if ((entry.rayMask >> firstRay) & 0xff) {
+					rayMask |= static_cast<uint64>(intersectRays(packet, firstRay, bounds)) << firstRay;
+				}
+			}
+			rayMask &= entry.rayMask;
+			if (rayMask == 0) {
+				continue;
+			}
+		}
+		if (entry.primCount > 0) {
+			if (stats) {
+				stats->primsTested += entry.primCount * popCount(rayMask);
+			}
+			for (uint32 i = 0; i < entry.primCount; i += 1) {
+				intersectPrim(bvh.primIndices[entry.childIndex + i], rayMask);
+			}
+			tMax = packet.maxTMax();
+			continue;
+		}
+		if (popCount(rayMask) <= singleRayThreshold) {
+			while (rayMask) {
+				uint32 rayIndex = countTrailingZeros(rayMask);
+				rayMask &= rayMask - 1;
+				traverseSingleRay(rayIndex, entry.childIndex);
+			}
+			tMax = packet.maxTMax();
+			continue;
+		}
+		const auto& node = bvh.nodes[entry.childIndex];
+		if (stats) {
+			stats->nodesVisited += 1;
+		}
+		float tNears[8];
+		uint32 mask = bvh8IntersectChildrenPacket(node, frustum, tMax, tNears);
+		uint32 childCount = 0;
+		assert(stackSize + 8 <= countof(stack));
+		StackEntry* children = &stack[stackSize];
+		while (mask) {
+			uint32 slot = countTrailingZeros(mask);
+			mask &= mask - 1;
+			// insertion sort by descending tNear
+			uint32 i = childCount;
+			while (i > 0 && children[i - 1].tNear < tNears[slot]) {
+				children[i] = children[i - 1];
+				i -= 1;
+			}
+			children[i] = StackEntry{ node.childIndices[slot], node.primCounts[slot], tNears[slot], entry.childIndex, slot, rayMask };
+			childCount += 1;
+		}
+		stackSize += childCount;
+	}
+}
+
+// traceBVH8 for every ray of the packet, hit bit i of the result is set when hits[i] is valid,
+// anyHit(primIndex, rayIndex, u, v) follows traceBVH
+template <typename BVH8Type, typename AnyHit>
+uint64 traceBVH8Packet(const BVH8Type& bvh, const BVHTriangle* triangles, RayPacket& packet, RayHit* hits, AnyHit&& anyHit) {
+	uint64 hitMask = 0;
+	traverseBVH8Packet(bvh, packet, [&](uint32 primIndex, uint64 rayMask) {
+		while (rayMask) {
+			uint32 rayIndex = countTrailingZeros(rayMask);
+			rayMask &= rayMask - 1;
+			float t, u, v;
+			if (rayIntersectTriangle(triangles[primIndex], packet.ray(rayIndex), t, u, v) && anyHit(primIndex, rayIndex, u, v)) {
+				packet.tMaxs[rayIndex] = t;
+				hits[rayIndex].t = t;
+				hits[rayIndex].barycentrics[0] = u;
+				hits[rayIndex].barycentrics[1] = v;
+				hits[rayIndex].primIndex = primIndex;
+				hitMask |= 1ull << rayIndex;
+			}
+		}
+	});
+	return hitMask;
+}
+
+template <typename BVH8Type>
+uint64 traceBVH8Packet(const BVH8Type& bvh, const BVHTriangle* triangles, RayPacket& packet, RayHit* hits) {
+	return traceBVH8Packet(bvh, triangles, packet, hits, [](uint32, uint32, float, float) { return true; });
+}
+
+// occludedBVH8 for every ray of the packet, bit i of the result is set when ray i is occluded. An occluded ray gets
+// tMax = -FLT_MAX, which fails every later slab test, so it drops out of the packet and the traversal ends
+// once the whole packet is occluded
+template <typename BVH8Type, typename AnyHit>
+uint64 occludedBVH8Packet(const BVH8Type& bvh, const BVHTriangle* triangles, RayPacket& packet, AnyHit&& anyHit) {
+	uint64 occludedMask = 0;
+	traverseBVH8Packet(bvh, packet, [&](uint32 primIndex, uint64 rayMask) {
+		rayMask &= ~occludedMask;
+		while (rayMask) {
+			uint32 rayIndex = countTrailingZeros(rayMask);
+			rayMask &= rayMask - 1;
+			float t, u, v;
+			if (rayIntersectTriangle(triangles[primIndex], packet.ray(rayIndex), t, u, v) && anyHit(primIndex, rayIndex, u, v)) {
+				packet.tMaxs[rayIndex] = -FLT_MAX;
+				occludedMask |= 1ull << rayIndex;
+			}
+		}
+	});
+	return occludedMask;
+}
+
+template <typename BVH8Type>
+uint64 occludedBVH8Packet(const BVH8Type& bvh, const BVHTriangle* triangles, RayPacket& packet) {
+	return occludedBVH8Packet(bvh, triangles, packet, [](uint32, uint32, float, float) { return true; });
+}
+
+// Order for tracing a stream of incoherent rays (diffuse bounces). Rays are bucketed by direction octant and sorted
+// within a bucket by the Morton code of their origin's cell in a 1024^3 grid over the origins' bounds, so rays next to
+// each other in the order start close together heading the same way: they share most of their traversal and 64 of
+// them form a packet with a single direction sign per axis. order receives the ray indices in that order
+void rayStreamOrder(const Ray* rays, uint32 rayCount, std::vector<uint32>& order, ThreadPool* pool) {
+	AABB originBounds;
+	for (uint32 i = 0; i < rayCount; i += 1) {
+		originBounds.extend(rays[i].origin);
+	}
+	float scales[3];
+	for (int axis = 0; axis < 3; axis += 1) {
+		float extent = originBounds.max[axis] - originBounds.min[axis];
+		scales[axis] = extent > 0 ? 1023.0f / extent : 0.0f;
+	}
+	static constexpr uint32 chunkSize = 1 << 14;
+	std::vector<uint64> keys(rayCount);
+	order.resize(rayCount);
+	auto computeKeys = [&](uint64 chunk) {
+		uint32 chunkEnd = std::min(static_cast<uint32>(chunk + 1) * chunkSize, rayCount);
+		for (uint32 i = static_cast<uint32>(chunk) * chunkSize; i < chunkEnd; i += 1) {
+			uint64 key = 0;
+			for (int axis = 0; axis < 3; axis += 1) {
+				uint64 cell = static_cast<uint64>((rays[i].origin[axis] - originBounds.min[axis]) * scales[axis]);
+				key |= mortonExpandBits(std::min<uint64>(cell, 1023)) << axis;
+				key |= static_cast<uint64>(rays[i].direction[axis] < 0) << (30 + axis);
+			}
+			keys[i] = key;
+			order[i] = i;
+		}
+	};
+	uint32 chunkCount = (rayCount + chunkSize - 1) / chunkSize;
+	if (pool) {
+		pool->parallelFor(chunkCount, computeKeys);
+	}
+	else {
+		for (uint32 chunk = 0; chunk < chunkCount; chunk += 1) {
+			computeKeys(chunk);
+		}
+	}
+	radixSortPairs(keys, order, 33, pool);
+}
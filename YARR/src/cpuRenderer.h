@@ -0,0 +1,786 @@
+/************************************************************************************************/
+/*			Copyright (C) 2020 By Yang Chen (yngccc@gmail.com). All Rights Reserved.			*/
+/************************************************************************************************/
+
+#pragma once
+
+#include "scene.h"
+
+#include <chrono>
+#include <map>
+
+// CPU reference of primaryRay.hlsl + directLightRay.hlsl, it only reads the data rebuildTLAS uploads
+// (SceneRayTracingData) and never touches DX12, so scenes loaded with a nullptr DX12Context can be rendered
+
+static const float* srgbToLinearTable = [] {
+	static float table[256];
+	for (int i = 0; i < 256; i += 1) {
+		float c = i / 255.0f;
+		table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+	return table;
+}();
+
+float linearToSRGB(float c) {
+	c = std::min(std::max(c, 0.0f), 1.0f);
+	return std::max(1.055f * powf(c, 0.416666667f) - 0.055f, 0.0f);
+}
+
+template <int N>
+void barycentricsInterpolate(const float* barycentrics, const VertexInfo(&vertices)[3], float(VertexInfo::* attrib)[N], float* result) {
+	const float(&a0)[N] = vertices[0].*attrib;
+	const float(&a1)[N] = vertices[1].*attrib;
+	const float(&a2)[N] = vertices[2].*attrib;
+	for (int i = 0; i < N; i += 1) {
+		result[i] = a0[i] + barycentrics[0] * (a1[i] - a0[i]) + barycentrics[1] * (a2[i] - a0[i]);
+	}
+}
+
+// bilinear sample of one mip of image, wrap addressing,
+// 4 component images are R8G8B8A8_UNORM_SRGB on the GPU so their rgb is decoded before filtering
+void sampleTextureMip(const ModelImage& image, int mip, const float* uv, float* color) {
+	const uint8* pixels = image.pixels.data();
+	for (int m = 0; m < mip; m += 1) {
+		pixels += static_cast<uint64>(std::max(image.width >> m, 1)) * std::max(image.height >> m, 1) * image.component;
+	}
+	int width = std::max(image.width >> mip, 1);
+	int height = std::max(image.height >> mip, 1);
+	float x = uv[0] * width - 0.5f;
+	float y = uv[1] * height - 0.5f;
+	float fx = floorf(x);
+	float fy = floorf(y);
+	float wx = x - fx;
+	float wy = y - fy;
+	int x0 = static_cast<int>(fx) % width;
+	int y0 = static_cast<int>(fy) % height;
+	x0 = x0 < 0 ? x0 + width : x0;
+	y0 = y0 < 0 ? y0 + height : y0;
+	int x1 = (x0 + 1) % width;
+	int y1 = (y0 + 1) % height;
+	int texelCoords[4][2] = { {x0, y0}, {x1, y0}, {x0, y1}, {x1, y1} };
+	float texelWeights[4] = { (1 - wx) * (1 - wy), wx * (1 - wy), (1 - wx) * wy, wx * wy };
+	color[0] = 0;
+	color[1] = 0;
+	color[2] = 0;
+	color[3] = image.component < 4 ? 1.0f : 0.0f;
+	for (int i = 0; i < 4; i += 1) {
+		const uint8* texel = &pixels[(static_cast<uint64>(texelCoords[i][1]) * width + texelCoords[i][0]) * image.component];
+		for (int c = 0; c < image.component; c += 1) {
+			float value = (image.component == 4 && c < 3) ? srgbToLinearTable[texel[c]] : texel[c] / 255.0f;
+			color[c] += value * texelWeights[i];
+		}
+	}
+}
+
+// equivalent of SampleLevel(sampler0, uv, lod): trilinear between the two mips around lod, clamped to the mip chain
+void sampleTexture(const ModelImage& image, const float* uv, float lod, float* color) {
+	lod = std::min(std::max(lod, 0.0f), static_cast<float>(image.mipCount - 1));
+	int mip = static_cast<int>(lod);
+	float weight = lod - mip;
+	sampleTextureMip(image, mip, uv, color);
+	if (weight > 0) {
+		float nextColor[4];
+		sampleTextureMip(image, mip + 1, uv, nextColor);
+		for (int i = 0; i < 4; i += 1) {
+			color[i] += (nextColor[i] - color[i]) * weight;
+		}
+	}
+}
+
+// textureLOD of primaryRay.hlsl: coneWidth is the ray cone's object space width at the hit, direction and normal are
+// unit vectors in the same space
+float textureLOD(const ModelImage& image, float texCoordAreaRatio, float coneWidth, const float* direction, const float* normal) {
+	float texelWidth = coneWidth * sqrtf(texCoordAreaRatio * image.width * image.height) / std::max(fabsf(dotProduct(direction, normal)), 1e-4f);
+	return texelWidth > 1 ? log2f(texelWidth) : 0.0f;
+}
+
+// random numbers of the bounce pass, a hash of (pixel, sample) so images don't depend on thread scheduling
+uint32 hashUint32(uint32 x) {
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+float hashUniform(uint32& state) {
+	state = hashUint32(state);
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// cosine weighted direction around the unit vector normal, with the orthonormal basis of Duff et al. 2017
+void cosineHemisphereSample(const float* normal, float u0, float u1, float* direction) {
+	float r = sqrtf(u0);
+	float phi = 2.0f * static_cast<float>(M_PI) * u1;
+	float local[3] = { r * cosf(phi), r * sinf(phi), sqrtf(std::max(1.0f - u0, 0.0f)) };
+	float sign = copysignf(1.0f, normal[2]);
+	float a = -1.0f / (sign + normal[2]);
+	float b = normal[0] * normal[1] * a;
+	float tangent[3] = { 1.0f + sign * normal[0] * normal[0] * a, sign * b, -sign * normal[0] };
+	float bitangent[3] = { b, sign + normal[1] * normal[1] * a, -normal[1] };
+	for (int i = 0; i < 3; i += 1) {
+		direction[i] = tangent[i] * local[0] + bitangent[i] * local[1] + normal[i] * local[2];
+	}
+}
+
+// 1 bit per texel of alpha >= alphaCutoff, so anyHit alpha tests read a bit at the nearest texel instead of a
+// bilinear texture sample. Rows are padded to whole words so rows can be built in parallel.
+struct AlphaMask {
+	// alpha test result over a region of the texture
+	enum Coverage : uint8 {
+		Opaque,
+		Transparent,
+		Masked,
+	};
+
+	int width = 0;
+	int height = 0;
+	int wordsPerRow = 0;
+	std::vector<uint64> bits;
+	Coverage coverage = Opaque;
+
+	AlphaMask(const ModelImage& image, float alphaCutoff) : width(image.width), height(image.height), wordsPerRow((image.width + 63) / 64) {
+		bits.resize(static_cast<uint64>(wordsPerRow) * height);
+		bool alphaPasses[256];
+		for (int i = 0; i < 256; i += 1) {
+			alphaPasses[i] = image.component < 4 || i / 255.0f >= alphaCutoff;
+		}
+		std::atomic<uint64> opaqueTexelCount = 0;
+		threadPool.parallelFor(height, [&](uint64 y) {
+			uint64 rowOpaqueTexelCount = 0;
+			for (int x = 0; x < width; x += 1) {
+				const uint8* texel = &image.pixels[(y * width + x) * image.component];
+				if (alphaPasses[texel[image.component - 1]]) {
+					bits[y * wordsPerRow + x / 64] |= 1ull << (x % 64);
+					rowOpaqueTexelCount += 1;
+				}
+			}
+			opaqueTexelCount += rowOpaqueTexelCount;
+		});
+		uint64 texelCount = static_cast<uint64>(width) * height;
+		coverage = opaqueTexelCount == texelCount ? Opaque : (opaqueTexelCount == 0 ? Transparent : Masked);
+	}
+	// repeat wrapping like sampleTexture
+	bool sample(const float* uv) const {
+		int x = static_cast<int>(floorf(uv[0] * width)) % width;
+		int y = static_cast<int>(floorf(uv[1] * height)) % height;
+		x = x < 0 ? x + width : x;
+		y = y < 0 ? y + height : y;
+		return (bits[static_cast<uint64>(y) * wordsPerRow + x / 64] >> (x % 64)) & 1;
+	}
+	// coverage of every texel sample() can return for a uv inside [uvMin, uvMax]
+	Coverage rectCoverage(const float* uvMin, const float* uvMax) const {
+		if (coverage != Masked) {
+			return coverage;
+		}
+		int64 x0 = static_cast<int64>(floorf(uvMin[0] * width));
+		int64 x1 = static_cast<int64>(floorf(uvMax[0] * width));
+		int64 y0 = static_cast<int64>(floorf(uvMin[1] * height));
+		int64 y1 = static_cast<int64>(floorf(uvMax[1] * height));
+		if (x1 - x0 + 1 >= width || y1 - y0 + 1 >= height) {
+			return Masked;
+		}
+		// wrapped column ranges, the rect can cross the right edge once
+		int columnRanges[2][2];
+		int columnRangeCount = 0;
+		int wrappedX0 = static_cast<int>(((x0 % width) + width) % width);
+		int wrappedX1 = wrappedX0 + static_cast<int>(x1 - x0);
+		if (wrappedX1 < width) {
+			columnRanges[columnRangeCount][0] = wrappedX0;
+			columnRanges[columnRangeCount++][1] = wrappedX1;
+		}
+		else {
+			columnRanges[columnRangeCount][0] = wrappedX0;
+			columnRanges[columnRangeCount++][1] = width - 1;
+			columnRanges[columnRangeCount][0] = 0;
+			columnRanges[columnRangeCount++][1] = wrappedX1 - width;
+		}
+		bool anyOpaque = false;
+		bool anyTransparent = false;
+		for (int64 row = y0; row <= y1; row += 1) {
+			uint64 y = static_cast<uint64>(((row % height) + height) % height);
+			for (int range = 0; range < columnRangeCount; range += 1) {
+				int begin = columnRanges[range][0];
+				int end = columnRanges[range][1] + 1;
+				for (int word = begin / 64; word <= (end - 1) / 64; word += 1) {
+					int wordBegin = std::max(begin, word * 64) - word * 64;
+					int wordEnd = std::min(end, word * 64 + 64) - word * 64;
+					uint64 rangeBits = (wordEnd - wordBegin == 64 ? UINT64_MAX : ((1ull << (wordEnd - wordBegin)) - 1)) << wordBegin;
+					uint64 texelBits = bits[y * wordsPerRow + word] & rangeBits;
+					anyOpaque = anyOpaque || texelBits != 0;
+					anyTransparent = anyTransparent || texelBits != rangeBits;
+					if (anyOpaque && anyTransparent) {
+						return Masked;
+					}
+				}
+			}
+		}
+		return anyOpaque ? Opaque : Transparent;
+	}
+};
+
+struct CPURenderer {
+	static constexpr uint tileSize = 16;
+
+	SceneRayTracingData data;
+	std::vector<SceneLight> lights;
+	Camera camera;
+	SceneBVH sceneBVH;
+
+	uint width = 0;
+	uint height = 0;
+	std::vector<float> positionTexture;
+	std::vector<float> normalTexture;
+	std::vector<float> baseColorTexture;
+	std::vector<float> emissiveTexture;
+	std::vector<float> outputTexture;
+
+	// primary and shadow rays are traced as 8 x 8 packets, see SceneBVH::tracePacket and SceneBVH::occludedPacket
+	bool rayPackets = true;
+	// anyHit state, built once per CPURenderer: an AlphaMask per (base color texture, alphaCutoff) used by a non opaque
+	// primitive, the mask index of each materialInfo (-1 for none) and an AlphaMask::Coverage per triangle so only
+	// triangles whose uv footprint straddles the cutoff have to look at the mask
+	std::vector<AlphaMask> alphaMasks;
+	std::vector<int> materialAlphaMasks;
+	std::vector<AlphaMask::Coverage> triangleAlphaCoverages;
+	// BVH traversal work of each pixel's primary and shadow rays goes to nodesVisitedTexture and primsTestedTexture,
+	// and the sum over the frame to traversalStatsTotal, see BVHTraversalStats
+	bool traversalStats = false;
+	std::vector<float> nodesVisitedTexture;
+	std::vector<float> primsTestedTexture;
+	BVHTraversalStats traversalStatsTotal;
+	// bounceSampleCount diffuse bounces per pixel on top of the direct light, each lit by one shadow ray per light at
+	// its hit. Bounce rays of a band of rows are traced as one stream (SceneBVH::traceStream), reorderBounceRays puts
+	// them in rayStreamOrder first. They are not part of the traversal heat maps
+	uint bounceSampleCount = 0;
+	bool reorderBounceRays = true;
+	double bounceTime = 0;
+	uint64 bounceRayCount = 0;
+	double renderTime = 0;
+	uint64 rayCount = 0;
+	// Camera::pixelSpreadAngle of the last render, the spread of the primary ray cones
+	float pixelSpreadAngle = 0;
+
+	// the scene's ModelMeshBVHs have to be built first, see Scene::buildModelMeshBVHs
+	CPURenderer(const Scene& scene, const BVHBuildSettings& tlasBuildSettings = {}) : CPURenderer(scene, scene.lights, scene.camera, tlasBuildSettings) {}
+	// renders sceneLights and sceneCamera instead of the scene's own, copies taken while the scene can still be edited
+	CPURenderer(const Scene& scene, const std::vector<SceneLight>& sceneLights, const Camera& sceneCamera, const BVHBuildSettings& tlasBuildSettings = {}) : data(scene.buildRayTracingData()), lights(sceneLights), camera(sceneCamera) {
+		sceneBVH.build(data.instances, tlasBuildSettings);
+		buildAlphaMasks();
+	}
+	void buildAlphaMasks() {
+		// geometryInfos are per mesh primitive, instances of the same mesh share them
+		std::vector<std::pair<const ModelPrimitive*, const GeometryInfo*>> alphaTestedGeometries;
+		std::vector<bool> geometryVisited(data.geometryInfos.size(), false);
+		for (uint32 instanceIndex = 0; instanceIndex < data.instances.size(); instanceIndex += 1) {
+			const ModelMesh* mesh = data.instances[instanceIndex].mesh;
+			for (uint32 geometryIndex = 0; geometryIndex < mesh->primitives.size(); geometryIndex += 1) {
+				uint32 geometryInfoIndex = data.instanceInfos[instanceIndex].geometryOffset + geometryIndex;
+				if (!geometryVisited[geometryInfoIndex]) {
+					geometryVisited[geometryInfoIndex] = true;
+					if (!mesh->primitives[geometryIndex].opaque) {
+						alphaTestedGeometries.push_back({ &mesh->primitives[geometryIndex], &data.geometryInfos[geometryInfoIndex] });
+					}
+				}
+			}
+		}
+		materialAlphaMasks.assign(data.materialInfos.size(), -1);
+		std::map<std::pair<int, float>, int> alphaMaskIndices;
+		for (auto& [primitive, geometry] : alphaTestedGeometries) {
+			if (geometry->materialIndex < 0 || materialAlphaMasks[geometry->materialIndex] >= 0) {
+				continue;
+			}
+			const ModelMaterial& material = data.materialInfos[geometry->materialIndex].material;
+			if (material.baseColorTextureIndex >= 0) {
+				auto [maskIter, inserted] = alphaMaskIndices.insert({ { material.baseColorTextureIndex, material.alphaCutoff }, static_cast<int>(alphaMasks.size()) });
+				if (inserted) {
+					alphaMasks.emplace_back(*data.textures[material.baseColorTextureIndex], material.alphaCutoff);
+				}
+				materialAlphaMasks[geometry->materialIndex] = maskIter->second;
+			}
+		}
+		triangleAlphaCoverages.assign(data.triangleIndices.size(), AlphaMask::Opaque);
+		threadPool.parallelFor(alphaTestedGeometries.size(), [&](uint64 index) {
+			auto [primitive, geometry] = alphaTestedGeometries[index];
+			if (geometry->materialIndex < 0 || materialAlphaMasks[geometry->materialIndex] < 0) {
+				return;
+			}
+			const AlphaMask& alphaMask = alphaMasks[materialAlphaMasks[geometry->materialIndex]];
+			uint64 triangleCount = primitive->indexCount() / 3;
+			for (uint32 primitiveIndex = 0; primitiveIndex < triangleCount; primitiveIndex += 1) {
+				VertexInfo v[3];
+				triangleVertices(*geometry, primitiveIndex, v);
+				float uvMin[2] = { std::min({ v[0].uv[0], v[1].uv[0], v[2].uv[0] }), std::min({ v[0].uv[1], v[1].uv[1], v[2].uv[1] }) };
+				float uvMax[2] = { std::max({ v[0].uv[0], v[1].uv[0], v[2].uv[0] }), std::max({ v[0].uv[1], v[1].uv[1], v[2].uv[1] }) };
+				triangleAlphaCoverages[geometry->triangleOffset + primitiveIndex] = alphaMask.rectCoverage(uvMin, uvMax);
+			}
+		});
+	}
+	// picks up transform edits made with Scene::setNodeTransforms without rebuilding the TLAS
+	void updateInstanceTransforms(const Scene& scene, const std::vector<uint32>& changedInstances) {
+		for (uint32 instanceIndex : changedInstances) {
+			data.instances[instanceIndex].transform = scene.instances[instanceIndex].transform;
+			data.instanceInfos[instanceIndex].transformMat = scene.instances[instanceIndex].transform;
+		}
+		sceneBVH.refit(data.instances, changedInstances);
+	}
+	const GeometryInfo& geometryInfo(uint32 instanceIndex, uint32 geometryIndex) const {
+		return data.geometryInfos[data.instanceInfos[instanceIndex].geometryOffset + geometryIndex];
+	}
+	// getTriangleVertices of primaryRay.hlsl
+	void triangleVertices(const GeometryInfo& geometry, uint32 primitiveIndex, VertexInfo(&vertices)[3]) const {
+		const TriangleIndices& indices = data.triangleIndices[geometry.triangleOffset + primitiveIndex];
+		for (int i = 0; i < 3; i += 1) {
+			decodeVertexInfo(data.vertexInfos[geometry.vertexOffset + indices.indices[i]], vertices[i]);
+		}
+	}
+	// alpha test of a non opaque primitive against the nearest texel of its AlphaMask, triangles entirely on one side of
+	// the cutoff are decided by triangleAlphaCoverages alone
+	bool anyHit(uint32 instanceIndex, uint32 geometryIndex, uint32 primitiveIndex, const float* barycentrics) const {
+		const GeometryInfo& geometry = geometryInfo(instanceIndex, geometryIndex);
+		AlphaMask::Coverage coverage = triangleAlphaCoverages[geometry.triangleOffset + primitiveIndex];
+		if (coverage != AlphaMask::Masked) {
+			return coverage == AlphaMask::Opaque;
+		}
+		VertexInfo vertices[3];
+		triangleVertices(geometry, primitiveIndex, vertices);
+		float texCoord[2];
+		barycentricsInterpolate(barycentrics, vertices, &VertexInfo::uv, texCoord);
+		return alphaMasks[materialAlphaMasks[geometry.materialIndex]].sample(texCoord);
+	}
+	// getEyeRay of primaryRay.hlsl
+	Ray eyeRay(uint x, uint y, const DirectX::XMMATRIX& screenToWorldMat) const {
+		float screenPos[2] = { (x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f };
+		screenPos[1] = -screenPos[1];
+		DirectX::XMVECTOR world = DirectX::XMVector4Transform(DirectX::XMVectorSet(screenPos[0], screenPos[1], 0, 1), screenToWorldMat);
+		world = DirectX::XMVectorDivide(world, DirectX::XMVectorSplatW(world));
+		DirectX::XMVECTOR direction = DirectX::XMVector3Normalize(DirectX::XMVectorSubtract(world, camera.position));
+
+		Ray ray;
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(ray.origin), camera.position);
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(ray.direction), direction);
+		ray.tMin = 0;
+		ray.tMax = 500;
+		return ray;
+	}
+	void primaryRay(uint x, uint y, const DirectX::XMMATRIX& screenToWorldMat) {
+		Ray ray = eyeRay(x, y, screenToWorldMat);
+		SceneRayHit hit;
+		bool found = sceneBVH.trace(ray, hit, [this](uint32 instanceIndex, uint32 geometryIndex, uint32 primitiveIndex, const float* barycentrics) {
+			return anyHit(instanceIndex, geometryIndex, primitiveIndex, barycentrics);
+		});
+		shadePrimaryRay(x, y, ray, found, hit);
+	}
+	// primaryRay for the pixels [x0, x1) x [y0, y1) of at most 8 x 8, traced as one packet
+	void primaryRayPacket(uint x0, uint y0, uint x1, uint y1, const DirectX::XMMATRIX& screenToWorldMat) {
+		RayPacket packet;
+		for (uint y = y0; y < y1; y += 1) {
+			for (uint x = x0; x < x1; x += 1) {
+				packet.addRay(eyeRay(x, y, screenToWorldMat));
+			}
+		}
+		SceneRayHit hits[RayPacket::maxRayCount];
+		uint64 hitMask = sceneBVH.tracePacket(packet, hits, [this](uint32 instanceIndex, uint32 geometryIndex, uint32 primitiveIndex, const float* barycentrics) {
+			return anyHit(instanceIndex, geometryIndex, primitiveIndex, barycentrics);
+		});
+		uint32 rayIndex = 0;
+		for (uint y = y0; y < y1; y += 1) {
+			for (uint x = x0; x < x1; x += 1) {
+				shadePrimaryRay(x, y, packet.ray(rayIndex), (hitMask >> rayIndex) & 1, hits[rayIndex]);
+				rayIndex += 1;
+			}
+		}
+	}
+	void shadePrimaryRay(uint x, uint y, const Ray& ray, bool found, const SceneRayHit& hit) {
+		uint64 pixelIndex = (static_cast<uint64>(y) * width + x) * 3;
+		float* position = &positionTexture[pixelIndex];
+		float* normal = &normalTexture[pixelIndex];
+		float* color = &baseColorTexture[pixelIndex];
+		float* emissive = &emissiveTexture[pixelIndex];
+		if (!found) {
+			for (int i = 0; i < 3; i += 1) {
+				position[i] = normal[i] = color[i] = emissive[i] = 0;
+			}
+			return;
+		}
+		surfaceAttributes(ray, hit, pixelSpreadAngle, position, normal, color, emissive);
+	}
+	// the gbuffer attributes primaryRay.hlsl writes for a hit: world position, world shading normal, base color, emissive.
+	// Textures are sampled at the ray cone LOD of a cone spreading by spreadAngle, 0 samples mip 0
+	void surfaceAttributes(const Ray& ray, const SceneRayHit& hit, float spreadAngle, float* position, float* normal, float* color, float* emissive) const {
+		const InstanceInfo& instanceInfo = data.instanceInfos[hit.instanceIndex];
+		const GeometryInfo& geometry = geometryInfo(hit.instanceIndex, hit.geometryIndex);
+		const ModelMaterial& material = data.materialInfos[geometry.materialIndex].material;
+		VertexInfo vertices[3];
+		triangleVertices(geometry, hit.primitiveIndex, vertices);
+		for (int i = 0; i < 3; i += 1) {
+			position[i] = ray.origin[i] + ray.direction[i] * hit.t;
+		}
+		float n[3];
+		barycentricsInterpolate(hit.barycentrics, vertices, &VertexInfo::normal, n);
+		color[0] = material.baseColorFactor[0];
+		color[1] = material.baseColorFactor[1];
+		color[2] = material.baseColorFactor[2];
+		float texCoord[2];
+		barycentricsInterpolate(hit.barycentrics, vertices, &VertexInfo::uv, texCoord);
+		float coneWidth = 0;
+		float vertexWorldNormal[3] = {};
+		if (spreadAngle > 0) {
+			DirectX::XMMATRIX transformMat = instanceInfo.transformMat;
+			// texCoordAreaRatio is per object space area, so the cone is scaled by the instance's average scale
+			coneWidth = spreadAngle * hit.t / cbrtf(fabsf(DirectX::XMVectorGetX(DirectX::XMMatrixDeterminant(transformMat))));
+			DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(vertexWorldNormal), DirectX::XMVector3Normalize(DirectX::XMVector3TransformNormal(DirectX::XMVectorSet(n[0], n[1], n[2], 0), transformMat)));
+		}
+		if (material.baseColorTextureIndex >= 0) {
+			const ModelImage& image = *data.textures[material.baseColorTextureIndex];
+			float textureColor[4];
+			sampleTexture(image, texCoord, textureLOD(image, geometry.texCoordAreaRatio, coneWidth, ray.direction, vertexWorldNormal), textureColor);
+			color[0] *= textureColor[0];
+			color[1] *= textureColor[1];
+			color[2] *= textureColor[2];
+		}
+		if (material.normalTextureIndex >= 0) {
+			float tangent[3];
+			barycentricsInterpolate(hit.barycentrics, vertices, &VertexInfo::tangent, tangent);
+			float bitangent[3];
+			crossProduct(n, tangent, bitangent);
+			const ModelImage& image = *data.textures[material.normalTextureIndex];
+			float textureNormal[4];
+			sampleTexture(image, texCoord, textureLOD(image, geometry.texCoordAreaRatio, coneWidth, ray.direction, vertexWorldNormal), textureNormal);
+			float tbnNormal[3];
+			for (int i = 0; i < 3; i += 1) {
+				tbnNormal[i] = tangent[i] * textureNormal[0] + bitangent[i] * textureNormal[1] + n[i] * textureNormal[2];
+			}
+			arrayCopy(n, tbnNormal);
+		}
+		DirectX::XMVECTOR worldNormal = DirectX::XMVector3Normalize(DirectX::XMVector3TransformNormal(DirectX::XMVectorSet(n[0], n[1], n[2], 0), instanceInfo.transformMat));
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(normal), worldNormal);
+		emissive[0] = material.emissiveFactor[0];
+		emissive[1] = material.emissiveFactor[1];
+		emissive[2] = material.emissiveFactor[2];
+	}
+	// shadow ray of directLightRay.hlsl from the pixel to light, false if the pixel was a primary miss or the light needs none
+	bool shadowRay(uint x, uint y, const SceneLight& light, Ray& ray) const {
+		uint64 pixelIndex = (static_cast<uint64>(y) * width + x) * 3;
+		return shadowRay(&positionTexture[pixelIndex], &normalTexture[pixelIndex], light, ray);
+	}
+	bool shadowRay(const float* position, const float* normal, const SceneLight& light, Ray& ray) const {
+		// primary miss, every light term would be dot(0, dir) == 0
+		if (normal[0] == 0 && normal[1] == 0 && normal[2] == 0) {
+			return false;
+		}
+		for (int i = 0; i < 3; i += 1) {
+			ray.origin[i] = position[i];
+		}
+		if (light.type == DIRECTIONAL_LIGHT) {
+			for (int i = 0; i < 3; i += 1) {
+				ray.direction[i] = light.direction[i];
+			}
+		}
+		else if (light.type == POINT_LIGHT) {
+			float toLight[3] = { light.position[0] - position[0], light.position[1] - position[1], light.position[2] - position[2] };
+			if (vec3Len(toLight) == 0) {
+				return false;
+			}
+			vec3Normalize(toLight, ray.direction);
+		}
+		else {
+			return false;
+		}
+		ray.tMin = 0.001f;
+		ray.tMax = 500;
+		return true;
+	}
+	void addLight(uint x, uint y, const SceneLight& light, const Ray& ray) {
+		uint64 pixelIndex = (static_cast<uint64>(y) * width + x) * 3;
+		float nDotL = dotProduct(&normalTexture[pixelIndex], ray.direction);
+		for (int i = 0; i < 3; i += 1) {
+			outputTexture[pixelIndex + i] += light.color[i] * nDotL;
+		}
+	}
+	void applyBaseColor(uint x, uint y) {
+		uint64 pixelIndex = (static_cast<uint64>(y) * width + x) * 3;
+		for (int i = 0; i < 3; i += 1) {
+			outputTexture[pixelIndex + i] *= baseColorTexture[pixelIndex + i];
+		}
+	}
+	uint64 directLightRay(uint x, uint y) {
+		uint64 pixelIndex = (static_cast<uint64>(y) * width + x) * 3;
+		outputTexture[pixelIndex] = outputTexture[pixelIndex + 1] = outputTexture[pixelIndex + 2] = 0;
+		uint64 shadowRayCount = 0;
+		for (auto& light : lights) {
+			Ray ray;
+			if (shadowRay(x, y, light, ray)) {
+				shadowRayCount += 1;
+				if (!sceneBVH.occluded(ray, ray.tMax)) {
+					addLight(x, y, light, ray);
+				}
+			}
+		}
+		applyBaseColor(x, y);
+		return shadowRayCount;
+	}
+	// directLightRay for the pixels [x0, x1) x [y0, y1) of at most 8 x 8, the block's shadow rays to each light go to
+	// SceneBVH::occluded as one batch
+	uint64 directLightRayPacket(uint x0, uint y0, uint x1, uint y1) {
+		for (uint y = y0; y < y1; y += 1) {
+			uint64 pixelIndex = (static_cast<uint64>(y) * width + x0) * 3;
+			std::fill(&outputTexture[pixelIndex], &outputTexture[pixelIndex] + (x1 - x0) * 3, 0.0f);
+		}
+		uint64 shadowRayCount = 0;
+		for (auto& light : lights) {
+			Ray rays[RayPacket::maxRayCount];
+			uint32 pixels[RayPacket::maxRayCount][2];
+			uint32 rayCount = 0;
+			for (uint y = y0; y < y1; y += 1) {
+				for (uint x = x0; x < x1; x += 1) {
+					if (shadowRay(x, y, light, rays[rayCount])) {
+						pixels[rayCount][0] = x;
+						pixels[rayCount][1] = y;
+						rayCount += 1;
+					}
+				}
+			}
+			bool occluded[RayPacket::maxRayCount];
+			sceneBVH.occluded(rays, rayCount, occluded);
+			for (uint32 i = 0; i < rayCount; i += 1) {
+				if (!occluded[i]) {
+					addLight(pixels[i][0], pixels[i][1], light, rays[i]);
+				}
+			}
+			shadowRayCount += rayCount;
+		}
+		for (uint y = y0; y < y1; y += 1) {
+			for (uint x = x0; x < x1; x += 1) {
+				applyBaseColor(x, y);
+			}
+		}
+		return shadowRayCount;
+	}
+	// runs trace with the traversal counters on when traversalStats is set and spreads what it counted evenly over the
+	// pixels [x0, x1) x [y0, y1), a packet can't tell which of its rays a node was visited for
+	template <typename Trace>
+	void countTraversal(uint x0, uint y0, uint x1, uint y1, BVHTraversalStats& tileStats, Trace&& trace) {
+		if (!traversalStats) {
+			trace();
+			return;
+		}
+		BVHTraversalStats stats;
+		bvhTraversalStats = &stats;
+		trace();
+		bvhTraversalStats = nullptr;
+		float pixelCount = static_cast<float>((x1 - x0) * (y1 - y0));
+		for (uint y = y0; y < y1; y += 1) {
+			for (uint x = x0; x < x1; x += 1) {
+				nodesVisitedTexture[static_cast<uint64>(y) * width + x] += stats.nodesVisited / pixelCount;
+				primsTestedTexture[static_cast<uint64>(y) * width + x] += stats.primsTested / pixelCount;
+			}
+		}
+		tileStats.add(stats);
+	}
+	void render(uint renderWidth, uint renderHeight) {
+		auto startTime = std::chrono::high_resolution_clock::now();
+		width = renderWidth;
+		height = renderHeight;
+		uint64 pixelCount = static_cast<uint64>(width) * height;
+		positionTexture.resize(pixelCount * 3);
+		normalTexture.resize(pixelCount * 3);
+		baseColorTexture.resize(pixelCount * 3);
+		emissiveTexture.resize(pixelCount * 3);
+		outputTexture.resize(pixelCount * 3);
+		nodesVisitedTexture.assign(traversalStats ? pixelCount : 0, 0.0f);
+		primsTestedTexture.assign(traversalStats ? pixelCount : 0, 0.0f);
+		traversalStatsTotal = {};
+		std::mutex traversalStatsMutex;
+
+		camera.updateMatrices(static_cast<float>(width) / height);
+		pixelSpreadAngle = camera.pixelSpreadAngle(static_cast<float>(height));
+		DirectX::XMMATRIX screenToWorldMat = DirectX::XMMatrixInverse(nullptr, camera.viewProjMat);
+		uint tileCountX = (width + tileSize - 1) / tileSize;
+		uint tileCountY = (height + tileSize - 1) / tileSize;
+		std::atomic<uint64> shadowRayCount = 0;
+		threadPool.parallelFor(static_cast<uint64>(tileCountX) * tileCountY, [&](uint64 tileIndex) {
+			uint x0 = static_cast<uint>(tileIndex % tileCountX) * tileSize;
+			uint y0 = static_cast<uint>(tileIndex / tileCountX) * tileSize;
+			uint x1 = std::min(x0 + tileSize, width);
+			uint y1 = std::min(y0 + tileSize, height);
+			uint64 tileShadowRayCount = 0;
+			BVHTraversalStats tileStats;
+			if (rayPackets) {
+				for (uint y = y0; y < y1; y += 8) {
+					for (uint x = x0; x < x1; x += 8) {
+						uint xEnd = std::min(x + 8, x1);
+						uint yEnd = std::min(y + 8, y1);
+						countTraversal(x, y, xEnd, yEnd, tileStats, [&] { primaryRayPacket(x, y, xEnd, yEnd, screenToWorldMat); });
+					}
+				}
+			}
+			else {
+				for (uint y = y0; y < y1; y += 1) {
+					for (uint x = x0; x < x1; x += 1) {
+						countTraversal(x, y, x + 1, y + 1, tileStats, [&] { primaryRay(x, y, screenToWorldMat); });
+					}
+				}
+			}
+			if (rayPackets) {
+				for (uint y = y0; y < y1; y += 8) {
+					for (uint x = x0; x < x1; x += 8) {
+						uint xEnd = std::min(x + 8, x1);
+						uint yEnd = std::min(y + 8, y1);
+						countTraversal(x, y, xEnd, yEnd, tileStats, [&] { tileShadowRayCount += directLightRayPacket(x, y, xEnd, yEnd); });
+					}
+				}
+			}
+			else {
+				for (uint y = y0; y < y1; y += 1) {
+					for (uint x = x0; x < x1; x += 1) {
+						countTraversal(x, y, x + 1, y + 1, tileStats, [&] { tileShadowRayCount += directLightRay(x, y); });
+					}
+				}
+			}
+			shadowRayCount += tileShadowRayCount;
+			if (traversalStats) {
+				std::lock_guard<std::mutex> lock(traversalStatsMutex);
+				traversalStatsTotal.add(tileStats);
+			}
+		});
+		bounceRayCount = 0;
+		bounceTime = 0;
+		if (bounceSampleCount > 0) {
+			traceBounces();
+		}
+		rayCount = pixelCount + shadowRayCount + bounceRayCount;
+		renderTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	}
+	// adds bounceSampleCount cosine weighted bounces per pixel to outputTexture, a bounce hit contributes its emissive
+	// plus its directLightRay terms, times the pixel's base color (the cosine and pdf of a diffuse bounce cancel)
+	void traceBounces() {
+		static constexpr uint bandHeight = 64;
+		static constexpr uint32 chunkSize = 1 << 12;
+		auto startTime = std::chrono::high_resolution_clock::now();
+		auto alphaTest = [this](uint32 instanceIndex, uint32 geometryIndex, uint32 primitiveIndex, const float* barycentrics) {
+			return anyHit(instanceIndex, geometryIndex, primitiveIndex, barycentrics);
+		};
+		float sampleWeight = 1.0f / bounceSampleCount;
+		std::vector<Ray> rays;
+		std::vector<uint64> rayPixels;
+		std::vector<SceneRayHit> hits;
+		std::vector<float> hitSurfaces;
+		std::vector<float> radiances;
+		std::vector<Ray> shadowRays;
+		std::vector<uint32> shadowRayHits;
+		for (uint y0 = 0; y0 < height; y0 += bandHeight) {
+			uint y1 = std::min(y0 + bandHeight, height);
+			rays.clear();
+			rayPixels.clear();
+			for (uint64 pixel = static_cast<uint64>(y0) * width; pixel < static_cast<uint64>(y1) * width; pixel += 1) {
+				const float* normal = &normalTexture[pixel * 3];
+				// primary miss
+				if (normal[0] == 0 && normal[1] == 0 && normal[2] == 0) {
+					continue;
+				}
+				for (uint sample = 0; sample < bounceSampleCount; sample += 1) {
+					uint32 rngState = hashUint32(static_cast<uint32>(pixel) ^ hashUint32(sample));
+					float u0 = hashUniform(rngState);
+					float u1 = hashUniform(rngState);
+					Ray ray;
+					std::copy_n(&positionTexture[pixel * 3], 3, ray.origin);
+					cosineHemisphereSample(normal, u0, u1, ray.direction);
+					ray.tMin = 0.001f;
+					ray.tMax = 500;
+					rays.push_back(ray);
+					rayPixels.push_back(pixel);
+				}
+			}
+			uint32 streamRayCount = static_cast<uint32>(rays.size());
+			hits.resize(streamRayCount);
+			std::unique_ptr<bool[]> found(new bool[streamRayCount]);
+			sceneBVH.traceStream(rays.data(), streamRayCount, reorderBounceRays, rayPackets, hits.data(), found.get(), alphaTest);
+
+			// position, normal facing the bounce ray, color, emissive of each hit
+			hitSurfaces.assign(static_cast<uint64>(streamRayCount) * 12, 0.0f);
+			radiances.assign(static_cast<uint64>(streamRayCount) * 3, 0.0f);
+			threadPool.parallelFor((streamRayCount + chunkSize - 1) / chunkSize, [&](uint64 chunk) {
+				for (uint32 i = static_cast<uint32>(chunk) * chunkSize; i < std::min(static_cast<uint32>(chunk + 1) * chunkSize, streamRayCount); i += 1) {
+					if (found[i]) {
+						float* surface = &hitSurfaces[i * 12ull];
+						// bounce rays don't track a cone, they read mip 0
+						surfaceAttributes(rays[i], hits[i], 0, surface, surface + 3, surface + 6, surface + 9);
+						if (dotProduct(surface + 3, rays[i].direction) > 0) {
+							for (int j = 3; j < 6; j += 1) {
+								surface[j] = -surface[j];
+							}
+						}
+						std::copy_n(surface + 9, 3, &radiances[i * 3ull]);
+					}
+				}
+			});
+			uint64 shadowRayCount = 0;
+			for (auto& light : lights) {
+				shadowRays.clear();
+				shadowRayHits.clear();
+				for (uint32 i = 0; i < streamRayCount; i += 1) {
+					Ray ray;
+					if (found[i] && shadowRay(&hitSurfaces[i * 12ull], &hitSurfaces[i * 12ull + 3], light, ray)) {
+						shadowRays.push_back(ray);
+						shadowRayHits.push_back(i);
+					}
+				}
+				uint32 lightRayCount = static_cast<uint32>(shadowRays.size());
+				std::unique_ptr<bool[]> occluded(new bool[lightRayCount]);
+				sceneBVH.occludedStream(shadowRays.data(), lightRayCount, reorderBounceRays, rayPackets, occluded.get(), alphaTest);
+				for (uint32 i = 0; i < lightRayCount; i += 1) {
+					const float* surface = &hitSurfaces[shadowRayHits[i] * 12ull];
+					float nDotL = dotProduct(surface + 3, shadowRays[i].direction);
+					if (!occluded[i] && nDotL > 0) {
+						for (int j = 0; j < 3; j += 1) {
+							radiances[shadowRayHits[i] * 3ull + j] += surface[6 + j] * light.color[j] * nDotL;
+						}
+					}
+				}
+				shadowRayCount += lightRayCount;
+			}
+			for (uint32 i = 0; i < streamRayCount; i += 1) {
+				for (int j = 0; j < 3; j += 1) {
+					outputTexture[rayPixels[i] * 3 + j] += baseColorTexture[rayPixels[i] * 3 + j] * radiances[i * 3ull + j] * sampleWeight;
+				}
+			}
+			bounceRayCount += streamRayCount + shadowRayCount;
+		}
+		bounceTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	}
+	// .hdr keeps the linear outputTexture, anything else is written as an 8 bit png with the swap chain's linearToSRGB
+	void writeOutput(const std::filesystem::path& path) const {
+		int success = 0;
+		if (path.extension() == ".hdr") {
+			success = stbi_write_hdr(path.string().c_str(), width, height, 3, outputTexture.data());
+		}
+		else {
+			std::vector<uint8> pixels(outputTexture.size());
+			for (uint64 i = 0; i < pixels.size(); i += 1) {
+				pixels[i] = static_cast<uint8>(linearToSRGB(outputTexture[i]) * 255.0f + 0.5f);
+			}
+			success = stbi_write_png(path.string().c_str(), width, height, 3, pixels.data(), width * 3);
+		}
+		if (!success) {
+			throw Exception("CPURenderer::writeOutput error: cannot write \"" + path.string() + "\"");
+		}
+	}
+	// png of nodesVisitedTexture or primsTestedTexture, black to red to yellow to white from 0 to the texture's maximum
+	void writeTraversalHeatMap(const std::filesystem::path& path, const std::vector<float>& texture) const {
+		assert(texture.size() == static_cast<uint64>(width) * height);
+		float maxValue = texture.empty() ? 0.0f : *std::max_element(texture.begin(), texture.end());
+		float scale = maxValue > 0 ? 3.0f / maxValue : 0.0f;
+		std::vector<uint8> pixels(texture.size() * 3);
+		for (uint64 i = 0; i < texture.size(); i += 1) {
+			for (int channel = 0; channel < 3; channel += 1) {
+				float value = std::min(std::max(texture[i] * scale - channel, 0.0f), 1.0f);
+				pixels[i * 3 + channel] = static_cast<uint8>(value * 255.0f + 0.5f);
+			}
+		}
+		if (!stbi_write_png(path.string().c_str(), width, height, 3, pixels.data(), width * 3)) {
+			throw Exception("CPURenderer::writeTraversalHeatMap error: cannot write \"" + path.string() + "\"");
+		}
+	}
+};
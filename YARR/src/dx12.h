@@ -398,11 +398,11 @@ struct DX12Context {
 			descriptorRange[1].NumDescriptors = 4;
 			descriptorRange[2].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
 			descriptorRange[2].OffsetInDescriptorsFromTableStart = 5;
-			descriptorRange[2].NumDescriptors = 5;
+			descriptorRange[2].NumDescriptors = 6;
 			descriptorRange[3].RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-			descriptorRange[3].OffsetInDescriptorsFromTableStart = 10;
+			descriptorRange[3].OffsetInDescriptorsFromTableStart = 11;
 			descriptorRange[3].NumDescriptors = UINT_MAX;
-			descriptorRange[3].BaseShaderRegister = 5;
+			descriptorRange[3].BaseShaderRegister = 6;
 
 			D3D12_ROOT_PARAMETER rootParams[1] = {};
 			rootParams[0].ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
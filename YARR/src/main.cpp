@@ -9,6 +9,8 @@
 #include "../thirdparty/include/imgui/ImGuizmo.h"
 
 #include "scene.h"
+#include "cpuRenderer.h"
+#include "benchmark.h"
 #include "test.h"
 
 struct Gamepad {
@@ -56,6 +58,93 @@ static bool quit = false;
 static double frameTime = 0;
 static bool fullScreen = false;
 
+// the "trace" button of the metrics window: a CPURenderer run over scene as a threadPool job, which imguiCommands polls
+// instead of stalling the UI for the BVH builds and the render. lights and camera are copies taken when it starts, but
+// the job reads scene's models and instances, so it has to be joined before scenes are added or removed
+struct CPUTrace {
+	Scene* scene = nullptr;
+	std::vector<SceneLight> lights;
+	Camera camera;
+	uint width = 0;
+	uint height = 0;
+	// CPU BVH build and traversal stats, valid once the job finished without an error
+	bool statsValid = false;
+	BVH8Stats bvhStats;
+	std::vector<float> leafDepthHistogram;
+	BVHTraversalStats traversalStats;
+	uint64 rayCount = 0;
+	double renderTime = 0;
+	// kept from the last trace of scene, node transform edits made since then (changedInstances) are refit into its
+	// SceneBVH by CPURenderer::updateInstanceTransforms instead of building a new one
+	std::unique_ptr<CPURenderer> renderer;
+	std::vector<uint32> changedInstances;
+	// declared last so that destroying CPUTrace waits for the job before the rest goes away
+	ThreadPoolTaskGroup task = ThreadPoolTaskGroup(threadPool);
+
+	bool pending() const {
+		return task.pendingCount->load() > 0;
+	}
+	// waits for the job and drops the renderer, scenes being added or removed move or destroy the Scene it points into
+	void reset() {
+		task.join();
+		renderer = nullptr;
+		changedInstances.clear();
+	}
+	// instances of editedScene moved by Scene::setNodeTransforms, edits wait until no trace is pending
+	void instancesChanged(const Scene& editedScene, const std::vector<uint32>& instances) {
+		assert(!pending());
+		if (renderer && scene == &editedScene) {
+			changedInstances.insert(changedInstances.end(), instances.begin(), instances.end());
+		}
+	}
+	void start(Scene& traceScene, uint traceWidth, uint traceHeight) {
+		assert(!pending());
+		if (scene != &traceScene) {
+			renderer = nullptr;
+			changedInstances.clear();
+		}
+		scene = &traceScene;
+		lights = traceScene.lights;
+		camera = traceScene.camera;
+		width = traceWidth;
+		height = traceHeight;
+		statsValid = false;
+		task.run([this] {
+			if (renderer) {
+				std::sort(changedInstances.begin(), changedInstances.end());
+				changedInstances.erase(std::unique(changedInstances.begin(), changedInstances.end()), changedInstances.end());
+				renderer->updateInstanceTransforms(*scene, changedInstances);
+				renderer->lights = lights;
+				renderer->camera = camera;
+			}
+			else {
+				scene->buildModelMeshBVHs();
+			}
+			changedInstances.clear();
+			bvhStats = BVH8Stats();
+			for (auto& [modelName, model] : scene->models) {
+				for (auto& mesh : model.meshes) {
+					bvhStats.add(mesh.bvh.stats());
+				}
+			}
+			leafDepthHistogram.assign(bvhStats.leafDepthHistogram.begin(), bvhStats.leafDepthHistogram.end());
+			if (!renderer) {
+				renderer = std::make_unique<CPURenderer>(*scene, lights, camera);
+			}
+			renderer->traversalStats = true;
+			renderer->render(width, height);
+			renderer->writeTraversalHeatMap("bvhNodesVisited.png", renderer->nodesVisitedTexture);
+			renderer->writeTraversalHeatMap("bvhPrimsTested.png", renderer->primsTestedTexture);
+			traversalStats = renderer->traversalStatsTotal;
+			rayCount = renderer->rayCount;
+			renderTime = renderer->renderTime;
+			statsValid = true;
+		});
+	}
+};
+
+static CPUTrace cpuTrace;
+
 void imGuiInit() {
 	ImGui::CreateContext();
 	ImGuiIO& io = ImGui::GetIO();
@@ -241,9 +330,7 @@ void updateCamera() {
 			camera.position = DirectX::XMVectorAdd(camera.lookAt, v);
 		}
 	}
-	camera.viewMat = DirectX::XMMatrixLookAtRH(camera.position, camera.lookAt, camera.up);
-	camera.projMat = DirectX::XMMatrixPerspectiveFovRH(DirectX::XMConvertToRadians(45), static_cast<float>(window.width) / window.height, 1, 1000);
-	camera.viewProjMat = camera.viewMat * camera.projMat;
+	camera.updateMatrices(static_cast<float>(window.width) / window.height);
 }
 
 void updateFrameTime() {
@@ -263,7 +350,9 @@ void updateFrameTime() {
 	frameTime = static_cast<double>(ticks) / static_cast<double>(perfFrequency.QuadPart);
 }
 
+// textures are block compressed (and cached in textureCache) unless YARR.exe runs with -noTextureCompression
 void addScene(const std::string& sceneName, const std::filesystem::path& sceneFilePath) {
+	cpuTrace.reset();
 	std::string name = sceneName;
 	int n = 0;
 	while (true) {
@@ -287,7 +376,9 @@ void addScene(const std::string& sceneName, const std::filesystem::path& sceneFi
 		scenes.push_back(std::move(scene));
 	}
 	else {
-		Scene scene(name, sceneFilePath, dx12);
+		ModelImportSettings importSettings;
+		importSettings.compressTextures = std::find(cmdLineArgs.begin(), cmdLineArgs.end(), L"-noTextureCompression") == cmdLineArgs.end();
+		Scene scene(name, sceneFilePath, &dx12, importSettings);
 		scene.rebuildTLAS(dx12);
 		scenes.push_back(std::move(scene));
 	}
@@ -399,6 +490,7 @@ void imguiCommands() {
 				sceneIndex += 1;
 			}
 			if (sceneTodelete != -1) {
+				cpuTrace.reset();
 				scenes[sceneTodelete].deleteGPUResources();
 				scenes.erase(scenes.begin() + sceneTodelete);
 			}
@@ -496,6 +588,62 @@ void imguiCommands() {
 					}
 					ImGui::EndTabItem();
 				}
+				if (ImGui::BeginTabItem("Models")) {
+					static std::string modelName;
+					static int nodeIndex = 0;
+					static ImGuizmo::OPERATION gizmoOperation = ImGuizmo::TRANSLATE;
+					if (ImGui::BeginCombo("models", modelName.c_str())) {
+						for (auto& [name, model] : scene.models) {
+							if (ImGui::Selectable(name.c_str(), name == modelName)) {
+								modelName = name;
+								nodeIndex = 0;
+							}
+						}
+						ImGui::EndCombo();
+					}
+					auto modelIter = scene.models.find(modelName);
+					if (modelIter != scene.models.end() && !modelIter->second.nodes.empty()) {
+						const Model& model = modelIter->second;
+						nodeIndex = std::min(nodeIndex, static_cast<int>(model.nodes.size()) - 1);
+						char str[16] = {};
+						std::to_chars(str, str + sizeof(str), nodeIndex);
+						if (ImGui::BeginCombo("nodes", str)) {
+							for (int i = 0; i < model.nodes.size(); i += 1) {
+								std::to_chars(str, str + sizeof(str), i);
+								if (ImGui::Selectable(str, i == nodeIndex)) {
+									nodeIndex = i;
+								}
+							}
+							ImGui::EndCombo();
+						}
+						ImGui::RadioButton("translate", reinterpret_cast<int*>(&gizmoOperation), ImGuizmo::TRANSLATE);
+						ImGui::SameLine();
+						ImGui::RadioButton("rotate", reinterpret_cast<int*>(&gizmoOperation), ImGuizmo::ROTATE);
+						ImGui::SameLine();
+						ImGui::RadioButton("scale", reinterpret_cast<int*>(&gizmoOperation), ImGuizmo::SCALE);
+						// the CPU trace job reads the scene's instances
+						if (cpuTrace.pending()) {
+							ImGui::TextUnformatted("editing resumes once the CPU trace is done");
+						}
+						else {
+							// the gizmo edits the node's world transform, world = parentWorld * local like Model::nodeWorldTransform
+							int parentIndex = model.nodes[nodeIndex].parentIndex;
+							DirectX::XMMATRIX parentTransform = parentIndex >= 0 ? model.nodeWorldTransform(parentIndex) : DirectX::XMMatrixIdentity();
+							DirectX::XMFLOAT4X4 imguizmoMat;
+							DirectX::XMStoreFloat4x4(&imguizmoMat, model.nodeWorldTransform(nodeIndex));
+							DirectX::XMFLOAT4X4 oldImguizmoMat = imguizmoMat;
+							ImGuizmo::Manipulate(imguizmoView.m[0], imguizmoProj.m[0], gizmoOperation, ImGuizmo::LOCAL, imguizmoMat.m[0]);
+							if (memcmp(&imguizmoMat, &oldImguizmoMat, sizeof(imguizmoMat)) != 0) {
+								DirectX::XMMATRIX transform = DirectX::XMMatrixMultiply(DirectX::XMMatrixInverse(nullptr, parentTransform), DirectX::XMLoadFloat4x4(&imguizmoMat));
+								// transform only edit: the TLAS is refit in place instead of rebuilt with rebuildTLAS
+								std::vector<uint32> changedInstances = scene.setNodeTransforms({ SceneNodeTransform{ modelName, nodeIndex, transform } });
+								scene.updateTLAS(dx12, changedInstances);
+								cpuTrace.instancesChanged(scene, changedInstances);
+							}
+						}
+					}
+					ImGui::EndTabItem();
+				}
 			}
 			ImGui::EndTabBar();
 		}
@@ -531,6 +679,18 @@ void imguiCommands() {
 		metricsWindow.frameTimes.push(frameTime);
 		metricsWindow.frameTimeStr = std::to_string(frameTime * 1000) + " ms";
 	}
+	// reports an error of the last trace job once it's done, an Exception has already logged its message
+	if (!cpuTrace.pending()) {
+		try {
+			cpuTrace.task.wait();
+		}
+		catch (const std::exception& e) {
+			logWindow.addError(e.what());
+		}
+		catch (...) {
+			logWindow.addError("CPU BVH trace failed");
+		}
+	}
 	if (ImGui::Begin("Metrics", &metricsWindow.open)) {
 		ImGui::PlotLines(
 			metricsWindow.frameTimeStr.c_str(),
@@ -539,6 +699,25 @@ void imguiCommands() {
 				return static_cast<float>((*frameTimes)[idx] * 1000);
 			},
 			&metricsWindow.frameTimes, static_cast<int>(metricsWindow.frameTimes.size()), 0, nullptr, 0, 100);
+		if (ImGui::CollapsingHeader("CPU BVH") && currentSceneIndex < scenes.size()) {
+			if (cpuTrace.pending()) {
+				ImGui::TextUnformatted("tracing...");
+			}
+			else if (ImGui::Button("trace")) {
+				cpuTrace.start(scenes[currentSceneIndex], window.width, window.height);
+			}
+			ImGui::SameLine();
+			ImGui::TextUnformatted("renders the scene with CPURenderer, heat maps go to bvhNodesVisited.png and bvhPrimsTested.png");
+			if (!cpuTrace.pending() && cpuTrace.statsValid) {
+				const BVH8Stats& stats = cpuTrace.bvhStats;
+				ImGui::Text("%llu triangles, %llu interior nodes, %llu leaves", static_cast<unsigned long long>(stats.primCount), static_cast<unsigned long long>(stats.interiorNodeCount), static_cast<unsigned long long>(stats.leafCount));
+				ImGui::Text("%.2f triangles per leaf, max depth %u, SAH cost %.2f", stats.averageLeafSize(), stats.maxDepth(), stats.sahCost);
+				ImGui::PlotHistogram("leaves per depth", cpuTrace.leafDepthHistogram.data(), static_cast<int>(cpuTrace.leafDepthHistogram.size()), 0, nullptr, 0, FLT_MAX, ImVec2(0, 60));
+				uint64 rayCount = std::max<uint64>(cpuTrace.rayCount, 1);
+				ImGui::Text("%.2f nodes visited, %.2f triangles tested per ray", static_cast<double>(cpuTrace.traversalStats.nodesVisited) / rayCount, static_cast<double>(cpuTrace.traversalStats.primsTested) / rayCount);
+				ImGui::Text("%llu rays in %.2f ms", static_cast<unsigned long long>(cpuTrace.rayCount), cpuTrace.renderTime * 1000);
+			}
+		}
 	}
 	ImGui::End();
 
@@ -562,12 +741,14 @@ void graphicsCommands() {
 				int sampleCount;
 				int frameCount;
 				int lightCount;
+				float pixelSpreadAngle;
 			} constants = {
 					DirectX::XMMatrixTranspose(DirectX::XMMatrixInverse(nullptr, scene.camera.viewProjMat)),
 					scene.camera.position,
 					2, 16,
 					static_cast<int>(dx12.totalFrame % INT_MAX),
-					static_cast<int>(scene.lights.size())
+					static_cast<int>(scene.lights.size()),
+					scene.camera.pixelSpreadAngle(static_cast<float>(dx12.renderResolutionY))
 			};
 			uint64 constantsOffset = dx12.appendFrameDataBuffer(&constants, sizeof(constants), D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT);
 			uint64 lightsOffset = dx12.appendFrameDataBuffer(scene.lights.data(), scene.lights.size() * sizeof(scene.lights[0]), sizeof(scene.lights[0])) / sizeof(scene.lights[0]);
@@ -580,7 +761,8 @@ void graphicsCommands() {
 				dx12.appendDescriptorSRVTLAS(scene.tlasBuffer.buffer);
 				dx12.appendDescriptorSRVStructuredBuffer(scene.instanceInfosBuffer.buffer, 0, scene.instanceInfoCount, sizeof(InstanceInfo));
 				dx12.appendDescriptorSRVStructuredBuffer(scene.geometryInfosBuffer.buffer, 0, scene.geometryInfoCount, sizeof(GeometryInfo));
-				dx12.appendDescriptorSRVStructuredBuffer(scene.triangleInfosBuffer.buffer, 0, scene.triangleInfoCount, sizeof(TriangleInfo));
+				dx12.appendDescriptorSRVStructuredBuffer(scene.triangleIndicesBuffer.buffer, 0, scene.triangleIndicesCount, sizeof(TriangleIndices));
+				dx12.appendDescriptorSRVStructuredBuffer(scene.vertexInfosBuffer.buffer, 0, scene.vertexInfoCount, sizeof(SceneVertexInfo));
 				dx12.appendDescriptorSRVStructuredBuffer(scene.materialInfosBuffer.buffer, 0, scene.materialInfoCount, sizeof(MaterialInfo));
 				for (auto& [name, model] : scene.models) {
 					for (auto& texture : model.textures) {
@@ -824,9 +1006,116 @@ void saveSettings() {
 	writeFile(settingsFilePath, settingsFileStr);
 }
 
+// value of "-name <value>" on the command line, or defaultValue when it is not present
+uint cmdLineArgUint(const wchar_t* name, uint defaultValue) {
+	auto arg = std::find(cmdLineArgs.begin(), cmdLineArgs.end(), name);
+	if (arg == cmdLineArgs.end() || arg + 1 == cmdLineArgs.end()) {
+		return defaultValue;
+	}
+	return static_cast<uint>(std::stoul(*(arg + 1)));
+}
+
+bool cmdLineArgFlag(const wchar_t* name) {
+	return std::find(cmdLineArgs.begin(), cmdLineArgs.end(), name) != cmdLineArgs.end();
+}
+
+// YARR.exe -cpuRender <scene file> <output file> [width height] [-bvhBinCount n] [-bvhMaxLeafSize n] [-lbvh | -sbvh] [-bvhMortonCodeBits 30|63] [-bvhTreelets] [-bvhQuantized] [-noRayPackets] [-noBVHCache] [-traversalStats] [-bounceSamples n] [-noRayReorder] [-splitPrimitives n]
+// renders the scene with CPURenderer without creating a window or a DX12 device. -traversalStats logs the traversal work
+// per ray and writes its heat maps next to the output file as <output>.nodes.png and <output>.prims.png.
+// -bounceSamples adds n diffuse bounces per pixel, traced as ray streams sorted by rayStreamOrder unless -noRayReorder.
+// -splitPrimitives cuts primitives of more than n triangles into spatial clusters at import, see splitModelPrimitive
+void cpuRender() {
+	auto arg = std::find(cmdLineArgs.begin(), cmdLineArgs.end(), L"-cpuRender");
+	uint64 argIndex = arg - cmdLineArgs.begin();
+	if (argIndex + 2 >= cmdLineArgs.size()) {
+		throw Exception("-cpuRender error: expected -cpuRender <scene file> <output file> [width height]");
+	}
+	std::filesystem::path sceneFilePath = std::filesystem::absolute(cmdLineArgs[argIndex + 1]);
+	std::filesystem::path outputFilePath = std::filesystem::absolute(cmdLineArgs[argIndex + 2]);
+	uint width = 1920;
+	uint height = 1080;
+	if (argIndex + 4 < cmdLineArgs.size() && cmdLineArgs[argIndex + 3][0] != L'-') {
+		width = static_cast<uint>(std::stoi(cmdLineArgs[argIndex + 3]));
+		height = static_cast<uint>(std::stoi(cmdLineArgs[argIndex + 4]));
+	}
+	BVHBuildSettings bvhBuildSettings;
+	bvhBuildSettings.binCount = std::min(std::max(cmdLineArgUint(L"-bvhBinCount", bvhBuildSettings.binCount), 2u), BVHBuildSettings::maxBinCount);
+	bvhBuildSettings.maxLeafSize = std::max(cmdLineArgUint(L"-bvhMaxLeafSize", bvhBuildSettings.maxLeafSize), 1u);
+	bvhBuildSettings.builder = cmdLineArgFlag(L"-lbvh") ? BVHBuildSettings::LBVH : (cmdLineArgFlag(L"-sbvh") ? BVHBuildSettings::SBVH : BVHBuildSettings::BinnedSAH);
+	bvhBuildSettings.mortonCodeBits = cmdLineArgUint(L"-bvhMortonCodeBits", bvhBuildSettings.mortonCodeBits) > 30 ? 63 : 30;
+	bvhBuildSettings.treeletOptimization = cmdLineArgFlag(L"-bvhTreelets");
+	bvhBuildSettings.quantizedNodes = cmdLineArgFlag(L"-bvhQuantized");
+	auto sceneStartTime = std::chrono::high_resolution_clock::now();
+	ModelImportSettings importSettings;
+	importSettings.maxPrimitiveTriangleCount = cmdLineArgUint(L"-splitPrimitives", 0);
+	Scene scene("cpuRender", sceneFilePath, nullptr, importSettings);
+	double sceneTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - sceneStartTime).count();
+	for (auto& [modelName, model] : scene.models) {
+		model.bvhBuildSettings = bvhBuildSettings;
+	}
+	auto bvhStartTime = std::chrono::high_resolution_clock::now();
+	scene.buildModelMeshBVHs(cmdLineArgFlag(L"-noBVHCache") ? std::filesystem::path() : std::filesystem::path("bvhCache"));
+	double bvhTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - bvhStartTime).count();
+	char str[256];
+	snprintf(str, sizeof(str), "cpuRender: %llu models loaded in %.2f ms\n", static_cast<unsigned long long>(scene.models.size()), sceneTime * 1000);
+	OutputDebugStringA(str);
+	snprintf(str, sizeof(str), "cpuRender: model BVHs ready in %.2f ms\n", bvhTime * 1000);
+	OutputDebugStringA(str);
+	BVH8Stats bvhStats;
+	for (auto& [modelName, model] : scene.models) {
+		for (auto& mesh : model.meshes) {
+			bvhStats.add(mesh.bvh.stats());
+			snprintf(str, sizeof(str), "cpuRender: model \"%s\" mesh \"%s\", %llu triangles, %llu %sBVH8 nodes, SAH cost %.2f\n", modelName.c_str(), mesh.name.c_str(), static_cast<unsigned long long>(mesh.bvh.triangles.size()), static_cast<unsigned long long>(mesh.bvh.nodeCount()), mesh.bvh.quantizedBVH.nodes.empty() ? "" : "quantized ", mesh.bvh.sahCost);
+			OutputDebugStringA(str);
+		}
+	}
+	snprintf(str, sizeof(str), "cpuRender: model BVHs, %llu triangles, %llu interior nodes, %llu leaves, %.2f triangles per leaf, max depth %u, SAH cost %.2f\n", static_cast<unsigned long long>(bvhStats.primCount), static_cast<unsigned long long>(bvhStats.interiorNodeCount), static_cast<unsigned long long>(bvhStats.leafCount), bvhStats.averageLeafSize(), bvhStats.maxDepth(), bvhStats.sahCost);
+	OutputDebugStringA(str);
+	std::string leafDepthStr = "cpuRender: leaves per depth";
+	for (uint64 leafCount : bvhStats.leafDepthHistogram) {
+		leafDepthStr += " " + std::to_string(leafCount);
+	}
+	OutputDebugStringA((leafDepthStr + "\n").c_str());
+	CPURenderer renderer(scene, bvhBuildSettings);
+	renderer.rayPackets = !cmdLineArgFlag(L"-noRayPackets");
+	renderer.traversalStats = cmdLineArgFlag(L"-traversalStats");
+	renderer.bounceSampleCount = cmdLineArgUint(L"-bounceSamples", 0);
+	renderer.reorderBounceRays = !cmdLineArgFlag(L"-noRayReorder");
+	renderer.render(width, height);
+	renderer.writeOutput(outputFilePath);
+	snprintf(str, sizeof(str), "cpuRender: %llu instances, %u x %u, %u threads, %s rays, %.2f ms, %.2f Mrays/s\n", static_cast<unsigned long long>(renderer.sceneBVH.instances.size()), width, height, threadPool.threadCount() + 1, renderer.rayPackets ? "8x8 packet" : "single", renderer.renderTime * 1000, renderer.rayCount / renderer.renderTime / 1000000);
+	OutputDebugStringA(str);
+	if (renderer.bounceSampleCount > 0) {
+		snprintf(str, sizeof(str), "cpuRender: %u bounce samples, %llu bounce and bounce shadow rays, %s, %.2f ms, %.2f Mrays/s\n", renderer.bounceSampleCount, static_cast<unsigned long long>(renderer.bounceRayCount), renderer.reorderBounceRays ? "reordered" : "not reordered", renderer.bounceTime * 1000, renderer.bounceRayCount / renderer.bounceTime / 1000000);
+		OutputDebugStringA(str);
+	}
+	if (renderer.traversalStats) {
+		// bounce rays are not counted
+		uint64 countedRayCount = renderer.rayCount - renderer.bounceRayCount;
+		snprintf(str, sizeof(str), "cpuRender: %.2f nodes visited and %.2f triangles tested per ray\n", static_cast<double>(renderer.traversalStatsTotal.nodesVisited) / countedRayCount, static_cast<double>(renderer.traversalStatsTotal.primsTested) / countedRayCount);
+		OutputDebugStringA(str);
+		renderer.writeTraversalHeatMap(std::filesystem::path(outputFilePath).concat(".nodes.png"), renderer.nodesVisitedTexture);
+		renderer.writeTraversalHeatMap(std::filesystem::path(outputFilePath).concat(".prims.png"), renderer.primsTestedTexture);
+	}
+}
+
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd) {
 	runTests();
 
+	if (std::find(cmdLineArgs.begin(), cmdLineArgs.end(), L"-cpuRender") != cmdLineArgs.end()) {
+		cpuRender();
+		return 0;
+	}
+	auto benchmarkArg = std::find(cmdLineArgs.begin(), cmdLineArgs.end(), L"-benchmark");
+	if (benchmarkArg != cmdLineArgs.end()) {
+		std::filesystem::path sceneFilePath;
+		if (benchmarkArg + 1 != cmdLineArgs.end()) {
+			sceneFilePath = std::filesystem::absolute(*(benchmarkArg + 1));
+		}
+		runBenchmarks(sceneFilePath);
+		return 0;
+	}
+
 	setCurrentDirToExeDir();
 	CoInitialize(nullptr);
 	imGuiInit();
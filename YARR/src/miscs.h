@@ -21,6 +21,7 @@
 #define _XM_SSE4_INTRINSICS_
 #include <directxmath.h>
 #include <directxcolors.h>
+#include <directxpackedvector.h>
 
 #include <xinput.h>
 
@@ -29,6 +30,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <cmath>
 #include <algorithm>
 #include <vector>
@@ -36,6 +38,12 @@
 #include <stack>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <exception>
 #include <charconv>
 #include <fstream>
 #include <filesystem>
@@ -70,8 +78,66 @@ T align(uint64 x, uint64 n) {
 	}
 }
 
+uint32 countTrailingZeros(uint32 x) {
+	assert(x != 0);
+	unsigned long index;
+	_BitScanForward(&index, x);
+	return index;
+}
+
+uint32 countTrailingZeros(uint64 x) {
+	assert(x != 0);
+	unsigned long index;
+	_BitScanForward64(&index, x);
+	return index;
+}
+
+uint32 countLeadingZeros(uint64 x) {
+	assert(x != 0);
+	unsigned long index;
+	_BitScanReverse64(&index, x);
+	return 63 - index;
+}
+
+uint32 popCount(uint32 x) {
+	return __popcnt(x);
+}
+
+uint32 popCount(uint64 x) {
+	return static_cast<uint32>(__popcnt64(x));
+}
+
+// 64 bit non cryptographic hash (xxHash64 structure) for content keys, hash several ranges by passing the previous
+// hash as seed
+uint64 hashBytes(const void* data, uint64 size, uint64 seed = 0) {
+	const uint64 prime1 = 0x9e3779b185ebca87ull;
+	const uint64 prime2 = 0xc2b2ae3d27d4eb4full;
+	const uint64 prime3 = 0x165667b19e3779f9ull;
+	auto rotateLeft = [](uint64 x, int r) { return (x << r) | (x >> (64 - r)); };
+	const uint8* bytes = static_cast<const uint8*>(data);
+	uint64 lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+	uint64 i = 0;
+	for (; i + 32 <= size; i += 32) {
+		for (int lane = 0; lane < 4; lane += 1) {
+			uint64 word;
+			memcpy(&word, bytes + i + lane * 8, 8);
+			lanes[lane] = rotateLeft(lanes[lane] + word * prime2, 31) * prime1;
+		}
+	}
+	uint64 hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18) + size;
+	for (; i < size; i += 1) {
+		hash = rotateLeft(hash ^ (bytes[i] * prime1), 11) * prime2;
+	}
+	hash ^= hash >> 33;
+	hash *= prime2;
+	hash ^= hash >> 29;
+	hash *= prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
 template<typename T, int N>
-void arrayCopy(T(&dest)[N], T(&src)[N]) {
+void arrayCopy(T(&dest)[N], const T(&src)[N]) {
 	for (int i = 0; i < N; i += 1) {
 		dest[i] = src[i];
 	}
@@ -184,6 +250,24 @@ void matFromRotation(const float* rotation, float* mat) {
 	mat[15] = 1;
 }
 
+// MSVC accepts AVX2/FMA intrinsics without /arch:AVX2, so SIMD code paths are all compiled and picked with this at runtime
+static const bool cpuSupportsAVX2 = [] {
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	bool fma = info[2] & (1 << 12);
+	bool osxsave = info[2] & (1 << 27);
+	bool avx = info[2] & (1 << 28);
+	if (!fma || !osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}();
+
 struct Exception {
 	Exception(const char* str) {
 		OutputDebugStringA(str);
@@ -264,6 +348,212 @@ struct RingBuffer {
 	}
 };
 
+// read only view of count elements owned elsewhere (a std::vector, a FileMapping ...)
+template <typename T>
+struct ArrayView {
+	const T* elements = nullptr;
+	uint64 count = 0;
+
+	ArrayView() = default;
+	ArrayView(const T* elements, uint64 count) : elements(elements), count(count) {}
+	ArrayView(const std::vector<T>& vector) : elements(vector.data()), count(vector.size()) {}
+	const T& operator[](uint64 index) const {
+		assert(index < count);
+		return elements[index];
+	}
+	const T* data() const {
+		return elements;
+	}
+	uint64 size() const {
+		return count;
+	}
+	bool empty() const {
+		return count == 0;
+	}
+	const T* begin() const {
+		return elements;
+	}
+	const T* end() const {
+		return elements + count;
+	}
+};
+
+struct ThreadPool {
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stop = false;
+
+	ThreadPool(uint threadCount = std::max(std::thread::hardware_concurrency(), 1u)) {
+		threads.reserve(threadCount);
+		for (uint i = 0; i < threadCount; i += 1) {
+			threads.emplace_back([this] {
+				while (true) {
+					std::function<void()> job;
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						condition.wait(lock, [this] { return stop || !jobs.empty(); });
+						if (stop && jobs.empty()) {
+							return;
+						}
+						job = std::move(jobs.front());
+						jobs.pop_front();
+					}
+					job();
+				}
+			});
+		}
+	}
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		condition.notify_all();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+	}
+	uint threadCount() const {
+		return static_cast<uint>(threads.size());
+	}
+	void push(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		condition.notify_one();
+	}
+	bool runOneJob() {
+		std::function<void()> job;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (jobs.empty()) {
+				return false;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+		return true;
+	}
+	// calls func(i) for every i in [0, count), the calling thread takes part in the work,
+	// so nested parallelFor calls from inside a job cannot deadlock the pool.
+	// The first exception thrown by func stops the indices not started yet, and is rethrown here once the ones
+	// already running are done, so no job is left calling func after parallelFor returns
+	template <typename F>
+	void parallelFor(uint64 count, F&& func) {
+		if (count == 0) {
+			return;
+		}
+		struct State {
+			std::atomic<uint64> next = 0;
+			std::atomic<uint64> finished = 0;
+			std::mutex errorMutex;
+			std::exception_ptr error;
+		};
+		std::shared_ptr<State> state = std::make_shared<State>();
+		auto work = [state, count, &func] {
+			uint64 finished = 0;
+			for (uint64 i = state->next.fetch_add(1); i < count; i = state->next.fetch_add(1)) {
+				try {
+					func(i);
+				}
+				catch (...) {
+					{
+						std::lock_guard<std::mutex> lock(state->errorMutex);
+						if (!state->error) {
+							state->error = std::current_exception();
+						}
+					}
+					// the indices nobody took yet count as finished, later fetch_adds all land past count
+					uint64 next = state->next.exchange(count);
+					if (next < count) {
+						finished += count - next;
+					}
+				}
+				finished += 1;
+			}
+			state->finished.fetch_add(finished);
+		};
+		uint64 helperCount = std::min<uint64>(threads.size(), count - 1);
+		for (uint64 i = 0; i < helperCount; i += 1) {
+			push(work);
+		}
+		work();
+		while (state->finished.load() < count) {
+			if (!runOneJob()) {
+				std::this_thread::yield();
+			}
+		}
+		if (state->error) {
+			std::rethrow_exception(state->error);
+		}
+	}
+};
+
+// jobs started through a task group can be waited on together, wait() runs queued jobs instead of blocking,
+// so a job may start and wait on its own task group (recursive fork/join) without starving the pool.
+// A job that throws still counts as done, the first exception is rethrown by wait(). The destructor only joins, so
+// a group unwound by an exception of its own thread still outlives the jobs referencing that thread's locals
+struct ThreadPoolTaskGroup {
+	struct Error {
+		std::mutex mutex;
+		std::exception_ptr exception;
+	};
+
+	ThreadPool& pool;
+	std::shared_ptr<std::atomic<uint64>> pendingCount = std::make_shared<std::atomic<uint64>>(0);
+	std::shared_ptr<Error> error = std::make_shared<Error>();
+
+	ThreadPoolTaskGroup(ThreadPool& threadPool) : pool(threadPool) {}
+	~ThreadPoolTaskGroup() {
+		join();
+	}
+	template <typename F>
+	void run(F&& func) {
+		pendingCount->fetch_add(1);
+		pool.push([pendingCount = pendingCount, error = error, func = std::forward<F>(func)]() mutable {
+			struct PendingDecrement {
+				std::atomic<uint64>& pendingCount;
+				~PendingDecrement() {
+					pendingCount.fetch_sub(1);
+				}
+			} pendingDecrement = { *pendingCount };
+			try {
+				func();
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(error->mutex);
+				if (!error->exception) {
+					error->exception = std::current_exception();
+				}
+			}
+		});
+	}
+	void join() {
+		while (pendingCount->load() > 0) {
+			if (!pool.runOneJob()) {
+				std::this_thread::yield();
+			}
+		}
+	}
+	void wait() {
+		join();
+		std::exception_ptr exception;
+		{
+			std::lock_guard<std::mutex> lock(error->mutex);
+			std::swap(exception, error->exception);
+		}
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+	}
+};
+
+static ThreadPool threadPool;
+
 struct Window {
 	HWND handle = nullptr;
 	int width = 0;
@@ -400,6 +690,56 @@ void writeFile(const std::filesystem::path& filePath, const std::string& str) {
 	file << str;
 }
 
+// read only mapping of a whole file, data stays valid until the FileMapping is closed or destroyed
+struct FileMapping {
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	const uint8* data = nullptr;
+	uint64 size = 0;
+
+	FileMapping() = default;
+	FileMapping(const FileMapping&) = delete;
+	FileMapping& operator=(const FileMapping&) = delete;
+	~FileMapping() {
+		close();
+	}
+	// false if the file doesn't exist, is empty or can't be mapped
+	bool open(const std::filesystem::path& filePath) {
+		close();
+		file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER fileSize = {};
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+			close();
+			return false;
+		}
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping) {
+			data = static_cast<const uint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		}
+		if (!data) {
+			close();
+			return false;
+		}
+		size = static_cast<uint64>(fileSize.QuadPart);
+		return true;
+	}
+	void close() {
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+		file = INVALID_HANDLE_VALUE;
+		mapping = nullptr;
+		data = nullptr;
+		size = 0;
+	}
+};
+
 std::filesystem::path openFileDialog() {
 	std::filesystem::path filePath;
 	wchar_t buf[256] = {};
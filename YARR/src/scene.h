@@ -14,6 +14,8 @@
 #include "../thirdparty/include/tiny_obj_loader.h"
 
 #include "dx12.h"
+#include "bvh.h"
+#include "textureCompression.h"
 
 struct ModelVertex {
 	float position[3];
@@ -29,18 +31,318 @@ struct ModelPrimitive {
 	DX12Buffer indexBuffer;
 	int indexSize = 2;
 	int materialIndex = -1;
+	bool opaque = true;
+
+	uint32 getIndex(uint64 i) const {
+		if (indexSize == 2) {
+			return *reinterpret_cast<const uint16*>(&indices[i * 2]);
+		}
+		else {
+			return *reinterpret_cast<const uint32*>(&indices[i * 4]);
+		}
+	}
+	uint64 indexCount() const {
+		return indices.size() / indexSize;
+	}
+};
+
+// options of Scene's model import
+struct ModelImportSettings {
+	// primitives of more triangles are split into spatially compact parts of at most this many, see splitModelPrimitive.
+	// 0 keeps every primitive whole
+	uint32 maxPrimitiveTriangleCount = 0;
+	// block compress the textures of base color, normal and emissive images on their decode jobs, see
+	// compressModelImage. Encoded mip chains are cached in textureCacheDir (relative to the exe dir), empty for no cache
+	bool compressTextures = false;
+	std::filesystem::path textureCacheDir = "textureCache";
+};
+
+// primitive cut into primitives of at most maxTriangleCount triangles. Triangles are taken in the Morton order of their
+// centroids, so every part is a spatially compact cluster with bounds that overlap little, and each part only keeps the
+// vertices it references, with 16 bit indices when they fit
+std::vector<ModelPrimitive> splitModelPrimitive(const ModelPrimitive& primitive, uint32 maxTriangleCount) {
+	static constexpr uint32 chunkSize = 1 << 14;
+	uint64 triangleCount = primitive.indexCount() / 3;
+	assert(maxTriangleCount > 0 && triangleCount < UINT32_MAX);
+	uint32 chunkCount = static_cast<uint32>((triangleCount + chunkSize - 1) / chunkSize);
+	std::vector<float> centroids(triangleCount * 3);
+	std::vector<AABB> chunkBounds(chunkCount);
+	threadPool.parallelFor(chunkCount, [&](uint64 chunk) {
+		for (uint64 triangle = chunk * chunkSize; triangle < std::min((chunk + 1) * chunkSize, triangleCount); triangle += 1) {
+			float* centroid = &centroids[triangle * 3];
+			for (int i = 0; i < 3; i += 1) {
+				centroid[i] = (primitive.vertices[primitive.getIndex(triangle * 3)].position[i] + primitive.vertices[primitive.getIndex(triangle * 3 + 1)].position[i] + primitive.vertices[primitive.getIndex(triangle * 3 + 2)].position[i]) / 3.0f;
+			}
+			chunkBounds[chunk].extend(centroid);
+		}
+	});
+	AABB centroidBounds;
+	for (auto& bounds : chunkBounds) {
+		centroidBounds.extend(bounds);
+	}
+	float scales[3];
+	for (int axis = 0; axis < 3; axis += 1) {
+		float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+		scales[axis] = extent > 0 ? 1023.0f / extent : 0.0f;
+	}
+	std::vector<uint64> mortonCodes(triangleCount);
+	std::vector<uint32> order(triangleCount);
+	threadPool.parallelFor(chunkCount, [&](uint64 chunk) {
+		for (uint64 triangle = chunk * chunkSize; triangle < std::min((chunk + 1) * chunkSize, triangleCount); triangle += 1) {
+			uint64 code = 0;
+			for (int axis = 0; axis < 3; axis += 1) {
+				uint64 cell = static_cast<uint64>((centroids[triangle * 3 + axis] - centroidBounds.min[axis]) * scales[axis]);
+				code |= mortonExpandBits(std::min<uint64>(cell, 1023)) << (2 - axis);
+			}
+			mortonCodes[triangle] = code;
+			order[triangle] = static_cast<uint32>(triangle);
+		}
+	});
+	radixSortPairs(mortonCodes, order, 30, &threadPool);
+
+	std::vector<ModelPrimitive> parts((triangleCount + maxTriangleCount - 1) / maxTriangleCount);
+	threadPool.parallelFor(parts.size(), [&](uint64 partIndex) {
+		ModelPrimitive& part = parts[partIndex];
+		part.materialIndex = primitive.materialIndex;
+		part.opaque = primitive.opaque;
+		uint64 firstTriangle = partIndex * maxTriangleCount;
+		uint64 partIndexCount = (std::min(firstTriangle + maxTriangleCount, triangleCount) - firstTriangle) * 3;
+		std::vector<uint32> vertexIndices(partIndexCount);
+		for (uint64 i = 0; i < partIndexCount; i += 1) {
+			vertexIndices[i] = primitive.getIndex(order[firstTriangle + i / 3] * 3ull + i % 3);
+		}
+		std::vector<uint32> partVertices = vertexIndices;
+		std::sort(partVertices.begin(), partVertices.end());
+		partVertices.erase(std::unique(partVertices.begin(), partVertices.end()), partVertices.end());
+		part.vertices.resize(partVertices.size());
+		for (uint64 i = 0; i < partVertices.size(); i += 1) {
+			part.vertices[i] = primitive.vertices[partVertices[i]];
+		}
+		part.indexSize = partVertices.size() <= 65536 ? 2 : 4;
+		part.indices.resize(partIndexCount * part.indexSize);
+		for (uint64 i = 0; i < partIndexCount; i += 1) {
+			uint32 index = static_cast<uint32>(std::lower_bound(partVertices.begin(), partVertices.end(), vertexIndices[i]) - partVertices.begin());
+			if (part.indexSize == 2) {
+				uint16 shortIndex = static_cast<uint16>(index);
+				memcpy(&part.indices[i * 2], &shortIndex, 2);
+			}
+			else {
+				memcpy(&part.indices[i * 4], &index, 4);
+			}
+		}
+	});
+	return parts;
+}
+
+// per vertex tangents of a primitive without TANGENT, following MikkTSpace: every triangle's uv derived tangent is
+// projected onto the tangent plane of each corner's normal and summed with the corner angle as weight. Triangles with
+// degenerate uvs are skipped. MikkTSpace splits vertices shared by triangles of opposite uv orientation, vertices here
+// can't be split so they take the orientation with the larger weight. Vertices without any contribution get an
+// arbitrary tangent perpendicular to their normal
+void generateModelPrimitiveTangents(ModelPrimitive& primitive) {
+	static constexpr uint64 chunkSize = 1 << 14;
+	uint64 triangleCount = primitive.indexCount() / 3;
+	uint64 vertexCount = primitive.vertices.size();
+	assert(triangleCount * 3 < UINT32_MAX);
+	// uv derived tangent direction (dp/du) and uv orientation (+1, -1, or 0 when degenerate) of each triangle
+	struct TriangleTangent {
+		float tangent[3];
+		float orientation;
+	};
+	std::vector<TriangleTangent> triangleTangents(triangleCount);
+	threadPool.parallelFor((triangleCount + chunkSize - 1) / chunkSize, [&](uint64 chunk) {
+		for (uint64 triangle = chunk * chunkSize; triangle < std::min((chunk + 1) * chunkSize, triangleCount); triangle += 1) {
+			const ModelVertex& v0 = primitive.vertices[primitive.getIndex(triangle * 3)];
+			const ModelVertex& v1 = primitive.vertices[primitive.getIndex(triangle * 3 + 1)];
+			const ModelVertex& v2 = primitive.vertices[primitive.getIndex(triangle * 3 + 2)];
+			float s1[2] = { v1.uv[0] - v0.uv[0], v1.uv[1] - v0.uv[1] };
+			float s2[2] = { v2.uv[0] - v0.uv[0], v2.uv[1] - v0.uv[1] };
+			float signedArea = s1[0] * s2[1] - s1[1] * s2[0];
+			TriangleTangent& triangleTangent = triangleTangents[triangle];
+			triangleTangent.orientation = signedArea > 0 ? 1.0f : (signedArea < 0 ? -1.0f : 0.0f);
+			for (int i = 0; i < 3; i += 1) {
+				float d1 = v1.position[i] - v0.position[i];
+				float d2 = v2.position[i] - v0.position[i];
+				// dp/du is (s2[1] * d1 - s1[1] * d2) / signedArea, only its direction is kept
+				triangleTangent.tangent[i] = (s2[1] * d1 - s1[1] * d2) * triangleTangent.orientation;
+			}
+		}
+	});
+	// triangle corners around each vertex, vertexCorners[vertexCornerOffsets[v] .. vertexCornerOffsets[v + 1]]
+	std::vector<uint32> vertexCornerOffsets(vertexCount + 1, 0);
+	for (uint64 i = 0; i < triangleCount * 3; i += 1) {
+		vertexCornerOffsets[primitive.getIndex(i) + 1] += 1;
+	}
+	for (uint64 vertex = 0; vertex < vertexCount; vertex += 1) {
+		vertexCornerOffsets[vertex + 1] += vertexCornerOffsets[vertex];
+	}
+	std::vector<uint32> vertexCorners(triangleCount * 3);
+	{
+		std::vector<uint32> cornerCounts(vertexCount, 0);
+		for (uint64 i = 0; i < triangleCount * 3; i += 1) {
+			uint32 vertex = primitive.getIndex(i);
+			vertexCorners[vertexCornerOffsets[vertex] + cornerCounts[vertex]] = static_cast<uint32>(i);
+			cornerCounts[vertex] += 1;
+		}
+	}
+	auto projectNormalize = [](const float* v, const float* normal, float* result) {
+		float d = v[0] * normal[0] + v[1] * normal[1] + v[2] * normal[2];
+		for (int i = 0; i < 3; i += 1) {
+			result[i] = v[i] - normal[i] * d;
+		}
+		float length = sqrtf(result[0] * result[0] + result[1] * result[1] + result[2] * result[2]);
+		if (!(length > 0)) {
+			return false;
+		}
+		for (int i = 0; i < 3; i += 1) {
+			result[i] /= length;
+		}
+		return true;
+	};
+	threadPool.parallelFor((vertexCount + chunkSize - 1) / chunkSize, [&](uint64 chunk) {
+		for (uint64 vertex = chunk * chunkSize; vertex < std::min((chunk + 1) * chunkSize, vertexCount); vertex += 1) {
+			ModelVertex& modelVertex = primitive.vertices[vertex];
+			const float* normal = modelVertex.normal;
+			// [0] sums triangles of positive, [1] of negative uv orientation
+			float sums[2][3] = {};
+			float weights[2] = {};
+			for (uint32 c = vertexCornerOffsets[vertex]; c < vertexCornerOffsets[vertex + 1]; c += 1) {
+				uint32 corner = vertexCorners[c];
+				uint64 triangle = corner / 3;
+				const TriangleTangent& triangleTangent = triangleTangents[triangle];
+				if (triangleTangent.orientation == 0) {
+					continue;
+				}
+				float tangent[3];
+				if (!projectNormalize(triangleTangent.tangent, normal, tangent)) {
+					continue;
+				}
+				const float* p0 = primitive.vertices[primitive.getIndex(triangle * 3 + (corner + 1) % 3)].position;
+				const float* p1 = primitive.vertices[primitive.getIndex(triangle * 3 + (corner + 2) % 3)].position;
+				float e0[3] = { p0[0] - modelVertex.position[0], p0[1] - modelVertex.position[1], p0[2] - modelVertex.position[2] };
+				float e1[3] = { p1[0] - modelVertex.position[0], p1[1] - modelVertex.position[1], p1[2] - modelVertex.position[2] };
+				float edge0[3], edge1[3];
+				if (!projectNormalize(e0, normal, edge0) || !projectNormalize(e1, normal, edge1)) {
+					continue;
+				}
+				float angle = acosf(std::clamp(edge0[0] * edge1[0] + edge0[1] * edge1[1] + edge0[2] * edge1[2], -1.0f, 1.0f));
+				int group = triangleTangent.orientation > 0 ? 0 : 1;
+				for (int i = 0; i < 3; i += 1) {
+					sums[group][i] += tangent[i] * angle;
+				}
+				weights[group] += angle;
+			}
+			int group = weights[0] >= weights[1] ? 0 : 1;
+			if (weights[group] > 0 && projectNormalize(sums[group], normal, modelVertex.tangent)) {
+				continue;
+			}
+			float axis[3] = { fabsf(normal[0]) < 0.9f ? 1.0f : 0.0f, fabsf(normal[0]) < 0.9f ? 0.0f : 1.0f, 0.0f };
+			if (!projectNormalize(axis, normal, modelVertex.tangent)) {
+				modelVertex.tangent[0] = 1;
+				modelVertex.tangent[1] = 0;
+				modelVertex.tangent[2] = 0;
+			}
+		}
+	});
+}
+
+// CPU counterpart of a ModelMesh's BLAS, triangles are in object space and triangles[i] is
+// triangle primitiveIndices[i] of primitives[geometryIndices[i]] (DXR's GeometryIndex() and PrimitiveIndex()).
+// The views point into storage, the Storage filled by build or the mapping of a BVH cache file (see loadBVHCache),
+// which copies of the ModelMeshBVH share. Only one of bvh and quantizedBVH has nodes, see BVHBuildSettings::quantizedNodes
+struct ModelMeshBVH {
+	struct Storage {
+		BVH8 bvh;
+		BVH8Quantized quantizedBVH;
+		std::vector<BVHTriangle> triangles;
+		BVH8TriangleBlocks triangleBlocks;
+		std::vector<uint32> geometryIndices;
+		std::vector<uint32> primitiveIndices;
+	};
+
+	BVH8View bvh;
+	BVH8QuantizedView quantizedBVH;
+	ArrayView<BVHTriangle> triangles;
+	// leaf triangles for single ray traversal, packets still read triangles
+	BVH8TriangleBlocksView triangleBlocks;
+	ArrayView<uint32> geometryIndices;
+	ArrayView<uint32> primitiveIndices;
+	AABB bounds;
+	float sahCost = 0;
+	std::shared_ptr<const void> storage;
+
+	void build(const std::vector<ModelPrimitive>& primitives, const BVHBuildSettings& settings) {
+		uint64 triangleCount = 0;
+		for (auto& primitive : primitives) {
+			triangleCount += primitive.indexCount() / 3;
+		}
+		assert(triangleCount < UINT32_MAX);
+		std::shared_ptr<Storage> newStorage = std::make_shared<Storage>();
+		newStorage->triangles.resize(triangleCount);
+		newStorage->geometryIndices.resize(triangleCount);
+		newStorage->primitiveIndices.resize(triangleCount);
+		std::vector<AABB> triangleBounds(triangleCount);
+		uint32 triangleIndex = 0;
+		for (uint32 geometryIndex = 0; geometryIndex < primitives.size(); geometryIndex += 1) {
+			const ModelPrimitive& primitive = primitives[geometryIndex];
+			for (uint64 index = 0; index < primitive.indexCount(); index += 3) {
+				BVHTriangle& triangle = newStorage->triangles[triangleIndex];
+				arrayCopy(triangle.v0, primitive.vertices[primitive.getIndex(index)].position);
+				arrayCopy(triangle.v1, primitive.vertices[primitive.getIndex(index + 1)].position);
+				arrayCopy(triangle.v2, primitive.vertices[primitive.getIndex(index + 2)].position);
+				triangleBounds[triangleIndex].extend(triangle.v0);
+				triangleBounds[triangleIndex].extend(triangle.v1);
+				triangleBounds[triangleIndex].extend(triangle.v2);
+				newStorage->geometryIndices[triangleIndex] = geometryIndex;
+				newStorage->primitiveIndices[triangleIndex] = static_cast<uint32>(index / 3);
+				triangleIndex += 1;
+			}
+		}
+		BVH binaryBVH = buildTriangleBVH(newStorage->triangles, triangleBounds, settings);
+		sahCost = bvhSAHCost(binaryBVH, settings);
+		newStorage->bvh = buildBVH8(binaryBVH);
+		newStorage->triangleBlocks = buildBVH8TriangleBlocks(newStorage->bvh, newStorage->triangles.data());
+		bounds = bvh8Bounds(newStorage->bvh);
+		if (settings.quantizedNodes) {
+			newStorage->quantizedBVH = buildBVH8Quantized(newStorage->bvh);
+			newStorage->bvh = BVH8();
+		}
+		bvh = newStorage->bvh;
+		quantizedBVH = newStorage->quantizedBVH;
+		triangles = newStorage->triangles;
+		triangleBlocks = newStorage->triangleBlocks;
+		geometryIndices = newStorage->geometryIndices;
+		primitiveIndices = newStorage->primitiveIndices;
+		storage = std::move(newStorage);
+	}
+	uint64 nodeCount() const {
+		return bvh.nodes.size() + quantizedBVH.nodes.size();
+	}
+	// f(bvh) or f(quantizedBVH), whichever was built
+	template <typename F>
+	auto visitNodes(F&& f) const {
+		return quantizedBVH.nodes.empty() ? f(bvh) : f(quantizedBVH);
+	}
+	BVH8Stats stats() const {
+		BVH8Stats meshStats = visitNodes([](auto& nodes) { return bvh8Stats(nodes); });
+		meshStats.primCount = triangles.size();
+		meshStats.sahCost = sahCost;
+		return meshStats;
+	}
 };
 
 struct ModelMesh {
 	std::string name;
 	std::vector<ModelPrimitive> primitives;
 	DX12Buffer blasBuffer;
+	ModelMeshBVH bvh;
 };
 
 struct ModelNode {
 	int meshIndex;
 	DirectX::XMMATRIX transform;
 	std::vector<int> children;
+	int parentIndex = -1;
 };
 
 struct ModelMaterial {
@@ -55,15 +357,492 @@ struct ModelMaterial {
 	float alphaCutoff = 0.5;
 };
 
+struct ModelImage {
+	int width = 0;
+	int height = 0;
+	int component = 0;
+	// mip 0 is width x height, every further mip half the previous one rounded down (at least 1), all of them packed
+	// tightly one after another in pixels
+	int mipCount = 1;
+	std::vector<uint8> pixels;
+	// the mip chain of pixels as blocks of compressedFormat when the texture is block compressed, see
+	// compressModelImage. pixels stay for CPURenderer
+	DXGI_FORMAT compressedFormat = DXGI_FORMAT_UNKNOWN;
+	std::vector<uint8> compressedPixels;
+	std::string uri;
+	// the threadPool job decoding pixels, started by Scene::loadModelFromGLTF. Declared last so that destroying the
+	// image waits for it before pixels go away
+	std::shared_ptr<ThreadPoolTaskGroup> decode;
+
+	bool decodePending() const {
+		return decode && decode->pendingCount->load() > 0;
+	}
+	void waitDecode() {
+		if (decode) {
+			decode->wait();
+			decode = nullptr;
+			if (pixels.empty()) {
+				throw Exception("cannot decode image \"" + uri + "\"");
+			}
+		}
+	}
+};
+
+// appends the rest of the mip chain to image's mip 0 (the only one in pixels), down to 1 x 1. Each mip is the 2 x 2 box
+// filter of the previous one, an odd last column or row is left out, a size 1 axis repeats its texel. Filtering is done in
+// float on the whole chain so rounding doesn't add up from mip to mip, and the rgb of 4 component images is sRGB, so it's
+// averaged in linear and converted back
+void generateModelImageMips(ModelImage& image) {
+	static const std::vector<float> srgbToLinear = [] {
+		std::vector<float> table(256);
+		for (int i = 0; i < 256; i += 1) {
+			float c = i / 255.0f;
+			table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return table;
+	}();
+	static constexpr int linearToSRGBSize = 1 << 12;
+	static const std::vector<uint8> linearToSRGB = [] {
+		std::vector<uint8> table(linearToSRGBSize + 1);
+		for (int i = 0; i <= linearToSRGBSize; i += 1) {
+			float c = static_cast<float>(i) / linearToSRGBSize;
+			c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			table[i] = static_cast<uint8>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+		}
+		return table;
+	}();
+	int component = image.component;
+	assert(component == 1 || component == 2 || component == 4);
+	int mipCount = 1;
+	while ((std::max(image.width, image.height) >> mipCount) > 0) {
+		mipCount += 1;
+	}
+	bool srgb = component == 4;
+	uint64 chainSize = 0;
+	for (int mip = 0; mip < mipCount; mip += 1) {
+		chainSize += static_cast<uint64>(std::max(image.width >> mip, 1)) * std::max(image.height >> mip, 1) * component;
+	}
+	std::vector<float> level(static_cast<uint64>(image.width) * image.height * component);
+	for (uint64 i = 0; i < level.size(); i += 1) {
+		level[i] = (srgb && i % 4 != 3) ? srgbToLinear[image.pixels[i]] : image.pixels[i] / 255.0f;
+	}
+	uint64 levelOffset = image.pixels.size();
+	image.pixels.resize(chainSize);
+	std::vector<float> nextLevel;
+	int width = image.width;
+	int height = image.height;
+	for (int mip = 1; mip < mipCount; mip += 1) {
+		int nextWidth = std::max(width >> 1, 1);
+		int nextHeight = std::max(height >> 1, 1);
+		nextLevel.resize(static_cast<uint64>(nextWidth) * nextHeight * component);
+		__m128 quarter = _mm_set1_ps(0.25f);
+		for (int y = 0; y < nextHeight; y += 1) {
+			const float* row0 = &level[static_cast<uint64>(y * 2) * width * component];
+			const float* row1 = &level[static_cast<uint64>(std::min(y * 2 + 1, height - 1)) * width * component];
+			float* dst = &nextLevel[static_cast<uint64>(y) * nextWidth * component];
+			int x = 0;
+			if (width > 1) {
+				// 4 output floats per iteration out of 8 floats of each row: 4 texels of 1, 2 of 2 or 1 of 4 components
+				int simdEnd = nextWidth * component / 4 * 4;
+				for (int i = 0; i < simdEnd; i += 4) {
+					__m128 a = _mm_add_ps(_mm_loadu_ps(row0 + i * 2), _mm_loadu_ps(row1 + i * 2));
+					__m128 b = _mm_add_ps(_mm_loadu_ps(row0 + i * 2 + 4), _mm_loadu_ps(row1 + i * 2 + 4));
+					__m128 sum;
+					if (component == 1) {
+						sum = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+					}
+					else if (component == 2) {
+						sum = _mm_add_ps(_mm_movelh_ps(a, b), _mm_movehl_ps(b, a));
+					}
+					else {
+						sum = _mm_add_ps(a, b);
+					}
+					_mm_storeu_ps(dst + i, _mm_mul_ps(sum, quarter));
+				}
+				x = simdEnd / component;
+			}
+			for (; x < nextWidth; x += 1) {
+				int x0 = x * 2;
+				int x1 = std::min(x * 2 + 1, width - 1);
+				for (int c = 0; c < component; c += 1) {
+					dst[x * component + c] = (row0[x0 * component + c] + row0[x1 * component + c] + row1[x0 * component + c] + row1[x1 * component + c]) * 0.25f;
+				}
+			}
+		}
+		std::swap(level, nextLevel);
+		width = nextWidth;
+		height = nextHeight;
+		uint8* dst = &image.pixels[levelOffset];
+		uint64 i = 0;
+		if (!srgb) {
+			__m128 scale = _mm_set1_ps(255.0f);
+			__m128 half = _mm_set1_ps(0.5f);
+			for (; i + 16 <= level.size(); i += 16) {
+				__m128i v0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&level[i]), scale), half));
+				__m128i v1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&level[i + 4]), scale), half));
+				__m128i v2 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&level[i + 8]), scale), half));
+				__m128i v3 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&level[i + 12]), scale), half));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3)));
+			}
+			for (; i < level.size(); i += 1) {
+				dst[i] = static_cast<uint8>(level[i] * 255.0f + 0.5f);
+			}
+		}
+		else {
+			for (; i < level.size(); i += 4) {
+				alignas(16) int32 indices[4];
+				__m128 scales = _mm_setr_ps(linearToSRGBSize, linearToSRGBSize, linearToSRGBSize, 255.0f);
+				_mm_store_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&level[i]), scales), _mm_set1_ps(0.5f))));
+				dst[i] = linearToSRGB[indices[0]];
+				dst[i + 1] = linearToSRGB[indices[1]];
+				dst[i + 2] = linearToSRGB[indices[2]];
+				dst[i + 3] = static_cast<uint8>(indices[3]);
+			}
+		}
+		levelOffset += level.size();
+	}
+	image.mipCount = mipCount;
+}
+
 struct Model {
 	std::vector<ModelNode> nodes;
 	std::vector<int> rootNodes;
 	std::vector<ModelMesh> meshes;
 	std::vector<ModelMaterial> materials;
 	std::vector<DX12Texture> textures;
+	std::vector<ModelImage> images;
 	std::filesystem::path filePath;
+	BVHBuildSettings bvhBuildSettings;
+
+	void waitImageDecodes() {
+		for (auto& image : images) {
+			image.waitDecode();
+		}
+	}
+
+	// same composition as the node walk in Scene::rebuildInstances, world = parentWorld * local
+	DirectX::XMMATRIX nodeWorldTransform(int nodeIndex) const {
+		DirectX::XMMATRIX transform = nodes[nodeIndex].transform;
+		for (int parentIndex = nodes[nodeIndex].parentIndex; parentIndex >= 0; parentIndex = nodes[parentIndex].parentIndex) {
+			transform = XMMatrixMultiply(nodes[parentIndex].transform, transform);
+		}
+		return transform;
+	}
+};
+
+// On disk cache of a model's ModelMeshBVHs, one file per bvhCacheKey. Every array is stored 64 byte aligned after a
+// BVHCacheHeader and a BVHCacheMesh per mesh, so on a hit the file is mapped and the ModelMeshBVH views point straight
+// into the mapping, pages are only read as traversal touches them. Bump bvhCacheVersion when anything stored changes.
+static const uint32 bvhCacheVersion = 2;
+static const char bvhCacheMagic[8] = { 'Y', 'A', 'R', 'R', 'B', 'V', 'H', '8' };
+
+struct BVHCacheHeader {
+	char magic[8];
+	uint32 version;
+	uint32 meshCount;
+	uint64 key;
+	uint64 fileSize;
+};
+
+struct BVHCacheArray {
+	uint64 offset;
+	uint64 count;
+};
+
+struct BVHCacheMesh {
+	// one of nodes and quantizedNodes is empty
+	BVHCacheArray nodes;
+	BVHCacheArray quantizedNodes;
+	BVHCacheArray primIndices;
+	BVHCacheArray triangles;
+	BVHCacheArray blocks;
+	BVHCacheArray leafBlockOffsets;
+	BVHCacheArray geometryIndices;
+	BVHCacheArray primitiveIndices;
+	AABB bounds;
+	float sahCost;
+};
+
+// hash of the mesh vertex and index buffers, the build settings and the cache layout.
+// The key is taken from the parsed meshes, not the glTF file, so a hit saves the BVH build but never the parse and
+// the hash over every vertex. Loading can't skip the parse anyway, the GPU buffers and BLASes are made from it
+uint64 bvhCacheKey(const Model& model) {
+	const BVHBuildSettings& settings = model.bvhBuildSettings;
+	uint64 layout[] = { bvhCacheVersion, sizeof(BVHCacheMesh), sizeof(BVH8Node), sizeof(BVH8QuantizedNode), sizeof(BVH8TriangleBlock), sizeof(BVHTriangle) };
+	uint64 key = hashBytes(layout, sizeof(layout));
+	key = hashBytes(&settings.builder, sizeof(settings.builder), key);
+	key = hashBytes(&settings.binCount, sizeof(settings.binCount), key);
+	key = hashBytes(&settings.maxLeafSize, sizeof(settings.maxLeafSize), key);
+	key = hashBytes(&settings.traversalCost, sizeof(settings.traversalCost), key);
+	key = hashBytes(&settings.intersectionCost, sizeof(settings.intersectionCost), key);
+	key = hashBytes(&settings.mortonCodeBits, sizeof(settings.mortonCodeBits), key);
+	key = hashBytes(&settings.spatialSplitAlpha, sizeof(settings.spatialSplitAlpha), key);
+	key = hashBytes(&settings.spatialSplitBudget, sizeof(settings.spatialSplitBudget), key);
+	key = hashBytes(&settings.treeletOptimization, sizeof(settings.treeletOptimization), key);
+	key = hashBytes(&settings.quantizedNodes, sizeof(settings.quantizedNodes), key);
+	for (auto& mesh : model.meshes) {
+		uint64 primitiveCount = mesh.primitives.size();
+		key = hashBytes(&primitiveCount, sizeof(primitiveCount), key);
+		for (auto& primitive : mesh.primitives) {
+			uint64 sizes[3] = { primitive.vertices.size(), primitive.indices.size(), primitive.indexSize };
+			key = hashBytes(sizes, sizeof(sizes), key);
+			key = hashBytes(primitive.vertices.data(), primitive.vertices.size() * sizeof(ModelVertex), key);
+			key = hashBytes(primitive.indices.data(), primitive.indices.size(), key);
+		}
+	}
+	return key;
+}
+
+std::filesystem::path bvhCacheFilePath(const std::filesystem::path& cacheDir, uint64 key) {
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.bvh", static_cast<unsigned long long>(key));
+	return cacheDir / fileName;
+}
+
+// a temporary file next to cacheFilePath that no other thread or process writing the same cache file uses
+std::filesystem::path cacheTempFilePath(const std::filesystem::path& cacheFilePath) {
+	std::filesystem::path tempFilePath = cacheFilePath;
+	tempFilePath += "." + std::to_string(GetCurrentProcessId()) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	return tempFilePath;
+}
+
+template <typename T>
+bool bvhCacheArrayValid(const FileMapping& mapping, const BVHCacheArray& array) {
+	return array.offset % 64 == 0 && array.offset <= mapping.size && array.count <= (mapping.size - array.offset) / sizeof(T);
+}
+
+template <typename T>
+ArrayView<T> bvhCacheArrayView(const FileMapping& mapping, const BVHCacheArray& array) {
+	return ArrayView<T>(reinterpret_cast<const T*>(mapping.data + array.offset), array.count);
+}
+
+// points every mesh's ModelMeshBVH into the mapped cache file, false (and model untouched) if the file is missing,
+// from another version or key, or truncated
+bool loadBVHCache(Model& model, const std::filesystem::path& cacheFilePath, uint64 key) {
+	std::shared_ptr<FileMapping> mapping = std::make_shared<FileMapping>();
+	if (!mapping->open(cacheFilePath) || mapping->size < sizeof(BVHCacheHeader)) {
+		return false;
+	}
+	const BVHCacheHeader* header = reinterpret_cast<const BVHCacheHeader*>(mapping->data);
+	if (memcmp(header->magic, bvhCacheMagic, sizeof(bvhCacheMagic)) != 0 || header->version != bvhCacheVersion || header->key != key || header->fileSize != mapping->size || header->meshCount != model.meshes.size()) {
+		return false;
+	}
+	BVHCacheArray meshArray = { align(sizeof(BVHCacheHeader), 64), header->meshCount };
+	if (!bvhCacheArrayValid<BVHCacheMesh>(*mapping, meshArray)) {
+		return false;
+	}
+	ArrayView<BVHCacheMesh> cacheMeshes = bvhCacheArrayView<BVHCacheMesh>(*mapping, meshArray);
+	for (uint64 meshIndex = 0; meshIndex < model.meshes.size(); meshIndex += 1) {
+		const BVHCacheMesh& cacheMesh = cacheMeshes[meshIndex];
+		uint64 triangleCount = 0;
+		for (auto& primitive : model.meshes[meshIndex].primitives) {
+			triangleCount += primitive.indexCount() / 3;
+		}
+		bool valid = bvhCacheArrayValid<BVH8Node>(*mapping, cacheMesh.nodes) && bvhCacheArrayValid<BVH8QuantizedNode>(*mapping, cacheMesh.quantizedNodes) &&
+			(cacheMesh.nodes.count == 0 || cacheMesh.quantizedNodes.count == 0) && bvhCacheArrayValid<uint32>(*mapping, cacheMesh.primIndices) &&
+			bvhCacheArrayValid<BVHTriangle>(*mapping, cacheMesh.triangles) && bvhCacheArrayValid<BVH8TriangleBlock>(*mapping, cacheMesh.blocks) &&
+			bvhCacheArrayValid<uint32>(*mapping, cacheMesh.leafBlockOffsets) && bvhCacheArrayValid<uint32>(*mapping, cacheMesh.geometryIndices) &&
+			bvhCacheArrayValid<uint32>(*mapping, cacheMesh.primitiveIndices) && cacheMesh.triangles.count == triangleCount &&
+			cacheMesh.geometryIndices.count == triangleCount && cacheMesh.primitiveIndices.count == triangleCount &&
+			cacheMesh.leafBlockOffsets.count == cacheMesh.primIndices.count;
+		if (!valid) {
+			return false;
+		}
+	}
+	for (uint64 meshIndex = 0; meshIndex < model.meshes.size(); meshIndex += 1) {
+		const BVHCacheMesh& cacheMesh = cacheMeshes[meshIndex];
+		ModelMeshBVH& meshBVH = model.meshes[meshIndex].bvh;
+		ArrayView<uint32> primIndices = bvhCacheArrayView<uint32>(*mapping, cacheMesh.primIndices);
+		meshBVH.bvh = BVH8View();
+		meshBVH.quantizedBVH = BVH8QuantizedView();
+		if (cacheMesh.quantizedNodes.count > 0) {
+			meshBVH.quantizedBVH.nodes = bvhCacheArrayView<BVH8QuantizedNode>(*mapping, cacheMesh.quantizedNodes);
+			meshBVH.quantizedBVH.primIndices = primIndices;
+		}
+		else {
+			meshBVH.bvh.nodes = bvhCacheArrayView<BVH8Node>(*mapping, cacheMesh.nodes);
+			meshBVH.bvh.primIndices = primIndices;
+		}
+		meshBVH.triangles = bvhCacheArrayView<BVHTriangle>(*mapping, cacheMesh.triangles);
+		meshBVH.triangleBlocks.blocks = bvhCacheArrayView<BVH8TriangleBlock>(*mapping, cacheMesh.blocks);
+		meshBVH.triangleBlocks.leafBlockOffsets = bvhCacheArrayView<uint32>(*mapping, cacheMesh.leafBlockOffsets);
+		meshBVH.geometryIndices = bvhCacheArrayView<uint32>(*mapping, cacheMesh.geometryIndices);
+		meshBVH.primitiveIndices = bvhCacheArrayView<uint32>(*mapping, cacheMesh.primitiveIndices);
+		meshBVH.bounds = cacheMesh.bounds;
+		meshBVH.sahCost = cacheMesh.sahCost;
+		meshBVH.storage = mapping;
+	}
+	return true;
+}
+
+// writes to a temporary file renamed into place, so a concurrent or interrupted run never sees a partial file.
+// Failures only cost the next run a rebuild, so they are ignored
+void writeBVHCache(const Model& model, const std::filesystem::path& cacheFilePath, uint64 key) {
+	BVHCacheHeader header = {};
+	memcpy(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic));
+	header.version = bvhCacheVersion;
+	header.meshCount = static_cast<uint32>(model.meshes.size());
+	header.key = key;
+	std::vector<BVHCacheMesh> cacheMeshes(model.meshes.size());
+	uint64 fileSize = align(sizeof(BVHCacheHeader), 64) + align(sizeof(BVHCacheMesh) * cacheMeshes.size(), 64);
+	auto allocateArray = [&fileSize](BVHCacheArray& array, uint64 count, uint64 elementSize) {
+		array = { fileSize, count };
+		fileSize = align(fileSize + count * elementSize, 64);
+	};
+	for (uint64 meshIndex = 0; meshIndex < model.meshes.size(); meshIndex += 1) {
+		const ModelMeshBVH& meshBVH = model.meshes[meshIndex].bvh;
+		BVHCacheMesh& cacheMesh = cacheMeshes[meshIndex];
+		allocateArray(cacheMesh.nodes, meshBVH.bvh.nodes.size(), sizeof(BVH8Node));
+		allocateArray(cacheMesh.quantizedNodes, meshBVH.quantizedBVH.nodes.size(), sizeof(BVH8QuantizedNode));
+		allocateArray(cacheMesh.primIndices, meshBVH.visitNodes([](auto& bvh) { return bvh.primIndices.size(); }), sizeof(uint32));
+		allocateArray(cacheMesh.triangles, meshBVH.triangles.size(), sizeof(BVHTriangle));
+		allocateArray(cacheMesh.blocks, meshBVH.triangleBlocks.blocks.size(), sizeof(BVH8TriangleBlock));
+		allocateArray(cacheMesh.leafBlockOffsets, meshBVH.triangleBlocks.leafBlockOffsets.size(), sizeof(uint32));
+		allocateArray(cacheMesh.geometryIndices, meshBVH.geometryIndices.size(), sizeof(uint32));
+		allocateArray(cacheMesh.primitiveIndices, meshBVH.primitiveIndices.size(), sizeof(uint32));
+		cacheMesh.bounds = meshBVH.bounds;
+		cacheMesh.sahCost = meshBVH.sahCost;
+	}
+	header.fileSize = fileSize;
+
+	std::filesystem::path tempFilePath = cacheTempFilePath(cacheFilePath);
+	std::fstream file(tempFilePath, std::ios::out | std::ios_base::trunc | std::ios::binary);
+	if (!file.is_open()) {
+		return;
+	}
+	uint64 filePos = 0;
+	auto writeArray = [&](uint64 offset, const void* data, uint64 size) {
+		static const char padding[64] = {};
+		assert(offset >= filePos && offset - filePos < 64);
+		file.write(padding, offset - filePos);
+		file.write(static_cast<const char*>(data), size);
+		filePos = offset + size;
+	};
+	writeArray(0, &header, sizeof(header));
+	writeArray(align(sizeof(BVHCacheHeader), 64), cacheMeshes.data(), sizeof(BVHCacheMesh) * cacheMeshes.size());
+	for (uint64 meshIndex = 0; meshIndex < model.meshes.size(); meshIndex += 1) {
+		const ModelMeshBVH& meshBVH = model.meshes[meshIndex].bvh;
+		const BVHCacheMesh& cacheMesh = cacheMeshes[meshIndex];
+		writeArray(cacheMesh.nodes.offset, meshBVH.bvh.nodes.data(), meshBVH.bvh.nodes.size() * sizeof(BVH8Node));
+		writeArray(cacheMesh.quantizedNodes.offset, meshBVH.quantizedBVH.nodes.data(), meshBVH.quantizedBVH.nodes.size() * sizeof(BVH8QuantizedNode));
+		meshBVH.visitNodes([&](auto& bvh) { writeArray(cacheMesh.primIndices.offset, bvh.primIndices.data(), bvh.primIndices.size() * sizeof(uint32)); });
+		writeArray(cacheMesh.triangles.offset, meshBVH.triangles.data(), meshBVH.triangles.size() * sizeof(BVHTriangle));
+		writeArray(cacheMesh.blocks.offset, meshBVH.triangleBlocks.blocks.data(), meshBVH.triangleBlocks.blocks.size() * sizeof(BVH8TriangleBlock));
+		writeArray(cacheMesh.leafBlockOffsets.offset, meshBVH.triangleBlocks.leafBlockOffsets.data(), meshBVH.triangleBlocks.leafBlockOffsets.size() * sizeof(uint32));
+		writeArray(cacheMesh.geometryIndices.offset, meshBVH.geometryIndices.data(), meshBVH.geometryIndices.size() * sizeof(uint32));
+		writeArray(cacheMesh.primitiveIndices.offset, meshBVH.primitiveIndices.data(), meshBVH.primitiveIndices.size() * sizeof(uint32));
+	}
+	writeArray(fileSize, nullptr, 0);
+	file.close();
+	std::error_code error;
+	if (file.fail()) {
+		std::filesystem::remove(tempFilePath, error);
+		return;
+	}
+	std::filesystem::rename(tempFilePath, cacheFilePath, error);
+	if (error) {
+		std::filesystem::remove(tempFilePath, error);
+	}
+}
+
+// On disk cache of block compressed ModelImages, one file per textureCacheKey: a TextureCacheHeader followed by the
+// blocks of the whole mip chain. Bump textureCacheVersion when the encoders' output changes.
+static const uint32 textureCacheVersion = 2;
+static const char textureCacheMagic[8] = { 'Y', 'A', 'R', 'R', 'B', 'C', 'N', '1' };
+
+struct TextureCacheHeader {
+	char magic[8];
+	uint32 version;
+	uint32 format;
+	uint64 key;
+	int32 width;
+	int32 height;
+	int32 mipCount;
+	int32 component;
+	uint64 size;
 };
 
+// hash of the decoded mip chain and the format it is encoded to, images with the same pixels share a file across
+// models and scenes
+uint64 textureCacheKey(const ModelImage& image, BCFormat format) {
+	uint64 layout[] = { textureCacheVersion, sizeof(TextureCacheHeader), static_cast<uint64>(format) };
+	int32 dimensions[] = { image.width, image.height, image.mipCount, image.component };
+	uint64 key = hashBytes(layout, sizeof(layout));
+	key = hashBytes(dimensions, sizeof(dimensions), key);
+	return hashBytes(image.pixels.data(), image.pixels.size(), key);
+}
+
+// encodes image's mip chain to dxgiFormat (BC1, BC4, BC5 or BC7) into compressedPixels, or reads it from the matching
+// file of cacheDir. Runs on the image's decode job and spreads the block rows over threadPool. The cache is written
+// like writeBVHCache, with a temporary name per thread since two images of the same content may be encoded at once
+void compressModelImage(ModelImage& image, DXGI_FORMAT dxgiFormat, const std::filesystem::path& cacheDir) {
+	BCFormat format = BCFormat::BC7;
+	if (dxgiFormat == DXGI_FORMAT_BC1_UNORM || dxgiFormat == DXGI_FORMAT_BC1_UNORM_SRGB) {
+		format = BCFormat::BC1;
+	}
+	else if (dxgiFormat == DXGI_FORMAT_BC4_UNORM) {
+		format = BCFormat::BC4;
+	}
+	else if (dxgiFormat == DXGI_FORMAT_BC5_UNORM) {
+		format = BCFormat::BC5;
+	}
+	else {
+		assert(dxgiFormat == DXGI_FORMAT_BC7_UNORM || dxgiFormat == DXGI_FORMAT_BC7_UNORM_SRGB);
+	}
+	uint64 size = bcMipChainSize(image.width, image.height, image.mipCount, format);
+	uint64 key = 0;
+	std::filesystem::path cacheFilePath;
+	if (!cacheDir.empty()) {
+		key = textureCacheKey(image, format);
+		char fileName[32];
+		snprintf(fileName, sizeof(fileName), "%016llx.bcn", static_cast<unsigned long long>(key));
+		cacheFilePath = cacheDir / fileName;
+		FileMapping mapping;
+		if (mapping.open(cacheFilePath) && mapping.size == sizeof(TextureCacheHeader) + size) {
+			const TextureCacheHeader* header = reinterpret_cast<const TextureCacheHeader*>(mapping.data);
+			if (memcmp(header->magic, textureCacheMagic, sizeof(textureCacheMagic)) == 0 && header->version == textureCacheVersion && header->format == static_cast<uint32>(format) &&
+				header->key == key && header->width == image.width && header->height == image.height && header->mipCount == image.mipCount && header->component == image.component && header->size == size) {
+				image.compressedPixels.assign(mapping.data + sizeof(TextureCacheHeader), mapping.data + mapping.size);
+				image.compressedFormat = dxgiFormat;
+				return;
+			}
+		}
+	}
+	image.compressedPixels = encodeBCMipChain(image.pixels.data(), image.width, image.height, image.component, image.mipCount, format, threadPool);
+	image.compressedFormat = dxgiFormat;
+	if (cacheDir.empty()) {
+		return;
+	}
+	TextureCacheHeader header = {};
+	memcpy(header.magic, textureCacheMagic, sizeof(textureCacheMagic));
+	header.version = textureCacheVersion;
+	header.format = static_cast<uint32>(format);
+	header.key = key;
+	header.width = image.width;
+	header.height = image.height;
+	header.mipCount = image.mipCount;
+	header.component = image.component;
+	header.size = size;
+	std::error_code error;
+	std::filesystem::create_directories(cacheDir, error);
+	std::filesystem::path tempFilePath = cacheTempFilePath(cacheFilePath);
+	std::fstream file(tempFilePath, std::ios::out | std::ios_base::trunc | std::ios::binary);
+	if (!file.is_open()) {
+		return;
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(image.compressedPixels.data()), image.compressedPixels.size());
+	file.close();
+	if (file.fail()) {
+		std::filesystem::remove(tempFilePath, error);
+		return;
+	}
+	std::filesystem::rename(tempFilePath, cacheFilePath, error);
+	if (error) {
+		std::filesystem::remove(tempFilePath, error);
+	}
+}
+
 struct Camera {
 	DirectX::XMVECTOR position = DirectX::XMVectorSet(0, 0, 0, 0);
 	DirectX::XMVECTOR lookAt = DirectX::XMVectorSet(0, 0, 1, 0);
@@ -72,6 +851,17 @@ struct Camera {
 	DirectX::XMMATRIX viewMat;
 	DirectX::XMMATRIX projMat;
 	DirectX::XMMATRIX viewProjMat;
+
+	void updateMatrices(float aspectRatio) {
+		viewMat = DirectX::XMMatrixLookAtRH(position, lookAt, up);
+		projMat = DirectX::XMMatrixPerspectiveFovRH(DirectX::XMConvertToRadians(45), aspectRatio, 1, 1000);
+		viewProjMat = viewMat * projMat;
+	}
+	// angle between the eye rays through two vertically neighbouring pixels at the center of an image imageHeight pixels
+	// high, the spread of a primary ray cone (Akenine-Moller et al., Ray Tracing Gems chapter 20)
+	float pixelSpreadAngle(float imageHeight) const {
+		return atanf(2.0f / (DirectX::XMVectorGetY(projMat.r[1]) * imageHeight));
+	}
 };
 
 struct SceneInfo {
@@ -182,27 +972,436 @@ struct SceneParser : public Parser {
 
 #include "../hlsl/sceneStructs.hlsli"
 
+// octahedral mapping of a unit vector to 2 x 16 bit snorm, x in the low and y in the high half. A zero vector comes back
+// as (0, 0, 1)
+uint32 octEncode(const float* v) {
+	float l1 = fabsf(v[0]) + fabsf(v[1]) + fabsf(v[2]);
+	float x = l1 > 0 ? v[0] / l1 : 0;
+	float y = l1 > 0 ? v[1] / l1 : 0;
+	if (v[2] < 0) {
+		float ox = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+		float oy = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+		x = ox;
+		y = oy;
+	}
+	int32 qx = static_cast<int32>(lroundf(std::clamp(x, -1.0f, 1.0f) * 32767));
+	int32 qy = static_cast<int32>(lroundf(std::clamp(y, -1.0f, 1.0f) * 32767));
+	return static_cast<uint16>(qx) | (static_cast<uint32>(static_cast<uint16>(qy)) << 16);
+}
+
+// octDecode of utils.hlsli
+void octDecode(uint32 e, float* v) {
+	float x = std::max(static_cast<int16>(e & 0xffff) / 32767.0f, -1.0f);
+	float y = std::max(static_cast<int16>(e >> 16) / 32767.0f, -1.0f);
+	float z = 1 - fabsf(x) - fabsf(y);
+	float t = std::clamp(-z, 0.0f, 1.0f);
+	x += x >= 0 ? -t : t;
+	y += y >= 0 ? -t : t;
+	float length = sqrtf(x * x + y * y + z * z);
+	v[0] = x / length;
+	v[1] = y / length;
+	v[2] = z / length;
+}
+
+uint32 halfEncode2(const float* v) {
+	return DirectX::PackedVector::XMConvertFloatToHalf(v[0]) | (static_cast<uint32>(DirectX::PackedVector::XMConvertFloatToHalf(v[1])) << 16);
+}
+
+// halfDecode2 of utils.hlsli
+void halfDecode2(uint32 e, float* v) {
+	v[0] = DirectX::PackedVector::XMConvertHalfToFloat(static_cast<DirectX::PackedVector::HALF>(e & 0xffff));
+	v[1] = DirectX::PackedVector::XMConvertHalfToFloat(static_cast<DirectX::PackedVector::HALF>(e >> 16));
+}
+
+void encodeVertexInfo(const ModelVertex& vertex, VertexInfo& vertexInfo) {
+	arrayCopy(vertexInfo.normal, vertex.normal);
+	arrayCopy(vertexInfo.uv, vertex.uv);
+	arrayCopy(vertexInfo.tangent, vertex.tangent);
+}
+
+void encodeVertexInfo(const ModelVertex& vertex, CompactVertexInfo& vertexInfo) {
+	vertexInfo.normal = octEncode(vertex.normal);
+	vertexInfo.uv = halfEncode2(vertex.uv);
+	vertexInfo.tangent = octEncode(vertex.tangent);
+}
+
+void decodeVertexInfo(const VertexInfo& vertexInfo, VertexInfo& result) {
+	result = vertexInfo;
+}
+
+void decodeVertexInfo(const CompactVertexInfo& vertexInfo, VertexInfo& result) {
+	octDecode(vertexInfo.normal, result.normal);
+	halfDecode2(vertexInfo.uv, result.uv);
+	octDecode(vertexInfo.tangent, result.tangent);
+}
+
+struct SceneInstance {
+	const ModelMesh* mesh;
+	DirectX::XMMATRIX transform;
+	const Model* model;
+	int nodeIndex;
+};
+
+struct SceneNodeTransform {
+	std::string modelName;
+	int nodeIndex;
+	DirectX::XMMATRIX transform;
+};
+
+// CPU side of everything rebuildTLAS hands to the ray tracing shaders, instances[i] matches instanceInfos[i]
+// and textures is in the same order the texture descriptors are appended
+struct SceneRayTracingData {
+	std::vector<SceneInstance> instances;
+	std::vector<InstanceInfo> instanceInfos;
+	std::vector<GeometryInfo> geometryInfos;
+	// indices of each triangle relative to its geometry's vertexOffset into vertexInfos
+	std::vector<TriangleIndices> triangleIndices;
+	std::vector<SceneVertexInfo> vertexInfos;
+	std::vector<MaterialInfo> materialInfos;
+	std::vector<const ModelImage*> textures;
+};
+
+struct SceneRayHit {
+	float t = FLT_MAX;
+	float barycentrics[2] = {};
+	uint32 instanceIndex = UINT32_MAX;
+	uint32 geometryIndex = UINT32_MAX;
+	uint32 primitiveIndex = UINT32_MAX;
+};
+
+// CPU counterpart of the TLAS built by rebuildTLAS: one instance per SceneInstance over the mesh's ModelMeshBVH,
+// so a mesh referenced by many nodes is stored once. Rays enter a BLAS in object space, the object space ray is
+// worldToObject * (origin + t * direction) so t and tMax carry over unchanged between the two levels
+struct SceneBVH {
+	struct Instance {
+		DirectX::XMMATRIX worldToObject;
+		const ModelMeshBVH* blas;
+	};
+
+	std::vector<Instance> instances;
+	std::vector<AABB> instanceBounds;
+	BVH8 tlas;
+	std::vector<uint32> tlasParentIndices;
+	std::vector<uint32> instanceNodeIndices;
+
+	static AABB transformBounds(const AABB& bounds, const DirectX::XMMATRIX& transform) {
+		AABB transformedBounds;
+		if (bounds.empty()) {
+			return transformedBounds;
+		}
+		for (int corner = 0; corner < 8; corner += 1) {
+			DirectX::XMVECTOR p = DirectX::XMVectorSet((corner & 1) ? bounds.max[0] : bounds.min[0], (corner & 2) ? bounds.max[1] : bounds.min[1], (corner & 4) ? bounds.max[2] : bounds.min[2], 1);
+			float transformedP[3];
+			DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(transformedP), DirectX::XMVector3Transform(p, transform));
+			transformedBounds.extend(transformedP);
+		}
+		return transformedBounds;
+	}
+	// every instance's mesh needs its ModelMeshBVH, see Scene::buildModelMeshBVHs
+	void build(const std::vector<SceneInstance>& sceneInstances, const BVHBuildSettings& settings = {}) {
+		instances.resize(sceneInstances.size());
+		instanceBounds.resize(sceneInstances.size());
+		for (uint64 i = 0; i < sceneInstances.size(); i += 1) {
+			const ModelMeshBVH& blas = sceneInstances[i].mesh->bvh;
+			assert(blas.nodeCount() > 0 || blas.triangles.empty());
+			instances[i].worldToObject = DirectX::XMMatrixInverse(nullptr, sceneInstances[i].transform);
+			instances[i].blas = &blas;
+			instanceBounds[i] = transformBounds(blas.bounds, sceneInstances[i].transform);
+		}
+		tlas = buildBVH8(buildBVH(instanceBounds, settings));
+		bvh8ParentIndices(tlas, tlasParentIndices, instanceNodeIndices);
+	}
+	// transform only update of changedInstances (see Scene::setNodeTransforms), refits the TLAS nodes above them
+	// instead of rebuilding, which keeps editing interactive but lets tree quality degrade over large moves
+	void refit(const std::vector<SceneInstance>& sceneInstances, const std::vector<uint32>& changedInstances) {
+		assert(sceneInstances.size() == instances.size());
+		for (uint32 instanceIndex : changedInstances) {
+			instances[instanceIndex].worldToObject = DirectX::XMMatrixInverse(nullptr, sceneInstances[instanceIndex].transform);
+			instanceBounds[instanceIndex] = transformBounds(instances[instanceIndex].blas->bounds, sceneInstances[instanceIndex].transform);
+		}
+		refitBVH8(tlas, tlasParentIndices, instanceNodeIndices, instanceBounds, changedInstances);
+	}
+	// t is the same in both spaces since the direction is not renormalized
+	static Ray transformRay(const Ray& ray, const DirectX::XMMATRIX& transform) {
+		Ray transformedRay = ray;
+		DirectX::XMVECTOR origin = DirectX::XMVectorSet(ray.origin[0], ray.origin[1], ray.origin[2], 1);
+		DirectX::XMVECTOR direction = DirectX::XMVectorSet(ray.direction[0], ray.direction[1], ray.direction[2], 0);
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(transformedRay.origin), DirectX::XMVector3Transform(origin, transform));
+		DirectX::XMStoreFloat3(reinterpret_cast<DirectX::XMFLOAT3*>(transformedRay.direction), DirectX::XMVector3TransformNormal(direction, transform));
+		return transformedRay;
+	}
+	// closest hit, anyHit(instanceIndex, geometryIndex, primitiveIndex, barycentrics) returning false rejects a candidate hit
+	template <typename AnyHit>
+	bool trace(Ray ray, SceneRayHit& hit, AnyHit&& anyHit) const {
+		bool found = false;
+		traverseBVH8(tlas, ray, [&](uint32 instanceIndex, Ray& worldRay) {
+			const Instance& instance = instances[instanceIndex];
+			Ray objectRay = transformRay(worldRay, instance.worldToObject);
+			const ModelMeshBVH& blas = *instance.blas;
+			RayHit blasHit;
+			bool blasFound = blas.visitNodes([&](auto& blasNodes) {
+				return traceBVH8(blasNodes, blas.triangleBlocks, objectRay, blasHit, [&](uint32 primIndex, float u, float v) {
+					float barycentrics[2] = { u, v };
+					return anyHit(instanceIndex, blas.geometryIndices[primIndex], blas.primitiveIndices[primIndex], barycentrics);
+				});
+			});
+			if (blasFound) {
+				worldRay.tMax = blasHit.t;
+				hit.t = blasHit.t;
+				hit.barycentrics[0] = blasHit.barycentrics[0];
+				hit.barycentrics[1] = blasHit.barycentrics[1];
+				hit.instanceIndex = instanceIndex;
+				hit.geometryIndex = blas.geometryIndices[blasHit.primIndex];
+				hit.primitiveIndex = blas.primitiveIndices[blasHit.primIndex];
+				found = true;
+			}
+		});
+		return found;
+	}
+	bool trace(const Ray& ray, SceneRayHit& hit) const {
+		return trace(ray, hit, [](uint32, uint32, uint32, const float*) { return true; });
+	}
+	// world to object space copy of the rays in rayMask, compacted so objectPacket ray i is packet ray rayIndices[i].
+	// t is the same in both spaces since directions are not renormalized
+	static void transformRayPacket(const RayPacket& packet, uint64 rayMask, const DirectX::XMMATRIX& transform, RayPacket& objectPacket, uint32* rayIndices) {
+		DirectX::XMFLOAT4X4 m;
+		DirectX::XMStoreFloat4x4(&m, transform);
+		objectPacket.rayCount = 0;
+		while (rayMask) {
+			uint32 rayIndex = countTrailingZeros(rayMask);
+			rayMask &= rayMask - 1;
+			uint32 i = objectPacket.rayCount++;
+			for (int axis = 0; axis < 3; axis += 1) {
+				objectPacket.origins[axis][i] = packet.origins[0][rayIndex] * m.m[0][axis] + packet.origins[1][rayIndex] * m.m[1][axis] + packet.origins[2][rayIndex] * m.m[2][axis] + m.m[3][axis];
+				objectPacket.directions[axis][i] = packet.directions[0][rayIndex] * m.m[0][axis] + packet.directions[1][rayIndex] * m.m[1][axis] + packet.directions[2][rayIndex] * m.m[2][axis];
+				objectPacket.invDirections[axis][i] = 1.0f / objectPacket.directions[axis][i];
+			}
+			objectPacket.tMins[i] = packet.tMins[rayIndex];
+			objectPacket.tMaxs[i] = packet.tMaxs[rayIndex];
+			rayIndices[i] = rayIndex;
+		}
+	}
+	// trace for every ray of the packet, both levels are traversed with traverseBVH8Packet.
+	// Hit bit i of the result is set when hits[i] is valid
+	template <typename AnyHit>
+	uint64 tracePacket(RayPacket& packet, SceneRayHit* hits, AnyHit&& anyHit) const {
+		uint64 hitMask = 0;
+		traverseBVH8Packet(tlas, packet, [&](uint32 instanceIndex, uint64 rayMask) {
+			const Instance& instance = instances[instanceIndex];
+			const ModelMeshBVH& blas = *instance.blas;
+			RayPacket objectPacket;
+			uint32 rayIndices[RayPacket::maxRayCount];
+			transformRayPacket(packet, rayMask, instance.worldToObject, objectPacket, rayIndices);
+			RayHit blasHits[RayPacket::maxRayCount];
+			uint64 blasHitMask = blas.visitNodes([&](auto& blasNodes) {
+				return traceBVH8Packet(blasNodes, blas.triangles.data(), objectPacket, blasHits, [&](uint32 primIndex, uint32, float u, float v) {
+					float barycentrics[2] = { u, v };
+					return anyHit(instanceIndex, blas.geometryIndices[primIndex], blas.primitiveIndices[primIndex], barycentrics);
+				});
+			});
+			while (blasHitMask) {
+				uint32 objectRayIndex = countTrailingZeros(blasHitMask);
+				blasHitMask &= blasHitMask - 1;
+				const RayHit& blasHit = blasHits[objectRayIndex];
+				uint32 rayIndex = rayIndices[objectRayIndex];
+				packet.tMaxs[rayIndex] = blasHit.t;
+				SceneRayHit& hit = hits[rayIndex];
+				hit.t = blasHit.t;
+				hit.barycentrics[0] = blasHit.barycentrics[0];
+				hit.barycentrics[1] = blasHit.barycentrics[1];
+				hit.instanceIndex = instanceIndex;
+				hit.geometryIndex = blas.geometryIndices[blasHit.primIndex];
+				hit.primitiveIndex = blas.primitiveIndices[blasHit.primIndex];
+				hitMask |= 1ull << rayIndex;
+			}
+		});
+		return hitMask;
+	}
+	// hit/no hit query of directLightRay.hlsl, ends at the first hit anyHit accepts like
+	// RAY_FLAG_ACCEPT_FIRST_HIT_AND_END_SEARCH instead of searching for the closest one
+	template <typename AnyHit>
+	bool occluded(Ray ray, float tMax, AnyHit&& anyHit) const {
+		ray.tMax = tMax;
+		return occludedTraverseBVH8(tlas, ray, [&](uint32 instanceIndex, const Ray& worldRay) {
+			const ModelMeshBVH& blas = *instances[instanceIndex].blas;
+			Ray objectRay = transformRay(worldRay, instances[instanceIndex].worldToObject);
+			return blas.visitNodes([&](auto& blasNodes) {
+				return occludedBVH8(blasNodes, blas.triangleBlocks, objectRay, [&](uint32 primIndex, float u, float v) {
+					float barycentrics[2] = { u, v };
+					return anyHit(instanceIndex, blas.geometryIndices[primIndex], blas.primitiveIndices[primIndex], barycentrics);
+				});
+			});
+		});
+	}
+	bool occluded(const Ray& ray, float tMax) const {
+		return occluded(ray, tMax, [](uint32, uint32, uint32, const float*) { return true; });
+	}
+	// occluded for every ray of the packet, bit i of the result is set when ray i is occluded
+	template <typename AnyHit>
+	uint64 occludedPacket(RayPacket& packet, AnyHit&& anyHit) const {
+		uint64 occludedMask = 0;
+		traverseBVH8Packet(tlas, packet, [&](uint32 instanceIndex, uint64 rayMask) {
+			rayMask &= ~occludedMask;
+			if (rayMask == 0) {
+				return;
+			}
+			const Instance& instance = instances[instanceIndex];
+			const ModelMeshBVH& blas = *instance.blas;
+			RayPacket objectPacket;
+			uint32 rayIndices[RayPacket::maxRayCount];
+			transformRayPacket(packet, rayMask, instance.worldToObject, objectPacket, rayIndices);
+			uint64 blasOccludedMask = blas.visitNodes([&](auto& blasNodes) {
+				return occludedBVH8Packet(blasNodes, blas.triangles.data(), objectPacket, [&](uint32 primIndex, uint32, float u, float v) {
+					float barycentrics[2] = { u, v };
+					return anyHit(instanceIndex, blas.geometryIndices[primIndex], blas.primitiveIndices[primIndex], barycentrics);
+				});
+			});
+			while (blasOccludedMask) {
+				uint32 rayIndex = rayIndices[countTrailingZeros(blasOccludedMask)];
+				blasOccludedMask &= blasOccludedMask - 1;
+				packet.tMaxs[rayIndex] = -FLT_MAX;
+				occludedMask |= 1ull << rayIndex;
+			}
+		});
+		return occludedMask;
+	}
+	// batched occluded, rays go through occludedPacket 64 at a time so callers should submit neighbouring rays
+	// (a pixel block's rays to one light) next to each other. results[i] is the result of rays[i]
+	template <typename AnyHit>
+	void occluded(const Ray* rays, uint64 rayCount, bool* results, AnyHit&& anyHit) const {
+		for (uint64 first = 0; first < rayCount; first += RayPacket::maxRayCount) {
+			RayPacket packet;
+			for (uint64 i = first; i < std::min(first + RayPacket::maxRayCount, rayCount); i += 1) {
+				packet.addRay(rays[i]);
+			}
+			uint64 occludedMask = occludedPacket(packet, anyHit);
+			for (uint32 i = 0; i < packet.rayCount; i += 1) {
+				results[first + i] = (occludedMask >> i) & 1;
+			}
+		}
+	}
+	// Ray streams, trace and occluded over large batches of incoherent rays (CPURenderer's bounce rays) spread over
+	// threadPool, 64 rays at a time as one packet with packets or one by one without. With reorder the rays are taken in
+	// rayStreamOrder instead of the given order, hits[i]/found[i] and results[i] belong to rays[i] either way
+	template <typename F>
+	static void forEachStreamBatch(const Ray* rays, uint32 rayCount, bool reorder, F&& traceBatch) {
+		std::vector<uint32> order;
+		if (reorder) {
+			rayStreamOrder(rays, rayCount, order, &threadPool);
+		}
+		static constexpr uint32 batchesPerTask = 64;
+		uint32 batchCount = (rayCount + RayPacket::maxRayCount - 1) / RayPacket::maxRayCount;
+		threadPool.parallelFor((batchCount + batchesPerTask - 1) / batchesPerTask, [&](uint64 task) {
+			for (uint32 batch = static_cast<uint32>(task) * batchesPerTask; batch < std::min(static_cast<uint32>(task + 1) * batchesPerTask, batchCount); batch += 1) {
+				uint32 rayIndices[RayPacket::maxRayCount];
+				uint32 batchRayCount = std::min(rayCount - batch * RayPacket::maxRayCount, RayPacket::maxRayCount);
+				for (uint32 i = 0; i < batchRayCount; i += 1) {
+					rayIndices[i] = reorder ? order[batch * RayPacket::maxRayCount + i] : batch * RayPacket::maxRayCount + i;
+				}
+				traceBatch(rayIndices, batchRayCount);
+			}
+		});
+	}
+	template <typename AnyHit>
+	void traceStream(const Ray* rays, uint32 rayCount, bool reorder, bool packets, SceneRayHit* hits, bool* found, AnyHit&& anyHit) const {
+		forEachStreamBatch(rays, rayCount, reorder, [&](const uint32* rayIndices, uint32 batchRayCount) {
+			if (!packets) {
+				for (uint32 i = 0; i < batchRayCount; i += 1) {
+					found[rayIndices[i]] = trace(rays[rayIndices[i]], hits[rayIndices[i]], anyHit);
+				}
+				return;
+			}
+			RayPacket packet;
+			for (uint32 i = 0; i < batchRayCount; i += 1) {
+				packet.addRay(rays[rayIndices[i]]);
+			}
+			SceneRayHit packetHits[RayPacket::maxRayCount];
+			uint64 hitMask = tracePacket(packet, packetHits, anyHit);
+			for (uint32 i = 0; i < batchRayCount; i += 1) {
+				found[rayIndices[i]] = (hitMask >> i) & 1;
+				hits[rayIndices[i]] = packetHits[i];
+			}
+		});
+	}
+	template <typename AnyHit>
+	void occludedStream(const Ray* rays, uint32 rayCount, bool reorder, bool packets, bool* results, AnyHit&& anyHit) const {
+		forEachStreamBatch(rays, rayCount, reorder, [&](const uint32* rayIndices, uint32 batchRayCount) {
+			if (!packets) {
+				for (uint32 i = 0; i < batchRayCount; i += 1) {
+					results[rayIndices[i]] = occluded(rays[rayIndices[i]], rays[rayIndices[i]].tMax, anyHit);
+				}
+				return;
+			}
+			RayPacket packet;
+			for (uint32 i = 0; i < batchRayCount; i += 1) {
+				packet.addRay(rays[rayIndices[i]]);
+			}
+			uint64 occludedMask = occludedPacket(packet, anyHit);
+			for (uint32 i = 0; i < batchRayCount; i += 1) {
+				results[rayIndices[i]] = (occludedMask >> i) & 1;
+			}
+		});
+	}
+	void occluded(const Ray* rays, uint64 rayCount, bool* results) const {
+		occluded(rays, rayCount, results, [](uint32, uint32, uint32, const float*) { return true; });
+	}
+};
+
+// a .glb mapped by Scene::loadGLB, its BIN chunk is read in place for the whole load
+struct GLBFile {
+	FileMapping file;
+	const uint8* binChunk = nullptr;
+	uint64 binChunkSize = 0;
+	// the glTF buffer that is the BIN chunk, -1 for none
+	int binBufferIndex = -1;
+};
+
+// where the encoded bytes of a glTF image are, read by Scene::decodeModelImage on a threadPool job: in the mapped
+// BIN chunk of glb, in bytes, in a data uri or in a file
+struct ModelImageSource {
+	std::shared_ptr<GLBFile> glb;
+	const uint8* data = nullptr;
+	uint64 size = 0;
+	std::vector<uint8> bytes;
+	std::string dataURI;
+	std::filesystem::path filePath;
+};
+
 struct Scene {
 	Camera camera;
 	std::unordered_map<std::string, Model> models;
 	std::vector<SceneLight> lights;
+	// one per mesh node of every model, in the order of the TLAS instance descs and InstanceInfos
+	std::vector<SceneInstance> instances;
+	std::unordered_map<const Model*, std::vector<int>> nodeInstanceIndices;
 	DX12Buffer tlasBuffer;
+	DX12Buffer tlasInstanceDescsBuffer;
+	DX12Buffer tlasScratchBuffer;
 	DX12Buffer instanceInfosBuffer;
 	DX12Buffer geometryInfosBuffer;
-	DX12Buffer triangleInfosBuffer;
+	DX12Buffer triangleIndicesBuffer;
+	DX12Buffer vertexInfosBuffer;
 	DX12Buffer materialInfosBuffer;
 	uint64 instanceInfoCount = 0;
 	uint64 geometryInfoCount = 0;
-	uint64 triangleInfoCount = 0;
+	uint64 triangleIndicesCount = 0;
+	uint64 vertexInfoCount = 0;
 	uint64 materialInfoCount = 0;
 	std::string name;
 	std::filesystem::path filePath;
 
 	Scene(const std::string& sceneName) : name(sceneName) {}
-	Scene(const std::string& sceneName, const std::filesystem::path& sceneFilePath, DX12Context& dx12) : name(sceneName), filePath(sceneFilePath) {
+	// instances point into models, moving keeps the unordered_map nodes in place but a copy would not
+	Scene(const Scene&) = delete;
+	Scene& operator=(const Scene&) = delete;
+	Scene(Scene&&) = default;
+	Scene& operator=(Scene&&) = default;
+	// dx12 can be nullptr, models are then loaded without any GPU resources for the CPU renderer
+	Scene(const std::string& sceneName, const std::filesystem::path& sceneFilePath, DX12Context* dx12, const ModelImportSettings& importSettings = {}) : name(sceneName), filePath(sceneFilePath) {
 		setCurrentDirToExeDir();
 		SceneParser parser(sceneFilePath);
 		SceneInfo info;
+		std::vector<std::pair<std::string, std::filesystem::path>> modelFiles;
 		while (true) {
 			parser.getInfo(info);
 			if (info.type == SceneInfo::Camera) {
@@ -216,9 +1415,8 @@ struct Scene {
 			else if (info.type == SceneInfo::Model) {
 				std::filesystem::path path = info.path;
 				std::filesystem::path extension = path.extension();
-				if (extension == ".gltf") {
-					Model model = createModelFromGLTF(path, dx12);
-					models.insert({ std::string(info.name), model });
+				if (extension == ".gltf" || extension == ".glb") {
+					modelFiles.push_back({ std::string(info.name), path });
 				}
 				else if (extension == ".fbx") {
 					assert(false && "not implemented");
@@ -250,6 +1448,33 @@ struct Scene {
 				assert(false && "unknown SceneInfo::Type");
 			}
 		}
+		// models are parsed and unpacked one per threadPool job, then get their GPU resources and go into models on this
+		// thread in scene file order, so models and everything rebuildTLAS numbers from it come out the same every run.
+		// Images are still decoding on threadPool when loadModelFromGLTF returns, createModelGPUResources takes them as
+		// they finish
+		std::vector<Model> loadedModels(modelFiles.size());
+		std::vector<std::exception_ptr> loadErrors(modelFiles.size());
+		threadPool.parallelFor(modelFiles.size(), [&](uint64 index) {
+			try {
+				loadedModels[index] = loadModelFromGLTF(modelFiles[index].second, importSettings);
+			}
+			catch (...) {
+				loadErrors[index] = std::current_exception();
+			}
+		});
+		for (uint64 index = 0; index < modelFiles.size(); index += 1) {
+			if (loadErrors[index]) {
+				std::rethrow_exception(loadErrors[index]);
+			}
+			if (dx12) {
+				createModelGPUResources(loadedModels[index], dx12);
+			}
+			else {
+				loadedModels[index].waitImageDecodes();
+			}
+			models.insert({ std::move(modelFiles[index].first), std::move(loadedModels[index]) });
+		}
+		rebuildInstances();
 	}
 	void writeToFile() {
 		std::stringstream strStream;
@@ -279,19 +1504,74 @@ struct Scene {
 	void deleteGPUResources() {
 		assert(false && "TODO: implement");
 	}
-	Model createModelFromGLTF(const std::filesystem::path& gltfFilePath, DX12Context& dx12) {
+	// parse, vertex and index unpacking, materials and images of a .gltf or .glb model, everything but its GPU resources.
+	// It touches nothing but its own model, so the Scene constructor runs one per model on threadPool. Every image gets a
+	// threadPool job of its own (ModelImage::decode) as soon as the glTF is parsed, they decode alongside the geometry
+	// work and may still be running when this returns
+	static Model loadModelFromGLTF(const std::filesystem::path& gltfFilePath, const ModelImportSettings& importSettings = {}) {
 		tinygltf::TinyGLTF gltfLoader;
 		std::string gltfLoadError;
 		std::string gltfLoadWarning;
 		tinygltf::Model gltfModel;
-		bool loadSuccess = gltfLoader.LoadASCIIFromFile(&gltfModel, &gltfLoadError, &gltfLoadWarning, gltfFilePath.string());
+		std::shared_ptr<GLBFile> glb = std::make_shared<GLBFile>();
+		std::vector<ModelImageSource> imageSources;
+		bool loadSuccess = false;
+		if (gltfFilePath.extension() == ".glb") {
+			loadSuccess = loadGLB(gltfLoader, gltfFilePath, gltfModel, glb, imageSources, gltfLoadError, gltfLoadWarning);
+		}
+		else {
+			loadSuccess = loadGLTF(gltfLoader, gltfFilePath, gltfModel, glb, imageSources, gltfLoadError, gltfLoadWarning);
+		}
 		if (!loadSuccess) {
 			throw Exception(std::move(gltfLoadError));
 		}
 		assert(gltfModel.scenes.size() == 1);
+		// first byte of an accessor, in the mapped BIN chunk for the embedded buffer of a .glb
+		auto accessorData = [&](const tinygltf::Accessor& accessor) {
+			const tinygltf::BufferView& bufferView = gltfModel.bufferViews[accessor.bufferView];
+			const uint8* bufferData = bufferView.buffer == glb->binBufferIndex ? glb->binChunk : gltfModel.buffers[bufferView.buffer].data.data();
+			return bufferData + bufferView.byteOffset + accessor.byteOffset;
+		};
 
 		Model model = {};
 		model.filePath = gltfFilePath;
+		// block compression format of each image by what it is the texture of: BC7 for base color (alpha included),
+		// BC5 for normal (x and y, z is rebuilt in primaryRay.hlsl) and BC1 for emissive. Images used in more than one
+		// way stay uncompressed
+		std::vector<DXGI_FORMAT> imageCompressedFormats(gltfModel.images.size(), DXGI_FORMAT_UNKNOWN);
+		if (importSettings.compressTextures) {
+			std::vector<bool> imageUsed(gltfModel.images.size(), false);
+			auto useImage = [&](int textureIndex, DXGI_FORMAT format) {
+				if (textureIndex < 0 || gltfModel.textures[textureIndex].source < 0) {
+					return;
+				}
+				int imageIndex = gltfModel.textures[textureIndex].source;
+				if (imageUsed[imageIndex] && imageCompressedFormats[imageIndex] != format) {
+					format = DXGI_FORMAT_UNKNOWN;
+				}
+				imageUsed[imageIndex] = true;
+				imageCompressedFormats[imageIndex] = format;
+			};
+			for (auto& gltfMaterial : gltfModel.materials) {
+				useImage(gltfMaterial.pbrMetallicRoughness.baseColorTexture.index, DXGI_FORMAT_BC7_UNORM_SRGB);
+				useImage(gltfMaterial.normalTexture.index, DXGI_FORMAT_BC5_UNORM);
+				useImage(gltfMaterial.emissiveTexture.index, DXGI_FORMAT_BC1_UNORM_SRGB);
+			}
+		}
+		// sized once, the decode jobs write into the images in place and moving the model keeps them where they are.
+		// D3D12 needs the top mip of a block compressed texture to be whole blocks, other sizes stay uncompressed
+		model.images.resize(gltfModel.images.size());
+		for (uint64 imageIndex = 0; imageIndex < model.images.size(); imageIndex += 1) {
+			ModelImage& image = model.images[imageIndex];
+			image.uri = gltfModel.images[imageIndex].uri.empty() ? gltfModel.images[imageIndex].name : gltfModel.images[imageIndex].uri;
+			image.decode = std::make_shared<ThreadPoolTaskGroup>(threadPool);
+			image.decode->run([&image, source = std::move(imageSources[imageIndex]), compressedFormat = imageCompressedFormats[imageIndex], cacheDir = importSettings.textureCacheDir] {
+				decodeModelImage(source, image);
+				if (compressedFormat != DXGI_FORMAT_UNKNOWN && !image.pixels.empty() && image.width % 4 == 0 && image.height % 4 == 0) {
+					compressModelImage(image, compressedFormat, cacheDir);
+				}
+			});
+		}
 		model.nodes.reserve(gltfModel.nodes.size());
 		for (auto& gltfNode : gltfModel.nodes) {
 			DirectX::XMMATRIX transform = DirectX::XMMatrixIdentity();
@@ -319,8 +1599,15 @@ struct Scene {
 			}
 			model.nodes.push_back(ModelNode{ gltfNode.mesh, transform, gltfNode.children });
 		}
+		for (int nodeIndex = 0; nodeIndex < model.nodes.size(); nodeIndex += 1) {
+			for (int childIndex : model.nodes[nodeIndex].children) {
+				model.nodes[childIndex].parentIndex = nodeIndex;
+			}
+		}
 		model.rootNodes = gltfModel.scenes[0].nodes;
 		model.meshes.reserve(gltfModel.meshes.size());
+		// (mesh, primitive) indices of the primitives that have a normal texture but no TANGENT
+		std::vector<std::pair<uint64, uint64>> tangentPrimitives;
 		for (auto& gltfMesh : gltfModel.meshes) {
 			ModelMesh modelMesh;
 			modelMesh.name = gltfMesh.name;
@@ -330,32 +1617,30 @@ struct Scene {
 				ModelPrimitive modelPrimitive;
 				modelPrimitive.materialIndex = gltfPrimitive.material;
 				assert(gltfPrimitive.material >= 0 && gltfPrimitive.material < gltfModel.materials.size());
+				modelPrimitive.opaque = gltfModel.materials[gltfPrimitive.material].alphaMode == "OPAQUE";
 
 				auto positionAttribute = gltfPrimitive.attributes.find("POSITION");
 				assert(positionAttribute != gltfPrimitive.attributes.end());
 				auto& positionAccessor = gltfModel.accessors[positionAttribute->second];
 				auto& positionBufferView = gltfModel.bufferViews[positionAccessor.bufferView];
-				auto& positionBuffer = gltfModel.buffers[positionBufferView.buffer];
-				unsigned char* positionData = &positionBuffer.data[positionAccessor.byteOffset + positionBufferView.byteOffset];
+				const uint8* positionData = accessorData(positionAccessor);
 				assert(positionAccessor.type == TINYGLTF_TYPE_VEC3 && positionAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && (positionBufferView.byteStride == 0 || positionBufferView.byteStride == 12));
-				assert(positionAccessor.count < USHRT_MAX);
+				assert(positionAccessor.count < UINT32_MAX);
 
 				auto normalAttribute = gltfPrimitive.attributes.find("NORMAL");
 				assert(normalAttribute != gltfPrimitive.attributes.end());
 				auto& normalAccessor = gltfModel.accessors[normalAttribute->second];
 				auto& normalBufferView = gltfModel.bufferViews[normalAccessor.bufferView];
-				auto& normalBuffer = gltfModel.buffers[normalBufferView.buffer];
-				unsigned char* normalData = &normalBuffer.data[normalAccessor.byteOffset + normalBufferView.byteOffset];
+				const uint8* normalData = accessorData(normalAccessor);
 				assert(normalAccessor.type == TINYGLTF_TYPE_VEC3 && normalAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && (normalBufferView.byteStride == 0 || normalBufferView.byteStride == 12));
 				assert(normalAccessor.count == positionAccessor.count);
 
 				auto uvAttribute = gltfPrimitive.attributes.find("TEXCOORD_0");
-				unsigned char* uvData = nullptr;
+				const uint8* uvData = nullptr;
 				if (uvAttribute != gltfPrimitive.attributes.end()) {
 					auto& uvAccessor = gltfModel.accessors[uvAttribute->second];
 					auto& uvBufferView = gltfModel.bufferViews[uvAccessor.bufferView];
-					auto& uvBuffer = gltfModel.buffers[uvBufferView.buffer];
-					uvData = &uvBuffer.data[uvAccessor.byteOffset + uvBufferView.byteOffset];
+					uvData = accessorData(uvAccessor);
 					assert(uvAccessor.type == TINYGLTF_TYPE_VEC2 && uvAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && (uvBufferView.byteStride == 0 || uvBufferView.byteStride == 8));
 					assert(uvAccessor.count == positionAccessor.count);
 				}
@@ -365,24 +1650,20 @@ struct Scene {
 				}
 
 				auto tangentAttrib = gltfPrimitive.attributes.find("TANGENT");
-				unsigned char* tangentData = nullptr;
+				const uint8* tangentData = nullptr;
 				if (tangentAttrib != gltfPrimitive.attributes.end()) {
 					int tangentAccessorIndex = tangentAttrib->second;
 					auto& tangentAccessor = gltfModel.accessors[tangentAccessorIndex];
 					auto& tangentBufferView = gltfModel.bufferViews[tangentAccessor.bufferView];
-					auto& tangentBuffer = gltfModel.buffers[tangentBufferView.buffer];
-					tangentData = &tangentBuffer.data[tangentAccessor.byteOffset + tangentBufferView.byteOffset];
+					tangentData = accessorData(tangentAccessor);
 					assert(tangentAccessor.type == TINYGLTF_TYPE_VEC4 && tangentAccessor.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && (tangentBufferView.byteStride == 0 || tangentBufferView.byteStride == 16));
 					assert(tangentAccessor.count == positionAccessor.count);
 				}
-				else {
-					assert(gltfModel.materials[gltfPrimitive.material].normalTexture.index < 0);
-				}
+				bool generateTangents = !tangentData && gltfModel.materials[gltfPrimitive.material].normalTexture.index >= 0;
 
 				auto& indexAccessor = gltfModel.accessors[gltfPrimitive.indices];
 				auto& indexBufferView = gltfModel.bufferViews[indexAccessor.bufferView];
-				auto& indexBuffer = gltfModel.buffers[indexBufferView.buffer];
-				unsigned char* indexData = &indexBuffer.data[indexAccessor.byteOffset + indexBufferView.byteOffset];
+				const uint8* indexData = accessorData(indexAccessor);
 				assert(indexAccessor.count % 3 == 0 && indexAccessor.type == TINYGLTF_TYPE_SCALAR);
 				if (indexAccessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
 					assert(indexBufferView.byteStride == 0 || indexBufferView.byteStride == 2);
@@ -411,62 +1692,32 @@ struct Scene {
 				modelPrimitive.indices.resize(indexAccessor.count * modelPrimitive.indexSize);
 				memcpy(modelPrimitive.indices.data(), indexData, indexAccessor.count * modelPrimitive.indexSize);
 
-				modelPrimitive.vertexBuffer = dx12.createBuffer(modelPrimitive.vertices.size() * sizeof(ModelVertex), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
-				modelPrimitive.indexBuffer = dx12.createBuffer(modelPrimitive.indices.size(), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
-				uint8* vertexBufferPtr = nullptr;
-				uint8* indexBufferPtr = nullptr;
-				d3dAssert(modelPrimitive.vertexBuffer.buffer->Map(0, nullptr, reinterpret_cast<void**>(&vertexBufferPtr)));
-				d3dAssert(modelPrimitive.indexBuffer.buffer->Map(0, nullptr, reinterpret_cast<void**>(&indexBufferPtr)));
-				memcpy(vertexBufferPtr, modelPrimitive.vertices.data(), modelPrimitive.vertices.size() * sizeof(ModelVertex));
-				memcpy(indexBufferPtr, modelPrimitive.indices.data(), modelPrimitive.indices.size());
-				modelPrimitive.vertexBuffer.buffer->Unmap(0, nullptr);
-				modelPrimitive.indexBuffer.buffer->Unmap(0, nullptr);
-
+				if (generateTangents) {
+					tangentPrimitives.push_back({ model.meshes.size(), modelMesh.primitives.size() });
+				}
 				modelMesh.primitives.push_back(std::move(modelPrimitive));
 			}
-
-			std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> primitiveGeometryDescs;
-			primitiveGeometryDescs.reserve(modelMesh.primitives.size());
-			for (auto& primitive : modelMesh.primitives) {
-				D3D12_RAYTRACING_GEOMETRY_DESC primitiveGeometryDesc = {};
-				primitiveGeometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-				if (gltfModel.materials[primitive.materialIndex].alphaMode == "OPAQUE") {
-					primitiveGeometryDesc.Flags |= D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+			model.meshes.push_back(std::move(modelMesh));
+		}
+		// before splitting, so tangents are averaged across the seams of the parts
+		threadPool.parallelFor(tangentPrimitives.size(), [&](uint64 i) {
+			generateModelPrimitiveTangents(model.meshes[tangentPrimitives[i].first].primitives[tangentPrimitives[i].second]);
+		});
+		if (importSettings.maxPrimitiveTriangleCount > 0) {
+			for (auto& modelMesh : model.meshes) {
+				std::vector<ModelPrimitive> primitives;
+				for (auto& modelPrimitive : modelMesh.primitives) {
+					if (modelPrimitive.indexCount() / 3 > importSettings.maxPrimitiveTriangleCount) {
+						for (auto& part : splitModelPrimitive(modelPrimitive, importSettings.maxPrimitiveTriangleCount)) {
+							primitives.push_back(std::move(part));
+						}
+					}
+					else {
+						primitives.push_back(std::move(modelPrimitive));
+					}
 				}
-				primitiveGeometryDesc.Triangles.IndexFormat = (primitive.indexSize == 2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
-				primitiveGeometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-				primitiveGeometryDesc.Triangles.IndexCount = static_cast<UINT>(primitive.indices.size() / primitive.indexSize);
-				primitiveGeometryDesc.Triangles.VertexCount = static_cast<UINT>(primitive.vertices.size());
-				primitiveGeometryDesc.Triangles.IndexBuffer = primitive.indexBuffer.buffer->GetGPUVirtualAddress();
-				primitiveGeometryDesc.Triangles.VertexBuffer = { primitive.vertexBuffer.buffer->GetGPUVirtualAddress(), sizeof(ModelVertex) };
-				primitiveGeometryDescs.push_back(primitiveGeometryDesc);
+				modelMesh.primitives = std::move(primitives);
 			}
-
-			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS blasInput = {};
-			blasInput.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
-			blasInput.NumDescs = primitiveGeometryDescs.size();
-			blasInput.pGeometryDescs = primitiveGeometryDescs.data();
-
-			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO blasPrebuildInfo;
-			dx12.device->GetRaytracingAccelerationStructurePrebuildInfo(&blasInput, &blasPrebuildInfo);
-
-			DX12Buffer blasScratchBuffer = dx12.createBuffer(blasPrebuildInfo.ScratchDataSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON);
-			modelMesh.blasBuffer = dx12.createBuffer(blasPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
-			modelMesh.blasBuffer.buffer->SetName(L"bottomAccelerationStructureBuffer");
-
-			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {};
-			blasDesc.DestAccelerationStructureData = modelMesh.blasBuffer.buffer->GetGPUVirtualAddress();
-			blasDesc.Inputs = blasInput;
-			blasDesc.ScratchAccelerationStructureData = blasScratchBuffer.buffer->GetGPUVirtualAddress();
-
-			DX12CommandList& cmdList = dx12.graphicsCommandLists[dx12.currentFrame];
-			cmdList.list->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
-
-			dx12.closeAndExecuteCommandList(dx12.graphicsCommandLists[dx12.currentFrame]);
-			dx12.waitAndResetCommandList(dx12.graphicsCommandLists[dx12.currentFrame]);
-			blasScratchBuffer.buffer->Release();
-
-			model.meshes.push_back(std::move(modelMesh));
 		}
 		model.materials.reserve(gltfModel.materials.size());
 		for (auto& gltfMaterial : gltfModel.materials) {
@@ -505,90 +1756,404 @@ struct Scene {
 			}
 			model.materials.push_back(material);
 		}
-		model.textures.reserve(gltfModel.images.size());
-		for (auto& gltfImage : gltfModel.images) {
-			DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
-			if (gltfImage.component == 1 && gltfImage.bits == 8 && gltfImage.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
-				format = DXGI_FORMAT_R8_UNORM;
+		return model;
+	}
+	// .glb without a copy of its BIN chunk: tinygltf only parses the JSON chunk, in which the buffer standing for the BIN
+	// chunk is swapped for a 1 byte data uri (tinygltf rejects empty ones). Accessors of that buffer read the mapping
+	// instead (accessorData in loadModelFromGLTF) and bufferView images are decoded straight from it
+	static bool loadGLB(tinygltf::TinyGLTF& gltfLoader, const std::filesystem::path& glbFilePath, tinygltf::Model& gltfModel, const std::shared_ptr<GLBFile>& glbPtr, std::vector<ModelImageSource>& imageSources, std::string& error, std::string& warning) {
+		GLBFile& glb = *glbPtr;
+		if (!glb.file.open(glbFilePath)) {
+			error = "cannot open \"" + glbFilePath.string() + "\"";
+			return false;
+		}
+		// magic "glTF", version, file length, then the JSON chunk's length and type "JSON"
+		uint32 header[5] = {};
+		memcpy(header, glb.file.data, std::min<uint64>(glb.file.size, sizeof(header)));
+		if (header[0] != 0x46546C67 || header[1] != 2 || header[2] > glb.file.size || header[4] != 0x4E4F534A || sizeof(header) + static_cast<uint64>(header[3]) > header[2]) {
+			error = "\"" + glbFilePath.string() + "\" is not a glTF 2.0 binary";
+			return false;
+		}
+		uint64 binChunkOffset = sizeof(header) + static_cast<uint64>(header[3]);
+		if (binChunkOffset + 8 <= header[2]) {
+			// length and type "BIN\0"
+			uint32 binChunkHeader[2];
+			memcpy(binChunkHeader, glb.file.data + binChunkOffset, sizeof(binChunkHeader));
+			if (binChunkHeader[1] == 0x004E4942 && binChunkOffset + 8 + binChunkHeader[0] <= header[2]) {
+				glb.binChunk = glb.file.data + binChunkOffset + 8;
+				glb.binChunkSize = binChunkHeader[0];
 			}
-			else if (gltfImage.component == 2 && gltfImage.bits == 8 && gltfImage.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
-				format = DXGI_FORMAT_R8G8_UNORM;
+		}
+		nlohmann::json json = nlohmann::json::parse(glb.file.data + sizeof(header), glb.file.data + binChunkOffset, nullptr, false);
+		if (json.is_discarded() || !json.is_object()) {
+			error = "\"" + glbFilePath.string() + "\" has an invalid JSON chunk";
+			return false;
+		}
+		auto buffers = json.find("buffers");
+		if (buffers != json.end() && buffers->is_array()) {
+			for (uint64 bufferIndex = 0; bufferIndex < buffers->size(); bufferIndex += 1) {
+				nlohmann::json& buffer = (*buffers)[bufferIndex];
+				if (buffer.find("uri") != buffer.end()) {
+					continue;
+				}
+				if (!glb.binChunk || glb.binBufferIndex >= 0 || buffer.value("byteLength", UINT64_MAX) > glb.binChunkSize) {
+					error = "\"" + glbFilePath.string() + "\" buffer " + std::to_string(bufferIndex) + " has no uri and doesn't fit the BIN chunk";
+					return false;
+				}
+				glb.binBufferIndex = static_cast<int>(bufferIndex);
+				buffer["uri"] = "data:application/octet-stream;base64,AA==";
+				buffer["byteLength"] = 1;
 			}
-			else if (gltfImage.component == 4 && gltfImage.bits == 8 && gltfImage.pixel_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
-				format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+		}
+		return loadGLTFJSON(gltfLoader, json, glbFilePath, gltfModel, glbPtr, imageSources, error, warning);
+	}
+	// .gltf counterpart of loadGLB, glb stays empty
+	static bool loadGLTF(tinygltf::TinyGLTF& gltfLoader, const std::filesystem::path& gltfFilePath, tinygltf::Model& gltfModel, const std::shared_ptr<GLBFile>& glb, std::vector<ModelImageSource>& imageSources, std::string& error, std::string& warning) {
+		FileMapping file;
+		if (!file.open(gltfFilePath)) {
+			error = "cannot open \"" + gltfFilePath.string() + "\"";
+			return false;
+		}
+		nlohmann::json json = nlohmann::json::parse(file.data, file.data + file.size, nullptr, false);
+		if (json.is_discarded() || !json.is_object()) {
+			error = "\"" + gltfFilePath.string() + "\" is not valid JSON";
+			return false;
+		}
+		return loadGLTFJSON(gltfLoader, json, gltfFilePath, gltfModel, glb, imageSources, error, warning);
+	}
+	// tinygltf parse of a glTF's JSON with its images taken out, so tinygltf decodes none of them. gltfModel.images only
+	// gets their names and uris, imageSources where their encoded bytes are for decodeModelImage
+	static bool loadGLTFJSON(tinygltf::TinyGLTF& gltfLoader, nlohmann::json& json, const std::filesystem::path& filePath, tinygltf::Model& gltfModel, const std::shared_ptr<GLBFile>& glb, std::vector<ModelImageSource>& imageSources, std::string& error, std::string& warning) {
+		nlohmann::json images = nlohmann::json::array();
+		auto imagesIter = json.find("images");
+		if (imagesIter != json.end()) {
+			images = std::move(*imagesIter);
+			json.erase(imagesIter);
+		}
+		std::string jsonStr = json.dump();
+		if (!gltfLoader.LoadASCIIFromString(&gltfModel, &error, &warning, jsonStr.c_str(), static_cast<unsigned int>(jsonStr.size()), filePath.parent_path().string())) {
+			return false;
+		}
+		for (auto& bufferView : gltfModel.bufferViews) {
+			if (bufferView.buffer == glb->binBufferIndex && bufferView.byteOffset + bufferView.byteLength > glb->binChunkSize) {
+				error = "\"" + filePath.string() + "\" has a bufferView outside of the BIN chunk";
+				return false;
 			}
-			assert(format != DXGI_FORMAT_UNKNOWN);
-			DX12Texture texture = dx12.createTexture(gltfImage.width, gltfImage.height, 1, 1, format, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST);
-			DX12TextureCopy textureCopy = {
-				texture, gltfImage.image.data(), gltfImage.image.size(),
-				D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
-			};
-			dx12.copyTextures(&textureCopy, 1);
-			std::wstring name(gltfImage.uri.begin(), gltfImage.uri.end());
-			texture.texture->SetName(name.c_str());
-			model.textures.push_back(texture);
 		}
-		return model;
+		gltfModel.images.reserve(images.size());
+		imageSources.reserve(images.size());
+		for (auto& image : images) {
+			tinygltf::Image gltfImage;
+			gltfImage.name = image.value("name", std::string());
+			ModelImageSource source;
+			if (image.find("bufferView") != image.end()) {
+				gltfImage.bufferView = image["bufferView"].get<int>();
+				gltfImage.mimeType = image.value("mimeType", std::string());
+				if (gltfImage.bufferView < 0 || gltfImage.bufferView >= gltfModel.bufferViews.size()) {
+					error = "\"" + filePath.string() + "\" image " + std::to_string(gltfModel.images.size()) + " \"" + gltfImage.name + "\" has an invalid bufferView";
+					return false;
+				}
+				const tinygltf::BufferView& bufferView = gltfModel.bufferViews[gltfImage.bufferView];
+				if (bufferView.buffer == glb->binBufferIndex) {
+					source.glb = glb;
+					source.data = glb->binChunk + bufferView.byteOffset;
+					source.size = bufferView.byteLength;
+				}
+				else {
+					const std::vector<unsigned char>& bufferData = gltfModel.buffers[bufferView.buffer].data;
+					if (bufferView.byteOffset + bufferView.byteLength > bufferData.size()) {
+						error = "\"" + filePath.string() + "\" image " + std::to_string(gltfModel.images.size()) + " \"" + gltfImage.name + "\" is outside of its buffer";
+						return false;
+					}
+					source.bytes.assign(bufferData.begin() + bufferView.byteOffset, bufferData.begin() + bufferView.byteOffset + bufferView.byteLength);
+				}
+			}
+			else {
+				gltfImage.uri = image.value("uri", std::string());
+				if (tinygltf::IsDataURI(gltfImage.uri)) {
+					source.dataURI = gltfImage.uri;
+				}
+				else {
+					source.filePath = filePath.parent_path() / gltfImage.uri;
+				}
+			}
+			gltfModel.images.push_back(std::move(gltfImage));
+			imageSources.push_back(std::move(source));
+		}
+		return true;
 	}
-	void rebuildTLAS(DX12Context& dx12) {
-		if (models.empty()) {
+	// 8 bit rgba, like tinygltf's default LoadImageData. Runs on a threadPool job, a source that can't be read or decoded
+	// leaves image.pixels empty for ModelImage::waitDecode to report
+	static void decodeModelImage(const ModelImageSource& source, ModelImage& image) {
+		FileMapping file;
+		std::vector<unsigned char> dataURIBytes;
+		const uint8* data = source.data;
+		uint64 size = source.size;
+		if (!source.bytes.empty()) {
+			data = source.bytes.data();
+			size = source.bytes.size();
+		}
+		else if (!source.dataURI.empty()) {
+			std::string mimeType;
+			if (!tinygltf::DecodeDataURI(&dataURIBytes, mimeType, source.dataURI, 0, false)) {
+				return;
+			}
+			data = dataURIBytes.data();
+			size = dataURIBytes.size();
+		}
+		else if (!source.filePath.empty()) {
+			if (!file.open(source.filePath)) {
+				return;
+			}
+			data = file.data;
+			size = file.size;
+		}
+		if (!data || size > INT_MAX) {
 			return;
 		}
-		if (tlasBuffer.buffer) {
-			tlasBuffer.buffer->Release();
+		int width = 0;
+		int height = 0;
+		int component = 0;
+		uint8* pixels = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &component, 4);
+		if (!pixels) {
+			return;
 		}
-		if (instanceInfosBuffer.buffer) {
-			instanceInfosBuffer.buffer->Release();
+		image.width = width;
+		image.height = height;
+		image.component = 4;
+		image.pixels.assign(pixels, pixels + static_cast<uint64>(width) * height * 4);
+		stbi_image_free(pixels);
+		generateModelImageMips(image);
+	}
+	// the DX12 side of a loaded model: vertex and index upload buffers, a BLAS per mesh and the textures. It records
+	// on dx12's graphics command list, so it stays on the thread that owns it
+	static void createModelGPUResources(Model& model, DX12Context* dx12) {
+		for (auto& modelMesh : model.meshes) {
+			for (auto& primitive : modelMesh.primitives) {
+				primitive.vertexBuffer = dx12->createBuffer(primitive.vertices.size() * sizeof(ModelVertex), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
+				primitive.indexBuffer = dx12->createBuffer(primitive.indices.size(), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
+				uint8* vertexBufferPtr = nullptr;
+				uint8* indexBufferPtr = nullptr;
+				d3dAssert(primitive.vertexBuffer.buffer->Map(0, nullptr, reinterpret_cast<void**>(&vertexBufferPtr)));
+				d3dAssert(primitive.indexBuffer.buffer->Map(0, nullptr, reinterpret_cast<void**>(&indexBufferPtr)));
+				memcpy(vertexBufferPtr, primitive.vertices.data(), primitive.vertices.size() * sizeof(ModelVertex));
+				memcpy(indexBufferPtr, primitive.indices.data(), primitive.indices.size());
+				primitive.vertexBuffer.buffer->Unmap(0, nullptr);
+				primitive.indexBuffer.buffer->Unmap(0, nullptr);
+			}
+
+			std::vector<D3D12_RAYTRACING_GEOMETRY_DESC> primitiveGeometryDescs;
+			primitiveGeometryDescs.reserve(modelMesh.primitives.size());
+			for (auto& primitive : modelMesh.primitives) {
+				D3D12_RAYTRACING_GEOMETRY_DESC primitiveGeometryDesc = {};
+				primitiveGeometryDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+				if (primitive.opaque) {
+					primitiveGeometryDesc.Flags |= D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+				}
+				primitiveGeometryDesc.Triangles.IndexFormat = (primitive.indexSize == 2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+				primitiveGeometryDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+				primitiveGeometryDesc.Triangles.IndexCount = static_cast<UINT>(primitive.indices.size() / primitive.indexSize);
+				primitiveGeometryDesc.Triangles.VertexCount = static_cast<UINT>(primitive.vertices.size());
+				primitiveGeometryDesc.Triangles.IndexBuffer = primitive.indexBuffer.buffer->GetGPUVirtualAddress();
+				primitiveGeometryDesc.Triangles.VertexBuffer = { primitive.vertexBuffer.buffer->GetGPUVirtualAddress(), sizeof(ModelVertex) };
+				primitiveGeometryDescs.push_back(primitiveGeometryDesc);
+			}
+
+			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS blasInput = {};
+			blasInput.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+			blasInput.NumDescs = primitiveGeometryDescs.size();
+			blasInput.pGeometryDescs = primitiveGeometryDescs.data();
+
+			D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO blasPrebuildInfo;
+			dx12->device->GetRaytracingAccelerationStructurePrebuildInfo(&blasInput, &blasPrebuildInfo);
+
+			DX12Buffer blasScratchBuffer = dx12->createBuffer(blasPrebuildInfo.ScratchDataSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON);
+			modelMesh.blasBuffer = dx12->createBuffer(blasPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
+			modelMesh.blasBuffer.buffer->SetName(L"bottomAccelerationStructureBuffer");
+
+			D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC blasDesc = {};
+			blasDesc.DestAccelerationStructureData = modelMesh.blasBuffer.buffer->GetGPUVirtualAddress();
+			blasDesc.Inputs = blasInput;
+			blasDesc.ScratchAccelerationStructureData = blasScratchBuffer.buffer->GetGPUVirtualAddress();
+
+			DX12CommandList& cmdList = dx12->graphicsCommandLists[dx12->currentFrame];
+			cmdList.list->BuildRaytracingAccelerationStructure(&blasDesc, 0, nullptr);
+
+			dx12->closeAndExecuteCommandList(dx12->graphicsCommandLists[dx12->currentFrame]);
+			dx12->waitAndResetCommandList(dx12->graphicsCommandLists[dx12->currentFrame]);
+			blasScratchBuffer.buffer->Release();
 		}
-		if (geometryInfosBuffer.buffer) {
-			geometryInfosBuffer.buffer->Release();
+		// textures are created in the order their images finish decoding, the others keep decoding on threadPool meanwhile
+		model.textures.resize(model.images.size());
+		std::vector<bool> textureCreated(model.images.size(), false);
+		uint64 textureCreatedCount = 0;
+		while (textureCreatedCount < model.images.size()) {
+			bool created = false;
+			for (uint64 imageIndex = 0; imageIndex < model.images.size(); imageIndex += 1) {
+				if (textureCreated[imageIndex] || model.images[imageIndex].decodePending()) {
+					continue;
+				}
+				ModelImage& image = model.images[imageIndex];
+				image.waitDecode();
+				model.textures[imageIndex] = createModelTexture(image, dx12);
+				textureCreated[imageIndex] = true;
+				textureCreatedCount += 1;
+				created = true;
+			}
+			if (!created && !threadPool.runOneJob()) {
+				std::this_thread::yield();
+			}
 		}
-		if (triangleInfosBuffer.buffer) {
-			triangleInfosBuffer.buffer->Release();
+	}
+	// image's pixels with its whole mip chain, 4 component images are sRGB. Block compressed images upload
+	// compressedPixels instead
+	static DX12Texture createModelTexture(ModelImage& image, DX12Context* dx12) {
+		DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+		std::vector<uint8>& pixels = image.compressedFormat != DXGI_FORMAT_UNKNOWN ? image.compressedPixels : image.pixels;
+		if (image.compressedFormat != DXGI_FORMAT_UNKNOWN) {
+			format = image.compressedFormat;
 		}
-		if (materialInfosBuffer.buffer) {
-			materialInfosBuffer.buffer->Release();
+		else if (image.component == 1) {
+			format = DXGI_FORMAT_R8_UNORM;
 		}
-
-		std::vector<std::vector<std::vector<int>>> primitiveIndices;
-		std::vector<GeometryInfo> geometryInfos;
-		std::vector<TriangleInfo> triangleInfos;
-		std::vector<MaterialInfo> materialInfos;
-		int primitiveCount = 0;
+		else if (image.component == 2) {
+			format = DXGI_FORMAT_R8G8_UNORM;
+		}
+		else if (image.component == 4) {
+			format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+		}
+		assert(format != DXGI_FORMAT_UNKNOWN);
+		DX12Texture texture = dx12->createTexture(image.width, image.height, 1, image.mipCount, format, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_COPY_DEST);
+		DX12TextureCopy textureCopy = {
+			texture, pixels.data(), pixels.size(),
+			D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE
+		};
+		dx12->copyTextures(&textureCopy, 1);
+		std::wstring name(image.uri.begin(), image.uri.end());
+		texture.texture->SetName(name.c_str());
+		return texture;
+	}
+	// CPU BVHs are only needed by CPURenderer, so they are built on demand instead of in loadModelFromGLTF.
+	// With a bvhCacheDir (relative to the exe dir) a model whose cache file matches maps it instead of building,
+	// and the others write theirs after building
+	void buildModelMeshBVHs(const std::filesystem::path& bvhCacheDir = "bvhCache") {
+		for (auto& [modelName, model] : models) {
+			uint64 cacheKey = 0;
+			if (!bvhCacheDir.empty()) {
+				cacheKey = bvhCacheKey(model);
+				if (loadBVHCache(model, bvhCacheFilePath(bvhCacheDir, cacheKey), cacheKey)) {
+					continue;
+				}
+			}
+			for (auto& mesh : model.meshes) {
+				mesh.bvh.build(mesh.primitives, model.bvhBuildSettings);
+			}
+			if (!bvhCacheDir.empty()) {
+				std::error_code error;
+				std::filesystem::create_directories(bvhCacheDir, error);
+				writeBVHCache(model, bvhCacheFilePath(bvhCacheDir, cacheKey), cacheKey);
+			}
+		}
+	}
+	void rebuildInstances() {
+		instances.clear();
+		nodeInstanceIndices.clear();
+		for (auto& [modelName, model] : models) {
+			std::vector<int>& modelNodeInstanceIndices = nodeInstanceIndices[&model];
+			modelNodeInstanceIndices.assign(model.nodes.size(), -1);
+			std::stack<std::pair<int, DirectX::XMMATRIX>> nodeStack;
+			for (auto& nodeIndex : model.rootNodes) {
+				nodeStack.push(std::make_pair(nodeIndex, model.nodes[nodeIndex].transform));
+			}
+			while (!nodeStack.empty()) {
+				std::pair<int, DirectX::XMMATRIX> node = nodeStack.top();
+				nodeStack.pop();
+				const ModelNode* modelNode = &model.nodes[node.first];
+				if (modelNode->meshIndex >= 0) {
+					modelNodeInstanceIndices[node.first] = static_cast<int>(instances.size());
+					instances.push_back(SceneInstance{ &model.meshes[modelNode->meshIndex], node.second, &model, node.first });
+				}
+				for (int childIndex : modelNode->children) {
+					DirectX::XMMATRIX childTransform = XMMatrixMultiply(node.second, model.nodes[childIndex].transform);
+					nodeStack.push(std::make_pair(childIndex, childTransform));
+				}
+			}
+		}
+	}
+	// sets the local transform of the given nodes and recomputes the world transform of every instance below them,
+	// returns the changed instance indices (sorted, unique) for updateTLAS and SceneBVH::refit
+	std::vector<uint32> setNodeTransforms(const std::vector<SceneNodeTransform>& nodeTransforms) {
+		for (auto& nodeTransform : nodeTransforms) {
+			auto model = models.find(nodeTransform.modelName);
+			if (model == models.end()) {
+				throw Exception("Scene::setNodeTransforms error: unknown model \"" + nodeTransform.modelName + "\"");
+			}
+			assert(nodeTransform.nodeIndex >= 0 && nodeTransform.nodeIndex < model->second.nodes.size());
+			model->second.nodes[nodeTransform.nodeIndex].transform = nodeTransform.transform;
+		}
+		std::vector<uint32> changedInstances;
+		for (auto& nodeTransform : nodeTransforms) {
+			const Model& model = models.at(nodeTransform.modelName);
+			const std::vector<int>& modelNodeInstanceIndices = nodeInstanceIndices.at(&model);
+			std::stack<std::pair<int, DirectX::XMMATRIX>> nodeStack;
+			nodeStack.push(std::make_pair(nodeTransform.nodeIndex, model.nodeWorldTransform(nodeTransform.nodeIndex)));
+			while (!nodeStack.empty()) {
+				std::pair<int, DirectX::XMMATRIX> node = nodeStack.top();
+				nodeStack.pop();
+				int instanceIndex = modelNodeInstanceIndices[node.first];
+				if (instanceIndex >= 0) {
+					instances[instanceIndex].transform = node.second;
+					changedInstances.push_back(instanceIndex);
+				}
+				for (int childIndex : model.nodes[node.first].children) {
+					DirectX::XMMATRIX childTransform = XMMatrixMultiply(node.second, model.nodes[childIndex].transform);
+					nodeStack.push(std::make_pair(childIndex, childTransform));
+				}
+			}
+		}
+		std::sort(changedInstances.begin(), changedInstances.end());
+		changedInstances.erase(std::unique(changedInstances.begin(), changedInstances.end()), changedInstances.end());
+		return changedInstances;
+	}
+	SceneRayTracingData buildRayTracingData() const {
+		static constexpr uint64 chunkSize = 1 << 16;
+		SceneRayTracingData data;
+		std::unordered_map<const ModelMesh*, int> meshGeometryOffsets;
+		// every chunkSize triangles and vertices of a primitive and where their TriangleIndices and VertexInfos go, filled in parallel below
+		struct PrimitiveChunk {
+			const ModelPrimitive* primitive;
+			uint64 first;
+			uint64 triangleOffset;
+			uint64 vertexOffset;
+			uint64 geometryIndex;
+			// summed over the chunk's triangles for GeometryInfo::texCoordAreaRatio
+			double texCoordArea;
+			double area;
+		};
+		std::vector<PrimitiveChunk> primitiveChunks;
+		uint64 triangleCount = 0;
+		uint64 vertexCount = 0;
 		int textureCount = 0;
 		for (auto& [modelName, model] : models) {
-			std::vector<std::vector<int>> modelPrimitiveIndices;
 			for (auto& mesh : model.meshes) {
-				std::vector<int> meshPrimitiveIndices;
+				meshGeometryOffsets[&mesh] = static_cast<int>(data.geometryInfos.size());
 				for (auto& primitive : mesh.primitives) {
-					meshPrimitiveIndices.push_back(primitiveCount);
-					primitiveCount += 1;
 					GeometryInfo geometryInfo;
-					geometryInfo.triangleOffset = static_cast<int>(triangleInfos.size());
-					geometryInfo.materialIndex = primitive.materialIndex >= 0 ? static_cast<int>(materialInfos.size()) + primitive.materialIndex : -1;
-					geometryInfos.push_back(geometryInfo);
-					for (uint64 indexIndex = 0; indexIndex < primitive.indices.size() / primitive.indexSize; indexIndex += 3) {
-						TriangleInfo triangleInfo = {};
-						for (uint64 triangleIndex = 0; triangleIndex < 3; triangleIndex += 1) {
-							uint8* indexPtr = &primitive.indices[(indexIndex + triangleIndex) * primitive.indexSize];
-							uint32 index = 0;
-							if (primitive.indexSize == 2) {
-								index = *reinterpret_cast<uint16*>(indexPtr);
-							}
-							else {
-								index = *reinterpret_cast<uint32*>(indexPtr);
-							}
-							ModelVertex& vertex = primitive.vertices[index];
-							arrayCopy(triangleInfo.normals[triangleIndex], vertex.normal);
-							arrayCopy(triangleInfo.uvs[triangleIndex], vertex.uv);
-							arrayCopy(triangleInfo.tangents[triangleIndex], vertex.tangent);
-						}
-						triangleInfos.push_back(triangleInfo);
+					geometryInfo.triangleOffset = static_cast<int>(triangleCount);
+					geometryInfo.vertexOffset = static_cast<int>(vertexCount);
+					geometryInfo.materialIndex = primitive.materialIndex >= 0 ? static_cast<int>(data.materialInfos.size()) + primitive.materialIndex : -1;
+					data.geometryInfos.push_back(geometryInfo);
+					uint64 primitiveTriangleCount = primitive.indexCount() / 3;
+					uint64 primitiveChunkEnd = std::max<uint64>(primitiveTriangleCount, primitive.vertices.size());
+					for (uint64 first = 0; first < primitiveChunkEnd; first += chunkSize) {
+						primitiveChunks.push_back(PrimitiveChunk{ &primitive, first, triangleCount, vertexCount, data.geometryInfos.size() - 1, 0, 0 });
 					}
+					triangleCount += primitiveTriangleCount;
+					vertexCount += primitive.vertices.size();
+					// triangleOffset and vertexOffset are ints on the GPU
+					assert(triangleCount <= INT_MAX && vertexCount <= INT_MAX);
 				}
-				modelPrimitiveIndices.push_back(std::move(meshPrimitiveIndices));
 			}
-			primitiveIndices.push_back(std::move(modelPrimitiveIndices));
 			for (auto& material : model.materials) {
 				MaterialInfo materialInfo = { material };
 				if (material.baseColorTextureIndex >= 0) {
@@ -598,45 +2163,106 @@ struct Scene {
 				if (material.normalTextureIndex >= 0) {
 					materialInfo.material.normalTextureIndex = textureCount + material.normalTextureIndex;
 					materialInfo.material.normalTextureSamplerIndex = material.normalTextureSamplerIndex;
+					materialInfo.normalTextureTwoChannel = model.images[material.normalTextureIndex].compressedFormat == DXGI_FORMAT_BC5_UNORM;
 				}
 				if (material.emissiveTextureIndex >= 0) {
 					materialInfo.material.emissiveTextureIndex = textureCount + material.emissiveTextureIndex;
 					materialInfo.material.emissiveTextureSamplerIndex = material.emissiveTextureSamplerIndex;
 				}
-				materialInfos.push_back(materialInfo);
+				data.materialInfos.push_back(materialInfo);
 			}
-			textureCount += static_cast<int>(model.textures.size());
-		}
-		std::vector<InstanceInfo> instanceInfos;
-		std::vector<D3D12_RAYTRACING_INSTANCE_DESC> tlasInstanceDescs;
-		int modelIndex = 0;
-		for (auto& [modelName, model] : models) {
-			std::stack<std::pair<int, DirectX::XMMATRIX>> nodeStack;
-			for (auto& nodeIndex : model.rootNodes) {
-				nodeStack.push(std::make_pair(nodeIndex, model.nodes[nodeIndex].transform));
+			for (auto& image : model.images) {
+				data.textures.push_back(&image);
 			}
-			while (!nodeStack.empty()) {
-				std::pair<int, DirectX::XMMATRIX> node = nodeStack.top();
-				nodeStack.pop();
-				ModelNode* modelNode = &model.nodes[node.first];
-				if (modelNode->meshIndex >= 0) {
-					ModelMesh& mesh = model.meshes[modelNode->meshIndex];
-					D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
-					DirectX::XMStoreFloat3x4(reinterpret_cast<DirectX::XMFLOAT3X4*>(instanceDesc.Transform), node.second);
-					instanceDesc.InstanceMask = 0xff;
-					instanceDesc.AccelerationStructure = mesh.blasBuffer.buffer->GetGPUVirtualAddress();
-					tlasInstanceDescs.push_back(instanceDesc);
-					InstanceInfo instanceInfo = {};
-					instanceInfo.transformMat = node.second;
-					instanceInfo.geometryOffset = primitiveIndices[modelIndex][modelNode->meshIndex][0];
-					instanceInfos.push_back(instanceInfo);
-				}
-				for (int childIndex : modelNode->children) {
-					DirectX::XMMATRIX childTransform = XMMatrixMultiply(node.second, model.nodes[childIndex].transform);
-					nodeStack.push(std::make_pair(childIndex, childTransform));
+			textureCount += static_cast<int>(model.images.size());
+		}
+		data.triangleIndices.resize(triangleCount);
+		data.vertexInfos.resize(vertexCount);
+		threadPool.parallelFor(primitiveChunks.size(), [&](uint64 chunkIndex) {
+			PrimitiveChunk& chunk = primitiveChunks[chunkIndex];
+			const ModelPrimitive& primitive = *chunk.primitive;
+			uint64 triangleEnd = std::min(chunk.first + chunkSize, primitive.indexCount() / 3);
+			for (uint64 triangle = chunk.first; triangle < triangleEnd; triangle += 1) {
+				TriangleIndices& indices = data.triangleIndices[chunk.triangleOffset + triangle];
+				for (uint64 vertexIndex = 0; vertexIndex < 3; vertexIndex += 1) {
+					indices.indices[vertexIndex] = primitive.getIndex(triangle * 3 + vertexIndex);
 				}
+				const ModelVertex& v0 = primitive.vertices[indices.indices[0]];
+				const ModelVertex& v1 = primitive.vertices[indices.indices[1]];
+				const ModelVertex& v2 = primitive.vertices[indices.indices[2]];
+				float e1[3] = { v1.position[0] - v0.position[0], v1.position[1] - v0.position[1], v1.position[2] - v0.position[2] };
+				float e2[3] = { v2.position[0] - v0.position[0], v2.position[1] - v0.position[1], v2.position[2] - v0.position[2] };
+				float normal[3];
+				crossProduct(e1, e2, normal);
+				chunk.area += vec3Len(normal);
+				chunk.texCoordArea += fabsf((v1.uv[0] - v0.uv[0]) * (v2.uv[1] - v0.uv[1]) - (v1.uv[1] - v0.uv[1]) * (v2.uv[0] - v0.uv[0]));
+			}
+			uint64 vertexEnd = std::min(chunk.first + chunkSize, static_cast<uint64>(primitive.vertices.size()));
+			for (uint64 vertex = chunk.first; vertex < vertexEnd; vertex += 1) {
+				encodeVertexInfo(primitive.vertices[vertex], data.vertexInfos[chunk.vertexOffset + vertex]);
 			}
-			modelIndex += 1;
+		});
+		std::vector<std::pair<double, double>> geometryAreas(data.geometryInfos.size());
+		for (auto& chunk : primitiveChunks) {
+			geometryAreas[chunk.geometryIndex].first += chunk.texCoordArea;
+			geometryAreas[chunk.geometryIndex].second += chunk.area;
+		}
+		for (uint64 i = 0; i < data.geometryInfos.size(); i += 1) {
+			data.geometryInfos[i].texCoordAreaRatio = geometryAreas[i].second > 0 ? static_cast<float>(geometryAreas[i].first / geometryAreas[i].second) : 0.0f;
+		}
+		data.instances = instances;
+		data.instanceInfos.reserve(instances.size());
+		for (auto& instance : instances) {
+			InstanceInfo instanceInfo = {};
+			instanceInfo.transformMat = instance.transform;
+			instanceInfo.geometryOffset = meshGeometryOffsets.at(instance.mesh);
+			data.instanceInfos.push_back(instanceInfo);
+		}
+		return data;
+	}
+	void rebuildTLAS(DX12Context& dx12) {
+		if (models.empty()) {
+			return;
+		}
+		if (tlasBuffer.buffer) {
+			tlasBuffer.buffer->Release();
+		}
+		if (instanceInfosBuffer.buffer) {
+			instanceInfosBuffer.buffer->Release();
+		}
+		if (geometryInfosBuffer.buffer) {
+			geometryInfosBuffer.buffer->Release();
+		}
+		if (triangleIndicesBuffer.buffer) {
+			triangleIndicesBuffer.buffer->Release();
+		}
+		if (vertexInfosBuffer.buffer) {
+			vertexInfosBuffer.buffer->Release();
+		}
+		if (materialInfosBuffer.buffer) {
+			materialInfosBuffer.buffer->Release();
+		}
+		if (tlasInstanceDescsBuffer.buffer) {
+			tlasInstanceDescsBuffer.buffer->Release();
+		}
+		if (tlasScratchBuffer.buffer) {
+			tlasScratchBuffer.buffer->Release();
+		}
+
+		SceneRayTracingData data = buildRayTracingData();
+		std::vector<InstanceInfo>& instanceInfos = data.instanceInfos;
+		std::vector<GeometryInfo>& geometryInfos = data.geometryInfos;
+		std::vector<TriangleIndices>& triangleIndices = data.triangleIndices;
+		std::vector<SceneVertexInfo>& vertexInfos = data.vertexInfos;
+		std::vector<MaterialInfo>& materialInfos = data.materialInfos;
+		std::vector<D3D12_RAYTRACING_INSTANCE_DESC> tlasInstanceDescs;
+		tlasInstanceDescs.reserve(data.instances.size());
+		for (auto& instance : data.instances) {
+			D3D12_RAYTRACING_INSTANCE_DESC instanceDesc = {};
+			DirectX::XMStoreFloat3x4(reinterpret_cast<DirectX::XMFLOAT3X4*>(instanceDesc.Transform), instance.transform);
+			instanceDesc.InstanceMask = 0xff;
+			instanceDesc.AccelerationStructure = instance.mesh->blasBuffer.buffer->GetGPUVirtualAddress();
+			tlasInstanceDescs.push_back(instanceDesc);
 		}
 
 		instanceInfoCount = instanceInfos.size();
@@ -655,13 +2281,21 @@ struct Scene {
 		memcpy(geometryInfosBufferPtr, geometryInfos.data(), geometryInfos.size() * sizeof(geometryInfos[0]));
 		geometryInfosBuffer.buffer->Unmap(0, nullptr);
 
-		triangleInfoCount = triangleInfos.size();
-		triangleInfosBuffer = dx12.createBuffer(triangleInfos.size() * sizeof(triangleInfos[0]), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
-		triangleInfosBuffer.buffer->SetName(L"triangleInfosBuffer");
-		void* triangleInfosBufferPtr = nullptr;
-		triangleInfosBuffer.buffer->Map(0, nullptr, &triangleInfosBufferPtr);
-		memcpy(triangleInfosBufferPtr, triangleInfos.data(), triangleInfos.size() * sizeof(triangleInfos[0]));
-		triangleInfosBuffer.buffer->Unmap(0, nullptr);
+		triangleIndicesCount = triangleIndices.size();
+		triangleIndicesBuffer = dx12.createBuffer(triangleIndices.size() * sizeof(triangleIndices[0]), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
+		triangleIndicesBuffer.buffer->SetName(L"triangleIndicesBuffer");
+		void* triangleIndicesBufferPtr = nullptr;
+		triangleIndicesBuffer.buffer->Map(0, nullptr, &triangleIndicesBufferPtr);
+		memcpy(triangleIndicesBufferPtr, triangleIndices.data(), triangleIndices.size() * sizeof(triangleIndices[0]));
+		triangleIndicesBuffer.buffer->Unmap(0, nullptr);
+
+		vertexInfoCount = vertexInfos.size();
+		vertexInfosBuffer = dx12.createBuffer(vertexInfos.size() * sizeof(vertexInfos[0]), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
+		vertexInfosBuffer.buffer->SetName(L"vertexInfosBuffer");
+		void* vertexInfosBufferPtr = nullptr;
+		vertexInfosBuffer.buffer->Map(0, nullptr, &vertexInfosBufferPtr);
+		memcpy(vertexInfosBufferPtr, vertexInfos.data(), vertexInfos.size() * sizeof(vertexInfos[0]));
+		vertexInfosBuffer.buffer->Unmap(0, nullptr);
 
 		materialInfoCount = materialInfos.size();
 		materialInfosBuffer = dx12.createBuffer(materialInfos.size() * sizeof(materialInfos[0]), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
@@ -671,7 +2305,7 @@ struct Scene {
 		memcpy(materialInfosBufferPtr, materialInfos.data(), materialInfos.size() * sizeof(materialInfos[0]));
 		materialInfosBuffer.buffer->Unmap(0, nullptr);
 
-		DX12Buffer tlasInstanceDescsBuffer = dx12.createBuffer(tlasInstanceDescs.size() * sizeof(tlasInstanceDescs[0]), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
+		tlasInstanceDescsBuffer = dx12.createBuffer(tlasInstanceDescs.size() * sizeof(tlasInstanceDescs[0]), D3D12_HEAP_TYPE_UPLOAD, D3D12_RESOURCE_FLAG_NONE, D3D12_RESOURCE_STATE_GENERIC_READ);
 		void* instanceDescsBuffer = nullptr;
 		tlasInstanceDescsBuffer.buffer->Map(0, nullptr, &instanceDescsBuffer);
 		memcpy(instanceDescsBuffer, tlasInstanceDescs.data(), tlasInstanceDescs.size() * sizeof(tlasInstanceDescs[0]));
@@ -685,7 +2319,8 @@ struct Scene {
 
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO tlasPrebuildInfo = {};
 		dx12.device->GetRaytracingAccelerationStructurePrebuildInfo(&tlasInputs, &tlasPrebuildInfo);
-		DX12Buffer tlasScratchBuffer = dx12.createBuffer(tlasPrebuildInfo.ScratchDataSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON);
+		// kept for updateTLAS, which refits in place with PERFORM_UPDATE
+		tlasScratchBuffer = dx12.createBuffer(std::max(tlasPrebuildInfo.ScratchDataSizeInBytes, tlasPrebuildInfo.UpdateScratchDataSizeInBytes), D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COMMON);
 		tlasBuffer = dx12.createBuffer(tlasPrebuildInfo.ResultDataMaxSizeInBytes, D3D12_HEAP_TYPE_DEFAULT, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_RAYTRACING_ACCELERATION_STRUCTURE);
 		tlasBuffer.buffer->SetName(L"topAccelerationStructureBuffer");
 
@@ -698,7 +2333,45 @@ struct Scene {
 		cmdList.list->BuildRaytracingAccelerationStructure(&tlasDesc, 0, nullptr);
 		dx12.closeAndExecuteCommandList(dx12.graphicsCommandLists[dx12.currentFrame]);
 		dx12.waitAndResetCommandList(dx12.graphicsCommandLists[dx12.currentFrame]);
+	}
+	// rewrites the transforms of changedInstances (from setNodeTransforms) in the instance desc and InstanceInfo upload
+	// buffers and refits the TLAS in place, the instance count and BLASes have to be the same as in the last rebuildTLAS
+	void updateTLAS(DX12Context& dx12, const std::vector<uint32>& changedInstances) {
+		if (changedInstances.empty()) {
+			return;
+		}
+		assert(tlasBuffer.buffer && instanceInfoCount == instances.size());
+		// the upload buffers are rewritten in place, the frame in flight may still be reading them
+		dx12.drainGraphicsCommandQueue();
+		uint8* instanceDescsBufferPtr = nullptr;
+		uint8* instanceInfosBufferPtr = nullptr;
+		D3D12_RANGE readRange = { 0, 0 };
+		d3dAssert(tlasInstanceDescsBuffer.buffer->Map(0, &readRange, reinterpret_cast<void**>(&instanceDescsBufferPtr)));
+		d3dAssert(instanceInfosBuffer.buffer->Map(0, &readRange, reinterpret_cast<void**>(&instanceInfosBufferPtr)));
+		for (uint32 instanceIndex : changedInstances) {
+			D3D12_RAYTRACING_INSTANCE_DESC* instanceDesc = reinterpret_cast<D3D12_RAYTRACING_INSTANCE_DESC*>(instanceDescsBufferPtr) + instanceIndex;
+			DirectX::XMStoreFloat3x4(reinterpret_cast<DirectX::XMFLOAT3X4*>(instanceDesc->Transform), instances[instanceIndex].transform);
+			InstanceInfo* instanceInfo = reinterpret_cast<InstanceInfo*>(instanceInfosBufferPtr) + instanceIndex;
+			instanceInfo->transformMat = instances[instanceIndex].transform;
+		}
+		tlasInstanceDescsBuffer.buffer->Unmap(0, nullptr);
+		instanceInfosBuffer.buffer->Unmap(0, nullptr);
+
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS tlasInputs = {};
+		tlasInputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+		tlasInputs.Flags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		tlasInputs.NumDescs = static_cast<UINT>(instances.size());
+		tlasInputs.InstanceDescs = tlasInstanceDescsBuffer.buffer->GetGPUVirtualAddress();
+
+		D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC tlasDesc = {};
+		tlasDesc.DestAccelerationStructureData = tlasBuffer.buffer->GetGPUVirtualAddress();
+		tlasDesc.SourceAccelerationStructureData = tlasBuffer.buffer->GetGPUVirtualAddress();
+		tlasDesc.Inputs = tlasInputs;
+		tlasDesc.ScratchAccelerationStructureData = tlasScratchBuffer.buffer->GetGPUVirtualAddress();
 
-		tlasInstanceDescsBuffer.buffer->Release();
+		DX12CommandList& cmdList = dx12.graphicsCommandLists[dx12.currentFrame];
+		cmdList.list->BuildRaytracingAccelerationStructure(&tlasDesc, 0, nullptr);
+		dx12.closeAndExecuteCommandList(dx12.graphicsCommandLists[dx12.currentFrame]);
+		dx12.waitAndResetCommandList(dx12.graphicsCommandLists[dx12.currentFrame]);
 	}
 };
\ No newline at end of file
@@ -1,4 +1,13 @@
 #include "miscs.h"
+#include "bvh.h"
+#include "textureCompression.h"
+#include "scene.h"
+#include "cpuRenderer.h"
+
+#include <array>
+#include <chrono>
+#include <numeric>
+#include <random>
 
 static uint64 _testErrorCount_ = 0;
 static uint64 _testCount_ = 0;
@@ -86,5 +95,1651 @@ void runTests() {
 		CASEEND();
 	}
 	TESTEND();
+	TEST("ThreadPool");
+	{
+		ThreadPool pool(4);
+		// thrown by the jobs below, Exception would log every throw
+		struct JobError {};
+		CASE("parallelFor exception");
+		{
+			for (int n = 0; n < 20; n += 1) {
+				std::atomic<uint64> callCount = 0;
+				bool thrown = false;
+				try {
+					pool.parallelFor(10000, [&](uint64 i) {
+						callCount.fetch_add(1);
+						if (i % 997 == 5) {
+							throw JobError();
+						}
+					});
+				}
+				catch (const JobError&) {
+					thrown = true;
+				}
+				ASSERT(thrown);
+				// no index is started once parallelFor has returned
+				uint64 returnCallCount = callCount.load();
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				ASSERT(callCount.load() == returnCallCount);
+			}
+			bool nestedThrown = false;
+			try {
+				pool.parallelFor(8, [&](uint64) {
+					pool.parallelFor(100, [](uint64 i) {
+						if (i == 77) {
+							throw JobError();
+						}
+					});
+				});
+			}
+			catch (const JobError&) {
+				nestedThrown = true;
+			}
+			ASSERT(nestedThrown);
+			std::atomic<uint64> sum = 0;
+			pool.parallelFor(1000, [&](uint64 i) { sum.fetch_add(i); });
+			ASSERT(sum.load() == 999 * 1000 / 2);
+		}
+		CASEEND();
+		CASE("Task group exception");
+		{
+			std::atomic<uint64> runCount = 0;
+			ThreadPoolTaskGroup taskGroup(pool);
+			for (int i = 0; i < 100; i += 1) {
+				taskGroup.run([&runCount, i] {
+					runCount.fetch_add(1);
+					if (i == 50) {
+						throw JobError();
+					}
+				});
+			}
+			bool thrown = false;
+			try {
+				taskGroup.wait();
+			}
+			catch (const JobError&) {
+				thrown = true;
+			}
+			ASSERT(thrown);
+			// the throwing job still counted as done, and the exception is only reported once
+			ASSERT(runCount.load() == 100 && taskGroup.pendingCount->load() == 0);
+			taskGroup.run([&runCount] { runCount.fetch_add(1); });
+			taskGroup.wait();
+			ASSERT(runCount.load() == 101);
+		}
+		CASEEND();
+	}
+	TESTEND();
+	TEST("BVH");
+	{
+		std::mt19937 random(1234);
+		std::uniform_real_distribution<float> uniform(-10.0f, 10.0f);
+		std::vector<BVHTriangle> triangles(2000);
+		std::vector<AABB> triangleBounds(triangles.size());
+		for (uint32 i = 0; i < triangles.size(); i += 1) {
+			float center[3] = { uniform(random), uniform(random), uniform(random) };
+			float* vertices[3] = { triangles[i].v0, triangles[i].v1, triangles[i].v2 };
+			for (float* vertex : vertices) {
+				for (int j = 0; j < 3; j += 1) {
+					vertex[j] = center[j] + uniform(random) * 0.1f;
+				}
+				triangleBounds[i].extend(vertex);
+			}
+		}
+		BVHBuildSettings settings;
+		settings.binCount = 12;
+		settings.maxLeafSize = 4;
+		BVH bvh = buildBVH(triangleBounds, settings);
+		CASE("Build");
+		{
+			std::vector<uint32> primRefCounts(triangles.size());
+			for (auto& node : bvh.nodes) {
+				if (node.isLeaf()) {
+					ASSERT(node.primCount <= settings.maxLeafSize);
+					for (uint32 i = 0; i < node.primCount; i += 1) {
+						primRefCounts[bvh.primIndices[node.primOffset + i]] += 1;
+					}
+				}
+				else {
+					for (uint32 child = node.childIndex; child < node.childIndex + 2; child += 1) {
+						for (int i = 0; i < 3; i += 1) {
+							ASSERT(bvh.nodes[child].bounds.min[i] >= node.bounds.min[i] && bvh.nodes[child].bounds.max[i] <= node.bounds.max[i]);
+						}
+					}
+				}
+			}
+			ASSERT(std::all_of(primRefCounts.begin(), primRefCounts.end(), [](uint32 count) { return count == 1; }));
+			ASSERT(bvhSAHCost(bvh, settings) < settings.intersectionCost * triangles.size());
+		}
+		CASEEND();
+		CASE("Trace");
+		{
+			for (int i = 0; i < 256; i += 1) {
+				Ray ray;
+				float direction[3] = { uniform(random), uniform(random), uniform(random) };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				traceBVH(bvh, triangles.data(), ray, hit);
+				RayHit bruteForceHit;
+				for (uint32 primIndex = 0; primIndex < triangles.size(); primIndex += 1) {
+					float t, u, v;
+					if (rayIntersectTriangle(triangles[primIndex], ray, t, u, v) && t < bruteForceHit.t) {
+						bruteForceHit.t = t;
+						bruteForceHit.primIndex = primIndex;
+					}
+				}
+				ASSERT(hit.primIndex == bruteForceHit.primIndex && hit.t == bruteForceHit.t);
+			}
+		}
+		CASEEND();
+		CASE("BVH8");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			for (int i = 0; i < 256; i += 1) {
+				Ray ray;
+				float direction[3] = { uniform(random), uniform(random), uniform(random) };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				RayHit bvh8Hit;
+				traceBVH(bvh, triangles.data(), ray, hit);
+				traceBVH8(bvh8, triangles.data(), ray, bvh8Hit);
+				ASSERT(hit.primIndex == bvh8Hit.primIndex && hit.t == bvh8Hit.t);
+				// both kernels round the same operations, so even grazed children must agree exactly
+				if (cpuSupportsAVX2) {
+					BVH8Ray bvh8Ray(ray);
+					for (auto& node : bvh8.nodes) {
+						float tNears[8];
+						uint32 mask = bvh8IntersectChildrenSSE4(node, bvh8Ray, ray.tMin, ray.tMax, tNears);
+						ASSERT(mask == bvh8IntersectChildrenAVX2(node, bvh8Ray, ray.tMin, ray.tMax, tNears));
+					}
+				}
+			}
+		}
+		CASEEND();
+		CASE("BVH8 packet");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			for (int i = 0; i < 64; i += 1) {
+				// 8x8 grid of rays from one origin, every 4th packet random directions to take the single ray fallback
+				float origin[3] = { uniform(random) * 2.0f, uniform(random) * 2.0f, uniform(random) * 2.0f };
+				float center[3] = { uniform(random), uniform(random), uniform(random) };
+				RayPacket packet;
+				for (uint32 y = 0; y < 8; y += 1) {
+					for (uint32 x = 0; x < 8; x += 1) {
+						Ray ray;
+						float direction[3] = { center[0] + x * 0.05f, center[1] + y * 0.05f, center[2] };
+						if (i % 4 == 3) {
+							direction[0] = uniform(random);
+							direction[1] = uniform(random);
+							direction[2] = uniform(random);
+						}
+						arrayCopy(ray.origin, origin);
+						vec3Normalize(direction, ray.direction);
+						packet.addRay(ray);
+					}
+				}
+				RayHit hits[RayPacket::maxRayCount];
+				uint64 hitMask = traceBVH8Packet(bvh8, triangles.data(), packet, hits);
+				for (uint32 rayIndex = 0; rayIndex < packet.rayCount; rayIndex += 1) {
+					Ray ray = packet.ray(rayIndex);
+					ray.tMax = FLT_MAX;
+					RayHit hit;
+					bool found = traceBVH8(bvh8, triangles.data(), ray, hit);
+					ASSERT(found == ((hitMask >> rayIndex) & 1) && (!found || (hit.primIndex == hits[rayIndex].primIndex && hit.t == hits[rayIndex].t)));
+				}
+			}
+		}
+		CASEEND();
+		CASE("Occluded");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			for (int i = 0; i < 16; i += 1) {
+				float origin[3] = { uniform(random) * 2.0f, uniform(random) * 2.0f, uniform(random) * 2.0f };
+				float center[3] = { uniform(random), uniform(random), uniform(random) };
+				Ray rays[RayPacket::maxRayCount];
+				RayPacket packet;
+				for (uint32 y = 0; y < 8; y += 1) {
+					for (uint32 x = 0; x < 8; x += 1) {
+						Ray& ray = rays[packet.rayCount];
+						float direction[3] = { center[0] + x * 0.05f, center[1] + y * 0.05f, center[2] };
+						arrayCopy(ray.origin, origin);
+						vec3Normalize(direction, ray.direction);
+						ray.tMax = (uniform(random) + 10.0f) * 0.5f;
+						packet.addRay(ray);
+					}
+				}
+				RayPacket closestHitPacket = packet;
+				RayHit hits[RayPacket::maxRayCount];
+				uint64 hitMask = traceBVH8Packet(bvh8, triangles.data(), closestHitPacket, hits);
+				ASSERT(occludedBVH8Packet(bvh8, triangles.data(), packet) == hitMask);
+				for (uint32 rayIndex = 0; rayIndex < packet.rayCount; rayIndex += 1) {
+					ASSERT(occludedBVH8(bvh8, triangles.data(), rays[rayIndex]) == static_cast<bool>((hitMask >> rayIndex) & 1));
+				}
+			}
+		}
+		CASEEND();
+		CASE("BVH8 quantized");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			BVH8Quantized quantizedBVH8 = buildBVH8Quantized(bvh8);
+			ASSERT(quantizedBVH8.nodes.size() == bvh8.nodes.size());
+			for (uint64 nodeIndex = 0; nodeIndex < bvh8.nodes.size(); nodeIndex += 1) {
+				for (uint32 slot = 0; slot < 8; slot += 1) {
+					const BVH8QuantizedNode& node = quantizedBVH8.nodes[nodeIndex];
+					ASSERT(static_cast<bool>(node.childMask & (1 << slot)) == (bvh8.nodes[nodeIndex].childIndices[slot] != UINT32_MAX));
+					if (node.childMask & (1 << slot)) {
+						float bounds[6];
+						float quantizedBounds[6];
+						bvh8ChildBounds(bvh8.nodes[nodeIndex], slot, bounds);
+						bvh8ChildBounds(node, slot, quantizedBounds);
+						for (int axis = 0; axis < 3; axis += 1) {
+							ASSERT(quantizedBounds[axis] <= bounds[axis] && quantizedBounds[axis + 3] >= bounds[axis + 3]);
+						}
+					}
+				}
+			}
+			for (int i = 0; i < 256; i += 1) {
+				Ray ray;
+				float direction[3] = { uniform(random) - 0.5f, uniform(random) - 0.5f, uniform(random) - 0.5f };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				RayHit quantizedHit;
+				bool found = traceBVH8(bvh8, triangles.data(), ray, hit);
+				ASSERT(traceBVH8(quantizedBVH8, triangles.data(), ray, quantizedHit) == found);
+				ASSERT(hit.primIndex == quantizedHit.primIndex && hit.t == quantizedHit.t);
+				ASSERT(occludedBVH8(quantizedBVH8, triangles.data(), ray) == found);
+				if (cpuSupportsAVX2) {
+					BVH8Ray bvh8Ray(ray);
+					for (auto& node : quantizedBVH8.nodes) {
+						float tNears[8];
+						uint32 mask = bvh8IntersectQuantizedChildrenSSE4(node, bvh8Ray, ray.tMin, ray.tMax, tNears);
+						ASSERT(mask == bvh8IntersectQuantizedChildrenAVX2(node, bvh8Ray, ray.tMin, ray.tMax, tNears));
+					}
+				}
+			}
+			for (int i = 0; i < 16; i += 1) {
+				float origin[3] = { uniform(random) * 2.0f, uniform(random) * 2.0f, uniform(random) * 2.0f };
+				float center[3] = { uniform(random), uniform(random), uniform(random) };
+				RayPacket packet;
+				for (uint32 y = 0; y < 8; y += 1) {
+					for (uint32 x = 0; x < 8; x += 1) {
+						Ray ray;
+						float direction[3] = { center[0] + x * 0.05f, center[1] + y * 0.05f, center[2] };
+						arrayCopy(ray.origin, origin);
+						vec3Normalize(direction, ray.direction);
+						packet.addRay(ray);
+					}
+				}
+				RayPacket quantizedPacket = packet;
+				RayHit hits[RayPacket::maxRayCount];
+				RayHit quantizedHits[RayPacket::maxRayCount];
+				uint64 hitMask = traceBVH8Packet(bvh8, triangles.data(), packet, hits);
+				ASSERT(traceBVH8Packet(quantizedBVH8, triangles.data(), quantizedPacket, quantizedHits) == hitMask);
+				for (uint32 rayIndex = 0; rayIndex < packet.rayCount; rayIndex += 1) {
+					ASSERT(!((hitMask >> rayIndex) & 1) || (hits[rayIndex].primIndex == quantizedHits[rayIndex].primIndex && hits[rayIndex].t == quantizedHits[rayIndex].t));
+				}
+			}
+		}
+		CASEEND();
+		CASE("BVH8 stats");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			BVH8Stats stats = bvh8Stats(bvh8);
+			ASSERT(stats.interiorNodeCount == bvh8.nodes.size() && stats.leafPrimCount == triangles.size());
+			uint64 leafCount = 0;
+			for (uint64 count : stats.leafDepthHistogram) {
+				leafCount += count;
+			}
+			ASSERT(leafCount == stats.leafCount && stats.leafDepthHistogram[0] == 0 && stats.leafDepthHistogram.back() > 0);
+			BVH8Stats quantizedStats = bvh8Stats(buildBVH8Quantized(bvh8));
+			ASSERT(quantizedStats.leafCount == stats.leafCount && quantizedStats.leafDepthHistogram == stats.leafDepthHistogram);
+			stats.add(quantizedStats);
+			ASSERT(stats.leafCount == quantizedStats.leafCount * 2);
+			Ray ray;
+			float direction[3] = { 1, 1, 1 };
+			ray.origin[0] = ray.origin[1] = ray.origin[2] = 0;
+			vec3Normalize(direction, ray.direction);
+			BVHTraversalStats traversalStats;
+			bvhTraversalStats = &traversalStats;
+			RayHit hit;
+			traceBVH8(bvh8, triangles.data(), ray, hit);
+			bvhTraversalStats = nullptr;
+			ASSERT(traversalStats.nodesVisited > 0 && traversalStats.primsTested > 0);
+			BVHTraversalStats countedStats = traversalStats;
+			traceBVH8(bvh8, triangles.data(), ray, hit);
+			ASSERT(traversalStats.nodesVisited == countedStats.nodesVisited);
+		}
+		CASEEND();
+		CASE("Ray stream order");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			std::vector<Ray> rays(1000);
+			for (auto& ray : rays) {
+				float direction[3] = { uniform(random), uniform(random), uniform(random) };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+			}
+			std::vector<uint32> order;
+			rayStreamOrder(rays.data(), static_cast<uint32>(rays.size()), order, nullptr);
+			std::vector<uint32> sortedOrder = order;
+			std::sort(sortedOrder.begin(), sortedOrder.end());
+			std::vector<uint32> identity(rays.size());
+			std::iota(identity.begin(), identity.end(), 0);
+			ASSERT(sortedOrder == identity);
+			auto octant = [&](uint32 rayIndex) {
+				return (rays[rayIndex].direction[0] < 0) | (rays[rayIndex].direction[1] < 0) << 1 | (rays[rayIndex].direction[2] < 0) << 2;
+			};
+			for (uint32 i = 1; i < order.size(); i += 1) {
+				ASSERT(octant(order[i - 1]) <= octant(order[i]));
+			}
+			// packets of consecutive rays in the order hit what the rays hit one by one
+			for (uint32 first = 0; first < order.size(); first += RayPacket::maxRayCount) {
+				RayPacket packet;
+				for (uint32 i = first; i < std::min(first + RayPacket::maxRayCount, static_cast<uint32>(order.size())); i += 1) {
+					packet.addRay(rays[order[i]]);
+				}
+				RayHit hits[RayPacket::maxRayCount];
+				uint64 hitMask = traceBVH8Packet(bvh8, triangles.data(), packet, hits);
+				for (uint32 rayIndex = 0; rayIndex < packet.rayCount; rayIndex += 1) {
+					RayHit hit;
+					bool found = traceBVH8(bvh8, triangles.data(), rays[order[first + rayIndex]], hit);
+					ASSERT(found == ((hitMask >> rayIndex) & 1) && (!found || (hit.primIndex == hits[rayIndex].primIndex && hit.t == hits[rayIndex].t)));
+				}
+			}
+		}
+		CASEEND();
+		CASE("BVH8 refit");
+		{
+			std::vector<BVHTriangle> movedTriangles = triangles;
+			std::vector<AABB> movedTriangleBounds = triangleBounds;
+			BVH8 bvh8 = buildBVH8(bvh);
+			std::vector<uint32> parentIndices;
+			std::vector<uint32> primNodeIndices;
+			bvh8ParentIndices(bvh8, parentIndices, primNodeIndices);
+			std::vector<uint32> changedPrims;
+			for (uint32 primIndex = 0; primIndex < movedTriangles.size(); primIndex += 7) {
+				float offset[3] = { uniform(random), uniform(random), uniform(random) };
+				float* vertices[3] = { movedTriangles[primIndex].v0, movedTriangles[primIndex].v1, movedTriangles[primIndex].v2 };
+				for (float* vertex : vertices) {
+					for (int j = 0; j < 3; j += 1) {
+						vertex[j] += offset[j];
+					}
+				}
+				movedTriangleBounds[primIndex] = movedTriangles[primIndex].bounds();
+				changedPrims.push_back(primIndex);
+			}
+			refitBVH8(bvh8, parentIndices, primNodeIndices, movedTriangleBounds, changedPrims);
+			for (int i = 0; i < 256; i += 1) {
+				Ray ray;
+				float direction[3] = { uniform(random), uniform(random), uniform(random) };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				traceBVH8(bvh8, movedTriangles.data(), ray, hit);
+				RayHit bruteForceHit;
+				for (uint32 primIndex = 0; primIndex < movedTriangles.size(); primIndex += 1) {
+					float t, u, v;
+					if (rayIntersectTriangle(movedTriangles[primIndex], ray, t, u, v) && t < bruteForceHit.t) {
+						bruteForceHit.t = t;
+						bruteForceHit.primIndex = primIndex;
+					}
+				}
+				ASSERT(hit.primIndex == bruteForceHit.primIndex && hit.t == bruteForceHit.t);
+			}
+		}
+		CASEEND();
+		CASE("Parallel build");
+		{
+			// just above BVHBuilder::parallelThreshold, so the top nodes bin in parallel chunks and the rest as subtree
+			// tasks, small enough that runTests stays quick in Debug
+			std::vector<AABB> boxes(BVHBuilder::parallelThreshold + 16384);
+			for (auto& box : boxes) {
+				float center[3] = { uniform(random), uniform(random), uniform(random) };
+				float extent = (uniform(random) + 10.0f) * 0.001f;
+				float min[3] = { center[0] - extent, center[1] - extent, center[2] - extent };
+				float max[3] = { center[0] + extent, center[1] + extent, center[2] + extent };
+				box.extend(min);
+				box.extend(max);
+			}
+			BVH serialBVH = buildBVH(boxes, settings, nullptr);
+			BVH parallelBVH = buildBVH(boxes, settings, &threadPool);
+			ASSERT(serialBVH.nodes.size() == parallelBVH.nodes.size());
+			std::vector<uint32> primIndices(boxes.size());
+			std::iota(primIndices.begin(), primIndices.end(), 0);
+			std::sort(parallelBVH.primIndices.begin(), parallelBVH.primIndices.end());
+			ASSERT(parallelBVH.primIndices == primIndices);
+			float serialCost = bvhSAHCost(serialBVH, settings);
+			float parallelCost = bvhSAHCost(parallelBVH, settings);
+			ASSERT(fabsf(serialCost - parallelCost) <= serialCost * 1e-4f);
+		}
+		CASEEND();
+		CASE("SBVH");
+		{
+			// long thin overlapping triangles, the case object splits handle worst
+			std::vector<BVHTriangle> thinTriangles(1000);
+			std::vector<AABB> thinTriangleBounds(thinTriangles.size());
+			for (uint32 i = 0; i < thinTriangles.size(); i += 1) {
+				int axis = i % 3;
+				float center[3] = { uniform(random), uniform(random), uniform(random) };
+				float* vertices[3] = { thinTriangles[i].v0, thinTriangles[i].v1, thinTriangles[i].v2 };
+				for (int v = 0; v < 3; v += 1) {
+					for (int j = 0; j < 3; j += 1) {
+						vertices[v][j] = center[j] + uniform(random) * 0.02f;
+					}
+					thinTriangleBounds[i].extend(vertices[v]);
+				}
+				thinTriangles[i].v0[axis] = -10.0f;
+				thinTriangles[i].v1[axis] = 10.0f;
+				thinTriangleBounds[i] = thinTriangles[i].bounds();
+			}
+			BVHBuildSettings sbvhSettings = settings;
+			sbvhSettings.builder = BVHBuildSettings::SBVH;
+			BVH sbvh = buildTriangleBVH(thinTriangles, thinTriangleBounds, sbvhSettings);
+			BVH objectSplitBVH = buildTriangleBVH(thinTriangles, thinTriangleBounds, settings);
+			std::vector<uint32> primRefCounts(thinTriangles.size());
+			for (auto& node : sbvh.nodes) {
+				if (node.isLeaf()) {
+					for (uint32 i = 0; i < node.primCount; i += 1) {
+						primRefCounts[sbvh.primIndices[node.primOffset + i]] += 1;
+					}
+				}
+			}
+			ASSERT(std::all_of(primRefCounts.begin(), primRefCounts.end(), [](uint32 count) { return count >= 1; }));
+			ASSERT(sbvh.primIndices.size() > thinTriangles.size());
+			ASSERT(sbvh.primIndices.size() <= thinTriangles.size() * (1 + sbvhSettings.spatialSplitBudget));
+			ASSERT(bvhSAHCost(sbvh, settings) < bvhSAHCost(objectSplitBVH, settings));
+			BVH8 sbvh8 = buildBVH8(sbvh);
+			for (int i = 0; i < 256; i += 1) {
+				Ray ray;
+				float direction[3] = { uniform(random), uniform(random), uniform(random) };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				RayHit sbvhHit;
+				RayHit sbvh8Hit;
+				traceBVH(objectSplitBVH, thinTriangles.data(), ray, hit);
+				traceBVH(sbvh, thinTriangles.data(), ray, sbvhHit);
+				traceBVH8(sbvh8, thinTriangles.data(), ray, sbvh8Hit);
+				ASSERT(hit.primIndex == sbvhHit.primIndex && hit.t == sbvhHit.t);
+				ASSERT(hit.primIndex == sbvh8Hit.primIndex && hit.t == sbvh8Hit.t);
+			}
+		}
+		CASEEND();
+		CASE("LBVH");
+		{
+			std::vector<uint64> keys(100000);
+			std::vector<uint32> values(keys.size());
+			for (uint32 i = 0; i < keys.size(); i += 1) {
+				keys[i] = ((static_cast<uint64>(random()) << 32) | random()) & ((1ull << 40) - 1);
+				values[i] = i;
+			}
+			std::vector<uint64> sortedKeys = keys;
+			std::sort(sortedKeys.begin(), sortedKeys.end());
+			std::vector<uint64> unsortedKeys = keys;
+			radixSortPairs(keys, values, 40, &threadPool);
+			ASSERT(keys == sortedKeys);
+			for (uint32 i = 0; i < keys.size(); i += 1) {
+				ASSERT(unsortedKeys[values[i]] == keys[i]);
+			}
+			for (uint32 mortonCodeBits : { 30u, 63u }) {
+				for (bool treeletOptimization : { false, true }) {
+					BVHBuildSettings lbvhSettings = settings;
+					lbvhSettings.builder = BVHBuildSettings::LBVH;
+					lbvhSettings.mortonCodeBits = mortonCodeBits;
+					lbvhSettings.treeletOptimization = treeletOptimization;
+					BVH lbvh = buildBVH(triangleBounds, lbvhSettings);
+					std::vector<uint32> primIndices(triangles.size());
+					std::iota(primIndices.begin(), primIndices.end(), 0);
+					std::vector<uint32> lbvhPrimIndices = lbvh.primIndices;
+					std::sort(lbvhPrimIndices.begin(), lbvhPrimIndices.end());
+					ASSERT(lbvhPrimIndices == primIndices);
+					if (treeletOptimization) {
+						lbvhSettings.treeletOptimization = false;
+						ASSERT(bvhSAHCost(lbvh, settings) < bvhSAHCost(buildBVH(triangleBounds, lbvhSettings), settings));
+					}
+					for (int i = 0; i < 256; i += 1) {
+						Ray ray;
+						float direction[3] = { uniform(random), uniform(random), uniform(random) };
+						for (int j = 0; j < 3; j += 1) {
+							ray.origin[j] = uniform(random) * 2.0f;
+						}
+						vec3Normalize(direction, ray.direction);
+						RayHit hit;
+						RayHit lbvhHit;
+						traceBVH(bvh, triangles.data(), ray, hit);
+						traceBVH(lbvh, triangles.data(), ray, lbvhHit);
+						ASSERT(hit.primIndex == lbvhHit.primIndex && hit.t == lbvhHit.t);
+					}
+				}
+			}
+		}
+		CASEEND();
+		CASE("Triangle blocks");
+		{
+			BVH8 bvh8 = buildBVH8(bvh);
+			BVH8TriangleBlocks triangleBlocks = buildBVH8TriangleBlocks(bvh8, triangles.data());
+			for (int i = 0; i < 256; i += 1) {
+				Ray ray;
+				float direction[3] = { uniform(random), uniform(random), uniform(random) };
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = uniform(random) * 2.0f;
+				}
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				RayHit blockHit;
+				bool found = traceBVH8(bvh8, triangles.data(), ray, hit);
+				ASSERT(traceBVH8(bvh8, triangleBlocks, ray, blockHit) == found);
+				ASSERT(hit.primIndex == blockHit.primIndex && fabsf(hit.t - blockHit.t) <= hit.t * 1e-5f);
+				ray.tMax = (uniform(random) + 10.0f) * 0.5f;
+				ASSERT(occludedBVH8(bvh8, triangleBlocks, ray) == occludedBVH8(bvh8, triangles.data(), ray));
+				if (cpuSupportsAVX2) {
+					WatertightRay watertightRay(ray);
+					for (auto& block : triangleBlocks.blocks) {
+						float ts[2][8], us[2][8], vs[2][8];
+						uint32 mask = rayIntersectTriangleBlockSSE4(block, watertightRay, 0xff, 0, FLT_MAX, ts[0], us[0], vs[0]);
+						ASSERT(mask == rayIntersectTriangleBlockAVX2(block, watertightRay, 0xff, 0, FLT_MAX, ts[1], us[1], vs[1]));
+					}
+				}
+			}
+			// rays through the shared center vertex and shared edges of a closed fan can't slip between its triangles
+			const uint32 fanSize = 7;
+			std::vector<BVHTriangle> fan(fanSize);
+			float fanCenter[3] = { 0.3f, -0.1f, 0.7f };
+			for (uint32 j = 0; j < fanSize; j += 1) {
+				float angles[2] = { j * 6.2831853f / fanSize, (j + 1) % fanSize * 6.2831853f / fanSize };
+				arrayCopy(fan[j].v0, fanCenter);
+				float* ringVertices[2] = { fan[j].v1, fan[j].v2 };
+				for (int k = 0; k < 2; k += 1) {
+					ringVertices[k][0] = fanCenter[0] + cosf(angles[k]);
+					ringVertices[k][1] = fanCenter[1] + sinf(angles[k]) * 0.6f;
+					ringVertices[k][2] = fanCenter[2] + sinf(angles[k]) * 0.8f;
+				}
+			}
+			BVH8TriangleBlock fanBlock = {};
+			for (uint32 lane = 0; lane < fanSize; lane += 1) {
+				const float* vertices[3] = { fan[lane].v0, fan[lane].v1, fan[lane].v2 };
+				for (int vertex = 0; vertex < 3; vertex += 1) {
+					for (int axis = 0; axis < 3; axis += 1) {
+						fanBlock.vertices[vertex][axis][lane] = vertices[vertex][axis];
+					}
+				}
+			}
+			for (int i = 0; i < 256; i += 1) {
+				const BVHTriangle& triangle = fan[i % fanSize];
+				float edgeWeight = i < 128 ? 0.0f : 0.25f + (uniform(random) + 10.0f) / 40.0f;
+				float target[3];
+				Ray ray;
+				for (int j = 0; j < 3; j += 1) {
+					target[j] = triangle.v0[j] + edgeWeight * (triangle.v1[j] - triangle.v0[j]);
+					ray.origin[j] = uniform(random);
+				}
+				float direction[3] = { target[0] - ray.origin[0], target[1] - ray.origin[1], target[2] - ray.origin[2] };
+				vec3Normalize(direction, ray.direction);
+				WatertightRay watertightRay(ray);
+				uint32 hitMask = 0;
+				for (uint32 lane = 0; lane < fanSize; lane += 1) {
+					float t, u, v;
+					hitMask |= rayIntersectTriangle(fan[lane], watertightRay, ray.tMin, ray.tMax, t, u, v) << lane;
+				}
+				float ts[8], us[8], vs[8];
+				ASSERT(hitMask != 0 && rayIntersectTriangleBlockSSE4(fanBlock, watertightRay, (1u << fanSize) - 1, ray.tMin, ray.tMax, ts, us, vs) == hitMask);
+				if (cpuSupportsAVX2) {
+					ASSERT(rayIntersectTriangleBlockAVX2(fanBlock, watertightRay, (1u << fanSize) - 1, ray.tMin, ray.tMax, ts, us, vs) == hitMask);
+				}
+			}
+		}
+		CASEEND();
+		CASE("Shared edges");
+		{
+			// a flat grid of one triangle leaves, every grid vertex is a corner of several leaf boxes, and rays aimed
+			// right at the vertices must reach a triangle through the box tests of every node format and kernel
+			const int gridSize = 24;
+			auto gridVertex = [](int x, int y, float* vertex) {
+				vertex[0] = -1.3f + x * 0.0713f;
+				vertex[1] = 0.2f + y * 0.0529f;
+				vertex[2] = 0.37f;
+			};
+			std::vector<BVHTriangle> gridTriangles;
+			std::vector<AABB> gridBounds;
+			for (int x = 0; x < gridSize; x += 1) {
+				for (int y = 0; y < gridSize; y += 1) {
+					BVHTriangle quad[2];
+					gridVertex(x, y, quad[0].v0);
+					gridVertex(x + 1, y, quad[0].v1);
+					gridVertex(x + 1, y + 1, quad[0].v2);
+					gridVertex(x, y, quad[1].v0);
+					gridVertex(x + 1, y + 1, quad[1].v1);
+					gridVertex(x, y + 1, quad[1].v2);
+					for (auto& triangle : quad) {
+						AABB bounds;
+						bounds.extend(triangle.v0);
+						bounds.extend(triangle.v1);
+						bounds.extend(triangle.v2);
+						gridTriangles.push_back(triangle);
+						gridBounds.push_back(bounds);
+					}
+				}
+			}
+			BVHBuildSettings gridSettings;
+			gridSettings.maxLeafSize = 1;
+			BVH8 gridBVH8 = buildBVH8(buildBVH(gridBounds, gridSettings));
+			BVH8Quantized gridQuantizedBVH8 = buildBVH8Quantized(gridBVH8);
+			BVH8TriangleBlocks gridBlocks = buildBVH8TriangleBlocks(gridBVH8, gridTriangles.data());
+			std::uniform_int_distribution<int> gridIndex(1, gridSize - 1);
+			for (int i = 0; i < 2000; i += 1) {
+				float target[3];
+				gridVertex(gridIndex(random), gridIndex(random), target);
+				Ray ray;
+				for (int j = 0; j < 3; j += 1) {
+					ray.origin[j] = target[j] + uniform(random) * 0.3f;
+				}
+				ray.origin[2] = target[2] + 1.0f + (uniform(random) + 10.0f) * 0.1f;
+				float direction[3] = { target[0] - ray.origin[0], target[1] - ray.origin[1], target[2] - ray.origin[2] };
+				vec3Normalize(direction, ray.direction);
+				RayHit hit;
+				ASSERT(traceBVH8(gridBVH8, gridTriangles.data(), ray, hit));
+				ASSERT(traceBVH8(gridQuantizedBVH8, gridTriangles.data(), ray, hit));
+				ASSERT(traceBVH8(gridBVH8, gridBlocks, ray, hit));
+			}
+			for (int i = 0; i < 32; i += 1) {
+				// from beyond the grid's min corner, so every ray of the packet has the same direction signs
+				float origin[3] = { -1.5f + uniform(random) * 0.01f, 0.1f + uniform(random) * 0.01f, 1.5f + uniform(random) * 0.05f };
+				RayPacket packet;
+				for (uint32 rayIndex = 0; rayIndex < RayPacket::maxRayCount; rayIndex += 1) {
+					float target[3];
+					gridVertex(gridIndex(random), gridIndex(random), target);
+					Ray ray;
+					arrayCopy(ray.origin, origin);
+					float direction[3] = { target[0] - origin[0], target[1] - origin[1], target[2] - origin[2] };
+					vec3Normalize(direction, ray.direction);
+					packet.addRay(ray);
+				}
+				RayHit hits[RayPacket::maxRayCount];
+				ASSERT(traceBVH8Packet(gridBVH8, gridTriangles.data(), packet, hits) == ~0ull);
+			}
+		}
+		CASEEND();
+	}
+	TESTEND();
+	TEST("Texture compression");
+	{
+		std::mt19937 random(1234);
+		std::uniform_int_distribution<int> byte(0, 255);
+		std::uniform_int_distribution<int> noise(-6, 6);
+		// a smooth gradient with a little noise per channel, like most 4 x 4 blocks of a photographic texture
+		auto gradientBlock = [&](uint8(&texels)[16][4]) {
+			int base[4], dx[4], dy[4];
+			for (int c = 0; c < 4; c += 1) {
+				base[c] = byte(random);
+				dx[c] = byte(random) / 16 - 8;
+				dy[c] = byte(random) / 16 - 8;
+			}
+			for (int i = 0; i < 16; i += 1) {
+				for (int c = 0; c < 4; c += 1) {
+					texels[i][c] = static_cast<uint8>(std::clamp(base[c] + dx[c] * (i % 4) + dy[c] * (i / 4) + noise(random), 0, 255));
+				}
+			}
+		};
+		auto squaredError = [](const uint8(&a)[16][4], const uint8(&b)[16][4], int channelCount) {
+			uint64 error = 0;
+			for (int i = 0; i < 16; i += 1) {
+				for (int c = 0; c < channelCount; c += 1) {
+					error += (a[i][c] - b[i][c]) * (a[i][c] - b[i][c]);
+				}
+			}
+			return error;
+		};
+		// a red/green checker, its only variation is in hue, so the principal axis is (1, -1, 0) with (1, 1, 1) mapped to 0
+		uint8 hueChecker[16][4];
+		for (int i = 0; i < 16; i += 1) {
+			bool red = (i % 4 + i / 4) % 2 == 0;
+			hueChecker[i][0] = red ? 255 : 0;
+			hueChecker[i][1] = red ? 0 : 255;
+			hueChecker[i][2] = 0;
+			hueChecker[i][3] = 255;
+		}
+		CASE("BC1");
+		{
+			uint64 error = 0;
+			for (int n = 0; n < 1000; n += 1) {
+				uint8 texels[16][4];
+				gradientBlock(texels);
+				uint8 block[8];
+				uint8 decoded[16][4];
+				encodeBC1Block(texels, block);
+				decodeBC1Block(block, decoded);
+				error += squaredError(texels, decoded, 3);
+				uint16 colors[2];
+				memcpy(colors, block, 4);
+				ASSERT(colors[0] >= colors[1]);
+			}
+			ASSERT(sqrt(error / (1000.0 * 16 * 3)) < 5.5);
+			uint8 block[8];
+			uint8 decoded[16][4];
+			// within the 1/16 inset of the endpoints, a (1, 1, 1) axis gave back olive for both colors
+			encodeBC1Block(hueChecker, block);
+			decodeBC1Block(block, decoded);
+			ASSERT(squaredError(hueChecker, decoded, 3) <= 16 * 2 * 16 * 16);
+		}
+		CASEEND();
+		CASE("BC4");
+		{
+			uint64 error = 0;
+			for (int n = 0; n < 1000; n += 1) {
+				uint8 texels[16][4];
+				gradientBlock(texels);
+				uint8 values[16];
+				for (int i = 0; i < 16; i += 1) {
+					values[i] = texels[i][0];
+				}
+				uint8 block[8];
+				uint8 decoded[16];
+				encodeBC4Block(values, block);
+				decodeBC4Block(block, decoded);
+				for (int i = 0; i < 16; i += 1) {
+					error += (values[i] - decoded[i]) * (values[i] - decoded[i]);
+				}
+			}
+			ASSERT(sqrt(error / (1000.0 * 16)) < 1.5);
+		}
+		CASEEND();
+		CASE("BC7");
+		{
+			uint64 error = 0;
+			for (int n = 0; n < 1000; n += 1) {
+				uint8 texels[16][4];
+				gradientBlock(texels);
+				uint8 block[16];
+				uint8 decoded[16][4];
+				encodeBC7Block(texels, block);
+				decodeBC7Block(block, decoded);
+				error += squaredError(texels, decoded, 4);
+			}
+			ASSERT(sqrt(error / (1000.0 * 16 * 4)) < 5.5);
+			uint8 solid[16][4];
+			for (int i = 0; i < 16; i += 1) {
+				solid[i][0] = 200;
+				solid[i][1] = 13;
+				solid[i][2] = 77;
+				solid[i][3] = 255;
+			}
+			uint8 block[16];
+			uint8 decoded[16][4];
+			encodeBC7Block(solid, block);
+			decodeBC7Block(block, decoded);
+			ASSERT(squaredError(solid, decoded, 4) <= 16);
+			// within the 1 step the shared p-bit of mode 6 costs
+			encodeBC7Block(hueChecker, block);
+			decodeBC7Block(block, decoded);
+			ASSERT(squaredError(hueChecker, decoded, 4) <= 16 * 4);
+		}
+		CASEEND();
+		CASE("Mip chain");
+		{
+			const int width = 20, height = 12, mipCount = 5;
+			std::vector<uint8> pixels;
+			for (int mip = 0; mip < mipCount; mip += 1) {
+				for (int i = 0; i < std::max(width >> mip, 1) * std::max(height >> mip, 1); i += 1) {
+					uint8 texel[4] = { static_cast<uint8>(mip * 50), static_cast<uint8>(i), 128, 255 };
+					pixels.insert(pixels.end(), texel, texel + 4);
+				}
+			}
+			ThreadPool pool(4);
+			for (BCFormat format : { BCFormat::BC1, BCFormat::BC4, BCFormat::BC5, BCFormat::BC7 }) {
+				std::vector<uint8> blocks = encodeBCMipChain(pixels.data(), width, height, 4, mipCount, format, pool);
+				ASSERT(blocks.size() == bcMipChainSize(width, height, mipCount, format));
+			}
+			// the last mip (1 x 1) is one block of its texel repeated
+			std::vector<uint8> blocks = encodeBCMipChain(pixels.data(), width, height, 4, mipCount, BCFormat::BC4, pool);
+			uint8 decoded[16];
+			decodeBC4Block(&blocks[blocks.size() - 8], decoded);
+			ASSERT(std::all_of(decoded, decoded + 16, [](uint8 value) { return value == 200; }));
+		}
+		CASEEND();
+	}
+	TESTEND();
+	TEST("Scene");
+	{
+		CASE("GLB loading");
+		{
+			// one triangle, its positions, normals and uint16 indices one after another in the BIN chunk
+			float positions[3][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 } };
+			float normals[3][3] = { { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 } };
+			uint16 indices[4] = { 0, 1, 2, 0 };
+			std::vector<uint8> bin(sizeof(positions) + sizeof(normals) + sizeof(indices));
+			memcpy(bin.data(), positions, sizeof(positions));
+			memcpy(bin.data() + sizeof(positions), normals, sizeof(normals));
+			memcpy(bin.data() + sizeof(positions) + sizeof(normals), indices, sizeof(indices));
+			auto gltfJSON = [&](uint64 indicesOffset) {
+				return std::string(R"({"asset":{"version":"2.0"},"scene":0,"scenes":[{"nodes":[0]}],"nodes":[{"mesh":0}],)") +
+					R"("meshes":[{"primitives":[{"attributes":{"POSITION":0,"NORMAL":1},"indices":2,"material":0}]}],"materials":[{}],)" +
+					R"("buffers":[{"byteLength":)" + std::to_string(bin.size()) + "}]," +
+					R"("bufferViews":[{"buffer":0,"byteOffset":0,"byteLength":36},{"buffer":0,"byteOffset":36,"byteLength":36},{"buffer":0,"byteOffset":)" + std::to_string(indicesOffset) + R"(,"byteLength":6}],)" +
+					R"("accessors":[{"bufferView":0,"componentType":5126,"count":3,"type":"VEC3","min":[0,0,0],"max":[1,1,0]},{"bufferView":1,"componentType":5126,"count":3,"type":"VEC3"},{"bufferView":2,"componentType":5123,"count":3,"type":"SCALAR"}]})";
+			};
+			// header, JSON chunk padded with spaces and the BIN chunk if there is one
+			auto glbFile = [&](std::string json, bool binChunk) {
+				json.resize((json.size() + 3) / 4 * 4, ' ');
+				uint32 header[5] = { 0x46546C67, 2, static_cast<uint32>(sizeof(header) + json.size() + (binChunk ? 8 + bin.size() : 0)), static_cast<uint32>(json.size()), 0x4E4F534A };
+				std::vector<uint8> glb(reinterpret_cast<uint8*>(header), reinterpret_cast<uint8*>(header) + sizeof(header));
+				glb.insert(glb.end(), json.begin(), json.end());
+				if (binChunk) {
+					uint32 binChunkHeader[2] = { static_cast<uint32>(bin.size()), 0x004E4942 };
+					glb.insert(glb.end(), reinterpret_cast<uint8*>(binChunkHeader), reinterpret_cast<uint8*>(binChunkHeader) + sizeof(binChunkHeader));
+					glb.insert(glb.end(), bin.begin(), bin.end());
+				}
+				return glb;
+			};
+			std::filesystem::path glbFilePath = std::filesystem::temp_directory_path() / "yarrTest.glb";
+			auto writeGLB = [&](const std::vector<uint8>& glb) {
+				std::ofstream file(glbFilePath, std::ios::out | std::ios::trunc | std::ios::binary);
+				file.write(reinterpret_cast<const char*>(glb.data()), glb.size());
+			};
+			auto loadFails = [&](const std::vector<uint8>& glb) {
+				writeGLB(glb);
+				try {
+					Scene::loadModelFromGLTF(glbFilePath);
+				}
+				catch (const Exception&) {
+					return true;
+				}
+				return false;
+			};
+			std::vector<uint8> glb = glbFile(gltfJSON(72), true);
+			writeGLB(glb);
+			Model model = Scene::loadModelFromGLTF(glbFilePath);
+			ASSERT(model.meshes.size() == 1 && model.meshes[0].primitives.size() == 1);
+			ASSERT(model.rootNodes == std::vector<int>{ 0 });
+			const ModelPrimitive& primitive = model.meshes[0].primitives[0];
+			ASSERT(primitive.vertices.size() == 3 && primitive.indexSize == 2 && primitive.indexCount() == 3);
+			bool verticesMatch = true;
+			for (uint32 i = 0; i < 3; i += 1) {
+				verticesMatch = verticesMatch && primitive.getIndex(i) == i && memcmp(primitive.vertices[i].position, positions[i], sizeof(positions[i])) == 0 && memcmp(primitive.vertices[i].normal, normals[i], sizeof(normals[i])) == 0;
+			}
+			ASSERT(verticesMatch);
+			// the file length in the header past the end of the file, and a file that ends in the header
+			ASSERT(loadFails(std::vector<uint8>(glb.begin(), glb.end() - 8)));
+			ASSERT(loadFails(std::vector<uint8>(glb.begin(), glb.begin() + 10)));
+			// a buffer without uri but no BIN chunk to stand for it
+			ASSERT(loadFails(glbFile(gltfJSON(72), false)));
+			// the index bufferView past the end of the BIN chunk
+			ASSERT(loadFails(glbFile(gltfJSON(bin.size() - 4), true)));
+			std::error_code error;
+			std::filesystem::remove(glbFilePath, error);
+		}
+		CASEEND();
+		CASE("Image decode");
+		{
+			// one triangle like GLB loading plus two images in the BIN chunk, an 8 x 4 PNG and bytes that are no image
+			std::mt19937 random(3);
+			std::vector<uint8> imagePixels(8 * 4 * 4);
+			for (auto& pixel : imagePixels) {
+				pixel = static_cast<uint8>(random());
+			}
+			std::vector<uint8> png;
+			stbi_write_png_to_func([](void* context, void* data, int size) {
+				std::vector<uint8>& bytes = *static_cast<std::vector<uint8>*>(context);
+				bytes.insert(bytes.end(), static_cast<uint8*>(data), static_cast<uint8*>(data) + size);
+			}, &png, 8, 4, 4, imagePixels.data(), 8 * 4);
+			std::vector<uint8> corruptImage(64, 0xab);
+			float positions[3][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 } };
+			float normals[3][3] = { { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 } };
+			uint16 indices[4] = { 0, 1, 2, 0 };
+			std::vector<uint8> bin(reinterpret_cast<uint8*>(positions), reinterpret_cast<uint8*>(positions) + sizeof(positions));
+			bin.insert(bin.end(), reinterpret_cast<uint8*>(normals), reinterpret_cast<uint8*>(normals) + sizeof(normals));
+			bin.insert(bin.end(), reinterpret_cast<uint8*>(indices), reinterpret_cast<uint8*>(indices) + sizeof(indices));
+			uint64 pngOffset = bin.size();
+			bin.insert(bin.end(), png.begin(), png.end());
+			bin.resize((bin.size() + 3) / 4 * 4);
+			uint64 corruptImageOffset = bin.size();
+			bin.insert(bin.end(), corruptImage.begin(), corruptImage.end());
+			std::string json = std::string(R"({"asset":{"version":"2.0"},"scene":0,"scenes":[{"nodes":[0]}],"nodes":[{"mesh":0}],)") +
+				R"("meshes":[{"primitives":[{"attributes":{"POSITION":0,"NORMAL":1},"indices":2,"material":0}]}],"materials":[{}],)" +
+				R"("buffers":[{"byteLength":)" + std::to_string(bin.size()) + "}]," +
+				R"("bufferViews":[{"buffer":0,"byteOffset":0,"byteLength":36},{"buffer":0,"byteOffset":36,"byteLength":36},{"buffer":0,"byteOffset":72,"byteLength":6},)" +
+				R"({"buffer":0,"byteOffset":)" + std::to_string(pngOffset) + R"(,"byteLength":)" + std::to_string(png.size()) + "}," +
+				R"({"buffer":0,"byteOffset":)" + std::to_string(corruptImageOffset) + R"(,"byteLength":)" + std::to_string(corruptImage.size()) + "}]," +
+				R"("accessors":[{"bufferView":0,"componentType":5126,"count":3,"type":"VEC3","min":[0,0,0],"max":[1,1,0]},{"bufferView":1,"componentType":5126,"count":3,"type":"VEC3"},{"bufferView":2,"componentType":5123,"count":3,"type":"SCALAR"}],)" +
+				R"("images":[{"bufferView":3,"mimeType":"image/png"},{"bufferView":4,"mimeType":"image/png"}]})";
+			json.resize((json.size() + 3) / 4 * 4, ' ');
+			uint32 header[5] = { 0x46546C67, 2, static_cast<uint32>(sizeof(header) + json.size() + 8 + bin.size()), static_cast<uint32>(json.size()), 0x4E4F534A };
+			uint32 binChunkHeader[2] = { static_cast<uint32>(bin.size()), 0x004E4942 };
+			std::filesystem::path glbFilePath = std::filesystem::temp_directory_path() / "yarrImageTest.glb";
+			{
+				std::ofstream file(glbFilePath, std::ios::out | std::ios::trunc | std::ios::binary);
+				file.write(reinterpret_cast<const char*>(header), sizeof(header));
+				file.write(json.data(), json.size());
+				file.write(reinterpret_cast<const char*>(binChunkHeader), sizeof(binChunkHeader));
+				file.write(reinterpret_cast<const char*>(bin.data()), bin.size());
+			}
+			Model model = Scene::loadModelFromGLTF(glbFilePath);
+			ASSERT(model.images.size() == 2);
+			model.images[0].waitDecode();
+			const ModelImage& image = model.images[0];
+			ASSERT(image.width == 8 && image.height == 4 && image.component == 4 && image.mipCount == 4);
+			ASSERT(image.pixels.size() >= imagePixels.size() && memcmp(image.pixels.data(), imagePixels.data(), imagePixels.size()) == 0);
+			// the failed decode is reported once, its task group is gone and the pool keeps decoding
+			bool corruptImageThrows = false;
+			try {
+				model.images[1].waitDecode();
+			}
+			catch (const Exception&) {
+				corruptImageThrows = true;
+			}
+			ASSERT(corruptImageThrows && !model.images[1].decode && !model.images[1].decodePending());
+			Model reloadedModel = Scene::loadModelFromGLTF(glbFilePath);
+			reloadedModel.images[0].waitDecode();
+			ASSERT(reloadedModel.images[0].pixels == image.pixels);
+			// models dropped right after loading wait for their decodes instead of leaving them writing freed images
+			for (int n = 0; n < 8; n += 1) {
+				Scene::loadModelFromGLTF(glbFilePath);
+			}
+			// an image destroyed before its decode is done waits for it in ~ThreadPoolTaskGroup
+			std::atomic<bool> decodeDone = false;
+			{
+				ModelImage pendingImage;
+				pendingImage.decode = std::make_shared<ThreadPoolTaskGroup>(threadPool);
+				pendingImage.decode->run([&pendingImage, &decodeDone] {
+					std::this_thread::sleep_for(std::chrono::milliseconds(50));
+					pendingImage.pixels.assign(16, 0);
+					decodeDone = true;
+				});
+				ASSERT(pendingImage.decodePending());
+			}
+			ASSERT(decodeDone);
+			std::error_code error;
+			std::filesystem::remove(glbFilePath, error);
+		}
+		CASEEND();
+		CASE("Split primitive");
+		{
+			std::mt19937 random(11);
+			std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+			auto triangleKey = [](const ModelPrimitive& primitive, uint64 triangle) {
+				std::array<float, 9> key;
+				for (int corner = 0; corner < 3; corner += 1) {
+					memcpy(&key[corner * 3], primitive.vertices[primitive.getIndex(triangle * 3 + corner)].position, sizeof(float) * 3);
+				}
+				return key;
+			};
+			auto splitMatches = [&](const ModelPrimitive& primitive, uint32 maxTriangleCount) {
+				std::vector<ModelPrimitive> parts = splitModelPrimitive(primitive, maxTriangleCount);
+				std::vector<std::array<float, 9>> triangles;
+				for (uint64 triangle = 0; triangle < primitive.indexCount() / 3; triangle += 1) {
+					triangles.push_back(triangleKey(primitive, triangle));
+				}
+				std::vector<std::array<float, 9>> partTriangles;
+				bool partsValid = true;
+				for (auto& part : parts) {
+					uint64 partTriangleCount = part.indexCount() / 3;
+					partsValid = partsValid && partTriangleCount > 0 && partTriangleCount <= maxTriangleCount && part.indexCount() % 3 == 0;
+					partsValid = partsValid && (part.indexSize == 2) == (part.vertices.size() <= 65536);
+					partsValid = partsValid && part.materialIndex == primitive.materialIndex && part.opaque == primitive.opaque;
+					std::vector<bool> vertexUsed(part.vertices.size(), false);
+					for (uint64 i = 0; i < part.indexCount(); i += 1) {
+						uint32 index = part.getIndex(i);
+						partsValid = partsValid && index < part.vertices.size();
+						if (index < part.vertices.size()) {
+							vertexUsed[index] = true;
+						}
+					}
+					partsValid = partsValid && std::all_of(vertexUsed.begin(), vertexUsed.end(), [](bool used) { return used; });
+					if (partsValid) {
+						for (uint64 triangle = 0; triangle < partTriangleCount; triangle += 1) {
+							partTriangles.push_back(triangleKey(part, triangle));
+						}
+					}
+				}
+				// every source triangle exactly once across the parts, with the same positions in the same corner order
+				std::sort(triangles.begin(), triangles.end());
+				std::sort(partTriangles.begin(), partTriangles.end());
+				return partsValid && triangles == partTriangles;
+			};
+			// a 64 x 64 quad grid with shared vertices and 16 bit indices
+			ModelPrimitive grid;
+			grid.materialIndex = 3;
+			grid.opaque = false;
+			for (int y = 0; y <= 64; y += 1) {
+				for (int x = 0; x <= 64; x += 1) {
+					grid.vertices.push_back(ModelVertex{ { static_cast<float>(x), static_cast<float>(y), 0 } });
+				}
+			}
+			for (int y = 0; y < 64; y += 1) {
+				for (int x = 0; x < 64; x += 1) {
+					uint16 quad[6] = { static_cast<uint16>(y * 65 + x), static_cast<uint16>(y * 65 + x + 1), static_cast<uint16>(y * 65 + x + 66), static_cast<uint16>(y * 65 + x), static_cast<uint16>(y * 65 + x + 66), static_cast<uint16>(y * 65 + x + 65) };
+					grid.indices.insert(grid.indices.end(), reinterpret_cast<uint8*>(quad), reinterpret_cast<uint8*>(quad) + sizeof(quad));
+				}
+			}
+			ASSERT(splitMatches(grid, 1000));
+			ASSERT(splitMatches(grid, 8192));
+			ASSERT(splitMatches(grid, 1));
+			// a soup of 30000 triangles with 32 bit indices and no shared vertices, so parts of 25000 triangles have
+			// more vertices than 16 bit indices can address and the last one fewer
+			ModelPrimitive soup;
+			soup.indexSize = 4;
+			for (uint32 i = 0; i < 90000; i += 1) {
+				soup.vertices.push_back(ModelVertex{ { coordinate(random), coordinate(random), coordinate(random) } });
+				uint32 index = (i / 3) * 3 + (2 - i % 3);
+				soup.indices.insert(soup.indices.end(), reinterpret_cast<uint8*>(&index), reinterpret_cast<uint8*>(&index) + sizeof(index));
+			}
+			ASSERT(splitMatches(soup, 25000));
+			std::vector<ModelPrimitive> soupParts = splitModelPrimitive(soup, 25000);
+			ASSERT(soupParts.size() == 2 && soupParts[0].indexSize == 4 && soupParts[1].indexSize == 2);
+		}
+		CASEEND();
+		CASE("Vertex encoding");
+		{
+			// utils.hlsli's octDecode line for line, int2(e << 16, e) >> 16 sign extends each half
+			auto shaderOctDecode = [](uint32 e, float* v) {
+				float f[2] = { std::max((static_cast<int32>(e << 16) >> 16) / 32767.0f, -1.0f), std::max((static_cast<int32>(e) >> 16) / 32767.0f, -1.0f) };
+				float n[3] = { f[0], f[1], 1.0f - fabsf(f[0]) - fabsf(f[1]) };
+				float t = std::clamp(-n[2], 0.0f, 1.0f);
+				n[0] += n[0] >= 0.0f ? -t : t;
+				n[1] += n[1] >= 0.0f ? -t : t;
+				float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (int i = 0; i < 3; i += 1) {
+					v[i] = n[i] / length;
+				}
+			};
+			// the axes, the octant diagonals (both hemispheres) and random directions
+			std::vector<std::array<float, 3>> directions;
+			for (int axis = 0; axis < 3; axis += 1) {
+				for (float sign : { 1.0f, -1.0f }) {
+					std::array<float, 3> direction = {};
+					direction[axis] = sign;
+					directions.push_back(direction);
+				}
+			}
+			for (int octant = 0; octant < 8; octant += 1) {
+				float c = 1.0f / sqrtf(3.0f);
+				directions.push_back({ (octant & 1) ? -c : c, (octant & 2) ? -c : c, (octant & 4) ? -c : c });
+			}
+			std::mt19937 random(5);
+			std::normal_distribution<float> gaussian;
+			for (int n = 0; n < 100000; n += 1) {
+				std::array<float, 3> direction = { gaussian(random), gaussian(random), gaussian(random) };
+				float length = sqrtf(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+				directions.push_back({ direction[0] / length, direction[1] / length, direction[2] / length });
+			}
+			double maxAngle = 0;
+			bool matchesShader = true;
+			for (auto& direction : directions) {
+				uint32 e = octEncode(direction.data());
+				float decoded[3];
+				float shaderDecoded[3];
+				octDecode(e, decoded);
+				shaderOctDecode(e, shaderDecoded);
+				// atan2 of |cross| and dot, acos of a dot product this close to 1 is mostly float rounding
+				double a[3] = { direction[0], direction[1], direction[2] };
+				double b[3] = { decoded[0], decoded[1], decoded[2] };
+				double cross[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+				double angle = atan2(sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]), a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+				maxAngle = std::max(maxAngle, angle * 180 / M_PI);
+				for (int i = 0; i < 3; i += 1) {
+					matchesShader = matchesShader && fabsf(decoded[i] - shaderDecoded[i]) <= 1e-6f;
+				}
+			}
+			ASSERT(maxAngle < 0.005);
+			ASSERT(matchesShader);
+			float zero[3] = {};
+			float zeroDecoded[3];
+			octDecode(octEncode(zero), zeroDecoded);
+			ASSERT(zeroDecoded[0] == 0 && zeroDecoded[1] == 0 && zeroDecoded[2] == 1);
+			// every finite half survives decode and encode, and decodes to its IEEE value like f16tof32
+			bool halfsMatch = true;
+			for (uint32 h = 0; h < 0x10000; h += 1) {
+				uint32 exponent = (h >> 10) & 31;
+				if (exponent == 31) {
+					continue;
+				}
+				double magnitude = exponent == 0 ? (h & 1023) * pow(2.0, -24) : (1 + (h & 1023) / 1024.0) * pow(2.0, static_cast<int>(exponent) - 15);
+				float value = static_cast<float>((h & 0x8000) ? -magnitude : magnitude);
+				float decoded[2];
+				halfDecode2(h | (h << 16), decoded);
+				halfsMatch = halfsMatch && decoded[0] == value && decoded[1] == value && halfEncode2(decoded) == (h | (h << 16));
+			}
+			ASSERT(halfsMatch);
+			// uvs round to the nearest half, relative error at most 2^-11
+			std::uniform_real_distribution<float> uvCoordinate(-8.0f, 8.0f);
+			bool uvsMatch = true;
+			for (int n = 0; n < 10000; n += 1) {
+				float uv[2] = { uvCoordinate(random), uvCoordinate(random) };
+				float decoded[2];
+				halfDecode2(halfEncode2(uv), decoded);
+				for (int i = 0; i < 2; i += 1) {
+					uvsMatch = uvsMatch && fabsf(decoded[i] - uv[i]) <= std::max(fabsf(uv[i]) * exp2f(-11), exp2f(-25));
+				}
+			}
+			ASSERT(uvsMatch);
+		}
+		CASEEND();
+		CASE("Generated tangents");
+		{
+			// a unit quad in z = 0 facing +z, uv = uvTransform * xy + uvOffset. Its tangent is dp/du, whose xy is the
+			// first column of the inverse of uvTransform, whichever way the uvs are oriented
+			auto quadTangentMatches = [](const float(&uvTransform)[2][2], const float(&uvOffset)[2]) {
+				ModelPrimitive quad;
+				for (int corner = 0; corner < 4; corner += 1) {
+					float x = static_cast<float>(corner == 1 || corner == 2);
+					float y = static_cast<float>(corner >= 2);
+					float u = uvTransform[0][0] * x + uvTransform[0][1] * y + uvOffset[0];
+					float v = uvTransform[1][0] * x + uvTransform[1][1] * y + uvOffset[1];
+					quad.vertices.push_back(ModelVertex{ { x, y, 0 }, { 0, 0, 1 }, { u, v } });
+				}
+				uint16 indices[6] = { 0, 1, 2, 0, 2, 3 };
+				quad.indices.assign(reinterpret_cast<uint8*>(indices), reinterpret_cast<uint8*>(indices) + sizeof(indices));
+				generateModelPrimitiveTangents(quad);
+				float determinant = uvTransform[0][0] * uvTransform[1][1] - uvTransform[0][1] * uvTransform[1][0];
+				float expected[2] = { uvTransform[1][1] / determinant, -uvTransform[1][0] / determinant };
+				float length = sqrtf(expected[0] * expected[0] + expected[1] * expected[1]);
+				bool matches = true;
+				for (auto& vertex : quad.vertices) {
+					matches = matches && fabsf(vertex.tangent[0] - expected[0] / length) < 1e-5f && fabsf(vertex.tangent[1] - expected[1] / length) < 1e-5f && fabsf(vertex.tangent[2]) < 1e-5f;
+				}
+				return matches;
+			};
+			// uv = xy, and its copy mirrored in u
+			ASSERT(quadTangentMatches({ { 1, 0 }, { 0, 1 } }, { 0, 0 }));
+			ASSERT(quadTangentMatches({ { -1, 0 }, { 0, 1 } }, { 1, 0 }));
+			// mirrored in v only keeps the tangent, uv = yx (mirrored) has it along +y
+			ASSERT(quadTangentMatches({ { 1, 0 }, { 0, -1 } }, { 0, 1 }));
+			ASSERT(quadTangentMatches({ { 0, 1 }, { 1, 0 } }, { 0, 0 }));
+			std::mt19937 random(3);
+			std::uniform_real_distribution<float> entry(-2.0f, 2.0f);
+			bool randomMatch = true;
+			for (int n = 0; n < 100; n += 1) {
+				float uvTransform[2][2] = { { entry(random), entry(random) }, { entry(random), entry(random) } };
+				if (fabsf(uvTransform[0][0] * uvTransform[1][1] - uvTransform[0][1] * uvTransform[1][0]) > 0.1f) {
+					randomMatch = randomMatch && quadTangentMatches(uvTransform, { entry(random), entry(random) });
+				}
+			}
+			ASSERT(randomMatch);
+		}
+		CASEEND();
+		CASE("Image mips");
+		{
+			// every mip of generateModelImageMips against a double precision box filter of mip 0 with the same rules: an odd
+			// last column or row is left out, a size 1 axis repeats, sRGB rgb is averaged in linear
+			auto mipsMatchReference = [](int width, int height, int component, uint32 seed) {
+				std::mt19937 random(seed);
+				std::uniform_int_distribution<int> byte(0, 255);
+				ModelImage image;
+				image.width = width;
+				image.height = height;
+				image.component = component;
+				image.pixels.resize(static_cast<uint64>(width) * height * component);
+				for (auto& pixel : image.pixels) {
+					pixel = static_cast<uint8>(byte(random));
+				}
+				bool srgb = component == 4;
+				std::vector<double> level(image.pixels.size());
+				for (uint64 i = 0; i < level.size(); i += 1) {
+					double c = image.pixels[i] / 255.0;
+					level[i] = (srgb && i % 4 != 3) ? (c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4)) : c;
+				}
+				int expectedMipCount = 1;
+				uint64 chainSize = image.pixels.size();
+				for (int w = width, h = height; w > 1 || h > 1; w = std::max(w >> 1, 1), h = std::max(h >> 1, 1)) {
+					expectedMipCount += 1;
+					chainSize += static_cast<uint64>(std::max(w >> 1, 1)) * std::max(h >> 1, 1) * component;
+				}
+				generateModelImageMips(image);
+				bool matches = image.mipCount == expectedMipCount && image.pixels.size() == chainSize;
+				uint64 offset = static_cast<uint64>(width) * height * component;
+				for (int mip = 1; matches && mip < image.mipCount; mip += 1) {
+					int nextWidth = std::max(width >> 1, 1);
+					int nextHeight = std::max(height >> 1, 1);
+					std::vector<double> nextLevel(static_cast<uint64>(nextWidth) * nextHeight * component);
+					for (int y = 0; y < nextHeight; y += 1) {
+						for (int x = 0; x < nextWidth; x += 1) {
+							int xs[2] = { x * 2, std::min(x * 2 + 1, width - 1) };
+							int ys[2] = { y * 2, std::min(y * 2 + 1, height - 1) };
+							for (int c = 0; c < component; c += 1) {
+								double sum = 0;
+								for (int i = 0; i < 4; i += 1) {
+									sum += level[(static_cast<uint64>(ys[i / 2]) * width + xs[i % 2]) * component + c];
+								}
+								double value = sum / 4;
+								nextLevel[(static_cast<uint64>(y) * nextWidth + x) * component + c] = value;
+								if (srgb && c != 3) {
+									value = value <= 0.0031308 ? value * 12.92 : 1.055 * pow(value, 1 / 2.4) - 0.055;
+								}
+								int expected = static_cast<int>(floor(value * 255 + 0.5));
+								int actual = image.pixels[offset + (static_cast<uint64>(y) * nextWidth + x) * component + c];
+								matches = matches && abs(actual - expected) <= 1;
+							}
+						}
+					}
+					offset += nextLevel.size();
+					level = std::move(nextLevel);
+					width = nextWidth;
+					height = nextHeight;
+				}
+				return matches;
+			};
+			ASSERT(mipsMatchReference(7, 5, 4, 1));
+			ASSERT(mipsMatchReference(13, 29, 1, 2));
+			ASSERT(mipsMatchReference(1, 9, 1, 3));
+			ASSERT(mipsMatchReference(1, 9, 4, 4));
+			ASSERT(mipsMatchReference(6, 1, 2, 5));
+			ASSERT(mipsMatchReference(64, 33, 4, 6));
+		}
+		CASEEND();
+		CASE("Node transforms");
+		{
+			// node 0 (no mesh) has children 1 and 2, node 1 has child 3, node 4 is a second root. Every node but 0 is an
+			// instance of the same unit quad
+			Model model;
+			ModelPrimitive quad;
+			for (int corner = 0; corner < 4; corner += 1) {
+				float x = static_cast<float>(corner == 1 || corner == 2);
+				float y = static_cast<float>(corner >= 2);
+				quad.vertices.push_back(ModelVertex{ { x, y, 0 }, { 0, 0, 1 }, { x, y }, { 1, 0, 0 } });
+			}
+			uint16 quadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+			quad.indices.assign(reinterpret_cast<uint8*>(quadIndices), reinterpret_cast<uint8*>(quadIndices) + sizeof(quadIndices));
+			model.meshes.emplace_back();
+			model.meshes[0].primitives.push_back(quad);
+			model.nodes.push_back(ModelNode{ -1, DirectX::XMMatrixIdentity(), { 1, 2 } });
+			model.nodes.push_back(ModelNode{ 0, DirectX::XMMatrixTranslation(2, 0, 0), { 3 }, 0 });
+			model.nodes.push_back(ModelNode{ 0, DirectX::XMMatrixTranslation(0, 2, 0), {}, 0 });
+			model.nodes.push_back(ModelNode{ 0, DirectX::XMMatrixTranslation(0, 0, 2), {}, 1 });
+			model.nodes.push_back(ModelNode{ 0, DirectX::XMMatrixTranslation(-2, 0, 0) });
+			model.rootNodes = { 0, 4 };
+			Scene scene("nodeTransforms");
+			scene.models.insert({ "nodes", std::move(model) });
+			scene.rebuildInstances();
+			scene.buildModelMeshBVHs({});
+			const Model& sceneModel = scene.models.at("nodes");
+			const std::vector<int>& nodeInstances = scene.nodeInstanceIndices.at(&sceneModel);
+			ASSERT(scene.instances.size() == 4 && nodeInstances[0] == -1);
+			auto instancesMatchNodes = [&] {
+				bool match = true;
+				for (auto& instance : scene.instances) {
+					DirectX::XMFLOAT4X4 a, b;
+					DirectX::XMStoreFloat4x4(&a, instance.transform);
+					DirectX::XMStoreFloat4x4(&b, sceneModel.nodeWorldTransform(instance.nodeIndex));
+					for (int i = 0; i < 16; i += 1) {
+						match = match && fabsf(a.m[i / 4][i % 4] - b.m[i / 4][i % 4]) < 1e-5f;
+					}
+				}
+				return match;
+			};
+			// nodes 1 and 3 are both under node 0, their instances are listed once, in order
+			std::vector<uint32> changedInstances = scene.setNodeTransforms({
+				{ "nodes", 3, DirectX::XMMatrixTranslation(0, 0, 3) },
+				{ "nodes", 0, DirectX::XMMatrixRotationY(0.5f) },
+				{ "nodes", 1, DirectX::XMMatrixTranslation(3, 0, 0) } });
+			std::vector<uint32> expectedInstances = { static_cast<uint32>(nodeInstances[1]), static_cast<uint32>(nodeInstances[2]), static_cast<uint32>(nodeInstances[3]) };
+			std::sort(expectedInstances.begin(), expectedInstances.end());
+			ASSERT(changedInstances == expectedInstances);
+			ASSERT(instancesMatchNodes());
+			bool unknownModelThrows = false;
+			try {
+				scene.setNodeTransforms({ { "missing", 0, DirectX::XMMatrixIdentity() } });
+			}
+			catch (const Exception&) {
+				unknownModelThrows = true;
+			}
+			ASSERT(unknownModelThrows);
+			// rounds of random edits refit into one SceneBVH, traced against a SceneBVH built from scratch each round
+			SceneBVH refitBVH;
+			refitBVH.build(scene.instances);
+			std::mt19937 random(11);
+			std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+			bool refitMatches = true;
+			for (int round = 0; round < 20; round += 1) {
+				std::vector<SceneNodeTransform> nodeTransforms;
+				for (int nodeIndex : { 1, 3, 4 }) {
+					if (uniform(random) > 0) {
+						DirectX::XMMATRIX transform = DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationX(uniform(random) * 3), DirectX::XMMatrixTranslation(uniform(random) * 2, uniform(random) * 2, uniform(random) * 2));
+						nodeTransforms.push_back({ "nodes", nodeIndex, transform });
+					}
+				}
+				refitBVH.refit(scene.instances, scene.setNodeTransforms(nodeTransforms));
+				SceneBVH rebuiltBVH;
+				rebuiltBVH.build(scene.instances);
+				for (int n = 0; n < 200; n += 1) {
+					Ray ray = { { uniform(random) * 4, uniform(random) * 4, uniform(random) * 4 }, { uniform(random), uniform(random), uniform(random) } };
+					SceneRayHit refitHit;
+					SceneRayHit rebuiltHit;
+					bool refitFound = refitBVH.trace(ray, refitHit);
+					bool rebuiltFound = rebuiltBVH.trace(ray, rebuiltHit);
+					refitMatches = refitMatches && refitFound == rebuiltFound && refitHit.t == rebuiltHit.t && refitHit.instanceIndex == rebuiltHit.instanceIndex && refitHit.primitiveIndex == rebuiltHit.primitiveIndex;
+				}
+			}
+			ASSERT(refitMatches);
+			ASSERT(instancesMatchNodes());
+		}
+		CASEEND();
+		CASE("Scene occluded");
+		{
+			// 16 instances of a mesh of 300 random triangles around the unit cube, randomly rotated and placed in a 4^3 box
+			std::mt19937 random(13);
+			std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+			Model model;
+			ModelPrimitive triangles;
+			std::vector<uint32> triangleIndices;
+			for (uint32 i = 0; i < 900; i += 1) {
+				float center[3] = { uniform(random), uniform(random), uniform(random) };
+				if (i % 3 != 0) {
+					arrayCopy(center, triangles.vertices.back().position);
+				}
+				float position[3] = { center[0] + (uniform(random) - 0.5f) * 0.6f, center[1] + (uniform(random) - 0.5f) * 0.6f, center[2] + (uniform(random) - 0.5f) * 0.6f };
+				triangles.vertices.push_back(ModelVertex{ { position[0], position[1], position[2] }, { 0, 0, 1 }, { 0, 0 }, { 1, 0, 0 } });
+				triangleIndices.push_back(i);
+			}
+			triangles.indices.assign(reinterpret_cast<uint8*>(triangleIndices.data()), reinterpret_cast<uint8*>(triangleIndices.data() + triangleIndices.size()));
+			triangles.indexSize = 4;
+			model.meshes.emplace_back();
+			model.meshes[0].primitives.push_back(triangles);
+			for (int i = 0; i < 16; i += 1) {
+				DirectX::XMMATRIX transform = DirectX::XMMatrixMultiply(DirectX::XMMatrixRotationY(uniform(random) * 6), DirectX::XMMatrixTranslation(uniform(random) * 3, uniform(random) * 3, uniform(random) * 3));
+				model.nodes.push_back(ModelNode{ 0, transform });
+				model.rootNodes.push_back(i);
+			}
+			Scene scene("occluded");
+			scene.models.insert({ "occluded", std::move(model) });
+			scene.rebuildInstances();
+			scene.buildModelMeshBVHs({});
+			SceneBVH sceneBVH;
+			sceneBVH.build(scene.instances);
+			// random rays with random tMax, rays whose closest hit is too near tMax to tell apart are left out.
+			// The same rays go through the batched occluded, 64 at a time as occludedPacket
+			std::vector<Ray> rays;
+			std::vector<bool> expectedResults;
+			uint32 occludedCount = 0;
+			while (rays.size() < 4096) {
+				Ray ray = { { uniform(random) * 4, uniform(random) * 4, uniform(random) * 4 }, { uniform(random) - 0.5f, uniform(random) - 0.5f, uniform(random) - 0.5f } };
+				ray.tMax = uniform(random) * 4;
+				SceneRayHit hit;
+				bool found = sceneBVH.trace(ray, hit);
+				if (found && fabsf(hit.t - ray.tMax) < 1e-3f) {
+					continue;
+				}
+				rays.push_back(ray);
+				expectedResults.push_back(found && hit.t < ray.tMax);
+				occludedCount += expectedResults.back();
+			}
+			bool occludedMatches = true;
+			for (uint64 i = 0; i < rays.size(); i += 1) {
+				occludedMatches = occludedMatches && sceneBVH.occluded(rays[i], rays[i].tMax) == expectedResults[i];
+			}
+			ASSERT(occludedMatches);
+			std::unique_ptr<bool[]> results(new bool[rays.size()]);
+			sceneBVH.occluded(rays.data(), rays.size(), results.get(), [](uint32, uint32, uint32, const float*) { return true; });
+			bool occludedPacketMatches = true;
+			for (uint64 i = 0; i < rays.size(); i += 1) {
+				occludedPacketMatches = occludedPacketMatches && results[i] == expectedResults[i];
+			}
+			ASSERT(occludedPacketMatches);
+			ASSERT(occludedCount > rays.size() / 8 && occludedCount < rays.size() * 7 / 8);
+			// a ray through a single triangle, tMax just before and just after its only hit
+			SceneBVH singleTriangleBVH;
+			std::vector<SceneInstance> singleInstance = { scene.instances[0] };
+			singleTriangleBVH.build(singleInstance);
+			const float* v0 = scene.models.at("occluded").meshes[0].primitives[0].vertices[0].position;
+			const float* v1 = scene.models.at("occluded").meshes[0].primitives[0].vertices[1].position;
+			const float* v2 = scene.models.at("occluded").meshes[0].primitives[0].vertices[2].position;
+			DirectX::XMVECTOR target = DirectX::XMVectorSet((v0[0] + v1[0] + v2[0]) / 3, (v0[1] + v1[1] + v2[1]) / 3, (v0[2] + v1[2] + v2[2]) / 3, 1);
+			target = DirectX::XMVector3Transform(target, scene.instances[0].transform);
+			Ray ray = { { DirectX::XMVectorGetX(target), DirectX::XMVectorGetY(target), DirectX::XMVectorGetZ(target) - 10 }, { 0, 0, 1 } };
+			SceneRayHit hit;
+			ASSERT(singleTriangleBVH.trace(ray, hit));
+			bool occludedBefore = singleTriangleBVH.occluded(ray, hit.t * 0.9999f);
+			bool occludedAfter = singleTriangleBVH.occluded(ray, hit.t * 1.0001f);
+			ASSERT(!occludedBefore && occludedAfter);
+			RayPacket packet;
+			ray.tMax = hit.t * 0.9999f;
+			packet.addRay(ray);
+			ray.tMax = hit.t * 1.0001f;
+			packet.addRay(ray);
+			ASSERT(singleTriangleBVH.occludedPacket(packet, [](uint32, uint32, uint32, const float*) { return true; }) == 2);
+		}
+		CASEEND();
+		CASE("Parallel model loading");
+		{
+			// a scene file of 6 .glb models, model i has 8 * (i + 1) random triangles and an embedded (4 + i) x 4 PNG.
+			// The Scene constructor loads them with parallelFor, the reference loads them one after another
+			std::mt19937 random(17);
+			std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+			std::filesystem::path tempDir = std::filesystem::temp_directory_path();
+			std::vector<std::pair<std::string, std::filesystem::path>> modelFiles;
+			for (int modelIndex = 0; modelIndex < 6; modelIndex += 1) {
+				uint32 vertexCount = 8 * (modelIndex + 1) * 3;
+				std::vector<uint8> bin;
+				for (uint32 i = 0; i < vertexCount * 3; i += 1) {
+					float position = uniform(random);
+					bin.insert(bin.end(), reinterpret_cast<uint8*>(&position), reinterpret_cast<uint8*>(&position) + sizeof(position));
+				}
+				for (uint32 i = 0; i < vertexCount; i += 1) {
+					float normal[3] = { 0, 0, 1 };
+					bin.insert(bin.end(), reinterpret_cast<uint8*>(normal), reinterpret_cast<uint8*>(normal) + sizeof(normal));
+				}
+				for (uint32 i = 0; i < vertexCount; i += 1) {
+					uint16 index = static_cast<uint16>(vertexCount - 1 - i);
+					bin.insert(bin.end(), reinterpret_cast<uint8*>(&index), reinterpret_cast<uint8*>(&index) + sizeof(index));
+				}
+				bin.resize((bin.size() + 3) / 4 * 4);
+				int imageWidth = 4 + modelIndex;
+				std::vector<uint8> imagePixels(imageWidth * 4 * 4);
+				for (auto& pixel : imagePixels) {
+					pixel = static_cast<uint8>(random());
+				}
+				uint64 pngOffset = bin.size();
+				stbi_write_png_to_func([](void* context, void* data, int size) {
+					std::vector<uint8>& bytes = *static_cast<std::vector<uint8>*>(context);
+					bytes.insert(bytes.end(), static_cast<uint8*>(data), static_cast<uint8*>(data) + size);
+				}, &bin, imageWidth, 4, 4, imagePixels.data(), imageWidth * 4);
+				uint64 pngSize = bin.size() - pngOffset;
+				bin.resize((bin.size() + 3) / 4 * 4);
+				uint64 vertexBytes = vertexCount * 12;
+				std::string json = std::string(R"({"asset":{"version":"2.0"},"scene":0,"scenes":[{"nodes":[0]}],"nodes":[{"mesh":0}],)") +
+					R"("meshes":[{"primitives":[{"attributes":{"POSITION":0,"NORMAL":1},"indices":2,"material":0}]}],"materials":[{}],)" +
+					R"("buffers":[{"byteLength":)" + std::to_string(bin.size()) + "}]," +
+					R"("bufferViews":[{"buffer":0,"byteOffset":0,"byteLength":)" + std::to_string(vertexBytes) + R"(},{"buffer":0,"byteOffset":)" + std::to_string(vertexBytes) + R"(,"byteLength":)" + std::to_string(vertexBytes) + "}," +
+					R"({"buffer":0,"byteOffset":)" + std::to_string(vertexBytes * 2) + R"(,"byteLength":)" + std::to_string(vertexCount * 2) + "}," +
+					R"({"buffer":0,"byteOffset":)" + std::to_string(pngOffset) + R"(,"byteLength":)" + std::to_string(pngSize) + "}]," +
+					R"("accessors":[{"bufferView":0,"componentType":5126,"count":)" + std::to_string(vertexCount) + R"(,"type":"VEC3","min":[0,0,0],"max":[1,1,1]},)" +
+					R"({"bufferView":1,"componentType":5126,"count":)" + std::to_string(vertexCount) + R"(,"type":"VEC3"},)" +
+					R"({"bufferView":2,"componentType":5123,"count":)" + std::to_string(vertexCount) + R"(,"type":"SCALAR"}],)" +
+					R"("images":[{"bufferView":3,"mimeType":"image/png"}]})";
+				json.resize((json.size() + 3) / 4 * 4, ' ');
+				uint32 header[5] = { 0x46546C67, 2, static_cast<uint32>(sizeof(header) + json.size() + 8 + bin.size()), static_cast<uint32>(json.size()), 0x4E4F534A };
+				uint32 binChunkHeader[2] = { static_cast<uint32>(bin.size()), 0x004E4942 };
+				std::filesystem::path glbFilePath = tempDir / ("yarrParallelTest" + std::to_string(modelIndex) + ".glb");
+				std::ofstream file(glbFilePath, std::ios::out | std::ios::trunc | std::ios::binary);
+				file.write(reinterpret_cast<const char*>(header), sizeof(header));
+				file.write(json.data(), json.size());
+				file.write(reinterpret_cast<const char*>(binChunkHeader), sizeof(binChunkHeader));
+				file.write(reinterpret_cast<const char*>(bin.data()), bin.size());
+				modelFiles.push_back({ "model" + std::to_string(modelIndex), glbFilePath });
+			}
+			std::filesystem::path sceneFilePath = tempDir / "yarrParallelTest.txt";
+			{
+				std::ofstream file(sceneFilePath, std::ios::out | std::ios::trunc);
+				for (auto& [modelName, modelFilePath] : modelFiles) {
+					file << "Model: \"" << modelName << "\" \"" << modelFilePath.generic_string() << "\"\n";
+				}
+			}
+			Scene parallelScene("parallel", sceneFilePath, nullptr);
+			Scene serialScene("serial");
+			for (auto& [modelName, modelFilePath] : modelFiles) {
+				Model model = Scene::loadModelFromGLTF(modelFilePath);
+				model.waitImageDecodes();
+				serialScene.models.insert({ modelName, std::move(model) });
+			}
+			serialScene.rebuildInstances();
+			ASSERT(parallelScene.models.size() == serialScene.models.size());
+			bool modelsMatch = parallelScene.models.size() == serialScene.models.size();
+			for (auto parallelIter = parallelScene.models.begin(), serialIter = serialScene.models.begin(); modelsMatch && parallelIter != parallelScene.models.end(); ++parallelIter, ++serialIter) {
+				const Model& parallelModel = parallelIter->second;
+				const Model& serialModel = serialIter->second;
+				modelsMatch = parallelIter->first == serialIter->first && parallelModel.filePath == serialModel.filePath &&
+					parallelModel.meshes.size() == serialModel.meshes.size() && parallelModel.images.size() == serialModel.images.size();
+				for (uint64 meshIndex = 0; modelsMatch && meshIndex < parallelModel.meshes.size(); meshIndex += 1) {
+					const ModelPrimitive& parallelPrimitive = parallelModel.meshes[meshIndex].primitives[0];
+					const ModelPrimitive& serialPrimitive = serialModel.meshes[meshIndex].primitives[0];
+					modelsMatch = parallelPrimitive.vertices.size() == serialPrimitive.vertices.size() && parallelPrimitive.indices == serialPrimitive.indices &&
+						memcmp(parallelPrimitive.vertices.data(), serialPrimitive.vertices.data(), parallelPrimitive.vertices.size() * sizeof(ModelVertex)) == 0;
+				}
+				for (uint64 imageIndex = 0; modelsMatch && imageIndex < parallelModel.images.size(); imageIndex += 1) {
+					modelsMatch = !parallelModel.images[imageIndex].pixels.empty() && parallelModel.images[imageIndex].pixels == serialModel.images[imageIndex].pixels;
+				}
+			}
+			ASSERT(modelsMatch);
+			bool instancesMatch = parallelScene.instances.size() == serialScene.instances.size();
+			for (uint64 i = 0; instancesMatch && i < parallelScene.instances.size(); i += 1) {
+				instancesMatch = parallelScene.instances[i].model->filePath == serialScene.instances[i].model->filePath && parallelScene.instances[i].nodeIndex == serialScene.instances[i].nodeIndex;
+			}
+			ASSERT(instancesMatch);
+			std::error_code error;
+			std::filesystem::remove(sceneFilePath, error);
+			for (auto& [modelName, modelFilePath] : modelFiles) {
+				std::filesystem::remove(modelFilePath, error);
+			}
+		}
+		CASEEND();
+	}
+	TESTEND();
+	TEST("CPURenderer");
+	{
+		// alpha = (x * 7 + y * 13) % 256, 70 texels wide so rows take two mask words
+		auto alphaImage = [](int width, int height, int component) {
+			ModelImage image;
+			image.width = width;
+			image.height = height;
+			image.component = component;
+			image.pixels.resize(static_cast<uint64>(width) * height * component);
+			for (int y = 0; y < height; y += 1) {
+				for (int x = 0; x < width; x += 1) {
+					for (int c = 0; c < component; c += 1) {
+						image.pixels[(y * width + x) * component + c] = static_cast<uint8>(c == 3 ? (x * 7 + y * 13) % 256 : 100);
+					}
+				}
+			}
+			return image;
+		};
+		CASE("Alpha mask");
+		{
+			const float alphaCutoff = 0.5f;
+			ModelImage image = alphaImage(70, 5, 4);
+			auto texelPasses = [&](int64 x, int64 y) {
+				x = ((x % image.width) + image.width) % image.width;
+				y = ((y % image.height) + image.height) % image.height;
+				return image.pixels[(y * image.width + x) * 4 + 3] / 255.0f >= alphaCutoff;
+			};
+			AlphaMask mask(image, alphaCutoff);
+			ASSERT(mask.wordsPerRow == 2);
+			ASSERT(mask.coverage == AlphaMask::Masked);
+			bool maskMatches = true;
+			for (int y = 0; y < image.height; y += 1) {
+				for (int x = 0; x < image.width; x += 1) {
+					for (float wrap : { -1.0f, 0.0f, 2.0f }) {
+						float uv[2] = { (x + 0.5f) / image.width + wrap, (y + 0.5f) / image.height - wrap };
+						maskMatches = maskMatches && mask.sample(uv) == texelPasses(x, y);
+					}
+				}
+			}
+			ASSERT(maskMatches);
+			// rects crossing the texture edges included, against every texel under the rect
+			std::mt19937 random(7);
+			std::uniform_real_distribution<float> uvStart(-1.5f, 1.5f);
+			std::uniform_real_distribution<float> uvExtent(0.0f, 0.3f);
+			bool rectCoverageMatches = true;
+			for (int n = 0; n < 1000; n += 1) {
+				float uvMin[2] = { uvStart(random), uvStart(random) };
+				float uvMax[2] = { uvMin[0] + uvExtent(random), uvMin[1] + uvExtent(random) };
+				bool anyOpaque = false;
+				bool anyTransparent = false;
+				for (int64 y = static_cast<int64>(floorf(uvMin[1] * image.height)); y <= static_cast<int64>(floorf(uvMax[1] * image.height)); y += 1) {
+					for (int64 x = static_cast<int64>(floorf(uvMin[0] * image.width)); x <= static_cast<int64>(floorf(uvMax[0] * image.width)); x += 1) {
+						(texelPasses(x, y) ? anyOpaque : anyTransparent) = true;
+					}
+				}
+				AlphaMask::Coverage coverage = (anyOpaque && anyTransparent) ? AlphaMask::Masked : (anyOpaque ? AlphaMask::Opaque : AlphaMask::Transparent);
+				rectCoverageMatches = rectCoverageMatches && mask.rectCoverage(uvMin, uvMax) == coverage;
+			}
+			ASSERT(rectCoverageMatches);
+			// no alpha channel always passes, alpha exactly at the cutoff passes
+			ASSERT(AlphaMask(alphaImage(70, 5, 3), alphaCutoff).coverage == AlphaMask::Opaque);
+			ModelImage uniformImage = alphaImage(3, 3, 4);
+			for (uint64 i = 3; i < uniformImage.pixels.size(); i += 4) {
+				uniformImage.pixels[i] = 102;
+			}
+			ASSERT(AlphaMask(uniformImage, 102 / 255.0f).coverage == AlphaMask::Opaque);
+			ASSERT(AlphaMask(uniformImage, 103 / 255.0f).coverage == AlphaMask::Transparent);
+		}
+		CASEEND();
+		CASE("Alpha tested any hit");
+		{
+			// an alpha tested unit quad at z = 0 with uv = xy over alphaImage, in front of an opaque one at z = 1
+			const float alphaCutoff = 0.4f;
+			Model model;
+			model.images.push_back(alphaImage(70, 5, 4));
+			ModelMaterial material;
+			material.baseColorTextureIndex = 0;
+			material.alphaCutoff = alphaCutoff;
+			model.materials.push_back(material);
+			auto quad = [](float z, int materialIndex) {
+				ModelPrimitive primitive;
+				for (int corner = 0; corner < 4; corner += 1) {
+					float x = static_cast<float>(corner == 1 || corner == 2);
+					float y = static_cast<float>(corner >= 2);
+					primitive.vertices.push_back(ModelVertex{ { x, y, z }, { 0, 0, -1 }, { x, y }, { 1, 0, 0 } });
+				}
+				uint16 indices[6] = { 0, 1, 2, 0, 2, 3 };
+				primitive.indices.assign(reinterpret_cast<uint8*>(indices), reinterpret_cast<uint8*>(indices) + sizeof(indices));
+				primitive.materialIndex = materialIndex;
+				primitive.opaque = materialIndex < 0;
+				return primitive;
+			};
+			ModelMesh mesh;
+			mesh.primitives.push_back(quad(0, 0));
+			mesh.primitives.push_back(quad(1, -1));
+			model.meshes.push_back(std::move(mesh));
+			model.nodes.push_back(ModelNode{ 0, DirectX::XMMatrixIdentity() });
+			model.rootNodes.push_back(0);
+			Scene scene("alphaTest");
+			scene.models.insert({ "alphaTest", std::move(model) });
+			scene.rebuildInstances();
+			scene.buildModelMeshBVHs({});
+			CPURenderer renderer(scene);
+			ASSERT(renderer.alphaMasks.size() == 1);
+			ASSERT(renderer.triangleAlphaCoverages.size() == 4);
+			ASSERT(renderer.triangleAlphaCoverages[0] == AlphaMask::Masked && renderer.triangleAlphaCoverages[2] == AlphaMask::Opaque);
+			const ModelImage& image = scene.models.at("alphaTest").images[0];
+			bool hitsMatch = true;
+			for (int y = 0; y < image.height; y += 1) {
+				for (int x = 0; x < image.width; x += 1) {
+					Ray ray = { { (x + 0.5f) / image.width, (y + 0.5f) / image.height, -1 }, { 0, 0, 1 } };
+					SceneRayHit hit;
+					bool found = renderer.sceneBVH.trace(ray, hit, [&](uint32 instanceIndex, uint32 geometryIndex, uint32 primitiveIndex, const float* barycentrics) {
+						return renderer.anyHit(instanceIndex, geometryIndex, primitiveIndex, barycentrics);
+					});
+					bool alphaPasses = image.pixels[(y * image.width + x) * 4 + 3] / 255.0f >= alphaCutoff;
+					hitsMatch = hitsMatch && found && hit.geometryIndex == (alphaPasses ? 0 : 1);
+				}
+			}
+			ASSERT(hitsMatch);
+		}
+		CASEEND();
+	}
+	TESTEND();
 	REPORT();
 }
@@ -0,0 +1,500 @@
+/************************************************************************************************/
+/*			Copyright (C) 2020 By Yang Chen (yngccc@gmail.com). All Rights Reserved.			*/
+/************************************************************************************************/
+
+#pragma once
+
+#include "miscs.h"
+
+#include <cfloat>
+#include <climits>
+
+// Block compression of 8 bit images, every 4 x 4 block of texels becomes bcBlockSize bytes:
+// BC1: rgb, 2 RGB565 endpoints and 2 bit indices, only the 4 color mode
+// BC4: one channel, 2 8 bit endpoints and 3 bit indices, only the 8 value mode
+// BC5: two BC4 blocks, the first of r, the second of g
+// BC7: rgba, only mode 6 (1 subset, 7 bit endpoints with a p-bit each, 4 bit indices)
+// Endpoints come from the principal axis of the block's colors, BC7's are then refit to the chosen indices by least
+// squares. Encoding happens on the stored values, sRGB images are encoded in sRGB
+enum class BCFormat {
+	BC1,
+	BC4,
+	BC5,
+	BC7
+};
+
+uint32 bcBlockSize(BCFormat format) {
+	return (format == BCFormat::BC1 || format == BCFormat::BC4) ? 8 : 16;
+}
+
+// mean and principal axis (unit length, power iteration on the covariance) of count N dimensional points
+template <int N>
+void bcPrincipalAxis(const float(*points)[N], int count, float(&mean)[N], float(&axis)[N]) {
+	for (int c = 0; c < N; c += 1) {
+		mean[c] = 0;
+		for (int i = 0; i < count; i += 1) {
+			mean[c] += points[i][c];
+		}
+		mean[c] /= count;
+	}
+	float covariance[N][N] = {};
+	for (int i = 0; i < count; i += 1) {
+		for (int a = 0; a < N; a += 1) {
+			for (int b = 0; b < N; b += 1) {
+				covariance[a][b] += (points[i][a] - mean[a]) * (points[i][b] - mean[b]);
+			}
+		}
+	}
+	// start from the covariance column of the largest variance: a fixed start like (1, 1, 1) can be sent to zero, e.g.
+	// by a red/green checker whose axis is (1, -1, 0), leaving every point projected onto the mean
+	int largest = 0;
+	for (int c = 1; c < N; c += 1) {
+		if (covariance[c][c] > covariance[largest][largest]) {
+			largest = c;
+		}
+	}
+	float start[N];
+	float startLength = 0;
+	for (int c = 0; c < N; c += 1) {
+		start[c] = covariance[c][largest];
+		startLength += start[c] * start[c];
+	}
+	startLength = sqrtf(startLength);
+	for (int c = 0; c < N; c += 1) {
+		// all points equal, any axis will do
+		start[c] = startLength > 1e-6f ? start[c] / startLength : 1;
+		axis[c] = start[c];
+	}
+	for (int iteration = 0; iteration < 8; iteration += 1) {
+		float next[N] = {};
+		for (int a = 0; a < N; a += 1) {
+			for (int b = 0; b < N; b += 1) {
+				next[a] += covariance[a][b] * axis[b];
+			}
+		}
+		float length = 0;
+		for (int c = 0; c < N; c += 1) {
+			length += next[c] * next[c];
+		}
+		length = sqrtf(length);
+		if (!(length > 1e-6f)) {
+			std::copy_n(start, N, axis);
+			break;
+		}
+		for (int c = 0; c < N; c += 1) {
+			axis[c] = next[c] / length;
+		}
+	}
+	float length = 0;
+	for (int c = 0; c < N; c += 1) {
+		length += axis[c] * axis[c];
+	}
+	length = sqrtf(length);
+	for (int c = 0; c < N; c += 1) {
+		axis[c] /= length;
+	}
+}
+
+// the two ends of the projection of points onto their principal axis
+template <int N>
+void bcAxisEndpoints(const float(*points)[N], int count, float(&endpoint0)[N], float(&endpoint1)[N]) {
+	float mean[N];
+	float axis[N];
+	bcPrincipalAxis(points, count, mean, axis);
+	float tMin = FLT_MAX;
+	float tMax = -FLT_MAX;
+	for (int i = 0; i < count; i += 1) {
+		float t = 0;
+		for (int c = 0; c < N; c += 1) {
+			t += (points[i][c] - mean[c]) * axis[c];
+		}
+		tMin = std::min(tMin, t);
+		tMax = std::max(tMax, t);
+	}
+	for (int c = 0; c < N; c += 1) {
+		endpoint0[c] = std::clamp(mean[c] + axis[c] * tMin, 0.0f, 255.0f);
+		endpoint1[c] = std::clamp(mean[c] + axis[c] * tMax, 0.0f, 255.0f);
+	}
+}
+
+void bcBC1Palette(uint16 color0, uint16 color1, uint8(&palette)[4][3]) {
+	for (int e = 0; e < 2; e += 1) {
+		uint16 color = e == 0 ? color0 : color1;
+		uint32 r = color >> 11;
+		uint32 g = (color >> 5) & 63;
+		uint32 b = color & 31;
+		palette[e][0] = static_cast<uint8>((r << 3) | (r >> 2));
+		palette[e][1] = static_cast<uint8>((g << 2) | (g >> 4));
+		palette[e][2] = static_cast<uint8>((b << 3) | (b >> 2));
+	}
+	for (int c = 0; c < 3; c += 1) {
+		palette[2][c] = static_cast<uint8>((2 * palette[0][c] + palette[1][c] + 1) / 3);
+		palette[3][c] = static_cast<uint8>((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+	}
+}
+
+void encodeBC1Block(const uint8(&texels)[16][4], uint8* block) {
+	float points[16][3];
+	for (int i = 0; i < 16; i += 1) {
+		for (int c = 0; c < 3; c += 1) {
+			points[i][c] = texels[i][c];
+		}
+	}
+	float endpoint0[3];
+	float endpoint1[3];
+	bcAxisEndpoints(points, 16, endpoint0, endpoint1);
+	// inset by 1/16 of the range, the ends of the range are rarely worth a palette entry of their own
+	for (int c = 0; c < 3; c += 1) {
+		float inset = (endpoint1[c] - endpoint0[c]) / 16.0f;
+		endpoint0[c] += inset;
+		endpoint1[c] -= inset;
+	}
+	auto toRGB565 = [](const float* color) {
+		return static_cast<uint16>((lroundf(color[0] * 31 / 255.0f) << 11) | (lroundf(color[1] * 63 / 255.0f) << 5) | lroundf(color[2] * 31 / 255.0f));
+	};
+	uint16 color0 = toRGB565(endpoint1);
+	uint16 color1 = toRGB565(endpoint0);
+	if (color0 < color1) {
+		std::swap(color0, color1);
+	}
+	uint32 indices = 0;
+	if (color0 != color1) {
+		uint8 palette[4][3];
+		bcBC1Palette(color0, color1, palette);
+		for (int i = 0; i < 16; i += 1) {
+			int bestIndex = 0;
+			int bestError = INT_MAX;
+			for (int p = 0; p < 4; p += 1) {
+				int error = 0;
+				for (int c = 0; c < 3; c += 1) {
+					int d = texels[i][c] - palette[p][c];
+					error += d * d;
+				}
+				if (error < bestError) {
+					bestError = error;
+					bestIndex = p;
+				}
+			}
+			indices |= static_cast<uint32>(bestIndex) << (i * 2);
+		}
+	}
+	// equal endpoints select the 3 color mode, in which index 0 is still color0
+	memcpy(block, &color0, 2);
+	memcpy(block + 2, &color1, 2);
+	memcpy(block + 4, &indices, 4);
+}
+
+void decodeBC1Block(const uint8* block, uint8(&texels)[16][4]) {
+	uint16 color0;
+	uint16 color1;
+	uint32 indices;
+	memcpy(&color0, block, 2);
+	memcpy(&color1, block + 2, 2);
+	memcpy(&indices, block + 4, 4);
+	uint8 palette[4][3];
+	bcBC1Palette(color0, color1, palette);
+	for (int i = 0; i < 16; i += 1) {
+		uint32 index = (indices >> (i * 2)) & 3;
+		texels[i][0] = palette[index][0];
+		texels[i][1] = palette[index][1];
+		texels[i][2] = palette[index][2];
+		texels[i][3] = 255;
+	}
+}
+
+void bcBC4Palette(uint8 value0, uint8 value1, uint8(&palette)[8]) {
+	palette[0] = value0;
+	palette[1] = value1;
+	for (int i = 1; i < 7; i += 1) {
+		palette[i + 1] = static_cast<uint8>(((7 - i) * value0 + i * value1 + 3) / 7);
+	}
+}
+
+void encodeBC4Block(const uint8(&values)[16], uint8* block) {
+	uint8 value0 = *std::max_element(values, values + 16);
+	uint8 value1 = *std::min_element(values, values + 16);
+	uint64 indices = 0;
+	if (value0 != value1) {
+		uint8 palette[8];
+		bcBC4Palette(value0, value1, palette);
+		for (int i = 0; i < 16; i += 1) {
+			int bestIndex = 0;
+			int bestError = INT_MAX;
+			for (int p = 0; p < 8; p += 1) {
+				int error = std::abs(values[i] - palette[p]);
+				if (error < bestError) {
+					bestError = error;
+					bestIndex = p;
+				}
+			}
+			indices |= static_cast<uint64>(bestIndex) << (i * 3);
+		}
+	}
+	block[0] = value0;
+	block[1] = value1;
+	memcpy(block + 2, &indices, 6);
+}
+
+void decodeBC4Block(const uint8* block, uint8(&values)[16]) {
+	uint64 indices = 0;
+	memcpy(&indices, block + 2, 6);
+	uint8 palette[8];
+	if (block[0] > block[1]) {
+		bcBC4Palette(block[0], block[1], palette);
+	}
+	else {
+		// the 6 value mode, never written by encodeBC4Block
+		palette[0] = block[0];
+		palette[1] = block[1];
+		for (int i = 1; i < 5; i += 1) {
+			palette[i + 1] = static_cast<uint8>(((5 - i) * block[0] + i * block[1] + 2) / 5);
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	for (int i = 0; i < 16; i += 1) {
+		values[i] = palette[(indices >> (i * 3)) & 7];
+	}
+}
+
+static const uint32 bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// BC7 mode 6 endpoints: 7 bits per channel plus one p-bit shared by the channels of an endpoint
+struct BC7Mode6Endpoints {
+	uint8 colors[2][4];
+	uint8 pBits[2];
+
+	uint8 value(int endpoint, int channel) const {
+		return static_cast<uint8>((colors[endpoint][channel] << 1) | pBits[endpoint]);
+	}
+	uint8 interpolate(int channel, uint32 index) const {
+		return static_cast<uint8>(((64 - bc7Weights4[index]) * value(0, channel) + bc7Weights4[index] * value(1, channel) + 32) >> 6);
+	}
+};
+
+// best p-bits for float endpoints, the indices that go with them and the squared error
+uint32 bc7Mode6Fit(const uint8(&texels)[16][4], const float(&endpoint0)[4], const float(&endpoint1)[4], BC7Mode6Endpoints& endpoints, uint8(&indices)[16]) {
+	uint32 bestError = UINT32_MAX;
+	for (int p = 0; p < 4; p += 1) {
+		BC7Mode6Endpoints candidate;
+		candidate.pBits[0] = static_cast<uint8>(p & 1);
+		candidate.pBits[1] = static_cast<uint8>(p >> 1);
+		for (int c = 0; c < 4; c += 1) {
+			candidate.colors[0][c] = static_cast<uint8>(std::clamp(lroundf((endpoint0[c] - candidate.pBits[0]) / 2), 0l, 127l));
+			candidate.colors[1][c] = static_cast<uint8>(std::clamp(lroundf((endpoint1[c] - candidate.pBits[1]) / 2), 0l, 127l));
+		}
+		uint8 palette[16][4];
+		for (uint32 i = 0; i < 16; i += 1) {
+			for (int c = 0; c < 4; c += 1) {
+				palette[i][c] = candidate.interpolate(c, i);
+			}
+		}
+		uint32 error = 0;
+		uint8 candidateIndices[16];
+		for (int i = 0; i < 16; i += 1) {
+			uint32 bestTexelError = UINT32_MAX;
+			for (int j = 0; j < 16; j += 1) {
+				uint32 texelError = 0;
+				for (int c = 0; c < 4; c += 1) {
+					int d = texels[i][c] - palette[j][c];
+					texelError += d * d;
+				}
+				if (texelError < bestTexelError) {
+					bestTexelError = texelError;
+					candidateIndices[i] = static_cast<uint8>(j);
+				}
+			}
+			error += bestTexelError;
+		}
+		if (error < bestError) {
+			bestError = error;
+			endpoints = candidate;
+			memcpy(indices, candidateIndices, sizeof(indices));
+		}
+	}
+	return bestError;
+}
+
+void encodeBC7Block(const uint8(&texels)[16][4], uint8* block) {
+	float points[16][4];
+	for (int i = 0; i < 16; i += 1) {
+		for (int c = 0; c < 4; c += 1) {
+			points[i][c] = texels[i][c];
+		}
+	}
+	float endpoint0[4];
+	float endpoint1[4];
+	bcAxisEndpoints(points, 16, endpoint0, endpoint1);
+	BC7Mode6Endpoints endpoints;
+	uint8 indices[16];
+	uint32 error = bc7Mode6Fit(texels, endpoint0, endpoint1, endpoints, indices);
+	// least squares endpoints for the chosen indices, kept if they fit better
+	for (int iteration = 0; iteration < 2 && error > 0; iteration += 1) {
+		float aa = 0, ab = 0, bb = 0;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; i += 1) {
+			float w = bc7Weights4[indices[i]] / 64.0f;
+			aa += (1 - w) * (1 - w);
+			ab += (1 - w) * w;
+			bb += w * w;
+			for (int c = 0; c < 4; c += 1) {
+				ax[c] += (1 - w) * points[i][c];
+				bx[c] += w * points[i][c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (fabsf(determinant) < 1e-6f) {
+			break;
+		}
+		float refit0[4];
+		float refit1[4];
+		for (int c = 0; c < 4; c += 1) {
+			refit0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+			refit1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+		}
+		BC7Mode6Endpoints refitEndpoints;
+		uint8 refitIndices[16];
+		uint32 refitError = bc7Mode6Fit(texels, refit0, refit1, refitEndpoints, refitIndices);
+		if (refitError >= error) {
+			break;
+		}
+		error = refitError;
+		endpoints = refitEndpoints;
+		memcpy(indices, refitIndices, sizeof(indices));
+	}
+	// the first texel's index is stored without its top bit, so it has to be below 8
+	if (indices[0] >= 8) {
+		std::swap(endpoints.colors[0], endpoints.colors[1]);
+		std::swap(endpoints.pBits[0], endpoints.pBits[1]);
+		for (int i = 0; i < 16; i += 1) {
+			indices[i] = static_cast<uint8>(15 - indices[i]);
+		}
+	}
+	uint64 bits[2] = {};
+	uint32 bitOffset = 0;
+	auto writeBits = [&](uint64 value, uint32 count) {
+		for (uint32 i = 0; i < count; i += 1, bitOffset += 1) {
+			bits[bitOffset / 64] |= ((value >> i) & 1) << (bitOffset % 64);
+		}
+	};
+	writeBits(1 << 6, 7);
+	for (int c = 0; c < 4; c += 1) {
+		writeBits(endpoints.colors[0][c], 7);
+		writeBits(endpoints.colors[1][c], 7);
+	}
+	writeBits(endpoints.pBits[0], 1);
+	writeBits(endpoints.pBits[1], 1);
+	for (int i = 0; i < 16; i += 1) {
+		writeBits(indices[i], i == 0 ? 3 : 4);
+	}
+	memcpy(block, bits, 16);
+}
+
+// mode 6 only, other modes decode to 0
+void decodeBC7Block(const uint8* block, uint8(&texels)[16][4]) {
+	uint64 bits[2];
+	memcpy(bits, block, 16);
+	uint32 bitOffset = 0;
+	auto readBits = [&](uint32 count) {
+		uint64 value = 0;
+		for (uint32 i = 0; i < count; i += 1, bitOffset += 1) {
+			value |= ((bits[bitOffset / 64] >> (bitOffset % 64)) & 1) << i;
+		}
+		return static_cast<uint32>(value);
+	};
+	if (readBits(7) != (1 << 6)) {
+		memset(texels, 0, sizeof(texels));
+		return;
+	}
+	BC7Mode6Endpoints endpoints;
+	for (int c = 0; c < 4; c += 1) {
+		endpoints.colors[0][c] = static_cast<uint8>(readBits(7));
+		endpoints.colors[1][c] = static_cast<uint8>(readBits(7));
+	}
+	endpoints.pBits[0] = static_cast<uint8>(readBits(1));
+	endpoints.pBits[1] = static_cast<uint8>(readBits(1));
+	for (int i = 0; i < 16; i += 1) {
+		uint32 index = readBits(i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c += 1) {
+			texels[i][c] = endpoints.interpolate(c, index);
+		}
+	}
+}
+
+void encodeBCBlock(const uint8(&texels)[16][4], BCFormat format, uint8* block) {
+	if (format == BCFormat::BC1) {
+		encodeBC1Block(texels, block);
+	}
+	else if (format == BCFormat::BC7) {
+		encodeBC7Block(texels, block);
+	}
+	else {
+		for (int channel = 0; channel < (format == BCFormat::BC5 ? 2 : 1); channel += 1) {
+			uint8 values[16];
+			for (int i = 0; i < 16; i += 1) {
+				values[i] = texels[i][channel];
+			}
+			encodeBC4Block(values, block + channel * 8);
+		}
+	}
+}
+
+// size of a mip chain's blocks, mips are width and height halved (at least 1) and each at least one block
+uint64 bcMipChainSize(int width, int height, int mipCount, BCFormat format) {
+	uint64 size = 0;
+	for (int mip = 0; mip < mipCount; mip += 1) {
+		uint64 blocksX = (std::max(width >> mip, 1) + 3) / 4;
+		uint64 blocksY = (std::max(height >> mip, 1) + 3) / 4;
+		size += blocksX * blocksY * bcBlockSize(format);
+	}
+	return size;
+}
+
+// blocks of every mip of a chain packed like ModelImage::pixels (mips tightly one after another, texels of component
+// 1, 2 or 4 channels), mips one after another with blocks in rows. Texels past the edge of a mip
+// repeat its last row and column. Block rows are encoded in parallel on pool
+std::vector<uint8> encodeBCMipChain(const uint8* pixels, int width, int height, int component, int mipCount, BCFormat format, ThreadPool& pool) {
+	struct MipRows {
+		int width;
+		int height;
+		uint64 srcOffset;
+		uint64 dstOffset;
+		uint64 firstRow;
+	};
+	std::vector<MipRows> mips(mipCount);
+	uint64 srcOffset = 0;
+	uint64 dstOffset = 0;
+	uint64 rowCount = 0;
+	for (int mip = 0; mip < mipCount; mip += 1) {
+		int mipWidth = std::max(width >> mip, 1);
+		int mipHeight = std::max(height >> mip, 1);
+		mips[mip] = { mipWidth, mipHeight, srcOffset, dstOffset, rowCount };
+		srcOffset += static_cast<uint64>(mipWidth) * mipHeight * component;
+		dstOffset += static_cast<uint64>((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * bcBlockSize(format);
+		rowCount += (mipHeight + 3) / 4;
+	}
+	std::vector<uint8> blocks(dstOffset);
+	pool.parallelFor(rowCount, [&](uint64 row) {
+		int mip = mipCount - 1;
+		while (mips[mip].firstRow > row) {
+			mip -= 1;
+		}
+		const MipRows& mipRows = mips[mip];
+		int blockY = static_cast<int>(row - mipRows.firstRow);
+		int blocksX = (mipRows.width + 3) / 4;
+		for (int blockX = 0; blockX < blocksX; blockX += 1) {
+			uint8 texels[16][4];
+			for (int i = 0; i < 16; i += 1) {
+				int x = std::min(blockX * 4 + i % 4, mipRows.width - 1);
+				int y = std::min(blockY * 4 + i / 4, mipRows.height - 1);
+				const uint8* texel = pixels + mipRows.srcOffset + (static_cast<uint64>(y) * mipRows.width + x) * component;
+				texels[i][0] = texel[0];
+				texels[i][1] = component >= 2 ? texel[1] : texel[0];
+				texels[i][2] = component >= 4 ? texel[2] : (component == 1 ? texel[0] : 0);
+				texels[i][3] = component >= 4 ? texel[3] : 255;
+			}
+			encodeBCBlock(texels, format, &blocks[mipRows.dstOffset + (static_cast<uint64>(blockY) * blocksX + blockX) * bcBlockSize(format)]);
+		}
+	});
+	return blocks;
+}